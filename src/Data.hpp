@@ -11,5 +11,7 @@ const GLuint VERTEX_ATTRIB_POSITION_IDX = 0;
 const GLuint VERTEX_ATTRIB_NORMAL_IDX = 1;
 const GLuint VERTEX_ATTRIB_TEXCOORD0_IDX = 2;
 const GLuint VERTEX_ATTRIB_TANGENT_IDX = 3;
+const GLuint VERTEX_ATTRIB_JOINTS0_IDX = 4;
+const GLuint VERTEX_ATTRIB_WEIGHTS0_IDX = 5;
 
 #endif // GLTF_VIEWER_DATA_HPP
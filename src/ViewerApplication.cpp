@@ -1,17 +1,39 @@
 #include "ViewerApplication.hpp"
 
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <fstream>
 #include <iostream>
 
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
+#include <set>
 #include <utility>
 
 #include "Data.hpp"
+#include "utils/animation.hpp"
+#include "utils/batch_views.hpp"
 #include "utils/cameras.hpp"
+#include "utils/file_watcher.hpp"
+#include "utils/gl_context.hpp"
+#include "utils/gl_timer.hpp"
 #include "utils/gltf.hpp"
+#include "utils/hiz_culling.hpp"
+#include "utils/ibl.hpp"
+#include "utils/image_sequence.hpp"
 #include "utils/images.hpp"
+#include "utils/lights.hpp"
+#include "utils/meshlet_culling.hpp"
+#include "utils/morph_targets.hpp"
+#include "utils/occlusion_culling.hpp"
+#include "utils/png_writer.hpp"
+#include "utils/pvs.hpp"
+#include "utils/render_server.hpp"
+#include "utils/static_batching.hpp"
+#include "utils/thread_pool.hpp"
+#include "utils/transforms.hpp"
 
-#include <stb_image_write.h>
 #include <tiny_gltf.h>
 
 void keyCallback(
@@ -24,49 +46,27 @@ void keyCallback(
 
 int ViewerApplication::run()
 {
-  // Loader shaders
-  m_glslProgram_shadowMap =
-      compileProgram({m_ShadersRootPath / "simpleDepthShader.vs.glsl",
-          m_ShadersRootPath / "simpleDepthShader.fs.glsl"});
-  m_glslProgram_shadowMap.setUniform();
-  m_glslProgram_fullRender =
-      compileProgram({m_ShadersRootPath / "shadowMapShader.vs.glsl",
-          m_ShadersRootPath / "pbr_directional_light_shadows.fs.glsl"});
-  m_glslProgram_fullRender.setUniform();
-
-  m_glslProgram_normalRender =
-      compileProgram({m_ShadersRootPath / "forward.vs.glsl",
-          m_ShadersRootPath / "normals.fs.glsl"});
-  m_glslProgram_normalRender.setUniform();
-
-
-  m_glslProgram_noShadow =
-      compileProgram({m_ShadersRootPath / "shadowMapShader.vs.glsl",
-          m_ShadersRootPath / "pbr_directional_light.fs.glsl"});
-  m_glslProgram_noShadow.setUniform();
-
-  m_glslProgram_debugShadowMap =
-      compileProgram({m_ShadersRootPath / "shadowMapShader.vs.glsl",
-          m_ShadersRootPath / "debug.fs.glsl"});
-  m_glslProgram_debugShadowMap.setUniform();
-
-  m_glslProgram_tangent =
-      compileProgram({m_ShadersRootPath / "forward.vs.glsl",
-          m_ShadersRootPath / "tangent.fs.glsl"});
-  m_glslProgram_tangent.setUniform();
-
-  m_glslProgram_bitangent  =    compileProgram({m_ShadersRootPath / "forward.vs.glsl",
-      m_ShadersRootPath / "bitangent.fs.glsl"});
-  m_glslProgram_bitangent.setUniform();
-
-  m_glslProgram_normalTexture = compileProgram({m_ShadersRootPath / "forward.vs.glsl",
-      m_ShadersRootPath / "normals_texture.fs.glsl"});
-  m_glslProgram_normalTexture.setUniform();
+  if (!m_programsLoaded) {
+    loadPrograms();
+    m_programsLoaded = true;
+  }
 
+  if (m_aovOutput && m_deferred) {
+    std::cerr << "AOVs are written by the forward shading pass, --deferred "
+                 "ignored"
+              << std::endl;
+    m_deferred = false;
+  }
+  // A batch is drawn with a single node id, the nodes merged in it would be
+  // missing from the node id AOV
+  if (m_aovOutput && m_staticBatching) {
+    std::cerr << "Node ids are written per node, --static-batching ignored"
+              << std::endl;
+    m_staticBatching = false;
+  }
   m_glslProgram_shadowMapRendered = &m_glslProgram_shadowMap;
-  m_glslProgram_rendered = &m_glslProgram_fullRender;
-
-
+  m_glslProgram_rendered =
+      m_deferred ? &m_glslProgram_gBuffer : &m_glslProgram_fullRender;
 
   glm::vec3 lightDir = glm::vec3(1.0f, 1.0f, 1.0f);
   {
@@ -81,24 +81,178 @@ int ViewerApplication::run()
   bool applyOcclusion = true;
   bool renderShadow = true;
   bool applyNormalTexture = true;
+  bool applyIBL = true;
+  float iblIntensity = 1.f;
   bool shadowNeedUpdate = true;
 
-  // Build projection matrix
-  std::cerr << "Load model" << this->m_gltfFilePath << std::endl;
-  tinygltf::Model model;
-  if (!loadGltfFile(model)) {
-    return -1;
+  // Views of the batch mode, parsed before loading the model
+  std::vector<BatchView> batchViews;
+  if (!m_batchFile.empty()) {
+    std::ifstream batchFile;
+    if (m_batchFile != "-") {
+      batchFile.open(m_batchFile);
+      if (!batchFile) {
+        std::cerr << "Unable to open batch file " << m_batchFile << std::endl;
+        return -1;
+      }
+    }
+    if (!loadBatchViews(m_batchFile == "-" ? std::cin : batchFile,
+            m_OutputPath, m_nWindowWidth, m_nWindowHeight, batchViews)) {
+      return -1;
+    }
+    std::clog << "Batch: " << batchViews.size() << " views" << std::endl;
   }
-  std::cerr << "Loaded" << std::endl;
 
-  computeSceneBounds(model, m_bboxMin, m_bboxMax);
+  // Size of the image written to m_OutputPath, that is rendered in tiles of
+  // the rendering size so that the GPU targets do not grow with the image
+  const auto outputWidth = m_nWindowWidth;
+  const auto outputHeight = m_nWindowHeight;
+  if (!m_OutputPath.empty() && batchViews.empty() && !m_aovOutput) {
+    GLint maxTextureSize = 0;
+    GLint maxViewportDims[2] = {0, 0};
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxTextureSize);
+    glGetIntegerv(GL_MAX_VIEWPORT_DIMS, maxViewportDims);
+    const auto tileSize = std::min({GLsizei(m_tileSize), maxTextureSize,
+        maxViewportDims[0], maxViewportDims[1]});
+    m_nWindowWidth = std::min(m_nWindowWidth, tileSize);
+    m_nWindowHeight = std::min(m_nWindowHeight, tileSize);
+  }
+
+  // The models of serve() stay loaded with their OpenGL objects between runs,
+  // the others are deleted when run() returns
+  auto resident = m_server ? m_modelCache.find(m_gltfFilePath) : nullptr;
+  const auto isResident = resident != nullptr;
+  if (!isResident) {
+    resident = std::make_shared<ResidentModel>();
+  }
+  auto &model = resident->model;
+
+  // Build projection matrix
+  if (!isResident) {
+    std::cerr << "Load model" << this->m_gltfFilePath << std::endl;
+    if (!loadGltfFile(model)) {
+      return -1;
+    }
+    std::cerr << "Loaded" << std::endl;
+
+    if (m_animatedCopyCount > 0) {
+      computeSceneBounds(model, m_bboxMin, m_bboxMax);
+      addAnimatedCopies(model, m_animatedCopyCount, m_bboxMin, m_bboxMax);
+    }
+
+    // Before anything depending on the draw order, potentially visible sets
+    // must be baked and used with the same option
+    if (m_staticBatching) {
+      batchStaticNodes(model);
+    }
+
+    computeSceneBounds(model, resident->bboxMin, resident->bboxMax);
+  } else {
+    std::clog << "Model cache: " << m_gltfFilePath << " is loaded"
+              << std::endl;
+  }
+  m_bboxMin = resident->bboxMin;
+  m_bboxMax = resident->bboxMax;
+
+  // Offline baking of the potentially visible sets, nothing is rendered
+  if (m_bakePVS) {
+    std::vector<int> meshIndices;
+    std::vector<glm::mat4> modelMatrices;
+    flattenScene(model, meshIndices, modelMatrices);
+    const auto start = getSeconds();
+    const auto pvs = bakePVS(
+        model, meshIndices, modelMatrices, m_bboxMin, m_bboxMax);
+    std::clog << "PVS: " << pvs.cells.size() << " cells, " << pvs.drawCount
+              << " primitives, baked in " << getSeconds() - start << " s"
+              << std::endl;
+    return savePVS(pvsPath(m_gltfFilePath), pvs) ? 0 : -1;
+  }
 
   const auto diag = m_bboxMax - m_bboxMin;
   auto maxDistance = glm::length(diag);
 
-  const auto projMatrix =
-      glm::perspective(70.f, float(m_nWindowWidth) / float(m_nWindowHeight),
-          0.001f * maxDistance, 1.5f * maxDistance);
+  const auto zNear = 0.001f * maxDistance;
+  const auto zFar = 1.5f * maxDistance;
+  // Updated by setImageSize() in batch mode
+  auto projMatrix = glm::perspective(
+      70.f, float(m_nWindowWidth) / float(m_nWindowHeight), zNear, zFar);
+
+  if (m_randomLightCount > 0 && !isResident) {
+    addRandomPointLights(model, m_randomLightCount, m_bboxMin, m_bboxMax);
+  }
+  const auto punctualLights = loadPunctualLights(model);
+  const auto directionalLightCount = std::count_if(begin(punctualLights),
+      end(punctualLights), [](const PunctualLight &l) {
+        return l.type == PUNCTUAL_LIGHT_DIRECTIONAL;
+      });
+  if (!punctualLights.empty() && !m_deferred) {
+    m_glslProgram_rendered = &m_glslProgram_clustered;
+  }
+
+  const bool hasIBL = !m_environmentMapPath.empty() && createIBL();
+
+  auto morphTargets = std::any_of(
+      begin(model.meshes), end(model.meshes), [](const tinygltf::Mesh &mesh) {
+        return std::any_of(begin(mesh.primitives), end(mesh.primitives),
+            [](const tinygltf::Primitive &p) { return !p.targets.empty(); });
+      });
+  if (morphTargets && !MorphTargetEvaluator::isSupported()) {
+    std::cerr << "Morph targets require OpenGL 4.3, ignored" << std::endl;
+    morphTargets = false;
+  }
+
+  auto primitiveShaderFeatures = computePrimitiveShaderFeatures(model);
+  for (auto &features : primitiveShaderFeatures) {
+    features |= (hasIBL ? uint32_t(SHADER_FEATURE_IBL) : 0u) |
+                (m_aovOutput ? uint32_t(SHADER_FEATURE_AOV) : 0u);
+  }
+  const std::set<uint32_t> usedShaderFeatures(
+      begin(primitiveShaderFeatures), end(primitiveShaderFeatures));
+  // Features disabled from the GUI
+  const auto shaderFeatureMask = [&]() {
+    uint32_t mask = SHADER_FEATURE_ALL;
+    if (!applyNormalTexture) {
+      mask &= ~SHADER_FEATURE_NORMAL_MAP;
+    }
+    if (!applyOcclusion) {
+      mask &= ~SHADER_FEATURE_OCCLUSION;
+    }
+    if (!applyIBL || !hasIBL) {
+      mask &= ~SHADER_FEATURE_IBL;
+    }
+    return mask;
+  };
+  // Programs needed by the current settings, the others are compiled when
+  // selected from the GUI
+  const auto activePrograms = [&]() {
+    std::vector<GLProgramPermutations *> programs = {
+        m_glslProgram_shadowMapRendered, m_glslProgram_rendered};
+    if (m_depthPrepass) {
+      programs.push_back(&m_glslProgram_depthPrepass);
+    }
+    if (m_deferred) {
+      programs.push_back(&m_glslProgram_deferredLighting);
+    }
+    if (m_gpuCulling) {
+      programs.push_back(&m_glslProgram_hiZDepth);
+      programs.push_back(&m_glslProgram_hiZPyramid);
+      programs.push_back(&m_glslProgram_hiZCull);
+    }
+    if (m_meshletCulling) {
+      programs.push_back(&m_glslProgram_meshletCull);
+    }
+    if (morphTargets) {
+      programs.push_back(&m_glslProgram_morphTargets);
+    }
+    return programs;
+  };
+  // Issue the compilation of the programs of the first frame, so that the
+  // driver can link them while textures and buffers are uploaded
+  for (const auto programs : activePrograms()) {
+    for (const auto features : usedShaderFeatures) {
+      programs->request(features & shaderFeatureMask());
+    }
+  }
 
   std::unique_ptr<CameraController> cameraController =
       std::make_unique<TrackballCameraController>(
@@ -113,9 +267,12 @@ int ViewerApplication::run()
     cameraController->setCamera(Camera{eye, center, up});
   }
 
-  std::cerr << "Load texture" << std::endl;
-  auto textureObjects = createTextureObjects(model);
-  std::cerr << "Loadded" << std::endl;
+  if (!isResident) {
+    std::cerr << "Load texture" << std::endl;
+    resident->textureObjects = createTextureObjects(model);
+    std::cerr << "Loadded" << std::endl;
+  }
+  const auto &textureObjects = resident->textureObjects;
 
   GLuint whiteTexture = 0;
 
@@ -132,16 +289,49 @@ int ViewerApplication::run()
   glBindTexture(GL_TEXTURE_2D, 0);
 
   createShadowMap();
-
-  std::cerr << "Create Buffer Objects" << std::endl;
-  auto v_bufferObjects = createBufferObjects(model);
-  std::cerr << "Created" << std::endl;
-
-  std::cerr << "Create Vertex Array Objects" << std::endl;
-  std::vector<VaoRange> v_meshToVertexArrays;
-  const auto vertexArrayObjects =
-      createVertexArrayObjects(model, v_bufferObjects, v_meshToVertexArrays);
-  std::cerr << "Created" << std::endl;
+  createGBuffer();
+
+  // Storage buffers of clustered shading: lights, clusters, light indices
+  GLuint lightBufferObjects[3] = {0, 0, 0};
+  glGenBuffers(3, lightBufferObjects);
+
+  // Attribute-less VAO for fullscreen passes
+  GLuint fullscreenVAO = 0;
+  glGenVertexArrays(1, &fullscreenVAO);
+
+  if (!isResident) {
+    std::cerr << "Create Buffer Objects" << std::endl;
+    resident->bufferObjects = createBufferObjects(model);
+    std::cerr << "Created" << std::endl;
+
+    std::cerr << "Create Vertex Array Objects" << std::endl;
+    resident->vertexArrayObjects = createVertexArrayObjects(
+        model, resident->bufferObjects, resident->meshToVertexArrays);
+    resident->depthVertexArrayObjects = createDepthVertexArrayObjects(
+        model, resident->bufferObjects, resident->positionBufferObject);
+    std::cerr << "Created" << std::endl;
+
+    if (m_server) {
+      resident->computeFootprint();
+      std::clog << "Model cache: " << m_gltfFilePath << ", "
+                << resident->cpuBytes / (1024 * 1024) << " MB CPU, "
+                << resident->gpuBytes / (1024 * 1024) << " MB GPU"
+                << std::endl;
+      m_modelCache.insert(m_gltfFilePath, resident);
+    }
+  }
+  const auto &v_bufferObjects = resident->bufferObjects;
+  const auto &v_meshToVertexArrays = resident->meshToVertexArrays;
+  const auto &vertexArrayObjects = resident->vertexArrayObjects;
+  const auto &depthVertexArrayObjects = resident->depthVertexArrayObjects;
+
+  // Wait for the programs of the first frame
+  for (const auto programs : activePrograms()) {
+    for (const auto features : usedShaderFeatures) {
+      programs->variant(features & shaderFeatureMask());
+    }
+  }
+  m_programCache.logStatistics();
 
   // Setup OpenGL state for rendering
   glEnable(GL_DEPTH_TEST);
@@ -237,16 +427,7 @@ int ViewerApplication::run()
       if (shader->m_uNormalTexture >= 0) {
         auto textureObject = whiteTexture;
         if (material.normalTexture.index >= 0) {
-          const auto &texture = model.textures[material.normalTexture.index];
-          if (material.normalTexture.index >= 0) {
-            m_modelHasNormals = 1;
-            glUniform1i(m_glslProgram_rendered->m_uHasNormalMap, m_modelHasNormals);
-            textureObject = textureObjects[material.normalTexture.index];
-          }
-          else{
-            m_modelHasNormals = 0;
-            glUniform1i(m_glslProgram_rendered->m_uHasNormalMap, m_modelHasNormals);
-          }
+          textureObject = textureObjects[material.normalTexture.index];
         }
 
 
@@ -308,78 +489,323 @@ int ViewerApplication::run()
     }
   };
 
-  // Lambda function to draw the scene
-  const auto drawScene = [&](glm::mat4 viewMatrix, const GLProgram* shader) {
-    // The recursive function that should draw a node
-    // We use a std::function because a simple lambda cannot be recursive
-    const std::function<void(int, const glm::mat4 &)> drawNode =
-        [&](int nodeIdx, const glm::mat4 &parentMatrix) {
-          auto v_node = model.nodes[nodeIdx];
-          glm::mat4 modelMatrix = getLocalToWorldMatrix(v_node, parentMatrix);
-          if (v_node.mesh >= 0) {
-            // send model matrix
-            if (shader->m_uModelMatrixLocation >= 0) {
-              glUniformMatrix4fv(shader->m_uModelMatrixLocation, 1, GL_FALSE,
-                  glm::value_ptr(modelMatrix));
-            }
+  // Mesh instances of the scene, the node hierarchy is only traversed once
+  std::vector<int> instanceMeshes;
+  std::vector<glm::mat4> instanceModelMatrices;
+  std::vector<int> instanceNodes;
+  flattenScene(model, instanceMeshes, instanceModelMatrices, &instanceNodes);
+  std::vector<DrawTransforms> instanceTransforms(instanceMeshes.size());
+  size_t primitiveCount = 0;
+  for (const auto meshIdx : instanceMeshes) {
+    primitiveCount += model.meshes[meshIdx].primitives.size();
+  }
 
-            if (shader->m_ulightDirection >= 0) {
-              if (lightFromCamera) {
-                glUniform3f(shader->m_ulightDirection, 0, 0, 1);
-              } else {
-                const auto lightDirectionInViewSpace = glm::normalize(
-                    glm::vec3(viewMatrix * glm::vec4(lightDir, 0.)));
-                glUniform3f(shader->m_ulightDirection,
-                    lightDirectionInViewSpace[0], lightDirectionInViewSpace[1],
-                    lightDirectionInViewSpace[2]);
-              }
-            }
-            if (shader->m_ulightIntensity >= 0) {
-              glUniform3fv(
-                  shader->m_ulightIntensity, 1, glm::value_ptr(lightInt));
-            }
-            if (shader->m_uApplyOcclusion >= 0) {
-              glUniform1i(shader->m_uApplyOcclusion, applyOcclusion);
-            }
+  // Animations and skins. animate() updates the model matrices of the
+  // instances and the joint matrices of the skinned ones, which are drawn
+  // with the identity as model matrix. Joint matrices are read by the vertex
+  // shaders from a texture buffer bound to texture unit 8.
+  Animator animator(model);
+  // Morph targets are blended in their own vertex buffers by animate()
+  MorphTargetEvaluator morphTargetEvaluator;
+  std::vector<GLuint> morphedVertexArrayObjects;
+  std::vector<GLuint> morphedDepthVertexArrayObjects;
+  if (morphTargets) {
+    morphTargetEvaluator.init(model, instanceMeshes, instanceNodes);
+    createMorphedVertexArrayObjects(model, v_bufferObjects, instanceMeshes,
+        morphTargetEvaluator, morphedVertexArrayObjects,
+        morphedDepthVertexArrayObjects);
+  }
+  std::vector<GLint> instanceJointOffsets;
+  for (const auto nodeIdx : instanceNodes) {
+    instanceJointOffsets.push_back(animator.jointOffset(nodeIdx));
+  }
+  GLuint jointBufferObject = 0;
+  GLuint jointTexture = 0;
+  if (animator.hasSkins()) {
+    GLint maxTexelCount = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &maxTexelCount);
+    if (4 * animator.jointMatrices().size() > size_t(maxTexelCount)) {
+      std::cerr << "Too many joint matrices for a texture buffer, skinning "
+                   "will be wrong"
+                << std::endl;
+    }
+    glGenBuffers(1, &jointBufferObject);
+    glGenTextures(1, &jointTexture);
+    glActiveTexture(GL_TEXTURE8);
+    glBindTexture(GL_TEXTURE_BUFFER, jointTexture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, jointBufferObject);
+  }
+  bool playAnimations = animator.animationCount() > 0;
+  float animationSpeed = 1.f;
+  double animationTime = 0.;
+  double animationMilliseconds = 0.;
+  const auto animate = [&]() {
+    const auto start = getSeconds();
+    animator.update(float(animationTime));
+    const auto &worldMatrices = animator.worldMatrices();
+    for (size_t i = 0; i < instanceNodes.size(); ++i) {
+      instanceModelMatrices[i] = instanceJointOffsets[i] >= 0
+                                     ? glm::mat4(1)
+                                     : worldMatrices[instanceNodes[i]];
+    }
+    animationMilliseconds = 1000. * (getSeconds() - start);
 
-            // get mesh an draw every primitives
-            auto v_mesh = model.meshes[v_node.mesh];
-            auto v_vaoRange = v_meshToVertexArrays[v_node.mesh];
-
-            for (int i = 0; i < v_mesh.primitives.size(); ++i) {
-              auto v_vao = vertexArrayObjects[v_vaoRange.begin + i];
-              auto primitive = v_mesh.primitives[i];
-              bindMaterial(primitive.material, shader);
-              glBindVertexArray(v_vao);
-              if (primitive.indices >= 0) {
-                const auto &accessor = model.accessors[primitive.indices];
-                const auto &bufferView = model.bufferViews[accessor.bufferView];
-                const auto byteOffset =
-                    accessor.byteOffset + bufferView.byteOffset;
-                glDrawElements(primitive.mode, GLsizei(accessor.count),
-                    accessor.componentType, (const GLvoid *)byteOffset);
-
-              } else {
-                // Take first accessor to get the count
-                const auto accessorIdx = (*begin(primitive.attributes)).second;
-                const auto &accessor = model.accessors[accessorIdx];
-                glDrawArrays(primitive.mode, 0, GLsizei(accessor.count));
-              }
-            }
+    if (morphTargetEvaluator.initialized()) {
+      morphTargetEvaluator.evaluate(
+          animator.morphWeights(), m_glslProgram_morphTargets.variant(0));
+    }
+
+    if (jointBufferObject) {
+      const auto &jointMatrices = animator.jointMatrices();
+      const auto size = GLsizeiptr(jointMatrices.size() * sizeof(glm::mat4));
+      glBindBuffer(GL_TEXTURE_BUFFER, jointBufferObject);
+      // Orphan the storage that might still be read by the previous frame
+      glBufferData(GL_TEXTURE_BUFFER, size, nullptr, GL_STREAM_DRAW);
+      glBufferSubData(GL_TEXTURE_BUFFER, 0, size, jointMatrices.data());
+      glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    }
+  };
+  animate();
+
+  // Potentially visible sets baked by --bake-pvs
+  PotentiallyVisibleSets pvs;
+  if (m_pvsCulling) {
+    const auto path = pvsPath(m_gltfFilePath);
+    if (!loadPVS(path, pvs) || pvs.drawCount != primitiveCount) {
+      std::cerr << "Unable to load the potentially visible sets " << path
+                << ", bake them with --bake-pvs" << std::endl;
+      pvs = PotentiallyVisibleSets();
+      m_pvsCulling = false;
+    }
+  }
+
+  // Culling of the primitives drawn from the camera
+  enum class DrawCulling
+  {
+    NONE,
+    CPU,
+    GPU
+  };
+  // Culling data (packed draws, meshlets, bounds and occluders) is built once
+  // from the first pose, and skinned or morphed primitives are bounded by
+  // their bind pose: scenes that move are never culled
+  const auto staticScene = animator.animationCount() == 0 &&
+                           !animator.hasSkins() &&
+                           !morphTargetEvaluator.initialized();
+  if (!staticScene && (m_gpuCulling || m_occlusionCulling || m_pvsCulling ||
+                          m_meshletCulling)) {
+    std::cerr << "Culling is disabled for animated scenes" << std::endl;
+  }
+  const auto cameraCulling = [&]() {
+    if (!staticScene) {
+      return DrawCulling::NONE;
+    }
+    if (m_gpuCulling) {
+      return DrawCulling::GPU;
+    }
+    return m_occlusionCulling || m_pvsCulling ? DrawCulling::CPU
+                                              : DrawCulling::NONE;
+  };
+
+  // GPU culling, the draw list is packed the first time it is enabled
+  HiZCuller hiZCuller;
+  const auto cullHiZ = [&](const glm::mat4 &viewMatrix) {
+    if (!hiZCuller.initialized()) {
+      hiZCuller.init(model, instanceMeshes, instanceModelMatrices,
+          m_nWindowWidth, m_nWindowHeight);
+    }
+    hiZCuller.cull(projMatrix * viewMatrix, m_glslProgram_hiZDepth.variant(0),
+        m_glslProgram_hiZPyramid.variant(0), m_glslProgram_hiZCull.variant(0));
+  };
+
+  // Meshlets are built the first time the meshlet culling is enabled
+  MeshletCuller meshletCuller;
+  const auto cullMeshlets = [&](const Camera &camera, bool hiZ) {
+    if (!meshletCuller.initialized()) {
+      meshletCuller.init(model, instanceMeshes, instanceModelMatrices);
+    }
+    meshletCuller.cull(projMatrix * camera.getViewMatrix(), camera.eye(),
+        m_glslProgram_meshletCull.variant(0), hiZ ? &hiZCuller : nullptr);
+  };
+
+  // CPU culling of the primitives of the instances, in drawing order: the
+  // potentially visible set of the camera cell, then the occlusion culling.
+  // Occluders are selected the first time the occlusion culling is enabled.
+  OcclusionCuller occlusionCuller;
+  std::vector<BoundingBox> primitiveBounds;
+  std::vector<uint8_t> primitiveVisibility(primitiveCount, 1);
+  size_t visiblePrimitiveCount = primitiveCount;
+  int pvsCell = -1;
+  double occlusionCullingMilliseconds = 0.;
+  const auto cullPrimitives = [&](const Camera &camera, bool occlusion) {
+    const auto start = getSeconds();
+    if (m_pvsCulling) {
+      pvsCell = pvs.cellVisibility(camera.eye(), primitiveVisibility.data());
+    } else {
+      std::fill(begin(primitiveVisibility), end(primitiveVisibility), 1);
+    }
+    if (occlusion) {
+      if (primitiveBounds.empty()) {
+        primitiveBounds = computeInstanceBounds(
+            model, instanceMeshes, instanceModelMatrices);
+        auto occluders =
+            selectOccluders(model, instanceMeshes, instanceModelMatrices);
+        std::clog << "Occlusion culling: " << occluders.indices.size() / 3
+                  << " occluder triangles" << std::endl;
+        occlusionCuller.setOccluders(std::move(occluders));
+      }
+      occlusionCuller.renderOccluders(projMatrix * camera.getViewMatrix());
+      visiblePrimitiveCount = occlusionCuller.testVisibility(
+          primitiveBounds.data(), primitiveBounds.size(),
+          primitiveVisibility.data());
+    } else {
+      visiblePrimitiveCount = size_t(std::count(
+          begin(primitiveVisibility), end(primitiveVisibility), 1));
+    }
+    occlusionCullingMilliseconds = 1000. * (getSeconds() - start);
+  };
+
+  // Lambda function to draw the scene
+  // The variant of programs matching the features of each primitive is used.
+  // depthOnly draws with position-only VAOs and skips material binding, for
+  // shaders that only output depth, skinning being the only feature they
+  // support. culling skips the primitives culled by
+  // the last cullPrimitives() call, and draws the others with the indirect
+  // commands of the last cullHiZ() call for GPU culling. meshlets draws the
+  // primitives split in meshlets with the visible indices of the last
+  // cullMeshlets() call.
+  const auto drawScene = [&](const glm::mat4 &viewMatrix,
+                             const glm::mat4 &projMatrix,
+                             GLProgramPermutations *programs,
+                             bool depthOnly = false,
+                             DrawCulling culling = DrawCulling::NONE,
+                             bool meshlets = false) {
+    const auto &vaos =
+        depthOnly ? depthVertexArrayObjects : vertexArrayObjects;
+    const auto &morphedVaos = depthOnly ? morphedDepthVertexArrayObjects
+                                        : morphedVertexArrayObjects;
+    const auto featureMask =
+        depthOnly ? uint32_t(SHADER_FEATURE_SKINNING) : shaderFeatureMask();
+    const GLProgram *shader = nullptr;
+
+    computeDrawTransforms(viewMatrix, projMatrix, instanceModelMatrices.data(),
+        instanceModelMatrices.size(), instanceTransforms.data());
+
+    if (culling == DrawCulling::GPU) {
+      glBindBuffer(GL_DRAW_INDIRECT_BUFFER, hiZCuller.shadingCommandBuffer());
+    }
+    size_t drawIdx = 0;
+    for (size_t instanceIdx = 0; instanceIdx < instanceMeshes.size();
+         ++instanceIdx) {
+      // get mesh an draw every primitives
+      const auto &v_mesh = model.meshes[instanceMeshes[instanceIdx]];
+      const auto &v_vaoRange =
+          v_meshToVertexArrays[instanceMeshes[instanceIdx]];
+      const auto &transforms = instanceTransforms[instanceIdx];
+      bool matricesSent = false;
+
+      for (int i = 0; i < v_mesh.primitives.size(); ++i, ++drawIdx) {
+        if (culling != DrawCulling::NONE && !primitiveVisibility[drawIdx]) {
+          continue;
+        }
+        const auto vaoIdx = v_vaoRange.begin + i;
+        const auto &variant =
+            programs->variant(primitiveShaderFeatures[vaoIdx] & featureMask);
+        if (&variant != shader) {
+          shader = &variant;
+          shader->use();
+          matricesSent = false;
+          if (shader->m_uJointMatrices >= 0) {
+            glUniform1i(shader->m_uJointMatrices, 8);
+          }
+        }
+        // send matrices of the instance
+        if (!matricesSent) {
+          if (shader->m_uModelMatrixLocation >= 0) {
+            glUniformMatrix4fv(shader->m_uModelMatrixLocation, 1, GL_FALSE,
+                glm::value_ptr(instanceModelMatrices[instanceIdx]));
+          }
+          if (shader->m_uModelViewMatrixLocation >= 0) {
+            glUniformMatrix4fv(shader->m_uModelViewMatrixLocation, 1,
+                GL_FALSE, glm::value_ptr(transforms.modelViewMatrix));
+          }
+          if (shader->m_uModelViewProjMatrixLocation >= 0) {
+            glUniformMatrix4fv(shader->m_uModelViewProjMatrixLocation, 1,
+                GL_FALSE, glm::value_ptr(transforms.modelViewProjMatrix));
+          }
+          if (shader->m_uNormalMatrixLocation >= 0) {
+            glUniformMatrix3fv(shader->m_uNormalMatrixLocation, 1, GL_FALSE,
+                glm::value_ptr(transforms.normalMatrix));
+          }
+          if (shader->m_uJointOffset >= 0) {
+            glUniform1i(
+                shader->m_uJointOffset, instanceJointOffsets[instanceIdx]);
           }
-          for (auto v_child : v_node.children) {
-            drawNode(v_child, parentMatrix);
+          if (shader->m_uNodeId >= 0) {
+            glUniform1ui(
+                shader->m_uNodeId, GLuint(instanceNodes[instanceIdx] + 1));
           }
-        };
+          matricesSent = true;
+        }
 
-    if(shader->m_applyNormalMapping >= 0)
-      glUniform1i(shader->m_applyNormalMapping, applyNormalTexture);
-    // Draw the scene referenced by gltf file
-    if (model.defaultScene >= 0) {
-      for (auto node : model.scenes[model.defaultScene].nodes) {
-        drawNode(node, glm::mat4(1));
+        const auto v_vao = drawIdx < morphedVaos.size() && morphedVaos[drawIdx]
+                               ? morphedVaos[drawIdx]
+                               : vaos[vaoIdx];
+        const auto &primitive = v_mesh.primitives[i];
+        if (!depthOnly) {
+          bindMaterial(primitive.material, shader);
+          if (shader->m_uMaterialId >= 0) {
+            glUniform1ui(
+                shader->m_uMaterialId, GLuint(primitive.material + 1));
+          }
+        }
+        glBindVertexArray(v_vao);
+        const auto meshletCommand =
+            meshlets ? meshletCuller.commandOffset(drawIdx) : -1;
+        if (meshletCommand >= 0) {
+          // Temporarily replace the index buffer of the VAO
+          GLuint indexBuffer = 0;
+          if (primitive.indices >= 0) {
+            const auto &accessor = model.accessors[primitive.indices];
+            indexBuffer =
+                v_bufferObjects[model.bufferViews[accessor.bufferView].buffer];
+          }
+          glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, meshletCuller.indexBuffer());
+          glBindBuffer(GL_DRAW_INDIRECT_BUFFER, meshletCuller.commandBuffer());
+          glDrawElementsIndirect(primitive.mode, GL_UNSIGNED_INT,
+              (const GLvoid *)meshletCommand);
+          glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
+          glBindBuffer(GL_DRAW_INDIRECT_BUFFER,
+              culling == DrawCulling::GPU ? hiZCuller.shadingCommandBuffer()
+                                          : 0);
+        } else if (culling == DrawCulling::GPU) {
+          // The instance count is 0 if the primitive is culled
+          const auto command = (const GLvoid *)(
+              drawIdx * sizeof(DrawElementsIndirectCommand));
+          if (primitive.indices >= 0) {
+            glDrawElementsIndirect(primitive.mode,
+                model.accessors[primitive.indices].componentType, command);
+          } else {
+            glDrawArraysIndirect(primitive.mode, command);
+          }
+        } else if (primitive.indices >= 0) {
+          const auto &accessor = model.accessors[primitive.indices];
+          const auto &bufferView = model.bufferViews[accessor.bufferView];
+          const auto byteOffset = accessor.byteOffset + bufferView.byteOffset;
+          glDrawElements(primitive.mode, GLsizei(accessor.count),
+              accessor.componentType, (const GLvoid *)byteOffset);
+
+        } else {
+          // Take first accessor to get the count
+          const auto accessorIdx = (*begin(primitive.attributes)).second;
+          const auto &accessor = model.accessors[accessorIdx];
+          glDrawArrays(primitive.mode, 0, GLsizei(accessor.count));
+        }
       }
     }
+    if (culling == DrawCulling::GPU) {
+      glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    }
   };
 
   const auto computeShadowMap = [&]() {
@@ -404,65 +830,554 @@ int ViewerApplication::run()
         -sceneRadius, sceneRadius, 0.1f * sceneRadius, 2.f * sceneRadius);
     m_lightSpaceMatrix = dirLightProjMatrix * dirLightViewMatrix;
 
-    m_glslProgram_shadowMapRendered->use();
-    glUniformMatrix4fv(m_glslProgram_shadowMapRendered->m_uLightSpaceMatrix, 1, GL_FALSE,
-        glm::value_ptr(m_lightSpaceMatrix));
 
     glEnable(GL_DEPTH_TEST);
     glViewport(0, 0, SHADOW_RES, SHADOW_RES);
     glBindFramebuffer(GL_FRAMEBUFFER, m_depthMapFBO);
     glClear(GL_DEPTH_BUFFER_BIT);
-    drawScene(dirLightViewMatrix, m_glslProgram_shadowMapRendered);
+    drawScene(dirLightViewMatrix, dirLightProjMatrix,
+        m_glslProgram_shadowMapRendered, true);
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
   };
 
-  const auto render = [&]() {
-    const auto camera = cameraController->getCamera();
+  // Frame uniforms of image based lighting, for variants compiled with HAS_IBL
+  const auto setIBLUniforms = [&](const GLProgram &program,
+                                  const glm::mat4 &viewMatrix) {
+    if (program.m_uSpecularMap < 0) {
+      return;
+    }
+    glActiveTexture(GL_TEXTURE6);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, m_iblSpecularMap);
+    glActiveTexture(GL_TEXTURE7);
+    glBindTexture(GL_TEXTURE_2D, m_iblBRDFLut);
+    glUniform1i(program.m_uSpecularMap, 6);
+    glUniform1i(program.m_uBRDFLut, 7);
+    glUniformMatrix4fv(program.m_uInvViewMatrix, 1, GL_FALSE,
+        glm::value_ptr(glm::inverse(viewMatrix)));
+    glUniform3fv(program.m_uSHCoefficients, 9,
+        glm::value_ptr(m_iblSHCoefficients[0]));
+    glUniform1f(program.m_uSpecularMaxLod, float(m_iblSpecularMipCount - 1));
+    glUniform1f(program.m_uIBLIntensity, iblIntensity);
+  };
 
-    m_glslProgram_rendered->use();
-    const auto viewMatrix = camera.getViewMatrix();
-    if (m_glslProgram_rendered->m_uViewMatrixLocation >= 0) {
-      glUniformMatrix4fv(m_glslProgram_rendered->m_uViewMatrixLocation, 1,
-          GL_FALSE, glm::value_ptr(viewMatrix));
+  // Fullscreen lighting pass of the deferred pipeline, the G-buffer must have
+  // been filled by drawing the scene with m_glslProgram_gBuffer
+  const auto shadeGBuffer = [&](const glm::mat4 &viewMatrix) {
+    const auto &program =
+        m_glslProgram_deferredLighting.variant(shaderFeatureMask());
+    program.use();
+    setIBLUniforms(program, viewMatrix);
+
+    if (lightFromCamera) {
+      glUniform3f(program.m_ulightDirection, 0, 0, 1);
+    } else {
+      const auto lightDirectionInViewSpace =
+          glm::normalize(glm::vec3(viewMatrix * glm::vec4(lightDir, 0.)));
+      glUniform3fv(program.m_ulightDirection, 1,
+          glm::value_ptr(lightDirectionInViewSpace));
     }
-    if (m_glslProgram_rendered->m_uProjectionMatrixLocation >= 0) {
-      glUniformMatrix4fv(m_glslProgram_rendered->m_uProjectionMatrixLocation, 1,
-          GL_FALSE, glm::value_ptr(projMatrix));
+    glUniform3fv(program.m_ulightIntensity, 1, glm::value_ptr(lightInt));
+    glUniformMatrix4fv(program.m_uInvProjectionMatrix, 1, GL_FALSE,
+        glm::value_ptr(glm::inverse(projMatrix)));
+    glUniformMatrix4fv(program.m_uViewToLightSpaceMatrix, 1, GL_FALSE,
+        glm::value_ptr(m_lightSpaceMatrix * glm::inverse(viewMatrix)));
+
+    const GLint samplers[GBufferTextureCount] = {program.m_uGBufferNormal,
+        program.m_uGBufferBaseColor, program.m_uGBufferMaterial,
+        program.m_uGBufferEmissive, program.m_uGBufferDepth};
+    for (GLint i = 0; i < GBufferTextureCount; ++i) {
+      // Unit 4 is for shadow map
+      const auto unit = i < 4 ? i : i + 1;
+      glActiveTexture(GL_TEXTURE0 + unit);
+      glBindTexture(GL_TEXTURE_2D, m_gBufferTextures[i]);
+      glUniform1i(samplers[i], unit);
     }
-    glUniformMatrix4fv(m_glslProgram_rendered->m_uLightSpaceMatrix, 1, GL_FALSE,
-        glm::value_ptr(m_lightSpaceMatrix));
-
     glActiveTexture(GL_TEXTURE4);
     glBindTexture(GL_TEXTURE_2D, m_depthMap);
-    glUniform1i(m_glslProgram_rendered->m_uDirLightShadowMap, 4);
+    glUniform1i(program.m_uDirLightShadowMap, 4);
+
+    glDisable(GL_DEPTH_TEST);
+    glBindVertexArray(fullscreenVAO);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    glBindVertexArray(0);
+    glEnable(GL_DEPTH_TEST);
+  };
+
+  LightClusterGrid lightClusters;
+  lightClusters.zNear = zNear;
+  lightClusters.zFar = zFar;
+  std::vector<PunctualLight> viewSpaceLights;
+  double lightClusteringMilliseconds = 0.;
+  // Workers kept for the whole run, clusters are built every frame
+  ThreadPool lightClusteringThreadPool(punctualLights.empty() ? 1 : 0);
+
+  // Cull punctual lights for the current view and upload the result for
+  // m_glslProgram_clustered
+  const auto updateLightClusters = [&](const glm::mat4 &viewMatrix) {
+    const auto start = getSeconds();
+    transformPunctualLights(punctualLights, viewMatrix, viewSpaceLights);
+    buildLightClusters(viewSpaceLights, projMatrix, lightClusters,
+        lightClusteringThreadPool);
+    lightClusteringMilliseconds = 1000. * (getSeconds() - start);
+
+    const auto uploadStorageBuffer = [&](GLuint binding, GLsizeiptr size,
+                                         const void *data) {
+      glBindBuffer(GL_SHADER_STORAGE_BUFFER, lightBufferObjects[binding]);
+      // Never leave a binding empty
+      glBufferData(GL_SHADER_STORAGE_BUFFER, glm::max(size, GLsizeiptr(16)),
+          size ? data : nullptr, GL_STREAM_DRAW);
+      glBindBufferBase(
+          GL_SHADER_STORAGE_BUFFER, binding, lightBufferObjects[binding]);
+    };
+    uploadStorageBuffer(0, viewSpaceLights.size() * sizeof(PunctualLight),
+        viewSpaceLights.data());
+    uploadStorageBuffer(1, lightClusters.clusters.size() * sizeof(glm::uvec2),
+        lightClusters.clusters.data());
+    uploadStorageBuffer(2, lightClusters.lightIndices.size() * sizeof(uint32_t),
+        lightClusters.lightIndices.data());
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+  };
+
+  GLTimer depthPrepassTimer;
+  GLTimer hiZCullingTimer;
+  GLTimer meshletCullingTimer;
+  GLTimer shadingTimer;
+  GLTimer lightingTimer;
+
+  const auto render = [&]() {
+    const auto camera = cameraController->getCamera();
+    const auto viewMatrix = camera.getViewMatrix();
+
+    // Deferred: geometry passes render in the G-buffer, then the lighting
+    // pass renders in the framebuffer that was bound when render() was called
+    GLint outputFramebuffer = 0;
+    if (m_deferred) {
+      glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &outputFramebuffer);
+      glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_gBufferFBO);
+      glEnable(GL_FRAMEBUFFER_SRGB); // Only affects the base color target
+    }
 
     glViewport(0, 0, m_nWindowWidth, m_nWindowHeight);
     glClearColor(0.529, 0.808, 0.922,1.0);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-    drawScene(viewMatrix, m_glslProgram_rendered);
+    if (m_aovOutput) {
+      clearAovAttachments();
+    }
+
+    const auto culling = cameraCulling();
+    if (culling != DrawCulling::NONE) {
+      cullPrimitives(camera, culling == DrawCulling::CPU && m_occlusionCulling);
+    }
+    if (culling == DrawCulling::GPU) {
+      hiZCullingTimer.begin();
+      cullHiZ(viewMatrix);
+      hiZCullingTimer.end();
+    }
+    const auto meshlets = m_meshletCulling && staticScene;
+    if (meshlets) {
+      meshletCullingTimer.begin();
+      cullMeshlets(camera, culling == DrawCulling::GPU);
+      meshletCullingTimer.end();
+    }
+
+    if (m_depthPrepass) {
+      depthPrepassTimer.begin();
+      glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+      drawScene(
+          viewMatrix, projMatrix, &m_glslProgram_depthPrepass, true, culling,
+          meshlets);
+      glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+      depthPrepassTimer.end();
+
+      // Only shade the visible fragments
+      glDepthFunc(GL_EQUAL);
+      glDepthMask(GL_FALSE);
+    }
+
+    // CPU work, timed by itself, while the GPU runs the previous passes
+    if (m_glslProgram_rendered == &m_glslProgram_clustered) {
+      updateLightClusters(viewMatrix);
+    }
+    shadingTimer.begin();
+
+    // Compile variants that might be missing after a GUI change, then set the
+    // uniforms that are constant over the frame in every variant
+    for (const auto features : usedShaderFeatures) {
+      m_glslProgram_rendered->request(features & shaderFeatureMask());
+    }
+    for (const auto features : usedShaderFeatures) {
+      m_glslProgram_rendered->variant(features & shaderFeatureMask());
+    }
+    const auto lightDirectionInViewSpace =
+        lightFromCamera
+            ? glm::vec3(0, 0, 1)
+            : glm::normalize(glm::vec3(viewMatrix * glm::vec4(lightDir, 0.)));
+    glActiveTexture(GL_TEXTURE4);
+    glBindTexture(GL_TEXTURE_2D, m_depthMap);
+    m_glslProgram_rendered->forEachVariant([&](const GLProgram &program) {
+      program.use();
+      glUniformMatrix4fv(program.m_uLightSpaceMatrix, 1, GL_FALSE,
+          glm::value_ptr(m_lightSpaceMatrix));
+      glUniform1i(program.m_uDirLightShadowMap, 4);
+      glUniform3fv(program.m_ulightDirection, 1,
+          glm::value_ptr(lightDirectionInViewSpace));
+      glUniform3fv(program.m_ulightIntensity, 1, glm::value_ptr(lightInt));
+      setIBLUniforms(program, viewMatrix);
+
+      if (program.m_uClusterGridSize >= 0) {
+        glUniform1i(
+            program.m_uDirectionalLightCount, GLint(directionalLightCount));
+        glUniform3iv(program.m_uClusterGridSize, 1,
+            glm::value_ptr(lightClusters.size));
+        glUniform2f(program.m_uClusterTileSize,
+            float(m_nWindowWidth) / lightClusters.size.x,
+            float(m_nWindowHeight) / lightClusters.size.y);
+        glUniform2fv(program.m_uClusterSliceScaleBias, 1,
+            glm::value_ptr(lightClusters.sliceScaleBias()));
+      }
+    });
+
+    drawScene(viewMatrix, projMatrix, m_glslProgram_rendered, false, culling,
+        meshlets);
+    shadingTimer.end();
+
+    if (m_depthPrepass) {
+      glDepthFunc(GL_LESS);
+      glDepthMask(GL_TRUE);
+    }
+
+    if (m_deferred) {
+      glDisable(GL_FRAMEBUFFER_SRGB);
+      glBindFramebuffer(GL_DRAW_FRAMEBUFFER, outputFramebuffer);
+      glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+      lightingTimer.begin();
+      shadeGBuffer(viewMatrix);
+      lightingTimer.end();
+    }
+  };
+
+  // Timings of the last rendered image, for the output modes. Without wait,
+  // GPU timings are the last available ones, that can be of a previous image.
+  const auto logTimings = [&](bool wait) {
+    const auto milliseconds = [&](GLTimer &timer) {
+      return wait ? timer.waitMilliseconds() : timer.lastMilliseconds();
+    };
+    if (animator.animationCount() > 0 || animator.hasSkins()) {
+      std::clog << "Animation: " << animationMilliseconds << " ms, "
+                << animator.channelCount() << " channels, "
+                << animator.jointMatrices().size() << " joints" << std::endl;
+    }
+    if (morphTargetEvaluator.morphedDrawCount() > 0) {
+      std::clog << "Morph targets: "
+                << morphTargetEvaluator.blendedTargetCount() << " blended, "
+                << morphTargetEvaluator.blendedDeltaCount() << " deltas"
+                << std::endl;
+    }
+    if (m_depthPrepass) {
+      std::clog << "Depth pre-pass: " << milliseconds(depthPrepassTimer)
+                << " ms" << std::endl;
+    }
+    if (m_glslProgram_rendered == &m_glslProgram_clustered) {
+      std::clog << "Light clustering: " << lightClusteringMilliseconds
+                << " ms" << std::endl;
+    }
+    if (cameraCulling() == DrawCulling::GPU) {
+      std::clog << "GPU occlusion culling: "
+                << milliseconds(hiZCullingTimer) << " ms" << std::endl;
+    }
+    if (cameraCulling() == DrawCulling::CPU || m_pvsCulling) {
+      std::clog << "CPU culling: " << occlusionCullingMilliseconds << " ms, "
+                << visiblePrimitiveCount << " / " << primitiveCount
+                << " primitives drawn";
+      if (m_pvsCulling) {
+        std::clog << ", PVS cell " << pvsCell;
+      }
+      std::clog << std::endl;
+    }
+    if (m_meshletCulling) {
+      std::clog << "Meshlet culling: " << milliseconds(meshletCullingTimer)
+                << " ms" << std::endl;
+    }
+    std::clog << (m_deferred ? "Geometry pass: " : "Shading pass: ")
+              << milliseconds(shadingTimer) << " ms" << std::endl;
+    if (m_deferred) {
+      std::clog << "Lighting pass: " << milliseconds(lightingTimer)
+                << " ms" << std::endl;
+    }
+  };
+
+  // Resolution of the rendered images, changed by the views of the batch mode
+  const auto setImageSize = [&](int width, int height) {
+    if (width == m_nWindowWidth && height == m_nWindowHeight) {
+      return;
+    }
+    m_nWindowWidth = width;
+    m_nWindowHeight = height;
+    projMatrix = glm::perspective(
+        70.f, float(m_nWindowWidth) / float(m_nWindowHeight), zNear, zFar);
+    glDeleteFramebuffers(1, &m_gBufferFBO);
+    glDeleteTextures(GBufferTextureCount, m_gBufferTextures);
+    createGBuffer();
+    hiZCuller.resize(m_nWindowWidth, m_nWindowHeight);
   };
 
+  // View of the batch or serve modes rendered in framebuffer, the shadow map
+  // being reused while the light does not move. True if it was updated.
+  auto shadowMapValid = false;
+  const auto renderView = [&](const BatchView &view,
+                              OffscreenFramebuffer &framebuffer) {
+    setImageSize(view.width, view.height);
+    cameraController->setCamera(view.camera);
+    if (view.hasLightDirection &&
+        (view.lightTheta != lightTheta || view.lightPhi != lightPhi)) {
+      lightTheta = view.lightTheta;
+      lightPhi = view.lightPhi;
+      const auto sinPhi = glm::sin(lightPhi);
+      const auto cosPhi = glm::cos(lightPhi);
+      const auto sinTheta = glm::sin(lightTheta);
+      const auto cosTheta = glm::cos(lightTheta);
+      lightDir = glm::vec3(sinTheta * cosPhi, cosTheta, sinTheta * sinPhi);
+      shadowMapValid = false;
+    }
+    if (view.hasLightIntensity) {
+      lightInt = view.lightIntensity;
+    }
+    const auto shadowMapUpdated = !shadowMapValid;
+
+    if (!shadowMapValid) {
+      computeShadowMap();
+      shadowMapValid = true;
+    }
+    framebuffer.resize(m_nWindowWidth, m_nWindowHeight);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, framebuffer.framebuffer());
+    render();
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+    return shadowMapUpdated;
+  };
+
+  // GPU resources of the run, released when run() returns to serve(). The
+  // ones of the model belong to resident.
+  const auto releaseSceneObjects = [&]() {
+    glDeleteVertexArrays(GLsizei(morphedVertexArrayObjects.size()),
+        morphedVertexArrayObjects.data());
+    glDeleteVertexArrays(GLsizei(morphedDepthVertexArrayObjects.size()),
+        morphedDepthVertexArrayObjects.data());
+    glDeleteBuffers(1, &jointBufferObject);
+    glDeleteTextures(1, &jointTexture);
+    glDeleteTextures(1, &whiteTexture);
+    glDeleteFramebuffers(1, &m_depthMapFBO);
+    glDeleteTextures(1, &m_depthMap);
+    glDeleteFramebuffers(1, &m_gBufferFBO);
+    glDeleteTextures(GBufferTextureCount, m_gBufferTextures);
+    glDeleteTextures(1, &m_iblSpecularMap);
+    glDeleteTextures(1, &m_iblBRDFLut);
+    m_iblSpecularMap = m_iblBRDFLut = 0;
+    glDeleteVertexArrays(1, &fullscreenVAO);
+    glDeleteBuffers(3, lightBufferObjects);
+  };
+
+  // AOVs are read back by the batch mode: the image of m_OutputPath is its
+  // single view, rendered without tiles
+  if (m_aovOutput && batchViews.empty() && !m_OutputPath.empty()) {
+    BatchView view;
+    view.camera = cameraController->getCamera();
+    view.output = m_OutputPath;
+    view.width = outputWidth;
+    view.height = outputHeight;
+    batchViews.push_back(view);
+  }
+
+  // Batch mode: every view is rendered with the GPU resources of the model
+  // loaded once
+  if (!batchViews.empty()) {
+    // Images are read back and encoded while the next views are rendered
+    OffscreenFramebuffer framebuffer(m_aovOutput);
+    ImageSequenceWriter imageWriter(m_pngCompression);
+    GLint maxTextureSize = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxTextureSize);
+    auto success = true;
+    const auto batchStart = getSeconds();
+    for (size_t viewIdx = 0; viewIdx < batchViews.size(); ++viewIdx) {
+      const auto &view = batchViews[viewIdx];
+      if (view.width > maxTextureSize || view.height > maxTextureSize) {
+        std::cerr << "View " << viewIdx << ": " << view.output.string()
+                  << " not rendered, its size exceeds the largest texture of "
+                  << maxTextureSize << std::endl;
+        success = false;
+        continue;
+      }
+      const auto viewStart = getSeconds();
+      const auto shadowMapUpdated = renderView(view, framebuffer);
+      imageWriter.write(framebuffer, view.output);
+      std::clog << "View " << viewIdx << ": " << view.output.string() << ", "
+                << m_nWindowWidth << "x" << m_nWindowHeight << ", "
+                << 1000. * (getSeconds() - viewStart) << " ms"
+                << (shadowMapUpdated ? ", shadow map updated" : "")
+                << std::endl;
+      logTimings(false);
+    }
+    if (!imageWriter.finish() || !success) {
+      return -1;
+    }
+    const auto batchSeconds = getSeconds() - batchStart;
+    std::clog << "Batch: " << batchViews.size() << " views in "
+              << batchSeconds << " s, " << batchViews.size() / batchSeconds
+              << " views/s, " << imageWriter.stallMilliseconds()
+              << " ms waiting for readbacks" << std::endl;
+    return 0;
+  }
+
+  // Serve mode: the requests for the loaded model are answered until one is
+  // for another model, left pending for serve()
+  if (m_server) {
+    OffscreenFramebuffer framebuffer;
+    // Strips of PNG images are compressed in parallel
+    ThreadPool threadPool;
+    GLint maxTextureSize = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxTextureSize);
+    const auto modelCamera = cameraController->getCamera();
+    std::vector<unsigned char> pixels;
+    std::string bytes;
+    while (m_hasPendingRequest && m_pendingRequest.model == m_gltfFilePath) {
+      const auto &request = m_pendingRequest;
+      const auto start = getSeconds();
+      auto view = request.view;
+      if (!request.hasCamera) {
+        view.camera = modelCamera;
+      }
+      if (view.width > maxTextureSize || view.height > maxTextureSize) {
+        m_server->sendError("size exceeds the largest texture of " +
+                            std::to_string(maxTextureSize));
+      } else {
+        renderView(view, framebuffer);
+        pixels.resize(size_t(m_nWindowWidth) * m_nWindowHeight * 3);
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer.framebuffer());
+        glReadBuffer(GL_COLOR_ATTACHMENT0);
+        glPixelStorei(GL_PACK_ALIGNMENT, 1);
+        glReadPixels(0, 0, m_nWindowWidth, m_nWindowHeight, GL_RGB,
+            GL_UNSIGNED_BYTE, pixels.data());
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+        flipImageYAxis(m_nWindowWidth, m_nWindowHeight, 3, pixels.data());
+        if (encodeImage(request.format, m_nWindowWidth, m_nWindowHeight,
+                pixels.data(), m_pngCompression, threadPool, bytes)) {
+          m_server->sendImage(request.format, m_nWindowWidth,
+              m_nWindowHeight, 1000. * (getSeconds() - start), bytes);
+        } else {
+          m_server->sendError("Unable to encode the image");
+        }
+      }
+      m_hasPendingRequest = m_server->readRequest(m_pendingRequest);
+    }
+    releaseSceneObjects();
+    return 0;
+  }
+
   if (!m_OutputPath.empty()) {
-    std::vector<unsigned char> pixels(m_nWindowWidth * m_nWindowHeight * 3);
-
-    renderToImage(m_nWindowWidth, m_nWindowHeight, 3, pixels.data(), [&]() {
-      render();
-    },[&]() {
-          computeShadowMap();
-        });
-    flipImageYAxis(m_nWindowWidth, m_nWindowHeight, 3, pixels.data());
-    const auto strPath = m_OutputPath.string();
-    stbi_write_png(
-        strPath.c_str(), m_nWindowWidth, m_nWindowHeight, 3, pixels.data(), 0);
+    // Each tile is rendered with the sub-frustum of the projection of the
+    // whole image. Bands of tiles are read back from the top of the image, in
+    // the order of the rows of the PNG file, and streamed to its encoder.
+    const auto tileWidth = m_nWindowWidth;
+    const auto tileHeight = m_nWindowHeight;
+    const auto imageProjMatrix = glm::perspective(
+        70.f, float(outputWidth) / float(outputHeight), zNear, zFar);
+    // Strips of the bands are compressed in parallel
+    ThreadPool threadPool;
+    PngWriter pngWriter(threadPool);
+    if (!pngWriter.open(m_OutputPath, outputWidth, outputHeight, 3,
+            m_pngCompression)) {
+      std::cerr << "Unable to write " << m_OutputPath << std::endl;
+      return -1;
+    }
+    OffscreenFramebuffer framebuffer;
+    framebuffer.resize(tileWidth, tileHeight);
+    std::vector<unsigned char> band(size_t(outputWidth) * tileHeight * 3);
+
+    computeShadowMap();
+    const auto renderingStart = getSeconds();
+    auto encodingSeconds = 0.;
+    auto tileCount = 0;
+    for (GLsizei top = 0; top < outputHeight; top += tileHeight) {
+      const auto bandHeight = std::min(tileHeight, outputHeight - top);
+      // OpenGL rows go upward
+      const auto y = outputHeight - top - bandHeight;
+      for (GLsizei x = 0; x < outputWidth; x += tileWidth) {
+        // Tiles crossing the right or bottom edge keep their size, only
+        // their part in the image is read
+        const auto width = std::min(tileWidth, outputWidth - x);
+        projMatrix = tileProjection(imageProjMatrix, x, y, tileWidth,
+            tileHeight, outputWidth, outputHeight);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, framebuffer.framebuffer());
+        render();
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer.framebuffer());
+        glReadBuffer(GL_COLOR_ATTACHMENT0);
+        glPixelStorei(GL_PACK_ALIGNMENT, 1);
+        glPixelStorei(GL_PACK_ROW_LENGTH, outputWidth);
+        glReadPixels(0, 0, width, bandHeight, GL_RGB, GL_UNSIGNED_BYTE,
+            band.data() + size_t(x) * 3);
+        glPixelStorei(GL_PACK_ROW_LENGTH, 0);
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+        ++tileCount;
+      }
+      flipImageYAxis(outputWidth, bandHeight, 3, band.data());
+      const auto encodingStart = getSeconds();
+      if (!pngWriter.writeRows(band.data(), bandHeight)) {
+        std::cerr << "Unable to write " << m_OutputPath << std::endl;
+        return -1;
+      }
+      encodingSeconds += getSeconds() - encodingStart;
+    }
+    if (!pngWriter.finish()) {
+      std::cerr << "Unable to write " << m_OutputPath << std::endl;
+      return -1;
+    }
+    logTimings(true);
+    std::clog << "Tiled rendering: " << tileCount << " tiles of " << tileWidth
+              << "x" << tileHeight << ", "
+              << 1000. * (getSeconds() - renderingStart - encodingSeconds)
+              << " ms" << std::endl;
+    std::clog << "PNG encoding: " << 1000. * encodingSeconds << " ms on "
+              << threadPool.size() << " threads" << std::endl;
     return 0;
   }
 
+  // Recompile programs when their shaders are modified
+  FileWatcher shaderWatcher(m_ShadersRootPath);
+  GLProgramPermutations *const allPrograms[] = {&m_glslProgram_shadowMap,
+      &m_glslProgram_fullRender, &m_glslProgram_normalRender,
+      &m_glslProgram_noShadow, &m_glslProgram_debugShadowMap,
+      &m_glslProgram_tangent, &m_glslProgram_bitangent,
+      &m_glslProgram_normalTexture, &m_glslProgram_depthPrepass,
+      &m_glslProgram_gBuffer, &m_glslProgram_deferredLighting,
+      &m_glslProgram_clustered, &m_glslProgram_hiZDepth,
+      &m_glslProgram_hiZPyramid, &m_glslProgram_hiZCull,
+      &m_glslProgram_meshletCull, &m_glslProgram_morphTargets};
+
   // Loop until the user closes the window
+  auto previousSeconds = getSeconds();
   for (auto iterationCount = 0u; !m_GLFWHandle.shouldClose();
        ++iterationCount) {
-    const auto seconds = glfwGetTime();
+    const auto seconds = getSeconds();
     const auto camera = cameraController->getCamera();
 
+    if (playAnimations) {
+      animationTime += animationSpeed * (seconds - previousSeconds);
+      animate();
+      shadowNeedUpdate = true;
+    }
+    previousSeconds = seconds;
+
+    for (const auto &shaderPath : shaderWatcher.poll()) {
+      std::clog << "Shader modified: " << shaderPath << std::endl;
+      for (const auto programs : allPrograms) {
+        if (programs->usesShader(shaderPath) && programs->reload() &&
+            programs == m_glslProgram_shadowMapRendered) {
+          shadowNeedUpdate = true;
+        }
+      }
+    }
+
     if((shadowNeedUpdate || lightFromCamera) && renderShadow) {
       computeShadowMap();
       shadowNeedUpdate = false;
@@ -537,9 +1452,50 @@ int ViewerApplication::run()
           lightInt = lightColor * lightIntensityFactor;
         }
       }
+      if (!punctualLights.empty()) {
+        ImGui::Text("Punctual lights: %d", int(punctualLights.size()));
+        if (m_glslProgram_rendered == &m_glslProgram_clustered) {
+          ImGui::Text("Light clustering: %.3f ms, max %u lights per cluster",
+              lightClusteringMilliseconds, lightClusters.maxLightsPerCluster);
+        }
+      }
+      if (animator.animationCount() > 0 &&
+          ImGui::CollapsingHeader(
+              "Animation", ImGuiTreeNodeFlags_DefaultOpen)) {
+        const auto current = animator.animation();
+        if (ImGui::BeginCombo(
+                "animation", animator.animationName(current).c_str())) {
+          for (size_t i = 0; i < animator.animationCount(); ++i) {
+            if (ImGui::Selectable(animator.animationName(int(i)).c_str(),
+                    int(i) == current)) {
+              animator.setAnimation(int(i));
+              animate();
+              shadowNeedUpdate = true;
+            }
+          }
+          ImGui::EndCombo();
+        }
+        ImGui::Checkbox("play", &playAnimations);
+        ImGui::SliderFloat("speed", &animationSpeed, 0.f, 4.f);
+        ImGui::Text("Animation: %.3f ms, %d channels, %d joints",
+            animationMilliseconds, int(animator.channelCount()),
+            int(animator.jointMatrices().size()));
+        if (morphTargetEvaluator.morphedDrawCount() > 0) {
+          ImGui::Text("Morph targets: %d blended, %d deltas",
+              int(morphTargetEvaluator.blendedTargetCount()),
+              int(morphTargetEvaluator.blendedDeltaCount()));
+        }
+        if (!staticScene) {
+          ImGui::Text("Culling is disabled for animated scenes");
+        }
+      }
       ImGui::Checkbox("light from camera", &lightFromCamera);
       ImGui::Checkbox("apply occlusion", &applyOcclusion);
       ImGui::Checkbox("apply normal map", &applyNormalTexture);
+      if (hasIBL) {
+        ImGui::Checkbox("image based lighting", &applyIBL);
+        ImGui::SliderFloat("IBL intensity", &iblIntensity, 0.f, 4.f);
+      }
       if (ImGui::CollapsingHeader("Shadow Option")) {
         if(ImGui::SliderInt("Shadow Resolution", &SHADOW_RES, 128, 4096*3)){
           glDeleteFramebuffers(1,&m_depthMapFBO);
@@ -549,7 +1505,11 @@ int ViewerApplication::run()
         }
       }
       if (ImGui::CollapsingHeader("Render Type")) {
-        static int renderType = 0;
+        static int renderType =
+            m_deferred ? 7
+                       : (m_glslProgram_rendered == &m_glslProgram_clustered
+                                 ? 8
+                                 : 0);
         auto renderTypeChanged =
             ImGui::RadioButton("Full Render", &renderType, 0) ||
             ImGui::RadioButton("Normal render", &renderType, 1) ||
@@ -557,44 +1517,86 @@ int ViewerApplication::run()
             ImGui::RadioButton("Shadow Map Render", &renderType, 3) ||
             ImGui::RadioButton("Tangent Render", &renderType, 4) ||
             ImGui::RadioButton("Bitangent Render", &renderType, 5) ||
-            ImGui::RadioButton("Normal Texture Render", &renderType, 6);
+            ImGui::RadioButton("Normal Texture Render", &renderType, 6) ||
+            ImGui::RadioButton("Deferred Render", &renderType, 7) ||
+            ImGui::RadioButton("Clustered Lights Render", &renderType, 8);
         if (renderTypeChanged) {
+          m_deferred = renderType == 7;
           if (renderType == 0) {
             m_glslProgram_rendered = &m_glslProgram_fullRender;
-            m_glslProgram_rendered->use();
             renderShadow = true;
 
           } else if (renderType == 1) {
             m_glslProgram_rendered = &m_glslProgram_normalRender;
-            m_glslProgram_rendered->use();
             renderShadow = false;
 
           } else if (renderType == 2) {
             m_glslProgram_rendered = &m_glslProgram_noShadow;
-            m_glslProgram_rendered->use();
             renderShadow = false;
 
           }
           else if (renderType == 3) {
             m_glslProgram_rendered = &m_glslProgram_debugShadowMap;
-            m_glslProgram_rendered->use();
             renderShadow = true;
           }
           else if (renderType == 4) {
                 m_glslProgram_rendered = &m_glslProgram_tangent;
-                m_glslProgram_rendered->use();
                 renderShadow = false;
           }
           else if (renderType == 5) {
                 m_glslProgram_rendered = &m_glslProgram_bitangent;
-                m_glslProgram_rendered->use();
                 renderShadow = false;
           }
           else if (renderType == 6) {
                 m_glslProgram_rendered = &m_glslProgram_normalTexture;
-                m_glslProgram_rendered->use();
                 renderShadow = false;
           }
+          else if (renderType == 7) {
+                m_glslProgram_rendered = &m_glslProgram_gBuffer;
+                renderShadow = true;
+          }
+          else if (renderType == 8) {
+                m_glslProgram_rendered = &m_glslProgram_clustered;
+                renderShadow = true;
+          }
+        }
+        ImGui::Checkbox("Depth pre-pass", &m_depthPrepass);
+        if (HiZCuller::isSupported()) {
+          ImGui::Checkbox("GPU occlusion culling", &m_gpuCulling);
+        }
+        if (m_gpuCulling) {
+          ImGui::Text("GPU occlusion culling: %.3f ms",
+              hiZCullingTimer.lastMilliseconds());
+        } else {
+          ImGui::Checkbox("Occlusion culling", &m_occlusionCulling);
+        }
+        if (!pvs.cells.empty()) {
+          ImGui::Checkbox("PVS culling", &m_pvsCulling);
+        }
+        if (cameraCulling() == DrawCulling::CPU || m_pvsCulling) {
+          ImGui::Text("CPU culling: %.3f ms, %d / %d primitives drawn",
+              occlusionCullingMilliseconds, int(visiblePrimitiveCount),
+              int(primitiveCount));
+        }
+        if (m_pvsCulling) {
+          ImGui::Text("PVS cell: %d", pvsCell);
+        }
+        if (MeshletCuller::isSupported()) {
+          ImGui::Checkbox("Meshlet culling", &m_meshletCulling);
+        }
+        if (m_meshletCulling) {
+          ImGui::Text("Meshlet culling: %.3f ms, %d meshlets",
+              meshletCullingTimer.lastMilliseconds(),
+              int(meshletCuller.meshletCount()));
+        }
+        if (m_depthPrepass) {
+          ImGui::Text("Depth pre-pass: %.3f ms",
+              depthPrepassTimer.lastMilliseconds());
+        }
+        ImGui::Text(m_deferred ? "Geometry pass: %.3f ms" : "Shading pass: %.3f ms",
+            shadingTimer.lastMilliseconds());
+        if (m_deferred) {
+          ImGui::Text("Lighting pass: %.3f ms", lightingTimer.lastMilliseconds());
         }
       }
 
@@ -605,7 +1607,7 @@ int ViewerApplication::run()
 
     glfwPollEvents(); // Poll for and process events
 
-    auto ellapsedTime = glfwGetTime() - seconds;
+    auto ellapsedTime = getSeconds() - seconds;
     auto guiHasFocus =
         ImGui::GetIO().WantCaptureMouse || ImGui::GetIO().WantCaptureKeyboard;
     if (!guiHasFocus) {
@@ -615,19 +1617,134 @@ int ViewerApplication::run()
     m_GLFWHandle.swapBuffers(); // Swap front and back buffers
   }
 
-  glDeleteVertexArrays((GLsizei)vertexArrayObjects.size(), vertexArrayObjects.data());
-  glDeleteBuffers((GLsizei)v_bufferObjects.size(), v_bufferObjects.data());
-  glDeleteTextures((GLsizei)textureObjects.size(), textureObjects.data());
-  glDeleteFramebuffers(1, &m_depthMapFBO);
-  glDeleteTextures(1, &m_depthMap);
+  releaseSceneObjects();
 
   return 0;
 }
 
+int ViewerApplication::serve(
+    const std::string &socketPath, size_t cpuBudget, size_t gpuBudget)
+{
+  m_modelCache.setBudgets(cpuBudget, gpuBudget);
+  // Settings of the requests that do not set them
+  BatchView defaults;
+  defaults.width = m_nWindowWidth;
+  defaults.height = m_nWindowHeight;
+  defaults.lightTheta = lightTheta;
+  defaults.lightPhi = lightPhi;
+  RenderServer server;
+  if (!server.listen(socketPath, defaults)) {
+    return -1;
+  }
+  m_server = &server;
+  m_hasPendingRequest = server.readRequest(m_pendingRequest);
+  while (m_hasPendingRequest) {
+    m_gltfFilePath = m_pendingRequest.model;
+    if (run() != 0) {
+      server.sendError("Unable to load " + m_gltfFilePath.string());
+      m_hasPendingRequest = server.readRequest(m_pendingRequest);
+    }
+  }
+  m_server = nullptr;
+  m_modelCache.clear();
+  return 0;
+}
+
+void ViewerApplication::loadPrograms()
+{
+  // Loader shaders, variants are compiled once the model is loaded and only
+  // when a program is used
+  m_glslProgram_shadowMap =
+      GLProgramPermutations({m_ShadersRootPath / "simpleDepthShader.vs.glsl",
+                                m_ShadersRootPath / "simpleDepthShader.fs.glsl"},
+          SHADER_FEATURE_SKINNING, &m_programCache);
+  m_glslProgram_fullRender = GLProgramPermutations(
+      {m_ShadersRootPath / "shadowMapShader.vs.glsl",
+          m_ShadersRootPath / "pbr_directional_light_shadows.fs.glsl"},
+      SHADER_FEATURE_ALL, &m_programCache);
+
+  m_glslProgram_normalRender =
+      GLProgramPermutations({m_ShadersRootPath / "forward.vs.glsl",
+                                m_ShadersRootPath / "normals.fs.glsl"},
+          SHADER_FEATURE_SKINNING, &m_programCache);
+
+  m_glslProgram_noShadow = GLProgramPermutations(
+      {m_ShadersRootPath / "shadowMapShader.vs.glsl",
+          m_ShadersRootPath / "pbr_directional_light.fs.glsl"},
+      SHADER_FEATURE_ALL, &m_programCache);
+
+  m_glslProgram_debugShadowMap =
+      GLProgramPermutations({m_ShadersRootPath / "shadowMapShader.vs.glsl",
+                                m_ShadersRootPath / "debug.fs.glsl"},
+          SHADER_FEATURE_SKINNING, &m_programCache);
+
+  m_glslProgram_tangent =
+      GLProgramPermutations({m_ShadersRootPath / "forward.vs.glsl",
+                                m_ShadersRootPath / "tangent.fs.glsl"},
+          SHADER_FEATURE_TANGENTS | SHADER_FEATURE_SKINNING, &m_programCache);
+
+  m_glslProgram_bitangent =
+      GLProgramPermutations({m_ShadersRootPath / "forward.vs.glsl",
+                                m_ShadersRootPath / "bitangent.fs.glsl"},
+          SHADER_FEATURE_TANGENTS | SHADER_FEATURE_SKINNING, &m_programCache);
+
+  m_glslProgram_normalTexture =
+      GLProgramPermutations({m_ShadersRootPath / "forward.vs.glsl",
+                                m_ShadersRootPath / "normals_texture.fs.glsl"},
+          SHADER_FEATURE_SKINNING, &m_programCache);
+
+  m_glslProgram_depthPrepass =
+      GLProgramPermutations({m_ShadersRootPath / "depthPrepass.vs.glsl",
+                                m_ShadersRootPath / "simpleDepthShader.fs.glsl"},
+          SHADER_FEATURE_SKINNING, &m_programCache);
+
+  m_glslProgram_gBuffer =
+      GLProgramPermutations({m_ShadersRootPath / "forward.vs.glsl",
+                                m_ShadersRootPath / "gbuffer.fs.glsl"},
+          SHADER_FEATURE_ALL & ~SHADER_FEATURE_AOV, &m_programCache);
+
+  m_glslProgram_deferredLighting = GLProgramPermutations(
+      {m_ShadersRootPath / "fullscreen.vs.glsl",
+          m_ShadersRootPath / "pbr_directional_light_shadows_deferred.fs.glsl"},
+      SHADER_FEATURE_IBL, &m_programCache);
+
+  m_glslProgram_clustered = GLProgramPermutations(
+      {m_ShadersRootPath / "shadowMapShader.vs.glsl",
+          m_ShadersRootPath / "pbr_directional_light_shadows_clustered.fs.glsl"},
+      SHADER_FEATURE_ALL, &m_programCache);
+
+  m_glslProgram_hiZDepth =
+      GLProgramPermutations({m_ShadersRootPath / "hiz_depth.vs.glsl",
+                                m_ShadersRootPath / "simpleDepthShader.fs.glsl"},
+          0, &m_programCache);
+  m_glslProgram_hiZPyramid = GLProgramPermutations(
+      {m_ShadersRootPath / "hiz_pyramid.cs.glsl"}, 0, &m_programCache);
+  m_glslProgram_hiZCull = GLProgramPermutations(
+      {m_ShadersRootPath / "hiz_cull.cs.glsl"}, 0, &m_programCache);
+  if (m_gpuCulling && !HiZCuller::isSupported()) {
+    std::cerr << "GPU culling requires OpenGL 4.4, disabled" << std::endl;
+    m_gpuCulling = false;
+  }
+  m_glslProgram_meshletCull = GLProgramPermutations(
+      {m_ShadersRootPath / "meshlet_cull.cs.glsl"}, 0, &m_programCache);
+  if (m_meshletCulling && !MeshletCuller::isSupported()) {
+    std::cerr << "Meshlet culling requires OpenGL 4.3, disabled" << std::endl;
+    m_meshletCulling = false;
+  }
+  m_glslProgram_morphTargets = GLProgramPermutations(
+      {m_ShadersRootPath / "morph_targets.cs.glsl"}, 0, &m_programCache);
+}
+
 ViewerApplication::ViewerApplication(fs::path appPath, uint32_t width,
     uint32_t height, const fs::path &gltfFile,
     const std::vector<float> &lookatArgs, const std::string &vertexShader,
-    const std::string &fragmentShader, const fs::path &output) :
+    const std::string &fragmentShader, const fs::path &output,
+    bool depthPrepass, bool deferred, size_t randomLightCount,
+    const fs::path &environmentMap, bool occlusionCulling, bool gpuCulling,
+    bool meshletCulling, bool pvsCulling, bool bakePVS,
+    bool staticBatching, size_t animatedCopyCount,
+    const std::string &batchFile, const PngCompression &pngCompression,
+    uint32_t tileSize, bool headless, bool aovOutput) :
     m_nWindowWidth((GLsizei)width),
     m_nWindowHeight((GLsizei)height),
     m_AppPath{std::move(appPath)},
@@ -635,7 +1752,23 @@ ViewerApplication::ViewerApplication(fs::path appPath, uint32_t width,
     m_ImGuiIniFilename{m_AppName + ".imgui.ini"},
     m_ShadersRootPath{m_AppPath.parent_path() / "shaders"},
     m_gltfFilePath{gltfFile},
-    m_OutputPath{output}
+    m_depthPrepass{depthPrepass},
+    m_deferred{deferred},
+    m_randomLightCount{randomLightCount},
+    m_environmentMapPath{environmentMap},
+    m_occlusionCulling{occlusionCulling},
+    m_gpuCulling{gpuCulling},
+    m_meshletCulling{meshletCulling},
+    m_pvsCulling{pvsCulling},
+    m_bakePVS{bakePVS},
+    m_staticBatching{staticBatching},
+    m_animatedCopyCount{animatedCopyCount},
+    m_OutputPath{output},
+    m_batchFile{batchFile},
+    m_pngCompression{pngCompression},
+    m_tileSize{tileSize},
+    m_headless{headless},
+    m_aovOutput{aovOutput}
 {
   if (!lookatArgs.empty()) {
     m_hasUserCamera = true;
@@ -649,9 +1782,12 @@ ViewerApplication::ViewerApplication(fs::path appPath, uint32_t width,
       m_ImGuiIniFilename.c_str(); // At exit, ImGUI will store its windows
                                   // positions in this file
 
-  glfwSetKeyCallback(m_GLFWHandle.window(), keyCallback);
+  if (m_GLFWHandle.window()) {
+    glfwSetKeyCallback(m_GLFWHandle.window(), keyCallback);
+  }
 
   printGLVersion();
+  enableParallelShaderCompile();
 }
 
 bool ViewerApplication::loadGltfFile(tinygltf::Model &model)
@@ -740,6 +1876,41 @@ std::vector<GLuint> ViewerApplication::createBufferObjects(
   return bufferObjects;
 }
 
+// Joint and weight attributes of a skinned primitive, read from the glTF
+// buffers by both the shading and the depth VAOs
+static void setSkinningAttributes(const tinygltf::Model &model,
+    const tinygltf::Primitive &primitive,
+    const std::vector<GLuint> &bufferObjects)
+{
+  const auto joints = primitive.attributes.find("JOINTS_0");
+  const auto weights = primitive.attributes.find("WEIGHTS_0");
+  if (joints == end(primitive.attributes) ||
+      weights == end(primitive.attributes)) {
+    return;
+  }
+  {
+    const auto &accessor = model.accessors[(*joints).second];
+    const auto &bufferView = model.bufferViews[accessor.bufferView];
+    const auto byteOffset = accessor.byteOffset + bufferView.byteOffset;
+    glEnableVertexAttribArray(VERTEX_ATTRIB_JOINTS0_IDX);
+    glBindBuffer(GL_ARRAY_BUFFER, bufferObjects[bufferView.buffer]);
+    // Joint indices are integers, not converted to float
+    glVertexAttribIPointer(VERTEX_ATTRIB_JOINTS0_IDX, accessor.type,
+        accessor.componentType, GLsizei(bufferView.byteStride),
+        (const GLvoid *)byteOffset);
+  }
+  {
+    const auto &accessor = model.accessors[(*weights).second];
+    const auto &bufferView = model.bufferViews[accessor.bufferView];
+    const auto byteOffset = accessor.byteOffset + bufferView.byteOffset;
+    glEnableVertexAttribArray(VERTEX_ATTRIB_WEIGHTS0_IDX);
+    glBindBuffer(GL_ARRAY_BUFFER, bufferObjects[bufferView.buffer]);
+    glVertexAttribPointer(VERTEX_ATTRIB_WEIGHTS0_IDX, accessor.type,
+        accessor.componentType, GLboolean(accessor.normalized),
+        GLsizei(bufferView.byteStride), (const GLvoid *)byteOffset);
+  }
+}
+
 std::vector<GLuint> ViewerApplication::createVertexArrayObjects(
     const tinygltf::Model &model, const std::vector<GLuint> &bufferObjects,
     std::vector<VaoRange> &meshIndexToVaoRange)
@@ -881,6 +2052,7 @@ std::vector<GLuint> ViewerApplication::createVertexArrayObjects(
               (const GLvoid *)byteOffset);
         }
       }
+      setSkinningAttributes(model, primitive, bufferObjects);
       // Index array if defined
       if (primitive.indices >= 0) {
         const auto accessorIdx = primitive.indices;
@@ -904,6 +2076,205 @@ std::vector<GLuint> ViewerApplication::createVertexArrayObjects(
   return vertexArrayObjects;
 }
 
+std::vector<uint32_t> ViewerApplication::computePrimitiveShaderFeatures(
+    const tinygltf::Model &model)
+{
+  // Meshes of the nodes with a skin
+  std::vector<bool> skinnedMeshes(model.meshes.size(), false);
+  for (const auto &node : model.nodes) {
+    if (node.mesh >= 0 && node.skin >= 0) {
+      skinnedMeshes[node.mesh] = true;
+    }
+  }
+  std::vector<uint32_t> primitiveFeatures;
+  for (size_t meshIdx = 0; meshIdx < model.meshes.size(); ++meshIdx) {
+    for (const auto &primitive : model.meshes[meshIdx].primitives) {
+      uint32_t features = 0;
+      if (primitive.attributes.count("TANGENT")) {
+        features |= SHADER_FEATURE_TANGENTS;
+      }
+      if (skinnedMeshes[meshIdx] && primitive.attributes.count("JOINTS_0") &&
+          primitive.attributes.count("WEIGHTS_0")) {
+        features |= SHADER_FEATURE_SKINNING;
+      }
+      if (primitive.material >= 0) {
+        const auto &material = model.materials[primitive.material];
+        if (material.normalTexture.index >= 0) {
+          features |= SHADER_FEATURE_NORMAL_MAP;
+        }
+        if (material.occlusionTexture.index >= 0) {
+          features |= SHADER_FEATURE_OCCLUSION;
+        }
+      }
+      primitiveFeatures.push_back(features);
+    }
+  }
+  return primitiveFeatures;
+}
+
+std::vector<GLuint> ViewerApplication::createDepthVertexArrayObjects(
+    const tinygltf::Model &model, const std::vector<GLuint> &bufferObjects,
+    GLuint &positionBufferObject)
+{
+  // Byte offset of each primitive in the packed position buffer, -1 if its
+  // positions could not be packed and must be read from the glTF buffer
+  std::vector<std::ptrdiff_t> packedOffsets;
+  std::vector<glm::vec3> packedPositions;
+
+  for (const auto &mesh : model.meshes) {
+    for (const auto &primitive : mesh.primitives) {
+      const auto iterator = primitive.attributes.find("POSITION");
+      if (iterator == end(primitive.attributes)) {
+        packedOffsets.push_back(-1);
+        continue;
+      }
+      const auto &accessor = model.accessors[(*iterator).second];
+      if (accessor.type != TINYGLTF_TYPE_VEC3 ||
+          accessor.componentType != GL_FLOAT) {
+        packedOffsets.push_back(-1);
+        continue;
+      }
+      const auto &bufferView = model.bufferViews[accessor.bufferView];
+      const auto &buffer = model.buffers[bufferView.buffer];
+      const auto byteOffset = accessor.byteOffset + bufferView.byteOffset;
+      const auto byteStride =
+          bufferView.byteStride ? bufferView.byteStride : sizeof(glm::vec3);
+
+      packedOffsets.push_back(
+          std::ptrdiff_t(packedPositions.size() * sizeof(glm::vec3)));
+      for (size_t i = 0; i < accessor.count; ++i) {
+        packedPositions.push_back(*((const glm::vec3 *)&buffer
+                                        .data[byteOffset + byteStride * i]));
+      }
+    }
+  }
+
+  glGenBuffers(1, &positionBufferObject);
+  glBindBuffer(GL_ARRAY_BUFFER, positionBufferObject);
+  const auto positionBytes =
+      GLsizeiptr(packedPositions.size() * sizeof(glm::vec3));
+  // Never allocate an empty buffer
+  glBufferStorage(GL_ARRAY_BUFFER, std::max(positionBytes, GLsizeiptr(16)),
+      positionBytes ? packedPositions.data() : nullptr, 0);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+  std::vector<GLuint> vertexArrayObjects(packedOffsets.size(), 0);
+  glGenVertexArrays(GLsizei(vertexArrayObjects.size()),
+      vertexArrayObjects.data());
+
+  size_t vaoIdx = 0;
+  for (const auto &mesh : model.meshes) {
+    for (const auto &primitive : mesh.primitives) {
+      const auto packedOffset = packedOffsets[vaoIdx];
+      glBindVertexArray(vertexArrayObjects[vaoIdx++]);
+
+      if (packedOffset >= 0) {
+        glEnableVertexAttribArray(VERTEX_ATTRIB_POSITION_IDX);
+        glBindBuffer(GL_ARRAY_BUFFER, positionBufferObject);
+        glVertexAttribPointer(VERTEX_ATTRIB_POSITION_IDX, 3, GL_FLOAT,
+            GL_FALSE, 0, (const GLvoid *)packedOffset);
+      } else {
+        // Not a float vec3 accessor, fallback on the original buffer
+        const auto iterator = primitive.attributes.find("POSITION");
+        if (iterator != end(primitive.attributes)) {
+          const auto &accessor = model.accessors[(*iterator).second];
+          const auto &bufferView = model.bufferViews[accessor.bufferView];
+          const auto byteOffset = accessor.byteOffset + bufferView.byteOffset;
+
+          glEnableVertexAttribArray(VERTEX_ATTRIB_POSITION_IDX);
+          glBindBuffer(GL_ARRAY_BUFFER, bufferObjects[bufferView.buffer]);
+          glVertexAttribPointer(VERTEX_ATTRIB_POSITION_IDX, accessor.type,
+              accessor.componentType, GLboolean(accessor.normalized),
+              GLsizei(bufferView.byteStride), (const GLvoid *)byteOffset);
+        }
+      }
+
+      setSkinningAttributes(model, primitive, bufferObjects);
+
+      // Index buffer is shared with the shading VAO
+      if (primitive.indices >= 0) {
+        const auto &accessor = model.accessors[primitive.indices];
+        const auto &bufferView = model.bufferViews[accessor.bufferView];
+        glBindBuffer(
+            GL_ELEMENT_ARRAY_BUFFER, bufferObjects[bufferView.buffer]);
+      }
+    }
+  }
+  glBindVertexArray(0);
+  std::clog << "Number of depth VAOs: " << vertexArrayObjects.size() << " ("
+            << packedPositions.size() << " packed positions)" << std::endl;
+
+  return vertexArrayObjects;
+}
+
+void ViewerApplication::createMorphedVertexArrayObjects(
+    const tinygltf::Model &model, const std::vector<GLuint> &bufferObjects,
+    const std::vector<int> &meshIndices, const MorphTargetEvaluator &evaluator,
+    std::vector<GLuint> &vertexArrayObjects,
+    std::vector<GLuint> &depthVertexArrayObjects)
+{
+  using Vertex = MorphTargetEvaluator::Vertex;
+  const auto stride = GLsizei(sizeof(Vertex));
+  size_t drawIdx = 0;
+  for (const auto meshIdx : meshIndices) {
+    for (const auto &primitive : model.meshes[meshIdx].primitives) {
+      const auto vertexOffset = evaluator.vertexOffset(drawIdx++);
+      vertexArrayObjects.push_back(0);
+      depthVertexArrayObjects.push_back(0);
+      if (vertexOffset < 0) {
+        continue;
+      }
+      glGenVertexArrays(1, &vertexArrayObjects.back());
+      glGenVertexArrays(1, &depthVertexArrayObjects.back());
+
+      for (const auto vao :
+          {vertexArrayObjects.back(), depthVertexArrayObjects.back()}) {
+        const auto depthOnly = vao == depthVertexArrayObjects.back();
+        glBindVertexArray(vao);
+        glBindBuffer(GL_ARRAY_BUFFER, evaluator.vertexBuffer());
+        glEnableVertexAttribArray(VERTEX_ATTRIB_POSITION_IDX);
+        glVertexAttribPointer(VERTEX_ATTRIB_POSITION_IDX, 3, GL_FLOAT,
+            GL_FALSE, stride,
+            (const GLvoid *)(vertexOffset + offsetof(Vertex, position)));
+        if (!depthOnly) {
+          if (primitive.attributes.count("NORMAL")) {
+            glEnableVertexAttribArray(VERTEX_ATTRIB_NORMAL_IDX);
+            glVertexAttribPointer(VERTEX_ATTRIB_NORMAL_IDX, 3, GL_FLOAT,
+                GL_FALSE, stride,
+                (const GLvoid *)(vertexOffset + offsetof(Vertex, normal)));
+          }
+          if (primitive.attributes.count("TANGENT")) {
+            glEnableVertexAttribArray(VERTEX_ATTRIB_TANGENT_IDX);
+            glVertexAttribPointer(VERTEX_ATTRIB_TANGENT_IDX, 4, GL_FLOAT,
+                GL_FALSE, stride,
+                (const GLvoid *)(vertexOffset + offsetof(Vertex, tangent)));
+          }
+          const auto texCoords = primitive.attributes.find("TEXCOORD_0");
+          if (texCoords != end(primitive.attributes)) {
+            const auto &accessor = model.accessors[(*texCoords).second];
+            const auto &bufferView = model.bufferViews[accessor.bufferView];
+            const auto byteOffset =
+                accessor.byteOffset + bufferView.byteOffset;
+            glEnableVertexAttribArray(VERTEX_ATTRIB_TEXCOORD0_IDX);
+            glBindBuffer(GL_ARRAY_BUFFER, bufferObjects[bufferView.buffer]);
+            glVertexAttribPointer(VERTEX_ATTRIB_TEXCOORD0_IDX, accessor.type,
+                accessor.componentType, GLboolean(accessor.normalized),
+                GLsizei(bufferView.byteStride), (const GLvoid *)byteOffset);
+          }
+        }
+        setSkinningAttributes(model, primitive, bufferObjects);
+        if (primitive.indices >= 0) {
+          const auto &accessor = model.accessors[primitive.indices];
+          const auto &bufferView = model.bufferViews[accessor.bufferView];
+          glBindBuffer(
+              GL_ELEMENT_ARRAY_BUFFER, bufferObjects[bufferView.buffer]);
+        }
+      }
+    }
+  }
+  glBindVertexArray(0);
+}
+
 void ViewerApplication::createShadowMap()
 {
   glGenFramebuffers(1, &m_depthMapFBO);
@@ -925,4 +2296,187 @@ void ViewerApplication::createShadowMap()
   glDrawBuffer(GL_NONE);
   glReadBuffer(GL_NONE);
   glBindFramebuffer(GL_FRAMEBUFFER, 0);
-}
\ No newline at end of file
+}
+void ViewerApplication::createGBuffer()
+{
+  const GLenum formats[GBufferTextureCount] = {GL_RG16F, GL_SRGB8_ALPHA8,
+      GL_RGBA8, GL_R11F_G11F_B10F, GL_DEPTH_COMPONENT32F};
+
+  glGenFramebuffers(1, &m_gBufferFBO);
+  glGenTextures(GBufferTextureCount, m_gBufferTextures);
+  glBindFramebuffer(GL_FRAMEBUFFER, m_gBufferFBO);
+  for (GLint i = 0; i < GBufferTextureCount; ++i) {
+    glBindTexture(GL_TEXTURE_2D, m_gBufferTextures[i]);
+    glTexStorage2D(
+        GL_TEXTURE_2D, 1, formats[i], m_nWindowWidth, m_nWindowHeight);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glFramebufferTexture2D(GL_FRAMEBUFFER,
+        i == GDepth ? GL_DEPTH_ATTACHMENT : GL_COLOR_ATTACHMENT0 + i,
+        GL_TEXTURE_2D, m_gBufferTextures[i], 0);
+  }
+  glBindTexture(GL_TEXTURE_2D, 0);
+
+  const GLenum drawBuffers[GDepth] = {GL_COLOR_ATTACHMENT0,
+      GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2, GL_COLOR_ATTACHMENT3};
+  glDrawBuffers(GDepth, drawBuffers);
+
+  const auto status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+  if (status != GL_FRAMEBUFFER_COMPLETE) {
+    std::cerr << "G-buffer framebuffer is not complete: " << status
+              << std::endl;
+  }
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+bool ViewerApplication::createIBL()
+{
+  const auto start = std::chrono::steady_clock::now();
+
+  const auto cachePath = iblCachePath(
+      m_AppPath.parent_path() / "ibl_cache", m_environmentMapPath);
+  IBLData ibl;
+  const bool cached = loadIBLCache(cachePath, ibl);
+  // Workers for the CPU precomputations
+  ThreadPool threadPool(cached ? 1 : 0);
+
+  EnvironmentMap environment;
+  if (!cached) {
+    if (!loadEnvironmentMap(m_environmentMapPath, environment)) {
+      std::cerr << "Unable to load environment map " << m_environmentMapPath
+                << std::endl;
+      return false;
+    }
+    computeIrradianceSH(environment, ibl, threadPool);
+  }
+  std::copy(std::begin(ibl.shCoefficients), std::end(ibl.shCoefficients),
+      m_iblSHCoefficients);
+  m_iblSpecularMipCount = ibl.specularMipCount;
+
+  glGenTextures(1, &m_iblSpecularMap);
+  glBindTexture(GL_TEXTURE_CUBE_MAP, m_iblSpecularMap);
+  glTexStorage2D(GL_TEXTURE_CUBE_MAP, ibl.specularMipCount, GL_RGBA16F,
+      ibl.specularSize, ibl.specularSize);
+  glTexParameteri(
+      GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+  glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+
+  glGenTextures(1, &m_iblBRDFLut);
+  glBindTexture(GL_TEXTURE_2D, m_iblBRDFLut);
+  glTexStorage2D(GL_TEXTURE_2D, 1, GL_RG16F, ibl.brdfLutSize, ibl.brdfLutSize);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+  const auto uploadIBL = [&]() {
+    glBindTexture(GL_TEXTURE_CUBE_MAP, m_iblSpecularMap);
+    for (int32_t level = 0; level < ibl.specularMipCount; ++level) {
+      const auto size = std::max(ibl.specularSize >> level, 1);
+      const auto faceSize = size_t(size) * size * 4;
+      for (int face = 0; face < 6; ++face) {
+        glTexSubImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, level, 0, 0,
+            size, size, GL_RGBA, GL_HALF_FLOAT,
+            ibl.specularMips[level].data() + face * faceSize);
+      }
+    }
+    glBindTexture(GL_TEXTURE_2D, m_iblBRDFLut);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, ibl.brdfLutSize, ibl.brdfLutSize,
+        GL_RG, GL_HALF_FLOAT, ibl.brdfLut.data());
+  };
+
+  const char *method = "cache";
+  if (cached) {
+    uploadIBL();
+  } else if (GLAD_GL_VERSION_4_3) {
+    method = "compute shaders";
+
+    GLuint environmentTexture;
+    glGenTextures(1, &environmentTexture);
+    glBindTexture(GL_TEXTURE_2D, environmentTexture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, environment.width,
+        environment.height, 0, GL_RGB, GL_FLOAT, environment.pixels.data());
+    glGenerateMipmap(GL_TEXTURE_2D);
+    glTexParameteri(
+        GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    const auto prefilterProgram = m_programCache.compileProgram(
+        {m_ShadersRootPath / "ibl_prefilter.cs.glsl"});
+    prefilterProgram.use();
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, environmentTexture);
+    glUniform1i(prefilterProgram.getUniformLocation("uEnvironment"), 0);
+    glUniform1ui(prefilterProgram.getUniformLocation("uSampleCount"),
+        IBL_SPECULAR_SAMPLE_COUNT);
+    const auto uRoughness = prefilterProgram.getUniformLocation("uRoughness");
+    for (int32_t level = 0; level < ibl.specularMipCount; ++level) {
+      const auto size = std::max(ibl.specularSize >> level, 1);
+      glUniform1f(uRoughness,
+          ibl.specularMipCount > 1
+              ? float(level) / float(ibl.specularMipCount - 1)
+              : 0.f);
+      glBindImageTexture(0, m_iblSpecularMap, level, GL_TRUE, 0, GL_WRITE_ONLY,
+          GL_RGBA16F);
+      glDispatchCompute((size + 7) / 8, (size + 7) / 8, 6);
+    }
+
+    const auto brdfLutProgram = m_programCache.compileProgram(
+        {m_ShadersRootPath / "ibl_brdf_lut.cs.glsl"});
+    brdfLutProgram.use();
+    glUniform1ui(brdfLutProgram.getUniformLocation("uSampleCount"),
+        IBL_BRDF_LUT_SAMPLE_COUNT);
+    glBindImageTexture(
+        0, m_iblBRDFLut, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RG16F);
+    glDispatchCompute((ibl.brdfLutSize + 7) / 8, (ibl.brdfLutSize + 7) / 8, 1);
+
+    glMemoryBarrier(
+        GL_TEXTURE_FETCH_BARRIER_BIT | GL_TEXTURE_UPDATE_BARRIER_BIT);
+    glUseProgram(0);
+    glDeleteTextures(1, &environmentTexture);
+
+    // Read back the results to fill the disk cache
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    ibl.specularMips.resize(ibl.specularMipCount);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, m_iblSpecularMap);
+    for (int32_t level = 0; level < ibl.specularMipCount; ++level) {
+      const auto size = std::max(ibl.specularSize >> level, 1);
+      const auto faceSize = size_t(size) * size * 4;
+      ibl.specularMips[level].resize(6 * faceSize);
+      for (int face = 0; face < 6; ++face) {
+        glGetTexImage(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, level, GL_RGBA,
+            GL_HALF_FLOAT, ibl.specularMips[level].data() + face * faceSize);
+      }
+    }
+    ibl.brdfLut.resize(size_t(ibl.brdfLutSize) * ibl.brdfLutSize * 2);
+    glBindTexture(GL_TEXTURE_2D, m_iblBRDFLut);
+    glGetTexImage(
+        GL_TEXTURE_2D, 0, GL_RG, GL_HALF_FLOAT, ibl.brdfLut.data());
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+  } else {
+    method = "CPU";
+    prefilterSpecular(environment, ibl, threadPool);
+    computeBRDFLut(ibl, threadPool);
+    uploadIBL();
+  }
+  glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+  glBindTexture(GL_TEXTURE_2D, 0);
+
+  // Filter across cube faces, the prefiltered mips are small
+  glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
+
+  if (!cached) {
+    saveIBLCache(cachePath, ibl);
+  }
+
+  const auto end = std::chrono::steady_clock::now();
+  std::clog << "Image based lighting from " << method << ": "
+            << std::chrono::duration<double, std::milli>(end - start).count()
+            << " ms" << std::endl;
+  return true;
+}
@@ -4,6 +4,10 @@
 #include "utils/GLFWHandle.hpp"
 #include "utils/cameras.hpp"
 #include "utils/filesystem.hpp"
+#include "utils/model_cache.hpp"
+#include "utils/morph_targets.hpp"
+#include "utils/png_writer.hpp"
+#include "utils/render_server.hpp"
 #include "utils/shaders.hpp"
 
   static float lightTheta = 0.8f;
@@ -15,18 +19,26 @@ public:
   ViewerApplication(fs::path appPath, uint32_t width, uint32_t height,
       const fs::path &gltfFile, const std::vector<float> &lookatArgs,
       const std::string &vertexShader, const std::string &fragmentShader,
-      const fs::path &output);
+      const fs::path &output, bool depthPrepass = false,
+      bool deferred = false, size_t randomLightCount = 0,
+      const fs::path &environmentMap = "", bool occlusionCulling = false,
+      bool gpuCulling = false, bool meshletCulling = false,
+      bool pvsCulling = false, bool bakePVS = false,
+      bool staticBatching = false, size_t animatedCopyCount = 0,
+      const std::string &batchFile = "",
+      const PngCompression &pngCompression = {}, uint32_t tileSize = 4096,
+      bool headless = false, bool aovOutput = false);
 
   int run();
+  // Render the requests read from the Unix domain socket at socketPath, or
+  // from the standard input if empty, see utils/render_server.hpp. Requests
+  // for the same model are rendered from one load of it, programs are kept
+  // across models and models stay loaded within budgets of CPU and GPU
+  // memory, in bytes, 0 for no limit.
+  int serve(
+      const std::string &socketPath, size_t cpuBudget, size_t gpuBudget);
 
 private:
-  // A range of indices in a vector containing Vertex Array Objects
-  struct VaoRange
-  {
-    GLsizei begin; // Index of first element in vertexArrayObjects
-    GLsizei count; // Number of elements in range
-  };
-
   GLsizei m_nWindowWidth = 1280;
   GLsizei m_nWindowHeight = 720;
 
@@ -42,40 +54,144 @@ private:
   GLuint m_depthMapFBO;
   GLuint m_depthMap;
 
+  // Deferred shading G-buffer, see gbuffer.fs.glsl for the content of each
+  // texture
+  enum GBufferTextureType
+  {
+    GNormal = 0,
+    GBaseColor,
+    GMaterial,
+    GEmissive,
+    GDepth,
+    GBufferTextureCount
+  };
+  GLuint m_gBufferFBO;
+  GLuint m_gBufferTextures[GBufferTextureCount];
+
+  // Image based lighting, see utils/ibl.hpp
+  GLuint m_iblSpecularMap = 0;
+  GLuint m_iblBRDFLut = 0;
+  GLint m_iblSpecularMipCount = 0;
+  glm::vec3 m_iblSHCoefficients[9];
+
   glm::vec3 m_bboxMin, m_bboxMax;
 
-  int m_modelHasNormals = 1;
+  // Lay down depth with position-only VAOs before shading with GL_EQUAL
+  bool m_depthPrepass = false;
+  // Shade in a fullscreen pass reading the G-buffer instead of per fragment
+  bool m_deferred = false;
+  // Number of random point lights added to the scene, for benchmarking
+  size_t m_randomLightCount = 0;
+  // Equirectangular HDR image for image based lighting, none if empty
+  fs::path m_environmentMapPath;
+  // Skip primitives hidden behind occluders rasterized on the CPU, in the
+  // passes rendered from the camera
+  bool m_occlusionCulling = false;
+  // Same with two-pass hierarchical-Z culling on the GPU, takes precedence
+  // over m_occlusionCulling
+  bool m_gpuCulling = false;
+  // Only draw the visible meshlets of large primitives, combined with
+  // m_gpuCulling when both are enabled
+  bool m_meshletCulling = false;
+  // Skip the primitives outside of the potentially visible set of the cell of
+  // the camera, loaded from the sidecar file of the glTF file
+  bool m_pvsCulling = false;
+  // Bake the potentially visible sets to the sidecar file and exit
+  bool m_bakePVS = false;
+  // Merge the small primitives of static nodes in a few large draws
+  bool m_staticBatching = false;
+  // Copies of the animated nodes added to benchmark animation
+  size_t m_animatedCopyCount = 0;
   bool m_hasUserCamera = false;
   Camera m_userCamera;
 
   fs::path m_OutputPath;
+  // Views rendered from one load of the model, see utils/batch_views.hpp.
+  // "-" reads them from the standard input.
+  std::string m_batchFile;
+  // Compression of the image written to m_OutputPath
+  PngCompression m_pngCompression;
+  // Largest tile of the image written to m_OutputPath, also bounded by the
+  // limits of the OpenGL implementation
+  uint32_t m_tileSize = 4096;
+  // No window, for serve()
+  bool m_headless = false;
+  // Write the depth, normal and id AOVs next to the images of m_OutputPath
+  // and of the batch mode, see utils/image_sequence.hpp
+  bool m_aovOutput = false;
 
   // Order is important here, see comment below
   const std::string m_ImGuiIniFilename;
   // Last to be initialized, first to be destroyed:
   GLFWHandle m_GLFWHandle{int(m_nWindowWidth), int(m_nWindowHeight),
       "glTF Viewer",
-      m_OutputPath.empty()}; // show the window only if m_OutputPath is empty
-
-  GLProgram* m_glslProgram_shadowMapRendered;
-  GLProgram* m_glslProgram_rendered;
-  GLProgram m_glslProgram_shadowMap;
-  GLProgram m_glslProgram_fullRender;
-  GLProgram m_glslProgram_normalRender;
-  GLProgram m_glslProgram_noShadow;
-  GLProgram m_glslProgram_debugShadowMap;
-  GLProgram m_glslProgram_tangent;
-  GLProgram m_glslProgram_bitangent;
-  GLProgram m_glslProgram_normalTexture;
+      !m_headless && m_OutputPath.empty() &&
+          m_batchFile.empty()}; // show the window only if there is no output
+
+  GLProgramCache m_programCache{m_AppPath.parent_path() / "shader_cache"};
+  // Set by the first run(), the next ones of serve() reuse the programs
+  bool m_programsLoaded = false;
+
+  GLProgramPermutations *m_glslProgram_shadowMapRendered;
+  GLProgramPermutations *m_glslProgram_rendered;
+  GLProgramPermutations m_glslProgram_shadowMap;
+  GLProgramPermutations m_glslProgram_fullRender;
+  GLProgramPermutations m_glslProgram_normalRender;
+  GLProgramPermutations m_glslProgram_noShadow;
+  GLProgramPermutations m_glslProgram_debugShadowMap;
+  GLProgramPermutations m_glslProgram_tangent;
+  GLProgramPermutations m_glslProgram_bitangent;
+  GLProgramPermutations m_glslProgram_normalTexture;
+  GLProgramPermutations m_glslProgram_depthPrepass;
+  GLProgramPermutations m_glslProgram_gBuffer;
+  GLProgramPermutations m_glslProgram_deferredLighting;
+  GLProgramPermutations m_glslProgram_clustered;
+  // Hierarchical-Z culling, see utils/hiz_culling.hpp
+  GLProgramPermutations m_glslProgram_hiZDepth;
+  GLProgramPermutations m_glslProgram_hiZPyramid;
+  GLProgramPermutations m_glslProgram_hiZCull;
+  GLProgramPermutations m_glslProgram_meshletCull;
+  GLProgramPermutations m_glslProgram_morphTargets;
 
   glm::mat4 m_lightSpaceMatrix;
 
+  // Connection of serve(), null otherwise. run() renders the pending request
+  // and the next ones while they are for m_gltfFilePath, and returns with the
+  // first request for another model pending.
+  RenderServer *m_server = nullptr;
+  RenderRequest m_pendingRequest;
+  bool m_hasPendingRequest = false;
+  // Models kept loaded by serve(), destroyed before the OpenGL context
+  ModelCache m_modelCache;
+
+  void loadPrograms();
+
   bool loadGltfFile(tinygltf::Model & model);
   std::vector<GLuint> createTextureObjects(const tinygltf::Model &model);
   std::vector<GLuint> createBufferObjects(const tinygltf::Model &model);
   std::vector<GLuint> createVertexArrayObjects(const tinygltf::Model &model,
   const std::vector<GLuint> &bufferObjects,
   std::vector<VaoRange> &meshIndexToVaoRange);
+  // Shader features (see ShaderFeature) of each primitive, indexed like the
+  // VAOs returned by createVertexArrayObjects
+  std::vector<uint32_t> computePrimitiveShaderFeatures(
+      const tinygltf::Model &model);
+  // Position-only VAOs for depth passes, indexed like the ones returned by
+  // createVertexArrayObjects. Positions are copied in a tightly packed buffer
+  // stored in positionBufferObject.
+  std::vector<GLuint> createDepthVertexArrayObjects(
+      const tinygltf::Model &model, const std::vector<GLuint> &bufferObjects,
+      GLuint &positionBufferObject);
+  // Shading and depth VAOs of the primitives with morph targets of the mesh
+  // instances returned by flattenScene(), in drawing order, 0 for the others.
+  // Positions, normals and tangents are read from the vertices morphed by
+  // evaluator, the other attributes from bufferObjects.
+  void createMorphedVertexArrayObjects(const tinygltf::Model &model,
+      const std::vector<GLuint> &bufferObjects,
+      const std::vector<int> &meshIndices,
+      const MorphTargetEvaluator &evaluator,
+      std::vector<GLuint> &vertexArrayObjects,
+      std::vector<GLuint> &depthVertexArrayObjects);
   /*
     ! THE ORDER OF DECLARATION OF MEMBER VARIABLES IS IMPORTANT !
     - m_ImGuiIniFilename.c_str() will be used by ImGUI in ImGui::Shutdown, which
@@ -88,6 +204,9 @@ private:
     before most of OpenGL function calls.
   */
   void createShadowMap();
+  void createGBuffer();
+  // Load or precompute image based lighting from m_environmentMapPath
+  bool createIBL();
 };
 
 static const auto computeDirectionVectorUp = [](float phiRadians, float thetaRadians)
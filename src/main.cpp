@@ -1,6 +1,7 @@
 #include "ViewerApplication.hpp"
 #include "utils/GLFWHandle.hpp"
 #include "utils/filesystem.hpp"
+#include "utils/png_writer.hpp"
 
 #include <args.hxx>
 
@@ -43,6 +44,62 @@ int main(int argc, char **argv)
             "Output path to render the image. If specified no window is shown. "
             "Only png is supported.",
             {"o", "output"}};
+        args::Flag depthPrepass{parser, "depth-prepass",
+            "Render a depth pre-pass before the shading pass",
+            {"depth-prepass"}};
+        args::Flag deferred{parser, "deferred",
+            "Use the deferred shading pipeline", {"deferred"}};
+        args::ValueFlag<int32_t> randomLights{parser, "count",
+            "Add random point lights to the scene, to benchmark clustered "
+            "shading",
+            {"random-lights"}};
+        args::ValueFlag<std::string> environmentMap{parser, "hdr",
+            "Equirectangular HDR environment map for image based lighting",
+            {"env"}};
+        args::Flag occlusionCulling{parser, "occlusion-culling",
+            "Cull primitives hidden behind large occluders, rasterized on "
+            "the CPU",
+            {"occlusion-culling"}};
+        args::Flag gpuCulling{parser, "gpu-culling",
+            "Cull hidden primitives on the GPU with a depth pyramid, requires "
+            "OpenGL 4.4",
+            {"gpu-culling"}};
+        args::Flag meshletCulling{parser, "meshlets",
+            "Split large primitives in meshlets culled on the GPU, requires "
+            "OpenGL 4.3",
+            {"meshlets"}};
+        args::Flag pvsCulling{parser, "pvs",
+            "Cull primitives with the potentially visible sets baked by "
+            "--bake-pvs",
+            {"pvs"}};
+        args::Flag bakePVS{parser, "bake-pvs",
+            "Bake the potentially visible sets of the scene next to the glTF "
+            "file and exit",
+            {"bake-pvs"}};
+        args::Flag staticBatching{parser, "static-batching",
+            "Merge the small primitives of static nodes in a few large draws",
+            {"static-batching"}};
+        args::ValueFlag<int32_t> crowd{parser, "count",
+            "Add copies of the animated nodes of the scene, to benchmark "
+            "animation",
+            {"crowd"}};
+        args::ValueFlag<std::string> batch{parser, "file",
+            "Render the views listed in file, - for the standard input, from "
+            "one load of the model",
+            {"batch"}};
+        args::ValueFlag<std::string> pngCompression{parser, "mode",
+            "Compression of the png written by -o and --batch: a level from 1 "
+            "(fastest) to 9 (smallest, default 6), rle or store",
+            {"png-compression"}};
+        args::ValueFlag<int32_t> tileSize{parser, "size",
+            "Largest tile rendered at once for the png written by -o, larger "
+            "images are rendered in tiles (default 4096)",
+            {"tile-size"}};
+        args::Flag aov{parser, "aov",
+            "Also write the linear depth and view space normals (exr) and the "
+            "node and material ids (16 bits png) of the images of -o and "
+            "--batch",
+            {"aov"}};
         parser.Parse();
 
         std::vector<float> lookatParams;
@@ -59,14 +116,109 @@ int main(int argc, char **argv)
           }
         }
 
+        PngCompression compression;
+        if (pngCompression &&
+            !parsePngCompression(args::get(pngCompression), compression)) {
+          throw args::ValidationError(
+              "Unable to parse --png-compression argument (expected 1 to 9, "
+              "rle or store)");
+        }
+
+        if (tileSize && args::get(tileSize) <= 0) {
+          throw args::ValidationError("--tile-size must be positive");
+        }
+
+        if (randomLights && args::get(randomLights) < 0) {
+          throw args::ValidationError("--random-lights must not be negative");
+        }
+
+        if (crowd && args::get(crowd) < 0) {
+          throw args::ValidationError("--crowd must not be negative");
+        }
+
+        if (aov && !output && !batch) {
+          throw args::ValidationError("--aov requires -o or --batch");
+        }
+
         uint32_t width = imageWidth ? args::get(imageWidth) : 1280;
         uint32_t height = imageHeight ? args::get(imageHeight) : 720;
 
         ViewerApplication app{fs::path{argv[0]}, width, height, args::get(file),
             lookatParams, args::get(vertexShader), args::get(fragmentShader),
-            args::get(output)};
+            args::get(output), args::get(depthPrepass), args::get(deferred),
+            size_t(randomLights ? args::get(randomLights) : 0),
+            args::get(environmentMap), args::get(occlusionCulling),
+            args::get(gpuCulling), args::get(meshletCulling),
+            args::get(pvsCulling), args::get(bakePVS),
+            args::get(staticBatching),
+            size_t(crowd ? args::get(crowd) : 0), args::get(batch),
+            compression, uint32_t(tileSize ? args::get(tileSize) : 4096),
+            false, args::get(aov)};
         returnCode = app.run();
       }};
+  args::Command serve{commands, "serve",
+      "Render the images requested by JSON lines from a socket or the "
+      "standard input, see utils/render_server.hpp",
+      [&](args::Subparser &parser) {
+        args::ValueFlag<std::string> socket{parser, "path",
+            "Unix domain socket to listen on, the standard input and output "
+            "are used otherwise",
+            {"socket"}};
+        args::ValueFlag<int32_t> imageWidth{
+            parser, "width", "Default width of the images", {"w", "width"}};
+        args::ValueFlag<int32_t> imageHeight{
+            parser, "height", "Default height of the images", {"h", "height"}};
+        args::Flag depthPrepass{parser, "depth-prepass",
+            "Render a depth pre-pass before the shading pass",
+            {"depth-prepass"}};
+        args::Flag deferred{parser, "deferred",
+            "Use the deferred shading pipeline", {"deferred"}};
+        args::ValueFlag<std::string> environmentMap{parser, "hdr",
+            "Equirectangular HDR environment map for image based lighting",
+            {"env"}};
+        args::ValueFlag<std::string> pngCompression{parser, "mode",
+            "Compression of the png images: a level from 1 (fastest) to 9 "
+            "(smallest, default 6), rle or store",
+            {"png-compression"}};
+        args::ValueFlag<int32_t> cpuBudget{parser, "MB",
+            "CPU memory of the models kept loaded, the least recently used "
+            "are released first (default 4096, 0 for no limit)",
+            {"cpu-budget"}};
+        args::ValueFlag<int32_t> gpuBudget{parser, "MB",
+            "GPU memory of the models kept loaded (default 2048, 0 for no "
+            "limit)",
+            {"gpu-budget"}};
+        parser.Parse();
+
+        PngCompression compression;
+        if (pngCompression &&
+            !parsePngCompression(args::get(pngCompression), compression)) {
+          throw args::ValidationError(
+              "Unable to parse --png-compression argument (expected 1 to 9, "
+              "rle or store)");
+        }
+        if ((imageWidth && args::get(imageWidth) <= 0) ||
+            (imageHeight && args::get(imageHeight) <= 0)) {
+          throw args::ValidationError("--width and --height must be positive");
+        }
+        if ((cpuBudget && args::get(cpuBudget) < 0) ||
+            (gpuBudget && args::get(gpuBudget) < 0)) {
+          throw args::ValidationError(
+              "--cpu-budget and --gpu-budget must not be negative");
+        }
+
+        uint32_t width = imageWidth ? args::get(imageWidth) : 1280;
+        uint32_t height = imageHeight ? args::get(imageHeight) : 720;
+
+        ViewerApplication app{fs::path{argv[0]}, width, height, "", {}, "",
+            "", "", args::get(depthPrepass), args::get(deferred), 0,
+            args::get(environmentMap), false, false, false, false, false,
+            false, 0, "", compression, 4096, true};
+        const size_t megabyte = 1024 * 1024;
+        returnCode = app.serve(args::get(socket),
+            size_t(cpuBudget ? args::get(cpuBudget) : 4096) * megabyte,
+            size_t(gpuBudget ? args::get(gpuBudget) : 2048) * megabyte);
+      }};
 
   try {
     parser.ParseCLI(argc, argv);
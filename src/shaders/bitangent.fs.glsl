@@ -28,15 +28,14 @@ vec3 computeTangent(vec3 position, vec3 normal, vec2 texCoord)
 void main()
 {
      vec3 N;
+#ifdef HAS_TANGENTS
+   N = normalize(vBitengants);
+#else
    //Compute tangent if nor precomputed
-      if((vTangents.x == 0.0 && vTangents.y == 0.0 && vTangents.z == 0.0) && (vBitengants.x == 0.0 && vBitengants.y == 0.0 && vBitengants.z == 0.0)){
-        vec3 T = computeTangent(vViewSpacePosition, vViewSpaceNormal, vTexCoords);
-        vec3 T_space = normalize(vec3(vModelMatrix * vec4(T,1.0)));
-        vec3 B = cross(vViewSpaceNormal, T_space) * -1.0;
-        N = normalize(B);
-      }
-      else{
-        N = normalize(vBitengants);
-      }
+   vec3 T = computeTangent(vViewSpacePosition, vViewSpaceNormal, vTexCoords);
+   vec3 T_space = normalize(vec3(vModelMatrix * vec4(T,1.0)));
+   vec3 B = cross(vViewSpaceNormal, T_space) * -1.0;
+   N = normalize(B);
+#endif
    fColor = N;
 }
\ No newline at end of file
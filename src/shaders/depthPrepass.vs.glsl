@@ -0,0 +1,52 @@
+#version 330 core
+
+// Depth pre-pass, drawn with position only VAOs, plus joints and weights for
+// skinned primitives.
+// gl_Position must be computed exactly like in the shading vertex shaders,
+// otherwise the GL_EQUAL depth test of the shading pass would reject fragments.
+
+layout(location = 0) in vec3 aPosition;
+
+uniform mat4 uModelViewProjMatrix;
+
+#ifdef HAS_SKINNING
+layout(location = 4) in uvec4 aJoints;
+layout(location = 5) in vec4 aWeights;
+
+// Joint matrices of the skinned instances, 4 texels each
+uniform samplerBuffer uJointMatrices;
+// Index of the first joint matrix of the instance, -1 if it is not skinned
+uniform int uJointOffset;
+
+mat4 jointMatrix(uint joint)
+{
+    int texel = 4 * (uJointOffset + int(joint));
+    return mat4(texelFetch(uJointMatrices, texel),
+        texelFetch(uJointMatrices, texel + 1),
+        texelFetch(uJointMatrices, texel + 2),
+        texelFetch(uJointMatrices, texel + 3));
+}
+
+mat4 skinMatrix()
+{
+    if (uJointOffset < 0) {
+        return mat4(1.);
+    }
+    return aWeights.x * jointMatrix(aJoints.x) +
+        aWeights.y * jointMatrix(aJoints.y) +
+        aWeights.z * jointMatrix(aJoints.z) +
+        aWeights.w * jointMatrix(aJoints.w);
+}
+#endif
+
+invariant gl_Position;
+
+void main()
+{
+#ifdef HAS_SKINNING
+    vec4 position = skinMatrix() * vec4(aPosition, 1.);
+#else
+    vec4 position = vec4(aPosition, 1.);
+#endif
+    gl_Position =  uModelViewProjMatrix * position;
+}
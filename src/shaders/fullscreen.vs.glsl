@@ -0,0 +1,13 @@
+#version 330 core
+
+// Fullscreen triangle generated from gl_VertexID, to be drawn with 3 vertices
+// and an empty VAO
+
+out vec2 vTexCoords;
+
+void main()
+{
+    vec2 position = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+    vTexCoords = position;
+    gl_Position = vec4(position * 2.0 - 1.0, 0.0, 1.0);
+}
@@ -0,0 +1,112 @@
+#version 330 core
+
+// Compile time features, see ShaderFeature in utils/shaders.hpp:
+// HAS_NORMAL_MAP, HAS_TANGENTS, HAS_OCCLUSION
+
+// Geometry pass of the deferred renderer: evaluate materials and store the
+// inputs of the BRDF in the G-buffer. Lighting is done by
+// pbr_directional_light_shadows_deferred.fs.glsl
+
+in vec3 vViewSpacePosition;
+in vec3 vViewSpaceNormal;
+in vec2 vTexCoords;
+in vec3 vTangents;
+in vec3 vBitengants;
+
+in mat4 vModelMatrix;
+
+uniform vec4 uBaseColorFactor;
+uniform float uMetallicFactor;
+uniform float uRoughnessFactor;
+uniform vec3 uEmissiveFactor;
+uniform float uOcclusionStrength;
+
+uniform sampler2D uBaseColorTexture;
+uniform sampler2D uMetallicRoughnessTexture;
+uniform sampler2D uEmissiveTexture;
+uniform sampler2D uOcclusionTexture;
+uniform sampler2D uNormalTexture;
+
+uniform float uNormalScale;
+
+layout(location = 0) out vec2 gNormal;    // Octahedron encoded view space normal
+layout(location = 1) out vec4 gBaseColor; // sRGB texture, written in linear
+layout(location = 2) out vec4 gMaterial;  // metallic, roughness, occlusion
+layout(location = 3) out vec3 gEmissive;
+
+const float GAMMA = 2.2;
+
+vec4 SRGBtoLINEAR(vec4 srgbIn)
+{
+  return vec4(pow(srgbIn.xyz, vec3(GAMMA)), srgbIn.w);
+}
+
+//stolen from here http://www.thetenthplanet.de/archives/1180
+vec3 computeTangent(vec3 position, vec3 normal, vec2 texCoord)
+{
+  vec3 dp1 = dFdx(position);
+  vec3 dp2 = dFdy(position);
+  vec2 duv1 = dFdx(texCoord);
+  vec2 duv2 = dFdy(texCoord);
+
+  // solve the linear system
+  vec3 dp2perp = cross( dp2, normal );
+  vec3 dp1perp = cross( normal, dp1 );
+  vec3 tangent = dp2perp * duv1.x + dp1perp * duv2.x;
+
+  return tangent;
+}
+
+// http://jcgt.org/published/0003/02/01/
+vec2 signNotZero(vec2 v)
+{
+  return vec2(v.x >= 0.0 ? 1.0 : -1.0, v.y >= 0.0 ? 1.0 : -1.0);
+}
+
+vec2 encodeNormal(vec3 n)
+{
+  vec2 p = n.xy * (1.0 / (abs(n.x) + abs(n.y) + abs(n.z)));
+  return (n.z <= 0.0) ? ((1.0 - abs(p.yx)) * signNotZero(p)) : p;
+}
+
+void main()
+{
+  vec3 N;
+
+#ifdef HAS_NORMAL_MAP
+#ifdef HAS_TANGENTS
+  mat3 TBN = mat3(vTangents, vBitengants, vViewSpaceNormal);
+#else
+  //Compute tangent if nor precomputed
+  vec3 T = computeTangent(vViewSpacePosition, vViewSpaceNormal, vTexCoords);
+  vec3 T_space = normalize(vec3(vModelMatrix * vec4(T,1.0)));
+  vec3 B = cross(vViewSpaceNormal, T_space) * -1.0;
+  mat3 TBN = mat3(T_space, B, vViewSpaceNormal);
+#endif
+  N = TBN * normalize((texture(uNormalTexture, vTexCoords).rgb * 2.0 - 1.0) * vec3(uNormalScale, uNormalScale, 1.0f));
+  N = normalize(N);
+#else
+  N = vViewSpaceNormal;
+  N = normalize(N);
+#endif
+
+  vec4 baseColorFromTexture =
+      SRGBtoLINEAR(texture(uBaseColorTexture, vTexCoords));
+  vec4 metallicRougnessFromTexture =
+      texture(uMetallicRoughnessTexture, vTexCoords);
+
+  // Occlusion is applied on the final color, store it already mixed with the
+  // strength: mix(color, color * ao, s) == color * mix(1, ao, s)
+  float occlusion = 1.0;
+#ifdef HAS_OCCLUSION
+  float ao = texture(uOcclusionTexture, vTexCoords).r;
+  occlusion = mix(1.0, ao, uOcclusionStrength);
+#endif
+
+  gNormal = encodeNormal(N);
+  gBaseColor = uBaseColorFactor * baseColorFromTexture;
+  gMaterial = vec4(uMetallicFactor * metallicRougnessFromTexture.b,
+      uRoughnessFactor * metallicRougnessFromTexture.g, occlusion, 1.0);
+  gEmissive = SRGBtoLINEAR(texture(uEmissiveTexture, vTexCoords)).rgb *
+              uEmissiveFactor;
+}
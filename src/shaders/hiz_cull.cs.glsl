@@ -0,0 +1,133 @@
+#version 430 core
+
+// Two-pass hierarchical-Z occlusion culling of the packed draw list.
+// Pass 0 tests every draw against the depth pyramid of the previous frame,
+// pass 1 re-tests the draws culled by pass 0 against the pyramid built from
+// the depth of the draws of pass 0, so that draws that become visible are not
+// missing for a frame.
+// Each pass writes its draw commands twice: all of them with an instance
+// count of 0 or 1, and only the visible ones compacted at the front of their
+// range, for glMultiDrawElementsIndirectCountARB. The instance count of the
+// per primitive command used by the shading passes is also updated.
+// Must match the layouts of utils/hiz_culling.hpp.
+
+layout(local_size_x = 64, local_size_y = 1, local_size_z = 1) in;
+
+struct DrawCommand
+{
+  uint count;
+  uint instanceCount;
+  uint firstIndex;
+  int baseVertex;
+  uint baseInstance;
+};
+
+struct DrawInfo
+{
+  vec3 bboxMin; // World space
+  uint shadingCommandIndex;
+  vec3 bboxMax;
+  uint padding;
+  DrawCommand command;
+};
+
+layout(std430, binding = 3) readonly buffer DrawInfos
+{
+  DrawInfo drawInfos[];
+};
+
+// [0, N): pass 0, [N, 2N): pass 1, [2N, 3N): pass 0 compacted,
+// [3N, 4N): pass 1 compacted
+layout(std430, binding = 4) buffer DrawCommands
+{
+  uint drawCounts[4]; // Compacted draw count of each pass
+  DrawCommand commands[];
+};
+
+layout(std430, binding = 5) buffer DrawVisibility
+{
+  uint visibility[];
+};
+
+layout(std430, binding = 6) buffer ShadingCommands
+{
+  DrawCommand shadingCommands[];
+};
+
+uniform mat4 uViewProjMatrix;
+uniform sampler2D uDepthPyramid;
+uniform uint uDrawCount;
+uniform uint uPass;
+
+bool isVisible(vec3 bboxMin, vec3 bboxMax)
+{
+  vec3 ndcMin = vec3(1e30);
+  vec3 ndcMax = vec3(-1e30);
+  int cornersBehindNearPlane = 0;
+  for (int i = 0; i < 8; ++i) {
+    vec3 corner =
+        mix(bboxMin, bboxMax, vec3(i & 1, (i >> 1) & 1, (i >> 2) & 1));
+    vec4 clip = uViewProjMatrix * vec4(corner, 1);
+    if (clip.w <= 0.0 || clip.z < -clip.w) {
+      ++cornersBehindNearPlane;
+      continue;
+    }
+    vec3 ndc = clip.xyz / clip.w;
+    ndcMin = min(ndcMin, ndc);
+    ndcMax = max(ndcMax, ndc);
+  }
+  // Crossing the near plane: the screen space bounds are unbounded
+  if (cornersBehindNearPlane > 0) {
+    return cornersBehindNearPlane < 8;
+  }
+  if (any(lessThan(ndcMax.xy, vec2(-1))) ||
+      any(greaterThan(ndcMin.xy, vec2(1))) || ndcMin.z > 1.0) {
+    return false;
+  }
+
+  // At this level the rectangle covers at most 2x2 texels
+  vec2 size = vec2(textureSize(uDepthPyramid, 0));
+  vec2 rectMin = clamp((ndcMin.xy * 0.5 + 0.5) * size, vec2(0), size - 1.0);
+  vec2 rectMax = clamp((ndcMax.xy * 0.5 + 0.5) * size, vec2(0), size - 1.0);
+  vec2 extent = rectMax - rectMin;
+  int level = int(ceil(log2(max(max(extent.x, extent.y), 1.0))));
+  level = min(level, textureQueryLevels(uDepthPyramid) - 1);
+  ivec2 texelMin = ivec2(rectMin) >> level;
+  ivec2 texelMax = ivec2(rectMax) >> level;
+
+  float maxDepth = max(
+      max(texelFetch(uDepthPyramid, texelMin, level).r,
+          texelFetch(uDepthPyramid, ivec2(texelMax.x, texelMin.y), level).r),
+      max(texelFetch(uDepthPyramid, ivec2(texelMin.x, texelMax.y), level).r,
+          texelFetch(uDepthPyramid, texelMax, level).r));
+  return ndcMin.z * 0.5 + 0.5 <= maxDepth;
+}
+
+void main()
+{
+  uint drawIdx = gl_GlobalInvocationID.x;
+  if (drawIdx >= uDrawCount) {
+    return;
+  }
+  DrawCommand command = drawInfos[drawIdx].command;
+
+  if (uPass == 1u && visibility[drawIdx] != 0u) {
+    // Already drawn by pass 0
+    command.instanceCount = 0u;
+    commands[uDrawCount + drawIdx] = command;
+    return;
+  }
+
+  bool visible =
+      isVisible(drawInfos[drawIdx].bboxMin, drawInfos[drawIdx].bboxMax);
+  visibility[drawIdx] = visible ? 1u : 0u;
+  shadingCommands[drawInfos[drawIdx].shadingCommandIndex].instanceCount =
+      visible ? 1u : 0u;
+
+  command.instanceCount = visible ? 1u : 0u;
+  commands[uPass * uDrawCount + drawIdx] = command;
+  if (visible) {
+    uint slot = atomicAdd(drawCounts[uPass], 1u);
+    commands[(2u + uPass) * uDrawCount + slot] = command;
+  }
+}
@@ -0,0 +1,15 @@
+#version 330 core
+
+// Depth of the packed draw list of hierarchical-Z culling, drawn with
+// glMultiDrawElementsIndirect. The model matrix is an instanced attribute
+// fetched at the baseInstance of each draw command.
+
+layout(location = 0) in vec3 aPosition;
+layout(location = 1) in mat4 aModelMatrix; // Locations 1 to 4
+
+uniform mat4 uViewProjMatrix;
+
+void main()
+{
+    gl_Position = uViewProjMatrix * aModelMatrix * vec4(aPosition, 1.);
+}
@@ -0,0 +1,36 @@
+#version 430 core
+
+// One level of the depth pyramid of hierarchical-Z culling: each texel is the
+// farthest depth of the texels of the input it covers. The first level has
+// the largest power of two size below the depth buffer, so its footprint can
+// be up to 3x3 depth texels; the next levels halve the size.
+
+layout(local_size_x = 8, local_size_y = 8, local_size_z = 1) in;
+
+layout(r32f, binding = 0) writeonly uniform image2D uOutput;
+
+uniform sampler2D uInput;
+uniform int uInputLevel;
+
+void main()
+{
+  ivec2 outputSize = imageSize(uOutput);
+  ivec2 texel = ivec2(gl_GlobalInvocationID.xy);
+  if (any(greaterThanEqual(texel, outputSize))) {
+    return;
+  }
+  ivec2 inputSize = textureSize(uInput, uInputLevel);
+  // Footprint of the texel in the input, rounded outwards
+  ivec2 first = (texel * inputSize) / outputSize;
+  ivec2 last =
+      min(((texel + 1) * inputSize + outputSize - 1) / outputSize, inputSize) -
+      1;
+
+  float depth = 0.0;
+  for (int y = first.y; y <= last.y; ++y) {
+    for (int x = first.x; x <= last.x; ++x) {
+      depth = max(depth, texelFetch(uInput, ivec2(x, y), uInputLevel).r);
+    }
+  }
+  imageStore(uOutput, texel, vec4(depth));
+}
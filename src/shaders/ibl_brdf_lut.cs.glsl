@@ -0,0 +1,73 @@
+#version 430 core
+
+// Environment BRDF of the split sum approximation: scale and bias of F_0 for
+// (NdotV, roughness).
+// Must match computeBRDFLut in utils/ibl.cpp, which is used when compute
+// shaders are not available.
+
+layout(local_size_x = 8, local_size_y = 8, local_size_z = 1) in;
+
+layout(rg16f, binding = 0) writeonly uniform image2D uOutput;
+
+uniform uint uSampleCount;
+
+const float M_PI = 3.141592653589793;
+
+vec2 hammersley(uint i, uint count)
+{
+  return vec2(float(i) / float(count),
+      float(bitfieldReverse(i)) * 2.3283064365386963e-10);
+}
+
+// Half vector distributed according to GGX around N
+vec3 importanceSampleGGX(vec2 xi, vec3 N, float alpha)
+{
+  float phi = 2.0 * M_PI * xi.x;
+  float cosTheta = sqrt((1.0 - xi.y) / (1.0 + (alpha * alpha - 1.0) * xi.y));
+  float sinTheta = sqrt(1.0 - cosTheta * cosTheta);
+
+  vec3 up = abs(N.z) < 0.999 ? vec3(0, 0, 1) : vec3(1, 0, 0);
+  vec3 T = normalize(cross(up, N));
+  vec3 B = cross(N, T);
+  return normalize(T * (sinTheta * cos(phi)) + B * (sinTheta * sin(phi)) +
+                   N * cosTheta);
+}
+
+void main()
+{
+  ivec2 size = imageSize(uOutput);
+  ivec2 texel = ivec2(gl_GlobalInvocationID.xy);
+  if (any(greaterThanEqual(texel, size))) {
+    return;
+  }
+
+  float NdotV = (float(texel.x) + 0.5) / float(size.x);
+  float roughness = (float(texel.y) + 0.5) / float(size.y);
+  float alpha = roughness * roughness;
+  // Geometry term of Schlick-GGX for IBL
+  float k = alpha / 2.0;
+  vec3 N = vec3(0, 0, 1);
+  vec3 V = vec3(sqrt(1.0 - NdotV * NdotV), 0, NdotV);
+
+  float scale = 0.0;
+  float bias = 0.0;
+  for (uint i = 0u; i < uSampleCount; ++i) {
+    vec3 H = importanceSampleGGX(hammersley(i, uSampleCount), N, alpha);
+    vec3 L = 2.0 * dot(V, H) * H - V;
+    float NdotL = max(L.z, 0.0);
+    if (NdotL <= 0.0) {
+      continue;
+    }
+    float NdotH = max(H.z, 0.0);
+    float VdotH = max(dot(V, H), 0.0);
+    float G = (NdotV / (NdotV * (1.0 - k) + k)) *
+              (NdotL / (NdotL * (1.0 - k) + k));
+    float GVis = G * VdotH / (NdotH * NdotV);
+    float Fc = pow(1.0 - VdotH, 5.0);
+    scale += (1.0 - Fc) * GVis;
+    bias += Fc * GVis;
+  }
+
+  imageStore(uOutput, texel,
+      vec4(scale / float(uSampleCount), bias / float(uSampleCount), 0, 0));
+}
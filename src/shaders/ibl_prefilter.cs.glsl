@@ -0,0 +1,113 @@
+#version 430 core
+
+// Prefilter an equirectangular environment with GGX into one mip level of the
+// specular cubemap of image based lighting.
+// Must match prefilterSpecular in utils/ibl.cpp, which is used when compute
+// shaders are not available.
+
+layout(local_size_x = 8, local_size_y = 8, local_size_z = 1) in;
+
+layout(rgba16f, binding = 0) writeonly uniform imageCube uOutput;
+
+uniform sampler2D uEnvironment; // Mipmapped
+uniform float uRoughness;
+uniform uint uSampleCount;
+
+const float M_PI = 3.141592653589793;
+
+// See the OpenGL specification "Cube Map Texture Selection"
+vec3 cubeMapDirection(int face, vec2 st)
+{
+  switch (face) {
+  case 0:
+    return vec3(1, -st.y, -st.x);
+  case 1:
+    return vec3(-1, -st.y, st.x);
+  case 2:
+    return vec3(st.x, 1, st.y);
+  case 3:
+    return vec3(st.x, -1, -st.y);
+  case 4:
+    return vec3(st.x, -st.y, 1);
+  default:
+    return vec3(-st.x, -st.y, -1);
+  }
+}
+
+vec2 equirectangularUV(vec3 direction)
+{
+  return vec2(atan(direction.z, direction.x) * 0.5 / M_PI + 0.5,
+      acos(clamp(direction.y, -1.0, 1.0)) / M_PI);
+}
+
+vec2 hammersley(uint i, uint count)
+{
+  return vec2(float(i) / float(count),
+      float(bitfieldReverse(i)) * 2.3283064365386963e-10);
+}
+
+// Half vector distributed according to GGX around N
+vec3 importanceSampleGGX(vec2 xi, vec3 N, float alpha)
+{
+  float phi = 2.0 * M_PI * xi.x;
+  float cosTheta = sqrt((1.0 - xi.y) / (1.0 + (alpha * alpha - 1.0) * xi.y));
+  float sinTheta = sqrt(1.0 - cosTheta * cosTheta);
+
+  vec3 up = abs(N.z) < 0.999 ? vec3(0, 0, 1) : vec3(1, 0, 0);
+  vec3 T = normalize(cross(up, N));
+  vec3 B = cross(N, T);
+  return normalize(T * (sinTheta * cos(phi)) + B * (sinTheta * sin(phi)) +
+                   N * cosTheta);
+}
+
+float distributionGGX(float NdotH, float alpha)
+{
+  float sqrAlpha = alpha * alpha;
+  float d = NdotH * NdotH * (sqrAlpha - 1.0) + 1.0;
+  return sqrAlpha / (M_PI * d * d);
+}
+
+void main()
+{
+  ivec2 size = imageSize(uOutput);
+  ivec3 texel = ivec3(gl_GlobalInvocationID);
+  if (any(greaterThanEqual(texel.xy, size))) {
+    return;
+  }
+
+  vec2 st = (vec2(texel.xy) + 0.5) / vec2(size) * 2.0 - 1.0;
+  vec3 N = normalize(cubeMapDirection(texel.z, st));
+
+  vec3 color = vec3(0);
+  if (uRoughness == 0.0) {
+    color = textureLod(uEnvironment, equirectangularUV(N), 0.0).rgb;
+  } else {
+    float alpha = uRoughness * uRoughness;
+    ivec2 environmentSize = textureSize(uEnvironment, 0);
+    float texelSolidAngle =
+        4.0 * M_PI / float(environmentSize.x * environmentSize.y);
+    float maxLod = floor(log2(float(max(environmentSize.x, environmentSize.y))));
+
+    // N = V = R assumption of the split sum
+    float weight = 0.0;
+    for (uint i = 0u; i < uSampleCount; ++i) {
+      vec3 H = importanceSampleGGX(hammersley(i, uSampleCount), N, alpha);
+      float NdotH = max(dot(N, H), 0.0);
+      vec3 L = 2.0 * dot(N, H) * H - N;
+      float NdotL = dot(N, L);
+      if (NdotL <= 0.0) {
+        continue;
+      }
+      // pdf = D * NdotH / (4 * VdotH) = D / 4 since V = N
+      float pdf = distributionGGX(NdotH, alpha) / 4.0;
+      float sampleSolidAngle = 1.0 / (float(uSampleCount) * pdf + 1e-4);
+      float lod = clamp(
+          0.5 * log2(sampleSolidAngle / texelSolidAngle) + 1.0, 0.0, maxLod);
+      color += textureLod(uEnvironment, equirectangularUV(L), lod).rgb * NdotL;
+      weight += NdotL;
+    }
+    color /= max(weight, 1e-4);
+  }
+
+  imageStore(uOutput, texel, vec4(color, 1.0));
+}
@@ -0,0 +1,153 @@
+#version 430 core
+
+// Meshlet culling: one work group per meshlet tests its bounding sphere
+// against the view frustum, its normal cone against the camera position and
+// optionally its bounds against the hierarchical-Z depth pyramid. The
+// triangles of the visible meshlets are appended to the index range of their
+// draw, whose indirect command count is incremented.
+// Must match the layouts of utils/meshlet_culling.hpp.
+
+layout(local_size_x = 64, local_size_y = 1, local_size_z = 1) in;
+
+struct DrawCommand
+{
+  uint count;
+  uint instanceCount;
+  uint firstIndex;
+  int baseVertex;
+  uint baseInstance;
+};
+
+struct Meshlet
+{
+  vec3 center; // World space bounding sphere
+  float radius;
+  vec3 coneAxis;
+  float coneCutoff;
+  uint firstIndex; // In meshletIndices
+  uint triangleCount;
+  uint drawIdx; // In commands
+  uint shadingCommandIndex; // In shadingCommands
+};
+
+layout(std430, binding = 3) readonly buffer Meshlets
+{
+  Meshlet meshlets[];
+};
+
+layout(std430, binding = 4) readonly buffer MeshletIndices
+{
+  uint meshletIndices[];
+};
+
+layout(std430, binding = 5) buffer DrawCommands
+{
+  DrawCommand commands[];
+};
+
+layout(std430, binding = 6) writeonly buffer VisibleIndices
+{
+  uint visibleIndices[];
+};
+
+// Per primitive commands written by hiz_cull.cs.glsl
+layout(std430, binding = 7) readonly buffer ShadingCommands
+{
+  DrawCommand shadingCommands[];
+};
+
+uniform vec4 uFrustumPlanes[6]; // World space, pointing inside
+uniform vec3 uCameraPosition;
+uniform mat4 uViewProjMatrix;
+uniform uint uMeshletCount;
+uniform bool uHiZCulling;
+uniform sampler2D uDepthPyramid;
+
+shared uint visibleOffset;
+shared uint visible;
+
+bool isOccluded(vec3 bboxMin, vec3 bboxMax)
+{
+  vec3 ndcMin = vec3(1e30);
+  vec3 ndcMax = vec3(-1e30);
+  for (int i = 0; i < 8; ++i) {
+    vec3 corner =
+        mix(bboxMin, bboxMax, vec3(i & 1, (i >> 1) & 1, (i >> 2) & 1));
+    vec4 clip = uViewProjMatrix * vec4(corner, 1);
+    // Crossing the near plane: the screen space bounds are unbounded
+    if (clip.w <= 0.0 || clip.z < -clip.w) {
+      return false;
+    }
+    vec3 ndc = clip.xyz / clip.w;
+    ndcMin = min(ndcMin, ndc);
+    ndcMax = max(ndcMax, ndc);
+  }
+
+  // At this level the rectangle covers at most 2x2 texels
+  vec2 size = vec2(textureSize(uDepthPyramid, 0));
+  vec2 rectMin = clamp((ndcMin.xy * 0.5 + 0.5) * size, vec2(0), size - 1.0);
+  vec2 rectMax = clamp((ndcMax.xy * 0.5 + 0.5) * size, vec2(0), size - 1.0);
+  vec2 extent = rectMax - rectMin;
+  int level = int(ceil(log2(max(max(extent.x, extent.y), 1.0))));
+  level = min(level, textureQueryLevels(uDepthPyramid) - 1);
+  ivec2 texelMin = ivec2(rectMin) >> level;
+  ivec2 texelMax = ivec2(rectMax) >> level;
+
+  float maxDepth = max(
+      max(texelFetch(uDepthPyramid, texelMin, level).r,
+          texelFetch(uDepthPyramid, ivec2(texelMax.x, texelMin.y), level).r),
+      max(texelFetch(uDepthPyramid, ivec2(texelMin.x, texelMax.y), level).r,
+          texelFetch(uDepthPyramid, texelMax, level).r));
+  return ndcMin.z * 0.5 + 0.5 > maxDepth;
+}
+
+bool isVisible(Meshlet meshlet)
+{
+  if (uHiZCulling &&
+      shadingCommands[meshlet.shadingCommandIndex].instanceCount == 0u) {
+    return false;
+  }
+  for (int i = 0; i < 6; ++i) {
+    if (dot(uFrustumPlanes[i].xyz, meshlet.center) + uFrustumPlanes[i].w <
+        -meshlet.radius) {
+      return false;
+    }
+  }
+  // Back facing from every point of the bounding sphere
+  vec3 view = meshlet.center - uCameraPosition;
+  if (dot(view, meshlet.coneAxis) >=
+      meshlet.coneCutoff * length(view) + meshlet.radius) {
+    return false;
+  }
+  return !uHiZCulling || !isOccluded(meshlet.center - meshlet.radius,
+                             meshlet.center + meshlet.radius);
+}
+
+void main()
+{
+  // Large meshlet counts are dispatched as 2D grids
+  uint meshletIdx =
+      gl_WorkGroupID.y * gl_NumWorkGroups.x + gl_WorkGroupID.x;
+  if (meshletIdx >= uMeshletCount) {
+    return;
+  }
+  Meshlet meshlet = meshlets[meshletIdx];
+  uint indexCount = 3u * meshlet.triangleCount;
+
+  if (gl_LocalInvocationIndex == 0u) {
+    visible = isVisible(meshlet) ? 1u : 0u;
+    if (visible != 0u) {
+      visibleOffset = atomicAdd(commands[meshlet.drawIdx].count, indexCount);
+    }
+  }
+  memoryBarrierShared();
+  barrier();
+  if (visible == 0u) {
+    return;
+  }
+
+  uint first = commands[meshlet.drawIdx].firstIndex + visibleOffset;
+  for (uint i = gl_LocalInvocationIndex; i < indexCount; i += 64u) {
+    visibleIndices[first + i] = meshletIndices[meshlet.firstIndex + i];
+  }
+}
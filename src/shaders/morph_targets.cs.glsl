@@ -0,0 +1,83 @@
+#version 430 core
+
+// Morph target evaluation: each thread adds the weighted delta of one vertex
+// of one target to the morphed vertices of a primitive instance. The jobs of
+// a dispatch blend targets of different primitive instances, so that no two
+// threads move the same vertex and no atomic is needed.
+// Must match the layouts of utils/morph_targets.hpp.
+
+layout(local_size_x = 64, local_size_y = 1, local_size_z = 1) in;
+
+struct MorphDelta
+{
+  vec3 position;
+  uint vertex; // In the primitive
+  vec4 normal;
+  vec4 tangent;
+};
+
+struct MorphJob
+{
+  uint firstDelta;
+  uint deltaCount;
+  uint firstVertex; // In vertices
+  uint firstThread; // In the dispatch
+  float weight;
+};
+
+struct MorphedVertex
+{
+  vec4 position;
+  vec4 normal;
+  vec4 tangent;
+};
+
+layout(std430, binding = 3) readonly buffer MorphDeltas
+{
+  MorphDelta deltas[];
+};
+
+layout(std430, binding = 4) readonly buffer MorphJobs
+{
+  MorphJob jobs[];
+};
+
+layout(std430, binding = 5) buffer MorphedVertices
+{
+  MorphedVertex vertices[];
+};
+
+// Jobs of the dispatch, sorted by firstThread
+uniform uint uFirstJob;
+uniform uint uJobCount;
+uniform uint uThreadCount;
+
+void main()
+{
+  const uint thread = (gl_WorkGroupID.y * gl_NumWorkGroups.x +
+                          gl_WorkGroupID.x) *
+                          gl_WorkGroupSize.x +
+                      gl_LocalInvocationIndex;
+  if (thread >= uThreadCount) {
+    return;
+  }
+
+  // Last job starting at or before the thread
+  uint first = 0;
+  uint last = uJobCount - 1;
+  while (first < last) {
+    const uint middle = (first + last + 1) / 2;
+    if (jobs[uFirstJob + middle].firstThread <= thread) {
+      first = middle;
+    } else {
+      last = middle - 1;
+    }
+  }
+  const MorphJob job = jobs[uFirstJob + first];
+  const MorphDelta delta = deltas[job.firstDelta + thread - job.firstThread];
+
+  const uint v = job.firstVertex + delta.vertex;
+  vertices[v].position.xyz += job.weight * delta.position;
+  vertices[v].normal.xyz += job.weight * delta.normal.xyz;
+  vertices[v].tangent.xyz += job.weight * delta.tangent.xyz;
+}
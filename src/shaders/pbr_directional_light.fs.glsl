@@ -1,5 +1,8 @@
 #version 330 core
 
+// Compile time features, see ShaderFeature in utils/shaders.hpp:
+// HAS_NORMAL_MAP, HAS_TANGENTS, HAS_OCCLUSION, HAS_IBL, HAS_AOV
+
 // A reference implementation can be found here:
 // https://github.com/KhronosGroup/glTF-Sample-Viewer/blob/master/src/shaders/metallic-roughness.frag
 // Here we implement a simpler version handling only one directional light and
@@ -27,7 +30,6 @@ uniform float uMetallicFactor;
 uniform float uRoughnessFactor;
 uniform vec3 uEmissiveFactor;
 uniform float uOcclusionStrength;
-uniform int uApplyNormalMapping;
 
 uniform sampler2D uBaseColorTexture;
 uniform sampler2D uMetallicRoughnessTexture;
@@ -36,12 +38,53 @@ uniform sampler2D uOcclusionTexture;
 uniform sampler2D uDirLightShadowMap;
 uniform sampler2D uNormalTexture;
 
-uniform int uApplyOcclusion;
-
 uniform float uNormalScale;
-uniform int uHasNormalMap;
 
-out vec3 fColor;
+#ifdef HAS_IBL
+// Image based lighting with the split sum approximation, see utils/ibl.hpp
+uniform mat4 uInvViewMatrix;
+uniform vec3 uSHCoefficients[9]; // World space irradiance divided by pi
+uniform samplerCube uSpecularMap; // Prefiltered radiance, world space
+uniform sampler2D uBRDFLut;
+uniform float uSpecularMaxLod;
+uniform float uIBLIntensity;
+
+vec3 computeImageBasedLighting(
+    vec3 N, vec3 V, vec3 c_diff, vec3 F_0, float roughness)
+{
+  vec3 n = mat3(uInvViewMatrix) * N;
+  vec3 irradiance = uSHCoefficients[0] * 0.282095 +
+                    uSHCoefficients[1] * (0.488603 * n.y) +
+                    uSHCoefficients[2] * (0.488603 * n.z) +
+                    uSHCoefficients[3] * (0.488603 * n.x) +
+                    uSHCoefficients[4] * (1.092548 * n.x * n.y) +
+                    uSHCoefficients[5] * (1.092548 * n.y * n.z) +
+                    uSHCoefficients[6] * (0.315392 * (3.0 * n.z * n.z - 1.0)) +
+                    uSHCoefficients[7] * (1.092548 * n.x * n.z) +
+                    uSHCoefficients[8] * (0.546274 * (n.x * n.x - n.y * n.y));
+
+  vec3 R = mat3(uInvViewMatrix) * reflect(-V, N);
+  vec3 specular =
+      textureLod(uSpecularMap, R, roughness * uSpecularMaxLod).rgb;
+  vec2 brdf = texture(uBRDFLut, vec2(clamp(dot(N, V), 0., 1.), roughness)).rg;
+
+  return (c_diff * max(irradiance, vec3(0.)) +
+             specular * (F_0 * brdf.x + brdf.y)) *
+         uIBLIntensity;
+}
+#endif
+
+layout(location = 0) out vec3 fColor;
+
+#ifdef HAS_AOV
+// Arbitrary output variables, see AovAttachment in utils/image_sequence.hpp
+uniform uint uNodeId; // Index + 1
+uniform uint uMaterialId; // Index + 1, 0 without material
+
+layout(location = 1) out float fLinearDepth;
+layout(location = 2) out vec3 fViewSpaceNormal;
+layout(location = 3) out uvec2 fIds;
+#endif
 
 // Constants
 const float GAMMA = 2.2;
@@ -90,27 +133,22 @@ void main()
 {
   vec3 N;
 
-  //If model has no normal map
-  if(uHasNormalMap == 0 || uApplyNormalMapping == 0){
-    N = vViewSpaceNormal;
-    N = normalize(N);
-  }
-  else{
-    //Compute tangent if nor precomputed
-    if((vTangents.x == 0.0 && vTangents.y == 0.0 && vTangents.z == 0.0) && (vBitengants.x == 0.0 && vBitengants.y == 0.0 && vBitengants.z == 0.0)){
-      vec3 T = computeTangent(vViewSpacePosition, vViewSpaceNormal, vTexCoords);
-      vec3 T_space = normalize(vec3(vModelMatrix * vec4(T,1.0)));
-      vec3 B = cross(vViewSpaceNormal, T_space) * -1.0;
-      mat3 TBN = mat3(T_space, B, vViewSpaceNormal);
-      N = TBN * normalize((texture(uNormalTexture, vTexCoords).rgb * 2.0 - 1.0) * vec3(uNormalScale, uNormalScale, 1.0f));
-      N = normalize(N);
-    }
-    else{
-      mat3 TBN = mat3(vTangents, vBitengants, vViewSpaceNormal);
-      N = TBN * normalize((texture(uNormalTexture, vTexCoords).rgb * 2.0 - 1.0) * vec3(uNormalScale, uNormalScale, 1.0f));
-      N = normalize(N);
-    }
-  }
+#ifdef HAS_NORMAL_MAP
+#ifdef HAS_TANGENTS
+  mat3 TBN = mat3(vTangents, vBitengants, vViewSpaceNormal);
+#else
+  //Compute tangent if nor precomputed
+  vec3 T = computeTangent(vViewSpacePosition, vViewSpaceNormal, vTexCoords);
+  vec3 T_space = normalize(vec3(vModelMatrix * vec4(T,1.0)));
+  vec3 B = cross(vViewSpaceNormal, T_space) * -1.0;
+  mat3 TBN = mat3(T_space, B, vViewSpaceNormal);
+#endif
+  N = TBN * normalize((texture(uNormalTexture, vTexCoords).rgb * 2.0 - 1.0) * vec3(uNormalScale, uNormalScale, 1.0f));
+  N = normalize(N);
+#else
+  N = vViewSpaceNormal;
+  N = normalize(N);
+#endif
 
   vec3 V = normalize(-vViewSpacePosition);
   vec3 L = uLightDirection;
@@ -165,12 +203,21 @@ void main()
                   uEmissiveFactor;
 
   vec3 color = (f_diffuse  + f_specular ) * uLightIntensity * NdotL;
+#ifdef HAS_IBL
+  color += computeImageBasedLighting(N, V, c_diff, F_0, roughness);
+#endif
   color += emissive;
 
-  if (1 == uApplyOcclusion) {
-    float ao = texture2D(uOcclusionTexture, vTexCoords).r;
-    color = mix(color, color * ao, uOcclusionStrength);
-  }
+#ifdef HAS_OCCLUSION
+  float ao = texture2D(uOcclusionTexture, vTexCoords).r;
+  color = mix(color, color * ao, uOcclusionStrength);
+#endif
 
   fColor = LINEARtoSRGB(color);
+
+#ifdef HAS_AOV
+  fLinearDepth = -vViewSpacePosition.z;
+  fViewSpaceNormal = N;
+  fIds = uvec2(uNodeId, uMaterialId);
+#endif
 }
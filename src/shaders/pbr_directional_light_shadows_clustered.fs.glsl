@@ -0,0 +1,363 @@
+#version 430 core
+
+// Compile time features, see ShaderFeature in utils/shaders.hpp:
+// HAS_NORMAL_MAP, HAS_TANGENTS, HAS_OCCLUSION, HAS_IBL, HAS_AOV
+
+// A reference implementation can be found here:
+// https://github.com/KhronosGroup/glTF-Sample-Viewer/blob/master/src/shaders/metallic-roughness.frag
+// Same as pbr_directional_light_shadows.fs.glsl with the addition of
+// KHR_lights_punctual lights, culled per cluster (see utils/lights.hpp)
+
+in vec3 vViewSpacePosition;
+in vec3 vViewSpaceNormal;
+in vec2 vTexCoords;
+in vec4 vFragPosLightSpace;
+in vec3 vFragPos;
+in vec3 vTangents;
+in vec3 vBitengants;
+
+in mat4 vModelMatrix;
+
+// Here we use vTexCoords but we should use vTexCoords1 or vTexCoords2 depending
+// on the material because glTF can handle two texture coordinates sets per
+// object see
+// https://github.com/KhronosGroup/glTF-Sample-Viewer/blob/master/src/shaders/textures.glsl
+// for a reference implementation
+
+uniform vec3 uLightDirection;
+uniform vec3 uLightIntensity;
+
+uniform vec4 uBaseColorFactor;
+uniform float uMetallicFactor;
+uniform float uRoughnessFactor;
+uniform vec3 uEmissiveFactor;
+uniform float uOcclusionStrength;
+
+uniform sampler2D uBaseColorTexture;
+uniform sampler2D uMetallicRoughnessTexture;
+uniform sampler2D uEmissiveTexture;
+uniform sampler2D uOcclusionTexture;
+uniform sampler2D uDirLightShadowMap;
+uniform sampler2D uNormalTexture;
+
+uniform float uNormalScale;
+
+// Clustered lights
+struct PunctualLight
+{
+  vec3 position; // View space
+  float range;
+  vec3 color;
+  int type;
+  vec3 direction; // View space
+  float innerConeCos;
+  float outerConeCos;
+};
+
+layout(std430, binding = 0) readonly buffer PunctualLights
+{
+  PunctualLight lights[];
+};
+layout(std430, binding = 1) readonly buffer LightClusters
+{
+  uvec2 clusters[]; // offset, count in clusterLightIndices
+};
+layout(std430, binding = 2) readonly buffer LightClusterIndices
+{
+  uint clusterLightIndices[];
+};
+
+uniform int uDirectionalLightCount; // Directional lights come first in lights
+uniform ivec3 uClusterGridSize;
+uniform vec2 uClusterTileSize;
+uniform vec2 uClusterSliceScaleBias;
+
+#ifdef HAS_IBL
+// Image based lighting with the split sum approximation, see utils/ibl.hpp
+uniform mat4 uInvViewMatrix;
+uniform vec3 uSHCoefficients[9]; // World space irradiance divided by pi
+uniform samplerCube uSpecularMap; // Prefiltered radiance, world space
+uniform sampler2D uBRDFLut;
+uniform float uSpecularMaxLod;
+uniform float uIBLIntensity;
+
+vec3 computeImageBasedLighting(
+    vec3 N, vec3 V, vec3 c_diff, vec3 F_0, float roughness)
+{
+  vec3 n = mat3(uInvViewMatrix) * N;
+  vec3 irradiance = uSHCoefficients[0] * 0.282095 +
+                    uSHCoefficients[1] * (0.488603 * n.y) +
+                    uSHCoefficients[2] * (0.488603 * n.z) +
+                    uSHCoefficients[3] * (0.488603 * n.x) +
+                    uSHCoefficients[4] * (1.092548 * n.x * n.y) +
+                    uSHCoefficients[5] * (1.092548 * n.y * n.z) +
+                    uSHCoefficients[6] * (0.315392 * (3.0 * n.z * n.z - 1.0)) +
+                    uSHCoefficients[7] * (1.092548 * n.x * n.z) +
+                    uSHCoefficients[8] * (0.546274 * (n.x * n.x - n.y * n.y));
+
+  vec3 R = mat3(uInvViewMatrix) * reflect(-V, N);
+  vec3 specular =
+      textureLod(uSpecularMap, R, roughness * uSpecularMaxLod).rgb;
+  vec2 brdf = texture(uBRDFLut, vec2(clamp(dot(N, V), 0., 1.), roughness)).rg;
+
+  return (c_diff * max(irradiance, vec3(0.)) +
+             specular * (F_0 * brdf.x + brdf.y)) *
+         uIBLIntensity;
+}
+#endif
+
+layout(location = 0) out vec3 fColor;
+
+#ifdef HAS_AOV
+// Arbitrary output variables, see AovAttachment in utils/image_sequence.hpp
+uniform uint uNodeId; // Index + 1
+uniform uint uMaterialId; // Index + 1, 0 without material
+
+layout(location = 1) out float fLinearDepth;
+layout(location = 2) out vec3 fViewSpaceNormal;
+layout(location = 3) out uvec2 fIds;
+#endif
+
+// Constants
+const float GAMMA = 2.2;
+const float INV_GAMMA = 1. / GAMMA;
+const float M_PI = 3.141592653589793;
+const float M_1_PI = 1.0 / M_PI;
+
+// We need some simple tone mapping functions
+// Basic gamma = 2.2 implementation
+// Stolen here:
+// https://github.com/KhronosGroup/glTF-Sample-Viewer/blob/master/src/shaders/tonemapping.glsl
+
+// linear to sRGB approximation
+// see http://chilliant.blogspot.com/2012/08/srgb-approximations-for-hlsl.html
+vec3 LINEARtoSRGB(vec3 color) { return pow(color, vec3(INV_GAMMA)); }
+
+// sRGB to linear approximation
+// see http://chilliant.blogspot.com/2012/08/srgb-approximations-for-hlsl.html
+vec4 SRGBtoLINEAR(vec4 srgbIn)
+{
+  return vec4(pow(srgbIn.xyz, vec3(GAMMA)), srgbIn.w);
+}
+
+//stolen from here http://www.thetenthplanet.de/archives/1180
+vec3 computeTangent(vec3 position, vec3 normal, vec2 texCoord)
+{
+  vec3 dp1 = dFdx(position);
+  vec3 dp2 = dFdy(position);
+  vec2 duv1 = dFdx(texCoord);
+  vec2 duv2 = dFdy(texCoord);
+
+  // solve the linear system
+  vec3 dp2perp = cross( dp2, normal );
+  vec3 dp1perp = cross( normal, dp1 );
+  vec3 tangent = dp2perp * duv1.x + dp1perp * duv2.x;
+
+  return tangent;
+}
+
+const int PUNCTUAL_LIGHT_DIRECTIONAL = 0;
+const int PUNCTUAL_LIGHT_SPOT = 2;
+
+// Evaluate BRDF * NdotL for light direction L
+vec3 evaluateBRDF(vec3 N, vec3 V, vec3 L, vec3 c_diff, vec3 F_0, float alpha)
+{
+  vec3 H = normalize(L + V);
+
+  float VdotH = clamp(dot(V, H), 0., 1.);
+  float baseShlickFactor = 1. - VdotH;
+  float shlickFactor = baseShlickFactor * baseShlickFactor; // power 2
+  shlickFactor *= shlickFactor;                             // power 4
+  shlickFactor *= baseShlickFactor;                         // power 5
+  vec3 F = F_0 + (vec3(1.) - F_0) * shlickFactor;
+
+  float sqrAlpha = alpha * alpha;
+  float NdotL = clamp(dot(N, L), 0., 1.);
+  float NdotV = clamp(dot(N, V), 0., 1.);
+  float visDenominator =
+      NdotL * sqrt(NdotV * NdotV * (1. - sqrAlpha) + sqrAlpha) +
+      NdotV * sqrt(NdotL * NdotL * (1. - sqrAlpha) + sqrAlpha);
+  float Vis = visDenominator > 0. ? 0.5 / visDenominator : 0.0;
+
+  float NdotH = clamp(dot(N, H), 0., 1.);
+  float baseDenomD = (NdotH * NdotH * (sqrAlpha - 1.) + 1.);
+  float D = M_1_PI * sqrAlpha / (baseDenomD * baseDenomD);
+
+  vec3 f_specular = F * Vis * D;
+  vec3 f_diffuse = (1. - F) * c_diff * M_1_PI;
+
+  return (f_diffuse + f_specular) * NdotL;
+}
+
+// https://github.com/KhronosGroup/glTF/tree/master/extensions/2.0/Khronos/KHR_lights_punctual#range-property
+vec3 evaluatePunctualLight(PunctualLight light, vec3 N, vec3 V, vec3 c_diff,
+    vec3 F_0, float alpha)
+{
+  if (light.type == PUNCTUAL_LIGHT_DIRECTIONAL) {
+    return evaluateBRDF(N, V, -light.direction, c_diff, F_0, alpha) *
+           light.color;
+  }
+  vec3 toLight = light.position - vViewSpacePosition;
+  float sqrDistance = dot(toLight, toLight);
+  float distanceOverRange = sqrt(sqrDistance) / light.range;
+  float sqrDistanceOverRange = distanceOverRange * distanceOverRange;
+  float attenuation =
+      clamp(1.0 - sqrDistanceOverRange * sqrDistanceOverRange, 0.0, 1.0) /
+      max(sqrDistance, 1e-8);
+  vec3 L = normalize(toLight);
+  if (light.type == PUNCTUAL_LIGHT_SPOT) {
+    float cd = dot(light.direction, -L);
+    float t = clamp((cd - light.outerConeCos) /
+                        max(light.innerConeCos - light.outerConeCos, 1e-4),
+        0.0, 1.0);
+    attenuation *= t * t;
+  }
+  if (attenuation <= 0.0) {
+    return vec3(0.0);
+  }
+  return evaluateBRDF(N, V, L, c_diff, F_0, alpha) * light.color * attenuation;
+}
+
+// The model is mathematically described here
+// https://github.com/KhronosGroup/glTF/blob/master/specification/2.0/README.md#appendix-b-brdf-implementation
+// We try to use the same or similar names for variables
+// One thing that is not descibed in the documentation is that the BRDF value
+// "f" must be multiplied by NdotL at the end.
+void main()
+{
+  vec3 N;
+
+#ifdef HAS_NORMAL_MAP
+#ifdef HAS_TANGENTS
+  mat3 TBN = mat3(vTangents, vBitengants, vViewSpaceNormal);
+#else
+  //Compute tangent if nor precomputed
+  vec3 T = computeTangent(vViewSpacePosition, vViewSpaceNormal, vTexCoords);
+  vec3 T_space = normalize(vec3(vModelMatrix * vec4(T,1.0)));
+  vec3 B = cross(vViewSpaceNormal, T_space) * -1.0;
+  mat3 TBN = mat3(T_space, B, vViewSpaceNormal);
+#endif
+  N = TBN * normalize((texture(uNormalTexture, vTexCoords).rgb * 2.0 - 1.0) * vec3(uNormalScale, uNormalScale, 1.0f));
+  N = normalize(N);
+#else
+  N = vViewSpaceNormal;
+  N = normalize(N);
+#endif
+
+  //vec3
+  vec3 V = normalize(-vViewSpacePosition);
+  vec3 L = uLightDirection;
+  vec3 H = normalize(L + V);
+
+  vec4 baseColorFromTexture =
+      SRGBtoLINEAR(texture(uBaseColorTexture, vTexCoords));
+  vec4 metallicRougnessFromTexture =
+      texture(uMetallicRoughnessTexture, vTexCoords);
+
+  vec4 baseColor = uBaseColorFactor * baseColorFromTexture;
+  vec3 metallic = vec3(uMetallicFactor * metallicRougnessFromTexture.b);
+  float roughness = uRoughnessFactor * metallicRougnessFromTexture.g;
+
+  // https://github.com/KhronosGroup/glTF/blob/master/specification/2.0/README.md#pbrmetallicroughnessmetallicroughnesstexture
+  // "The metallic-roughness texture.The metalness values are sampled from the B
+  // channel.The roughness values are sampled from the G channel."
+
+  vec3 dielectricSpecular = vec3(0.04);
+  vec3 black = vec3(0.);
+
+  vec3 c_diff =
+      mix(baseColor.rgb * (1. - dielectricSpecular.r), black, metallic);
+  vec3 F_0 = mix(vec3(dielectricSpecular), baseColor.rgb, metallic);
+  float alpha = roughness * roughness;
+
+  float VdotH = clamp(dot(V, H), 0., 1.);
+  float baseShlickFactor = 1. - VdotH;
+  float shlickFactor = baseShlickFactor * baseShlickFactor; // power 2
+  shlickFactor *= shlickFactor;                             // power 4
+  shlickFactor *= baseShlickFactor;                         // power 5
+  vec3 F = F_0 + (vec3(1.) - F_0) * shlickFactor;
+
+  float sqrAlpha = alpha * alpha;
+  float NdotL = clamp(dot(N, L), 0., 1.);
+  float NdotV = clamp(dot(N, V), 0., 1.);
+  float visDenominator =
+      NdotL * sqrt(NdotV * NdotV * (1. - sqrAlpha) + sqrAlpha) +
+      NdotV * sqrt(NdotL * NdotL * (1. - sqrAlpha) + sqrAlpha);
+  float Vis = visDenominator > 0. ? 0.5 / visDenominator : 0.0;
+
+  float NdotH = clamp(dot(N, H), 0., 1.);
+  float baseDenomD = (NdotH * NdotH * (sqrAlpha - 1.) + 1.);
+  float D = M_1_PI * sqrAlpha / (baseDenomD * baseDenomD);
+
+  vec3 f_specular = F * Vis * D;
+
+  vec3 diffuse = c_diff * M_1_PI;
+
+  vec3 f_diffuse = (1. - F) * diffuse;
+  vec3 emissive = SRGBtoLINEAR(texture(uEmissiveTexture, vTexCoords)).rgb *
+                  uEmissiveFactor;
+
+  float shadow = 0.0f;
+  vec3 lightCoords = vFragPosLightSpace.xyz / vFragPosLightSpace.w;
+  if(lightCoords.z <= 1.0f){
+    lightCoords = (lightCoords + 1.0f) / 2.0f;
+
+    float bias = 0.005f;
+    float currentDepth = lightCoords.z;
+
+    // Smoothens out the shadows
+    int radius = 2;
+    vec2 pixelSize = 1.0 / textureSize(uDirLightShadowMap, 0);
+    for(int y = -radius; y <= radius; y++)
+    {
+      for(int x = -radius; x <= radius; x++)
+      {
+        float closestDepth = texture(uDirLightShadowMap, lightCoords.xy + vec2(x, y) * pixelSize).r;
+        if (currentDepth > closestDepth + bias)
+        shadow += 0.79f;
+      }
+    }
+    // Get average shadow
+    shadow /= pow((radius * 2 + 1), 2);
+  }
+
+  vec3 color = (f_diffuse *(1.0f-shadow) + f_specular *(1.0f-shadow)) * uLightIntensity * NdotL;
+  color *= (1.0f-shadow);
+
+  for (int i = 0; i < uDirectionalLightCount; ++i) {
+    color += evaluatePunctualLight(lights[i], N, V, c_diff, F_0, alpha);
+  }
+
+  ivec3 clusterCoords = ivec3(ivec2(gl_FragCoord.xy / uClusterTileSize),
+      int(log(-vViewSpacePosition.z) * uClusterSliceScaleBias.x -
+          uClusterSliceScaleBias.y));
+  if (all(greaterThanEqual(clusterCoords, ivec3(0))) &&
+      all(lessThan(clusterCoords, uClusterGridSize))) {
+    uvec2 cluster = clusters[clusterCoords.x +
+                             uClusterGridSize.x * (clusterCoords.y +
+                                                      uClusterGridSize.y *
+                                                          clusterCoords.z)];
+    for (uint i = cluster.x; i < cluster.x + cluster.y; ++i) {
+      color += evaluatePunctualLight(
+          lights[clusterLightIndices[i]], N, V, c_diff, F_0, alpha);
+    }
+  }
+
+#ifdef HAS_IBL
+  color += computeImageBasedLighting(N, V, c_diff, F_0, roughness);
+#endif
+  color += emissive;
+
+#ifdef HAS_OCCLUSION
+  float ao = texture(uOcclusionTexture, vTexCoords).r;
+  color = mix(color, color * ao, uOcclusionStrength);
+#endif
+
+  fColor = LINEARtoSRGB(color);
+
+#ifdef HAS_AOV
+  fLinearDepth = -vViewSpacePosition.z;
+  fViewSpaceNormal = N;
+  fIds = uvec2(uNodeId, uMaterialId);
+#endif
+}
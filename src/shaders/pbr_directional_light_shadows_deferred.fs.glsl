@@ -0,0 +1,176 @@
+#version 330 core
+
+// Lighting pass of the deferred renderer, drawn as a fullscreen triangle.
+// Same BRDF and shadow lookup as pbr_directional_light_shadows.fs.glsl, but
+// material inputs are read from the G-buffer written by gbuffer.fs.glsl
+// Compile time features, see ShaderFeature in utils/shaders.hpp: HAS_IBL
+
+in vec2 vTexCoords;
+
+uniform vec3 uLightDirection;
+uniform vec3 uLightIntensity;
+
+uniform mat4 uInvProjectionMatrix;
+uniform mat4 uViewToLightSpaceMatrix;
+
+uniform sampler2D uGBufferNormal;
+uniform sampler2D uGBufferBaseColor;
+uniform sampler2D uGBufferMaterial;
+uniform sampler2D uGBufferEmissive;
+uniform sampler2D uGBufferDepth;
+uniform sampler2D uDirLightShadowMap;
+
+#ifdef HAS_IBL
+// Image based lighting with the split sum approximation, see utils/ibl.hpp
+uniform mat4 uInvViewMatrix;
+uniform vec3 uSHCoefficients[9]; // World space irradiance divided by pi
+uniform samplerCube uSpecularMap; // Prefiltered radiance, world space
+uniform sampler2D uBRDFLut;
+uniform float uSpecularMaxLod;
+uniform float uIBLIntensity;
+
+vec3 computeImageBasedLighting(
+    vec3 N, vec3 V, vec3 c_diff, vec3 F_0, float roughness)
+{
+  vec3 n = mat3(uInvViewMatrix) * N;
+  vec3 irradiance = uSHCoefficients[0] * 0.282095 +
+                    uSHCoefficients[1] * (0.488603 * n.y) +
+                    uSHCoefficients[2] * (0.488603 * n.z) +
+                    uSHCoefficients[3] * (0.488603 * n.x) +
+                    uSHCoefficients[4] * (1.092548 * n.x * n.y) +
+                    uSHCoefficients[5] * (1.092548 * n.y * n.z) +
+                    uSHCoefficients[6] * (0.315392 * (3.0 * n.z * n.z - 1.0)) +
+                    uSHCoefficients[7] * (1.092548 * n.x * n.z) +
+                    uSHCoefficients[8] * (0.546274 * (n.x * n.x - n.y * n.y));
+
+  vec3 R = mat3(uInvViewMatrix) * reflect(-V, N);
+  vec3 specular =
+      textureLod(uSpecularMap, R, roughness * uSpecularMaxLod).rgb;
+  vec2 brdf = texture(uBRDFLut, vec2(clamp(dot(N, V), 0., 1.), roughness)).rg;
+
+  return (c_diff * max(irradiance, vec3(0.)) +
+             specular * (F_0 * brdf.x + brdf.y)) *
+         uIBLIntensity;
+}
+#endif
+
+out vec3 fColor;
+
+// Constants
+const float GAMMA = 2.2;
+const float INV_GAMMA = 1. / GAMMA;
+const float M_PI = 3.141592653589793;
+const float M_1_PI = 1.0 / M_PI;
+
+// linear to sRGB approximation
+// see http://chilliant.blogspot.com/2012/08/srgb-approximations-for-hlsl.html
+vec3 LINEARtoSRGB(vec3 color) { return pow(color, vec3(INV_GAMMA)); }
+
+// http://jcgt.org/published/0003/02/01/
+vec2 signNotZero(vec2 v)
+{
+  return vec2(v.x >= 0.0 ? 1.0 : -1.0, v.y >= 0.0 ? 1.0 : -1.0);
+}
+
+vec3 decodeNormal(vec2 e)
+{
+  vec3 v = vec3(e.xy, 1.0 - abs(e.x) - abs(e.y));
+  if (v.z < 0.0) {
+    v.xy = (1.0 - abs(v.yx)) * signNotZero(v.xy);
+  }
+  return normalize(v);
+}
+
+void main()
+{
+  ivec2 texel = ivec2(gl_FragCoord.xy);
+  float depth = texelFetch(uGBufferDepth, texel, 0).r;
+  if (depth == 1.0) {
+    discard; // Background, keep the clear color
+  }
+
+  vec4 clipSpacePosition = vec4(vec3(vTexCoords, depth) * 2.0 - 1.0, 1.0);
+  vec4 viewSpacePosition = uInvProjectionMatrix * clipSpacePosition;
+  vec3 vViewSpacePosition = viewSpacePosition.xyz / viewSpacePosition.w;
+
+  vec3 N = decodeNormal(texelFetch(uGBufferNormal, texel, 0).rg);
+  vec3 V = normalize(-vViewSpacePosition);
+  vec3 L = uLightDirection;
+  vec3 H = normalize(L + V);
+
+  vec4 baseColor = texelFetch(uGBufferBaseColor, texel, 0);
+  vec4 material = texelFetch(uGBufferMaterial, texel, 0);
+  vec3 metallic = vec3(material.r);
+  float roughness = material.g;
+  float occlusion = material.b;
+
+  vec3 dielectricSpecular = vec3(0.04);
+  vec3 black = vec3(0.);
+
+  vec3 c_diff =
+      mix(baseColor.rgb * (1. - dielectricSpecular.r), black, metallic);
+  vec3 F_0 = mix(vec3(dielectricSpecular), baseColor.rgb, metallic);
+  float alpha = roughness * roughness;
+
+  float VdotH = clamp(dot(V, H), 0., 1.);
+  float baseShlickFactor = 1. - VdotH;
+  float shlickFactor = baseShlickFactor * baseShlickFactor; // power 2
+  shlickFactor *= shlickFactor;                             // power 4
+  shlickFactor *= baseShlickFactor;                         // power 5
+  vec3 F = F_0 + (vec3(1.) - F_0) * shlickFactor;
+
+  float sqrAlpha = alpha * alpha;
+  float NdotL = clamp(dot(N, L), 0., 1.);
+  float NdotV = clamp(dot(N, V), 0., 1.);
+  float visDenominator =
+      NdotL * sqrt(NdotV * NdotV * (1. - sqrAlpha) + sqrAlpha) +
+      NdotV * sqrt(NdotL * NdotL * (1. - sqrAlpha) + sqrAlpha);
+  float Vis = visDenominator > 0. ? 0.5 / visDenominator : 0.0;
+
+  float NdotH = clamp(dot(N, H), 0., 1.);
+  float baseDenomD = (NdotH * NdotH * (sqrAlpha - 1.) + 1.);
+  float D = M_1_PI * sqrAlpha / (baseDenomD * baseDenomD);
+
+  vec3 f_specular = F * Vis * D;
+
+  vec3 diffuse = c_diff * M_1_PI;
+
+  vec3 f_diffuse = (1. - F) * diffuse;
+  vec3 emissive = texelFetch(uGBufferEmissive, texel, 0).rgb;
+
+  float shadow = 0.0f;
+  vec4 vFragPosLightSpace =
+      uViewToLightSpaceMatrix * vec4(vViewSpacePosition, 1.0);
+  vec3 lightCoords = vFragPosLightSpace.xyz / vFragPosLightSpace.w;
+  if(lightCoords.z <= 1.0f){
+    lightCoords = (lightCoords + 1.0f) / 2.0f;
+
+    float bias = 0.005f;
+    float currentDepth = lightCoords.z;
+
+    // Smoothens out the shadows
+    int radius = 2;
+    vec2 pixelSize = 1.0 / textureSize(uDirLightShadowMap, 0);
+    for(int y = -radius; y <= radius; y++)
+    {
+      for(int x = -radius; x <= radius; x++)
+      {
+        float closestDepth = texture(uDirLightShadowMap, lightCoords.xy + vec2(x, y) * pixelSize).r;
+        if (currentDepth > closestDepth + bias)
+        shadow += 0.79f;
+      }
+    }
+    // Get average shadow
+    shadow /= pow((radius * 2 + 1), 2);
+  }
+
+  vec3 color = (f_diffuse *(1.0f-shadow) + f_specular *(1.0f-shadow)) * uLightIntensity * NdotL;
+  color *= (1.0f-shadow);
+#ifdef HAS_IBL
+  color += computeImageBasedLighting(N, V, c_diff, F_0, roughness);
+#endif
+  color += emissive;
+  color *= occlusion;
+
+  fColor = LINEARtoSRGB(color);
+}
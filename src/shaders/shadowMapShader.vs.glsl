@@ -15,38 +15,78 @@ out vec3 vBitengants;
 
 out mat4 vModelMatrix;
 
-uniform mat4 uViewMatrix;
 uniform mat4 uModelMatrix;
-uniform mat4 uProjectionMatrix;
+// Constant per draw, computed on the CPU
+uniform mat4 uModelViewMatrix;
+uniform mat4 uModelViewProjMatrix;
+uniform mat3 uNormalMatrix;
 uniform mat4 uLightSpaceMatrix;
 
 
+#ifdef HAS_SKINNING
+layout(location = 4) in uvec4 aJoints;
+layout(location = 5) in vec4 aWeights;
+
+// Joint matrices of the skinned instances, 4 texels each
+uniform samplerBuffer uJointMatrices;
+// Index of the first joint matrix of the instance, -1 if it is not skinned
+uniform int uJointOffset;
+
+mat4 jointMatrix(uint joint)
+{
+    int texel = 4 * (uJointOffset + int(joint));
+    return mat4(texelFetch(uJointMatrices, texel),
+        texelFetch(uJointMatrices, texel + 1),
+        texelFetch(uJointMatrices, texel + 2),
+        texelFetch(uJointMatrices, texel + 3));
+}
+
+mat4 skinMatrix()
+{
+    if (uJointOffset < 0) {
+        return mat4(1.);
+    }
+    return aWeights.x * jointMatrix(aJoints.x) +
+        aWeights.y * jointMatrix(aJoints.y) +
+        aWeights.z * jointMatrix(aJoints.z) +
+        aWeights.w * jointMatrix(aJoints.w);
+}
+#endif
+
+invariant gl_Position; // Must match depthPrepass.vs.glsl
+
 void main()
 {
-    mat4 vModelViewMatrix = uViewMatrix * uModelMatrix;
-    mat4 vModelViewProjMatrix = uProjectionMatrix * vModelViewMatrix;
-    mat4 vNormalMatrix = transpose(inverse(vModelViewMatrix));
-    vViewSpacePosition = vec3(vModelViewMatrix * vec4(aPosition, 1.));
-	vViewSpaceNormal = normalize(vec3(vNormalMatrix * vec4(aNormal, 0.)));
+#ifdef HAS_SKINNING
+    // Skinned instances are drawn with the identity as model matrix
+    mat4 skin = skinMatrix();
+    vec4 position = skin * vec4(aPosition, 1.);
+    vec3 normal = mat3(skin) * aNormal;
+    vec4 tangent = vec4(mat3(skin) * aTangent.xyz, aTangent.w);
+#else
+    vec4 position = vec4(aPosition, 1.);
+    vec3 normal = aNormal;
+    vec4 tangent = aTangent;
+#endif
+
+    vViewSpacePosition = vec3(uModelViewMatrix * position);
+	vViewSpaceNormal = normalize(uNormalMatrix * normal);
 	vTexCoords = aTexCoords;
 
     //Shadow Mapping
-    vFragPos = vec3(uModelMatrix * vec4(aPosition, 1.0));
+    vFragPos = vec3(uModelMatrix * position);
     vFragPosLightSpace = uLightSpaceMatrix * vec4(vFragPos, 1.0);
     //NormalMapping
 
-    if(aTangent.x == 0.0 && aTangent.y == 0.0 && aTangent.z == 0.0)
-    {
-        vTangents = vec3(0.0, 0.0, 0.0);
-        vBitengants = vec3(0.0, 0.0, 0.0);
-    }
-    else
-    {
-        vTangents = normalize(vec3(uModelMatrix * aTangent));
-        vBitengants = cross(vViewSpaceNormal, vTangents) * aTangent.w;
-    }
+#ifdef HAS_TANGENTS
+    vTangents = normalize(vec3(uModelMatrix * tangent));
+    vBitengants = cross(vViewSpaceNormal, vTangents) * tangent.w;
+#else
+    vTangents = vec3(0.0, 0.0, 0.0);
+    vBitengants = vec3(0.0, 0.0, 0.0);
+#endif
 
     vModelMatrix = uModelMatrix; // For tangent space normal mapping
 
-    gl_Position =  vModelViewProjMatrix * vec4(aPosition, 1.);
+    gl_Position =  uModelViewProjMatrix * position;
 }
\ No newline at end of file
@@ -1,10 +1,43 @@
 #version 330 core
 layout (location = 0) in vec3 aPos;
 
-uniform mat4 uLightSpaceMatrix;
-uniform mat4 uModelMatrix;
+uniform mat4 uModelViewProjMatrix; // Light space matrix * model matrix
+
+#ifdef HAS_SKINNING
+layout(location = 4) in uvec4 aJoints;
+layout(location = 5) in vec4 aWeights;
+
+// Joint matrices of the skinned instances, 4 texels each
+uniform samplerBuffer uJointMatrices;
+// Index of the first joint matrix of the instance, -1 if it is not skinned
+uniform int uJointOffset;
+
+mat4 jointMatrix(uint joint)
+{
+    int texel = 4 * (uJointOffset + int(joint));
+    return mat4(texelFetch(uJointMatrices, texel),
+        texelFetch(uJointMatrices, texel + 1),
+        texelFetch(uJointMatrices, texel + 2),
+        texelFetch(uJointMatrices, texel + 3));
+}
+
+mat4 skinMatrix()
+{
+    if (uJointOffset < 0) {
+        return mat4(1.);
+    }
+    return aWeights.x * jointMatrix(aJoints.x) +
+        aWeights.y * jointMatrix(aJoints.y) +
+        aWeights.z * jointMatrix(aJoints.z) +
+        aWeights.w * jointMatrix(aJoints.w);
+}
+#endif
 
 void main()
 {
-    gl_Position = uLightSpaceMatrix * uModelMatrix * vec4(aPos, 1.0);
+#ifdef HAS_SKINNING
+    gl_Position = uModelViewProjMatrix * skinMatrix() * vec4(aPos, 1.0);
+#else
+    gl_Position = uModelViewProjMatrix * vec4(aPos, 1.0);
+#endif
 }
\ No newline at end of file
@@ -1,7 +1,9 @@
 #pragma once
 
+#include "gl_context.hpp"
 #include "gl_debug_output.hpp"
 #include "glfw.hpp"
+#include "headless_context.hpp"
 #include <glm/glm.hpp>
 
 #include <imgui.h>
@@ -12,50 +14,35 @@
 #include <stdexcept>
 
 // Class responsible for initializing GLFW, creating a window, initializing
-// OpenGL function pointers with GLAD library and initializing ImGUI
+// OpenGL function pointers with GLAD library and initializing ImGUI.
+// Without a visible window, a HeadlessContext is created instead when
+// possible, so that offline renders need no display: there is then no window
+// and no GLFW function may be called.
 class GLFWHandle
 {
 public:
-  GLFWHandle(int width, int height, const char *title, bool visible = true)
+  GLFWHandle(int width, int height, const char *title, bool visible = true) :
+      m_width(width), m_height(height)
   {
-    if (!glfwInit()) {
-      std::cerr << "Unable to init GLFW.\n";
-      throw std::runtime_error("Unable to init GLFW.\n");
+    if (!visible && m_headlessContext.create(4, 4)) {
+      currentGLLoader() = HeadlessContext::getProcAddress;
+    } else {
+      createWindow(title, visible);
+      currentGLLoader() = (GLADloadproc)glfwGetProcAddress;
     }
 
-    if (!visible) {
-      glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
-    }
-
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 4);
-    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
-    glfwWindowHint(GLFW_OPENGL_DEBUG_CONTEXT, GL_TRUE);
-    glfwWindowHint(GLFW_RESIZABLE, GL_FALSE);
-    glfwWindowHint(GLFW_SAMPLES, 4);
-
-    m_pWindow =
-        glfwCreateWindow(int(width), int(height), title, nullptr, nullptr);
-    if (!m_pWindow) {
-      std::cerr << "Unable to open window.\n";
-      glfwTerminate();
-      throw std::runtime_error("Unable to open window.\n");
-    }
-
-    glfwMakeContextCurrent(m_pWindow);
-
-    glfwSwapInterval(0); // No VSync
-
-    if (!gladLoadGL()) {
+    if (!gladLoadGLLoader(currentGLLoader())) {
       std::cerr << "Unable to init OpenGL.\n";
       throw std::runtime_error("Unable to init OpenGL.\n");
     }
 
     initGLDebugOutput();
 
-    // Setup ImGui
+    // Setup ImGui, only drawn in a window
     ImGui::CreateContext();
-    ImGui_ImplGlfw_InitForOpenGL(m_pWindow, true);
+    if (m_pWindow) {
+      ImGui_ImplGlfw_InitForOpenGL(m_pWindow, true);
+    }
     const char *glsl_version = "#version 130";
     ImGui_ImplOpenGL3_Init(glsl_version);
   }
@@ -63,31 +50,80 @@ public:
   ~GLFWHandle()
   {
     ImGui_ImplOpenGL3_Shutdown();
-    ImGui_ImplGlfw_Shutdown();
+    if (m_pWindow) {
+      ImGui_ImplGlfw_Shutdown();
+    }
     ImGui::DestroyContext();
 
-    glfwDestroyWindow(m_pWindow);
-    glfwTerminate();
+    if (m_pWindow) {
+      glfwDestroyWindow(m_pWindow);
+      glfwTerminate();
+    }
   }
 
   // Non-copyable class:
   GLFWHandle(const GLFWHandle &) = delete;
   GLFWHandle &operator=(const GLFWHandle &) = delete;
 
-  bool shouldClose() const { return glfwWindowShouldClose(m_pWindow); }
+  bool shouldClose() const
+  {
+    return !m_pWindow || glfwWindowShouldClose(m_pWindow);
+  }
 
   glm::ivec2 framebufferSize() const
   {
+    if (!m_pWindow) {
+      return glm::ivec2(m_width, m_height);
+    }
     int displayWidth, displayHeight;
     glfwGetFramebufferSize(m_pWindow, &displayWidth, &displayHeight);
     return glm::ivec2(displayWidth, displayHeight);
   }
 
-  void swapBuffers() const { glfwSwapBuffers(m_pWindow); }
+  void swapBuffers() const
+  {
+    if (m_pWindow) {
+      glfwSwapBuffers(m_pWindow);
+    }
+  }
 
+  // Null with a headless context
   GLFWwindow *window() { return m_pWindow; }
 
 private:
+  void createWindow(const char *title, bool visible)
+  {
+    if (!glfwInit()) {
+      std::cerr << "Unable to init GLFW.\n";
+      throw std::runtime_error("Unable to init GLFW.\n");
+    }
+
+    if (!visible) {
+      glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    }
+
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 4);
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    glfwWindowHint(GLFW_OPENGL_DEBUG_CONTEXT, GL_TRUE);
+    glfwWindowHint(GLFW_RESIZABLE, GL_FALSE);
+    glfwWindowHint(GLFW_SAMPLES, 4);
+
+    m_pWindow = glfwCreateWindow(m_width, m_height, title, nullptr, nullptr);
+    if (!m_pWindow) {
+      std::cerr << "Unable to open window.\n";
+      glfwTerminate();
+      throw std::runtime_error("Unable to open window.\n");
+    }
+
+    glfwMakeContextCurrent(m_pWindow);
+
+    glfwSwapInterval(0); // No VSync
+  }
+
+  int m_width;
+  int m_height;
+  HeadlessContext m_headlessContext;
   GLFWwindow *m_pWindow = nullptr;
 };
 
@@ -112,4 +148,28 @@ inline void printGLVersion()
 
   std::clog << "OpenGL Version " << glVersion[0] << "." << glVersion[1]
             << std::endl;
-}
\ No newline at end of file
+}
+
+// Let the driver compile and link shaders on its own threads when
+// GL_KHR_parallel_shader_compile or GL_ARB_parallel_shader_compile is exposed.
+// Compilation then runs in the background until the status of a shader or
+// program is queried.
+inline bool enableParallelShaderCompile()
+{
+  typedef void(APIENTRYP MaxShaderCompilerThreadsProc)(GLuint count);
+  MaxShaderCompilerThreadsProc maxShaderCompilerThreads = nullptr;
+  if (isGLExtensionSupported("GL_KHR_parallel_shader_compile")) {
+    maxShaderCompilerThreads = (MaxShaderCompilerThreadsProc)getGLProcAddress(
+        "glMaxShaderCompilerThreadsKHR");
+  } else if (isGLExtensionSupported("GL_ARB_parallel_shader_compile")) {
+    maxShaderCompilerThreads = (MaxShaderCompilerThreadsProc)getGLProcAddress(
+        "glMaxShaderCompilerThreadsARB");
+  }
+  if (!maxShaderCompilerThreads) {
+    return false;
+  }
+  // 0xFFFFFFFF lets the implementation choose the number of threads
+  maxShaderCompilerThreads(0xFFFFFFFF);
+  std::clog << "Parallel shader compilation enabled" << std::endl;
+  return true;
+}
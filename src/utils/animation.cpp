@@ -0,0 +1,613 @@
+#include "animation.hpp"
+#include "gltf.hpp"
+
+#include <glm/gtc/type_ptr.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <iostream>
+#include <map>
+
+#if defined(__SSE2__) || defined(_M_X64) ||                                    \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define GLTF_VIEWER_USE_SSE 1
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+// Keyframes a cursor steps over before falling back on a binary search, when
+// the time jumps forward
+const int MAX_CURSOR_STEPS = 4;
+
+// Polynomial approximation of slerp from "A Fast and Accurate Algorithm for
+// Computing SLERP", David Eberly: no trigonometric function nor branch, so it
+// is evaluated on four quaternions at once. The last term is scaled by mu to
+// bring the error of the truncated series under 2e-5.
+const float SLERP_MU = 1.85298109240830f;
+const float SLERP_U[8] = {1.f / 3.f, 1.f / 10.f, 1.f / 21.f, 1.f / 36.f,
+    1.f / 55.f, 1.f / 78.f, 1.f / 105.f, SLERP_MU / 136.f};
+const float SLERP_V[8] = {1.f / 3.f, 2.f / 5.f, 3.f / 7.f, 4.f / 9.f,
+    5.f / 11.f, 6.f / 13.f, 7.f / 15.f, SLERP_MU * 8.f / 17.f};
+
+// Weights of q0 and q1 in slerp(q0, q1, t), for x = dot(q0, q1) >= 0
+void slerpWeights(float x, float t, float &w0, float &w1)
+{
+  const auto xm1 = x - 1.f;
+  const auto d = 1.f - t;
+  const auto t2 = t * t;
+  const auto d2 = d * d;
+  auto f0 = 1.f;
+  auto f1 = 1.f;
+  for (int i = 7; i >= 0; --i) {
+    f0 = 1.f + (SLERP_U[i] * d2 - SLERP_V[i]) * xm1 * f0;
+    f1 = 1.f + (SLERP_U[i] * t2 - SLERP_V[i]) * xm1 * f1;
+  }
+  w0 = d * f0;
+  w1 = t * f1;
+}
+
+// a[i] = slerp(a[i], b[i], u[i]) along the shortest path, for count
+// quaternions stored as four arrays of components: x[i] = a[i], y[i] =
+// a[count + i]...
+void slerpSoA(float *a, const float *b, const float *u, size_t count)
+{
+  size_t i = 0;
+#ifdef GLTF_VIEWER_USE_SSE
+  const auto one = _mm_set1_ps(1.f);
+  const auto signBit = _mm_set1_ps(-0.f);
+  for (; i + 4 <= count; i += 4) {
+    __m128 a4[4], b4[4];
+    for (int c = 0; c < 4; ++c) {
+      a4[c] = _mm_loadu_ps(a + c * count + i);
+      b4[c] = _mm_loadu_ps(b + c * count + i);
+    }
+    auto x = _mm_mul_ps(a4[0], b4[0]);
+    for (int c = 1; c < 4; ++c) {
+      x = _mm_add_ps(x, _mm_mul_ps(a4[c], b4[c]));
+    }
+    // Quaternions of opposite hemispheres: slerp toward -b, by flipping the
+    // sign of its weight
+    const auto sign = _mm_and_ps(x, signBit);
+    x = _mm_xor_ps(x, sign);
+
+    const auto t = _mm_loadu_ps(u + i);
+    const auto xm1 = _mm_sub_ps(x, one);
+    const auto d = _mm_sub_ps(one, t);
+    const auto t2 = _mm_mul_ps(t, t);
+    const auto d2 = _mm_mul_ps(d, d);
+    auto f0 = one;
+    auto f1 = one;
+    for (int k = 7; k >= 0; --k) {
+      const auto uk = _mm_set1_ps(SLERP_U[k]);
+      const auto vk = _mm_set1_ps(SLERP_V[k]);
+      const auto bd = _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(uk, d2), vk), xm1);
+      const auto bt = _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(uk, t2), vk), xm1);
+      f0 = _mm_add_ps(one, _mm_mul_ps(bd, f0));
+      f1 = _mm_add_ps(one, _mm_mul_ps(bt, f1));
+    }
+    const auto w0 = _mm_mul_ps(d, f0);
+    const auto w1 = _mm_xor_ps(_mm_mul_ps(t, f1), sign);
+    for (int c = 0; c < 4; ++c) {
+      _mm_storeu_ps(a + c * count + i,
+          _mm_add_ps(_mm_mul_ps(a4[c], w0), _mm_mul_ps(b4[c], w1)));
+    }
+  }
+#endif
+  for (; i < count; ++i) {
+    auto x = 0.f;
+    for (int c = 0; c < 4; ++c) {
+      x += a[c * count + i] * b[c * count + i];
+    }
+    const auto sign = x < 0.f ? -1.f : 1.f;
+    float w0, w1;
+    slerpWeights(sign * x, u[i], w0, w1);
+    w1 *= sign;
+    for (int c = 0; c < 4; ++c) {
+      a[c * count + i] = w0 * a[c * count + i] + w1 * b[c * count + i];
+    }
+  }
+}
+
+// a[i] = mix(a[i], b[i], u[i])
+void lerpSoA(float *a, const float *b, const float *u, size_t count)
+{
+  size_t i = 0;
+#ifdef GLTF_VIEWER_USE_SSE
+  for (; i + 4 <= count; i += 4) {
+    const auto a4 = _mm_loadu_ps(a + i);
+    const auto b4 = _mm_loadu_ps(b + i);
+    _mm_storeu_ps(a + i,
+        _mm_add_ps(a4, _mm_mul_ps(_mm_sub_ps(b4, a4), _mm_loadu_ps(u + i))));
+  }
+#endif
+  for (; i < count; ++i) {
+    a[i] += (b[i] - a[i]) * u[i];
+  }
+}
+
+} // namespace
+
+Animator::Animator(const tinygltf::Model &model, unsigned threadCount) :
+    m_threadPool(threadCount)
+{
+  const auto nodeCount = model.nodes.size();
+  m_parents.assign(nodeCount, -1);
+  m_restTransforms.resize(nodeCount);
+  m_localMatrices.assign(nodeCount, glm::mat4(1));
+  m_animatedNodes.assign(nodeCount, false);
+  m_worldMatrices.assign(nodeCount, glm::mat4(1));
+  m_restWeights.resize(nodeCount);
+  m_jointOffsets.assign(nodeCount, -1);
+  for (size_t i = 0; i < nodeCount; ++i) {
+    const auto &node = model.nodes[i];
+    auto &rest = m_restTransforms[i];
+    if (node.translation.size() == 3) {
+      rest.translation = glm::vec3(
+          node.translation[0], node.translation[1], node.translation[2]);
+    }
+    if (node.rotation.size() == 4) {
+      rest.rotation = glm::quat(float(node.rotation[3]),
+          float(node.rotation[0]), float(node.rotation[1]),
+          float(node.rotation[2]));
+    }
+    if (node.scale.size() == 3) {
+      rest.scale = glm::vec3(node.scale[0], node.scale[1], node.scale[2]);
+    }
+    m_localMatrices[i] = getLocalToWorldMatrix(node, glm::mat4(1));
+
+    // Weights of the node override those of its mesh, which default to 0
+    auto &weights = m_restWeights[i];
+    if (!node.weights.empty()) {
+      weights.assign(begin(node.weights), end(node.weights));
+    } else if (node.mesh >= 0) {
+      const auto &mesh = model.meshes[node.mesh];
+      if (!mesh.weights.empty()) {
+        weights.assign(begin(mesh.weights), end(mesh.weights));
+      } else if (!mesh.primitives.empty()) {
+        weights.assign(mesh.primitives.front().targets.size(), 0.f);
+      }
+    }
+  }
+  m_localTransforms = m_restTransforms;
+  m_morphWeights = m_restWeights;
+
+  for (const auto &animation : model.animations) {
+    Clip clip;
+    clip.name = animation.name.empty()
+                    ? "Animation " + std::to_string(m_clips.size())
+                    : animation.name;
+    const auto firstSampler = int(m_samplers.size());
+    for (const auto &animationSampler : animation.samplers) {
+      Sampler sampler;
+      if (animationSampler.interpolation == "STEP") {
+        sampler.interpolation = INTERPOLATION_STEP;
+      } else if (animationSampler.interpolation == "CUBICSPLINE") {
+        sampler.interpolation = INTERPOLATION_CUBICSPLINE;
+      }
+      const auto valuesPerKeyframe =
+          sampler.interpolation == INTERPOLATION_CUBICSPLINE ? 3 : 1;
+      if (animationSampler.input >= 0 && animationSampler.output >= 0 &&
+          readAccessorFloats(model, model.accessors[animationSampler.input],
+              sampler.times) &&
+          readAccessorFloats(model, model.accessors[animationSampler.output],
+              sampler.values) &&
+          !sampler.times.empty()) {
+        sampler.componentCount =
+            int(sampler.values.size() /
+                (valuesPerKeyframe * sampler.times.size()));
+      }
+      if (sampler.componentCount == 0 ||
+          sampler.values.size() != valuesPerKeyframe * sampler.times.size() *
+                                        size_t(sampler.componentCount)) {
+        std::cerr << "Invalid sampler in animation " << clip.name
+                  << ", skipping it." << std::endl;
+        sampler.times.clear();
+        sampler.values.clear();
+      } else {
+        clip.duration = std::max(clip.duration, sampler.times.back());
+      }
+      m_samplers.push_back(std::move(sampler));
+    }
+
+    for (const auto &animationChannel : animation.channels) {
+      if (animationChannel.target_node < 0 ||
+          size_t(animationChannel.target_node) >= nodeCount ||
+          animationChannel.sampler < 0 ||
+          size_t(animationChannel.sampler) >= animation.samplers.size()) {
+        continue;
+      }
+      const Channel channel{
+          animationChannel.target_node, firstSampler + animationChannel.sampler};
+      const auto &sampler = m_samplers[channel.sampler];
+      const auto &path = animationChannel.target_path;
+      if (path == "translation" && sampler.componentCount == 3) {
+        clip.translations.push_back(channel);
+      } else if (path == "rotation" && sampler.componentCount == 4) {
+        clip.rotations.push_back(channel);
+      } else if (path == "scale" && sampler.componentCount == 3) {
+        clip.scales.push_back(channel);
+      } else if (path == "weights" &&
+                 size_t(sampler.componentCount) ==
+                     m_restWeights[channel.node].size()) {
+        // Weights do not change the transform of the node
+        clip.weights.push_back(channel);
+        continue;
+      } else {
+        continue;
+      }
+      m_animatedNodes[channel.node] = true;
+    }
+    m_clips.push_back(std::move(clip));
+  }
+
+  if (model.defaultScene >= 0) {
+    const std::function<void(int, int)> visitNode = [&](int nodeIdx,
+                                                        int parentIdx) {
+      m_parents[nodeIdx] = parentIdx;
+      m_sceneNodes.push_back(nodeIdx);
+      for (const auto childNodeIdx : model.nodes[nodeIdx].children) {
+        visitNode(childNodeIdx, nodeIdx);
+      }
+    };
+    for (const auto nodeIdx : model.scenes[model.defaultScene].nodes) {
+      visitNode(nodeIdx, -1);
+    }
+  }
+
+  std::vector<float> values;
+  for (const auto &skin : model.skins) {
+    m_skinJoints.push_back(skin.joints);
+    std::vector<glm::mat4> inverseBindMatrices(
+        skin.joints.size(), glm::mat4(1));
+    if (skin.inverseBindMatrices >= 0 &&
+        readAccessorFloats(model, model.accessors[skin.inverseBindMatrices],
+            values) &&
+        values.size() >= 16 * inverseBindMatrices.size()) {
+      for (size_t i = 0; i < inverseBindMatrices.size(); ++i) {
+        inverseBindMatrices[i] = glm::make_mat4(&values[16 * i]);
+      }
+    }
+    m_inverseBindMatrices.push_back(std::move(inverseBindMatrices));
+  }
+  int jointCount = 0;
+  for (const auto nodeIdx : m_sceneNodes) {
+    const auto &node = model.nodes[nodeIdx];
+    if (node.skin >= 0 && node.mesh >= 0) {
+      m_jointOffsets[nodeIdx] = jointCount;
+      m_skinInstances.push_back({node.skin, jointCount});
+      jointCount += int(m_skinJoints[node.skin].size());
+    }
+  }
+  m_jointMatrices.assign(size_t(jointCount), glm::mat4(1));
+
+  update(0.f);
+}
+
+void Animator::setAnimation(int animation)
+{
+  if (animation == m_animation || animation < 0 ||
+      size_t(animation) >= m_clips.size()) {
+    return;
+  }
+  m_animation = animation;
+  resetPose();
+}
+
+size_t Animator::channelCount() const
+{
+  if (m_clips.empty()) {
+    return 0;
+  }
+  const auto &clip = m_clips[m_animation];
+  return clip.translations.size() + clip.rotations.size() +
+         clip.scales.size() + clip.weights.size();
+}
+
+void Animator::resetPose()
+{
+  m_localTransforms = m_restTransforms;
+  m_morphWeights = m_restWeights;
+}
+
+float Animator::sampleKeyframes(
+    Channel &channel, float time, float *a, float *b)
+{
+  const auto &sampler = m_samplers[channel.sampler];
+  const auto &times = sampler.times;
+  const auto componentCount = size_t(sampler.componentCount);
+  // Cubic spline keyframes are made of the in tangent, the value and the out
+  // tangent
+  const auto cubic = sampler.interpolation == INTERPOLATION_CUBICSPLINE;
+  const auto keyframeSize = cubic ? 3 * componentCount : componentCount;
+  const auto value = [&](size_t keyframe) {
+    return &sampler.values[keyframe * keyframeSize +
+                           (cubic ? componentCount : 0)];
+  };
+  const auto sampleKeyframe = [&](size_t keyframe) {
+    std::copy_n(value(keyframe), componentCount, a);
+    std::copy_n(value(keyframe), componentCount, b);
+    return 0.f;
+  };
+
+  auto &cursor = channel.cursor;
+  if (times.size() < 2 || time <= times.front()) {
+    cursor = 0;
+    return sampleKeyframe(0);
+  }
+  if (time >= times.back()) {
+    cursor = times.size() - 2;
+    return sampleKeyframe(times.size() - 1);
+  }
+  if (time < times[cursor]) {
+    // Looped or moved backward
+    cursor = size_t(std::upper_bound(begin(times), end(times), time) -
+                    begin(times)) -
+             1;
+  } else {
+    for (int steps = 0; times[cursor + 1] <= time; ++steps) {
+      if (steps == MAX_CURSOR_STEPS) {
+        cursor = size_t(std::upper_bound(begin(times) + cursor + 1,
+                            end(times), time) -
+                        begin(times)) -
+                 1;
+        break;
+      }
+      ++cursor;
+    }
+  }
+
+  const auto deltaTime = times[cursor + 1] - times[cursor];
+  const auto u = (time - times[cursor]) / deltaTime;
+  switch (sampler.interpolation) {
+  case INTERPOLATION_STEP:
+    return sampleKeyframe(cursor);
+  case INTERPOLATION_CUBICSPLINE: {
+    // Hermite spline from the value and out tangent of the keyframe to the
+    // in tangent and value of the next one
+    const auto u2 = u * u;
+    const auto u3 = u2 * u;
+    const auto v0 = value(cursor);
+    const auto outTangent0 = v0 + componentCount;
+    const auto v1 = value(cursor + 1);
+    const auto inTangent1 = v1 - componentCount;
+    for (size_t c = 0; c < componentCount; ++c) {
+      a[c] = (2.f * u3 - 3.f * u2 + 1.f) * v0[c] +
+             (u3 - 2.f * u2 + u) * deltaTime * outTangent0[c] +
+             (-2.f * u3 + 3.f * u2) * v1[c] +
+             (u3 - u2) * deltaTime * inTangent1[c];
+      b[c] = a[c];
+    }
+    return 0.f;
+  }
+  default:
+    std::copy_n(value(cursor), componentCount, a);
+    std::copy_n(value(cursor + 1), componentCount, b);
+    return u;
+  }
+}
+
+void Animator::update(float time)
+{
+  if (!m_clips.empty()) {
+    auto &clip = m_clips[m_animation];
+    auto clipTime = 0.f;
+    if (clip.duration > 0.f) {
+      clipTime = std::fmod(time, clip.duration);
+      if (clipTime < 0.f) {
+        clipTime += clip.duration;
+      }
+    }
+    float a[4];
+    float b[4];
+
+    // Translations then scales, one lane per component
+    const auto vectorLaneCount =
+        3 * (clip.translations.size() + clip.scales.size());
+    m_vectorA.resize(vectorLaneCount);
+    m_vectorB.resize(vectorLaneCount);
+    m_vectorU.resize(vectorLaneCount);
+    size_t lane = 0;
+    for (auto channels : {&clip.translations, &clip.scales}) {
+      for (auto &channel : *channels) {
+        const auto u = sampleKeyframes(channel, clipTime, a, b);
+        for (int c = 0; c < 3; ++c, ++lane) {
+          m_vectorA[lane] = a[c];
+          m_vectorB[lane] = b[c];
+          m_vectorU[lane] = u;
+        }
+      }
+    }
+    lerpSoA(m_vectorA.data(), m_vectorB.data(), m_vectorU.data(),
+        vectorLaneCount);
+    lane = 0;
+    for (const auto &channel : clip.translations) {
+      m_localTransforms[channel.node].translation =
+          glm::make_vec3(&m_vectorA[lane]);
+      lane += 3;
+    }
+    for (const auto &channel : clip.scales) {
+      m_localTransforms[channel.node].scale = glm::make_vec3(&m_vectorA[lane]);
+      lane += 3;
+    }
+
+    // Rotations, one array per quaternion component
+    const auto rotationCount = clip.rotations.size();
+    m_rotationA.resize(4 * rotationCount);
+    m_rotationB.resize(4 * rotationCount);
+    m_rotationU.resize(rotationCount);
+    for (size_t i = 0; i < rotationCount; ++i) {
+      auto &channel = clip.rotations[i];
+      m_rotationU[i] = sampleKeyframes(channel, clipTime, a, b);
+      if (m_samplers[channel.sampler].interpolation ==
+          INTERPOLATION_CUBICSPLINE) {
+        const auto q = glm::normalize(glm::make_vec4(a));
+        std::copy_n(glm::value_ptr(q), 4, a);
+        std::copy_n(glm::value_ptr(q), 4, b);
+      }
+      for (size_t c = 0; c < 4; ++c) {
+        m_rotationA[c * rotationCount + i] = a[c];
+        m_rotationB[c * rotationCount + i] = b[c];
+      }
+    }
+    slerpSoA(m_rotationA.data(), m_rotationB.data(), m_rotationU.data(),
+        rotationCount);
+    for (size_t i = 0; i < rotationCount; ++i) {
+      // glTF stores x, y, z, w
+      m_localTransforms[clip.rotations[i].node].rotation =
+          glm::quat(m_rotationA[3 * rotationCount + i], m_rotationA[i],
+              m_rotationA[rotationCount + i],
+              m_rotationA[2 * rotationCount + i]);
+    }
+
+    // Weights, one target per component
+    for (auto &channel : clip.weights) {
+      auto &weights = m_morphWeights[channel.node];
+      m_weightA.resize(weights.size());
+      m_weightB.resize(weights.size());
+      const auto u = sampleKeyframes(
+          channel, clipTime, m_weightA.data(), m_weightB.data());
+      for (size_t i = 0; i < weights.size(); ++i) {
+        weights[i] = m_weightA[i] + (m_weightB[i] - m_weightA[i]) * u;
+      }
+    }
+  }
+
+  for (const auto nodeIdx : m_sceneNodes) {
+    auto localMatrix = m_localMatrices[nodeIdx];
+    if (m_animatedNodes[nodeIdx]) {
+      const auto &transform = m_localTransforms[nodeIdx];
+      localMatrix = glm::mat4_cast(transform.rotation);
+      localMatrix[0] *= transform.scale.x;
+      localMatrix[1] *= transform.scale.y;
+      localMatrix[2] *= transform.scale.z;
+      localMatrix[3] = glm::vec4(transform.translation, 1.f);
+    }
+    const auto parentIdx = m_parents[nodeIdx];
+    m_worldMatrices[nodeIdx] = parentIdx >= 0
+                                   ? m_worldMatrices[parentIdx] * localMatrix
+                                   : localMatrix;
+  }
+
+  m_threadPool.parallelFor(int(m_skinInstances.size()), [&](int i) {
+    const auto &instance = m_skinInstances[i];
+    const auto &joints = m_skinJoints[instance.skin];
+    const auto &inverseBindMatrices = m_inverseBindMatrices[instance.skin];
+    const auto jointMatrices = &m_jointMatrices[instance.offset];
+    for (size_t j = 0; j < joints.size(); ++j) {
+      jointMatrices[j] = m_worldMatrices[joints[j]] * inverseBindMatrices[j];
+    }
+  });
+}
+
+void addAnimatedCopies(tinygltf::Model &model, size_t count,
+    const glm::vec3 &bboxMin, const glm::vec3 &bboxMax)
+{
+  if (model.defaultScene < 0 || count == 0) {
+    return;
+  }
+  std::vector<bool> animatedNodes(model.nodes.size(), false);
+  for (const auto &animation : model.animations) {
+    for (const auto &channel : animation.channels) {
+      if (channel.target_node >= 0 &&
+          size_t(channel.target_node) < model.nodes.size()) {
+        animatedNodes[channel.target_node] = true;
+      }
+    }
+  }
+  const std::function<bool(int)> isAnimated = [&](int nodeIdx) {
+    const auto &node = model.nodes[nodeIdx];
+    return animatedNodes[nodeIdx] || node.skin >= 0 ||
+           std::any_of(begin(node.children), end(node.children), isAnimated);
+  };
+  std::vector<int> rootNodes;
+  for (const auto nodeIdx : model.scenes[model.defaultScene].nodes) {
+    if (isAnimated(nodeIdx)) {
+      rootNodes.push_back(nodeIdx);
+    }
+  }
+  if (rootNodes.empty()) {
+    std::cerr << "No animated node to copy" << std::endl;
+    return;
+  }
+
+  // Square grid in the XZ plane, the original nodes being the first cell
+  const auto diag = bboxMax - bboxMin;
+  const auto spacing = 1.25f * std::max(std::max(diag.x, diag.z), 1e-3f);
+  const auto gridSize = size_t(std::ceil(std::sqrt(double(count + 1))));
+
+  // Channels of the original nodes, to be duplicated for each copy
+  std::vector<std::vector<tinygltf::AnimationChannel>> animationChannels;
+  for (const auto &animation : model.animations) {
+    animationChannels.push_back(animation.channels);
+  }
+
+  const auto nodeCount = model.nodes.size();
+  std::vector<int> nodeCopies(nodeCount);
+  const std::function<int(int)> copyNode = [&](int nodeIdx) {
+    const auto copyNodeIdx = int(model.nodes.size());
+    nodeCopies[nodeIdx] = copyNodeIdx;
+    auto node = model.nodes[nodeIdx];
+    model.nodes.push_back(node);
+    for (auto &childNodeIdx : node.children) {
+      childNodeIdx = copyNode(childNodeIdx);
+    }
+    model.nodes[copyNodeIdx].children = std::move(node.children);
+    return copyNodeIdx;
+  };
+  const auto copiedNode = [&](int nodeIdx) {
+    return nodeIdx >= 0 && nodeCopies[nodeIdx] >= 0 ? nodeCopies[nodeIdx]
+                                                    : nodeIdx;
+  };
+
+  for (size_t copyIdx = 1; copyIdx <= count; ++copyIdx) {
+    std::fill(begin(nodeCopies), end(nodeCopies), -1);
+    tinygltf::Node rootNode;
+    rootNode.name = "Animated copy " + std::to_string(copyIdx);
+    rootNode.translation = {double(spacing * float(copyIdx % gridSize)), 0.,
+        double(spacing * float(copyIdx / gridSize))};
+    for (const auto nodeIdx : rootNodes) {
+      rootNode.children.push_back(copyNode(nodeIdx));
+    }
+
+    // Copied skins reference the copied joints
+    std::map<int, int> skinCopies;
+    for (size_t nodeIdx = 0; nodeIdx < nodeCount; ++nodeIdx) {
+      if (nodeCopies[nodeIdx] < 0) {
+        continue;
+      }
+      auto &skinIdx = model.nodes[nodeCopies[nodeIdx]].skin;
+      if (skinIdx < 0) {
+        continue;
+      }
+      auto it = skinCopies.find(skinIdx);
+      if (it == end(skinCopies)) {
+        auto skin = model.skins[skinIdx];
+        for (auto &jointNodeIdx : skin.joints) {
+          jointNodeIdx = copiedNode(jointNodeIdx);
+        }
+        skin.skeleton = copiedNode(skin.skeleton);
+        it = skinCopies.emplace(skinIdx, int(model.skins.size())).first;
+        model.skins.push_back(std::move(skin));
+      }
+      skinIdx = (*it).second;
+    }
+
+    for (size_t i = 0; i < animationChannels.size(); ++i) {
+      for (auto channel : animationChannels[i]) {
+        if (channel.target_node >= 0 &&
+            size_t(channel.target_node) < nodeCount &&
+            nodeCopies[channel.target_node] >= 0) {
+          channel.target_node = nodeCopies[channel.target_node];
+          model.animations[i].channels.push_back(std::move(channel));
+        }
+      }
+    }
+
+    model.scenes[model.defaultScene].nodes.push_back(int(model.nodes.size()));
+    model.nodes.push_back(std::move(rootNode));
+  }
+  std::clog << "Added " << count << " animated copies, "
+            << model.nodes.size() << " nodes" << std::endl;
+}
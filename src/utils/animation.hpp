@@ -0,0 +1,163 @@
+#pragma once
+
+#include "thread_pool.hpp"
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include <tiny_gltf.h>
+
+#include <string>
+#include <vector>
+
+// Playback of the animations, skins and morph target weights of the default
+// scene of a glTF model.
+// Each channel keeps the keyframe it sampled last, so that steady playback
+// steps forward from it instead of searching the keyframes of every channel
+// each frame. Sampled keyframes are gathered in structure of arrays batches
+// and interpolated four channels at a time with SSE.
+class Animator
+{
+public:
+  // threadCount as ThreadPool
+  explicit Animator(const tinygltf::Model &model, unsigned threadCount = 0);
+
+  Animator(const Animator &) = delete;
+  Animator &operator=(const Animator &) = delete;
+
+  size_t animationCount() const { return m_clips.size(); }
+
+  const std::string &animationName(int animation) const
+  {
+    return m_clips[animation].name;
+  }
+
+  // Animation played by update(), nodes are reset to their rest pose when it
+  // changes
+  int animation() const { return m_animation; }
+  void setAnimation(int animation);
+
+  // Channels of the current animation
+  size_t channelCount() const;
+
+  bool hasSkins() const { return !m_skinInstances.empty(); }
+
+  // Sample the current animation at time, in seconds, looping over its
+  // duration, and update the world and joint matrices. Joint palettes of the
+  // skinned nodes are computed by the worker threads.
+  void update(float time);
+
+  // World matrix of each node of the model, identity for the nodes out of the
+  // default scene
+  const std::vector<glm::mat4> &worldMatrices() const
+  {
+    return m_worldMatrices;
+  }
+
+  // World space joint matrices of the skinned nodes of the default scene,
+  // each drawn with the identity as model matrix
+  const std::vector<glm::mat4> &jointMatrices() const
+  {
+    return m_jointMatrices;
+  }
+
+  // Offset of the joint matrices of node, -1 if it has no skin
+  int jointOffset(int node) const { return m_jointOffsets[node]; }
+
+  // Morph target weights of each node, from its mesh by default
+  const std::vector<std::vector<float>> &morphWeights() const
+  {
+    return m_morphWeights;
+  }
+
+private:
+  enum Interpolation
+  {
+    INTERPOLATION_STEP,
+    INTERPOLATION_LINEAR,
+    INTERPOLATION_CUBICSPLINE
+  };
+
+  // Keyframes of an animation sampler, shared by the channels using it
+  struct Sampler
+  {
+    Interpolation interpolation = INTERPOLATION_LINEAR;
+    int componentCount = 0;
+    std::vector<float> times;
+    // componentCount floats per keyframe, 3 * componentCount with cubic
+    // splines: in tangent, value and out tangent
+    std::vector<float> values;
+  };
+
+  struct Channel
+  {
+    int node;
+    int sampler; // In m_samplers
+    size_t cursor = 0; // Keyframe sampled last
+  };
+
+  struct Clip
+  {
+    std::string name;
+    float duration = 0.f;
+    std::vector<Channel> translations;
+    std::vector<Channel> rotations;
+    std::vector<Channel> scales;
+    std::vector<Channel> weights;
+  };
+
+  struct LocalTransform
+  {
+    glm::vec3 translation{0};
+    glm::quat rotation{1, 0, 0, 0};
+    glm::vec3 scale{1};
+  };
+
+  struct SkinInstance
+  {
+    int skin;
+    int offset; // In m_jointMatrices
+  };
+
+  // Keyframe values a and b of channel around time, and the interpolation
+  // factor u from a to b. Advance the cursor of the channel.
+  float sampleKeyframes(Channel &channel, float time, float *a, float *b);
+  void resetPose();
+
+  std::vector<Sampler> m_samplers;
+  std::vector<Clip> m_clips;
+  int m_animation = 0;
+
+  // Nodes of the default scene, parents before their children
+  std::vector<int> m_sceneNodes;
+  std::vector<int> m_parents;
+  std::vector<LocalTransform> m_restTransforms;
+  std::vector<LocalTransform> m_localTransforms;
+  // Local matrix of the nodes that are not animated
+  std::vector<glm::mat4> m_localMatrices;
+  std::vector<bool> m_animatedNodes;
+  std::vector<glm::mat4> m_worldMatrices;
+  std::vector<std::vector<float>> m_restWeights;
+  std::vector<std::vector<float>> m_morphWeights;
+
+  std::vector<std::vector<int>> m_skinJoints;
+  std::vector<std::vector<glm::mat4>> m_inverseBindMatrices;
+  std::vector<SkinInstance> m_skinInstances;
+  std::vector<int> m_jointOffsets;
+  std::vector<glm::mat4> m_jointMatrices;
+
+  // Interpolation batches: a is interpolated toward b by u, one lane per
+  // vector component for translations and scales, one lane per quaternion
+  // component array for rotations
+  std::vector<float> m_vectorA, m_vectorB, m_vectorU;
+  std::vector<float> m_rotationA, m_rotationB, m_rotationU;
+  // Keyframes of a weights channel, sampled one channel at a time
+  std::vector<float> m_weightA, m_weightB;
+
+  ThreadPool m_threadPool;
+};
+
+// Add count copies of the animated root nodes of the default scene on a grid
+// next to it, with their own skins, driven by new channels of the same
+// animations, to benchmark the animation of large crowds
+void addAnimatedCopies(tinygltf::Model &model, size_t count,
+    const glm::vec3 &bboxMin, const glm::vec3 &bboxMax);
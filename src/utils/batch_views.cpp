@@ -0,0 +1,93 @@
+#include "batch_views.hpp"
+
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+namespace {
+
+// Parse count comma separated floats
+bool parseFloats(const std::string &str, size_t count, float *values)
+{
+  std::istringstream input(str);
+  for (size_t i = 0; i < count; ++i) {
+    if (i > 0 && input.get() != ',') {
+      return false;
+    }
+    if (!(input >> values[i])) {
+      return false;
+    }
+  }
+  return input.peek() == std::char_traits<char>::eof();
+}
+
+} // namespace
+
+bool loadBatchViews(std::istream &input, const fs::path &output, int width,
+    int height, std::vector<BatchView> &views)
+{
+  const auto stem = output.empty() ? fs::path("view")
+                                   : output.parent_path() / output.stem();
+  std::string line;
+  for (size_t lineNumber = 1; std::getline(input, line); ++lineNumber) {
+    std::istringstream tokens(line);
+    std::string token;
+    if (!(tokens >> token) || token[0] == '#') {
+      continue;
+    }
+    const auto error = [&](const std::string &message) {
+      std::cerr << "Batch line " << lineNumber << ": " << message
+                << std::endl;
+      return false;
+    };
+
+    float lookat[9];
+    if (!parseFloats(token, 9, lookat)) {
+      return error("expected 9 look at numbers, got \"" + token + "\"");
+    }
+    const auto eye = glm::vec3(lookat[0], lookat[1], lookat[2]);
+    const auto center = glm::vec3(lookat[3], lookat[4], lookat[5]);
+    const auto up = glm::vec3(lookat[6], lookat[7], lookat[8]);
+    if (glm::cross(up, center - eye) == glm::vec3(0)) {
+      return error("the up vector is colinear to the view direction");
+    }
+    BatchView view;
+    view.camera = Camera{eye, center, up};
+    view.width = width;
+    view.height = height;
+    std::ostringstream defaultOutput;
+    defaultOutput << stem.string() << "_" << std::setw(3) << std::setfill('0')
+                  << views.size() << ".png";
+    view.output = defaultOutput.str();
+
+    while (tokens >> token) {
+      const auto separator = token.find('=');
+      const auto key = token.substr(0, separator);
+      const auto value =
+          separator == std::string::npos ? "" : token.substr(separator + 1);
+      float values[3];
+      if (key == "output" && !value.empty()) {
+        view.output = value;
+      } else if (key == "size") {
+        std::istringstream size(value);
+        char x = 0;
+        if (!(size >> view.width >> x >> view.height) || x != 'x' ||
+            view.width <= 0 || view.height <= 0) {
+          return error("invalid size \"" + value + "\"");
+        }
+      } else if (key == "light" && parseFloats(value, 2, values)) {
+        view.hasLightDirection = true;
+        view.lightTheta = values[0];
+        view.lightPhi = values[1];
+      } else if (key == "light-intensity" && parseFloats(value, 3, values)) {
+        view.hasLightIntensity = true;
+        view.lightIntensity = glm::vec3(values[0], values[1], values[2]);
+      } else {
+        return error("invalid setting \"" + token + "\"");
+      }
+    }
+    views.push_back(view);
+  }
+  return true;
+}
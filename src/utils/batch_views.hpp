@@ -0,0 +1,36 @@
+#pragma once
+
+#include "cameras.hpp"
+#include "filesystem.hpp"
+
+#include <glm/glm.hpp>
+
+#include <istream>
+#include <vector>
+
+// Views rendered from one load of a model by the batch mode. Each line of a
+// batch file is a view: the look at parameters of its camera, with the format
+// of --lookat, followed by optional key=value settings:
+//   output=<png file>     default <output stem>_<view index>.png
+//   size=<width>x<height> default --width and --height
+//   light=<theta>,<phi>   direction of the directional light, in radians
+//   light-intensity=<r>,<g>,<b>
+// Empty lines and lines starting with # are ignored.
+struct BatchView
+{
+  Camera camera;
+  fs::path output;
+  int width = 0;
+  int height = 0;
+  bool hasLightDirection = false;
+  float lightTheta = 0.f;
+  float lightPhi = 0.f;
+  bool hasLightIntensity = false;
+  glm::vec3 lightIntensity{1};
+};
+
+// Parse the views of a batch file, output being the default output path whose
+// stem is suffixed by the view index, and width and height the default size.
+// Errors are reported with their line number.
+bool loadBatchViews(std::istream &input, const fs::path &output, int width,
+    int height, std::vector<BatchView> &views);
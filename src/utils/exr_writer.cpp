@@ -0,0 +1,111 @@
+#include "exr_writer.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <numeric>
+
+namespace {
+
+const int32_t PIXEL_TYPE_FLOAT = 2;
+
+template <typename T> void appendLittleEndian(std::vector<char> &out, T value)
+{
+  uint64_t bits = 0;
+  std::memcpy(&bits, &value, sizeof(T));
+  for (size_t i = 0; i < sizeof(T); ++i) {
+    out.push_back(char(bits >> (8 * i)));
+  }
+}
+
+void appendString(std::vector<char> &out, const std::string &str)
+{
+  out.insert(end(out), begin(str), end(str));
+  out.push_back('\0');
+}
+
+// Header attribute: name, type name, size and value
+void appendAttribute(std::vector<char> &out, const char *name,
+    const char *type, const std::vector<char> &value)
+{
+  appendString(out, name);
+  appendString(out, type);
+  appendLittleEndian(out, int32_t(value.size()));
+  out.insert(end(out), begin(value), end(value));
+}
+
+} // namespace
+
+bool writeExr(const fs::path &path, int width, int height,
+    const std::vector<std::string> &channelNames, const float *pixels)
+{
+  if (width <= 0 || height <= 0 || channelNames.empty()) {
+    return false;
+  }
+  const auto channelCount = channelNames.size();
+  // Channels are stored in alphabetical order
+  std::vector<size_t> order(channelCount);
+  std::iota(begin(order), end(order), size_t(0));
+  std::sort(begin(order), end(order),
+      [&](size_t a, size_t b) { return channelNames[a] < channelNames[b]; });
+
+  // Magic number and version 2, single part scanline file
+  std::vector<char> header = {0x76, 0x2f, 0x31, 0x01, 2, 0, 0, 0};
+  std::vector<char> value;
+  for (const auto idx : order) {
+    appendString(value, channelNames[idx]);
+    appendLittleEndian(value, PIXEL_TYPE_FLOAT);
+    // pLinear and reserved bytes, then the x and y sampling
+    value.insert(end(value), 4, '\0');
+    appendLittleEndian(value, int32_t(1));
+    appendLittleEndian(value, int32_t(1));
+  }
+  value.push_back('\0');
+  appendAttribute(header, "channels", "chlist", value);
+  appendAttribute(header, "compression", "compression", {0});
+  value.clear();
+  for (const auto coordinate : {0, 0, width - 1, height - 1}) {
+    appendLittleEndian(value, int32_t(coordinate));
+  }
+  appendAttribute(header, "dataWindow", "box2i", value);
+  appendAttribute(header, "displayWindow", "box2i", value);
+  // Increasing y, the first scanline is the top of the image
+  appendAttribute(header, "lineOrder", "lineOrder", {0});
+  value.clear();
+  appendLittleEndian(value, 1.f);
+  appendAttribute(header, "pixelAspectRatio", "float", value);
+  appendAttribute(header, "screenWindowWidth", "float", value);
+  value.clear();
+  appendLittleEndian(value, 0.f);
+  appendLittleEndian(value, 0.f);
+  appendAttribute(header, "screenWindowCenter", "v2f", value);
+  header.push_back('\0');
+
+  // Offsets of the scanline blocks, one scanline each without compression:
+  // y, data size, then the row of each channel
+  const auto rowDataSize = size_t(width) * channelCount * sizeof(float);
+  const auto blockSize = 8 + rowDataSize;
+  const auto firstBlock = header.size() + size_t(height) * sizeof(uint64_t);
+  for (int y = 0; y < height; ++y) {
+    appendLittleEndian(header, uint64_t(firstBlock + size_t(y) * blockSize));
+  }
+
+  std::ofstream output(path.string(), std::ios::binary);
+  output.write(header.data(), std::streamsize(header.size()));
+  std::vector<char> block;
+  block.reserve(blockSize);
+  for (int y = 0; y < height && output; ++y) {
+    block.clear();
+    appendLittleEndian(block, int32_t(y));
+    appendLittleEndian(block, int32_t(rowDataSize));
+    const auto row = pixels + size_t(y) * width * channelCount;
+    for (const auto idx : order) {
+      for (int x = 0; x < width; ++x) {
+        appendLittleEndian(block, row[size_t(x) * channelCount + idx]);
+      }
+    }
+    output.write(block.data(), std::streamsize(block.size()));
+  }
+  return bool(output);
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+#include "filesystem.hpp"
+
+#include <string>
+#include <vector>
+
+// Write an uncompressed scanline OpenEXR file of 32 bits float channels.
+// pixels holds the channels interleaved in the order of channelNames, rows
+// going downward. Readers usually expect the names R, G, B, A or Z.
+bool writeExr(const fs::path &path, int width, int height,
+    const std::vector<std::string> &channelNames, const float *pixels);
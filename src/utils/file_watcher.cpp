@@ -0,0 +1,64 @@
+#include "file_watcher.hpp"
+
+#include <algorithm>
+#include <iostream>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+FileWatcher::FileWatcher(const fs::path &directory) : m_directory(directory)
+{
+#ifdef __linux__
+  m_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (m_fd < 0) {
+    std::cerr << "Unable to initialize inotify" << std::endl;
+    return;
+  }
+  // Editors either rewrite the file or replace it by a new one
+  if (inotify_add_watch(m_fd, directory.string().c_str(),
+          IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+    std::cerr << "Unable to watch " << directory << std::endl;
+    close(m_fd);
+    m_fd = -1;
+  }
+#else
+  std::clog << "File watching is not supported on this platform, " << directory
+            << " will not be watched" << std::endl;
+#endif
+}
+
+FileWatcher::~FileWatcher()
+{
+#ifdef __linux__
+  if (m_fd >= 0) {
+    close(m_fd);
+  }
+#endif
+}
+
+std::vector<fs::path> FileWatcher::poll()
+{
+  std::vector<fs::path> paths;
+#ifdef __linux__
+  if (m_fd < 0) {
+    return paths;
+  }
+  alignas(inotify_event) char buffer[4096];
+  ssize_t length;
+  while ((length = read(m_fd, buffer, sizeof(buffer))) > 0) {
+    for (auto ptr = buffer; ptr < buffer + length;) {
+      const auto event = (const inotify_event *)ptr;
+      if (event->len > 0) {
+        const auto path = m_directory / event->name;
+        if (std::find(begin(paths), end(paths), path) == end(paths)) {
+          paths.emplace_back(path);
+        }
+      }
+      ptr += sizeof(inotify_event) + event->len;
+    }
+  }
+#endif
+  return paths;
+}
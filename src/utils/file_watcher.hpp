@@ -0,0 +1,27 @@
+#pragma once
+
+#include "filesystem.hpp"
+
+#include <vector>
+
+// Notify modifications of the files of a directory, using inotify on Linux.
+// On other platforms the watcher never reports any change.
+class FileWatcher
+{
+public:
+  FileWatcher(const fs::path &directory);
+
+  ~FileWatcher();
+
+  FileWatcher(const FileWatcher &) = delete;
+
+  FileWatcher &operator=(const FileWatcher &) = delete;
+
+  // Non blocking, return the paths of the files written or moved in the
+  // directory since the last call, without duplicates
+  std::vector<fs::path> poll();
+
+private:
+  fs::path m_directory;
+  int m_fd = -1;
+};
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <chrono>
+#include <cstring>
+
+// Queries of the current OpenGL context, whether it was created by GLFW or by
+// HeadlessContext. GLFW functions require GLFW to be initialized and the
+// context to be a GLFW one, which headless renders avoid.
+
+// Loader of the OpenGL functions of the current context, set by GLFWHandle
+inline GLADloadproc &currentGLLoader()
+{
+  static GLADloadproc loader = nullptr;
+  return loader;
+}
+
+inline void *getGLProcAddress(const char *name)
+{
+  return currentGLLoader() ? currentGLLoader()(name) : nullptr;
+}
+
+inline bool isGLExtensionSupported(const char *name)
+{
+  GLint extensionCount = 0;
+  glGetIntegerv(GL_NUM_EXTENSIONS, &extensionCount);
+  for (GLint i = 0; i < extensionCount; ++i) {
+    const auto extension = (const char *)glGetStringi(GL_EXTENSIONS, GLuint(i));
+    if (extension && std::strcmp(extension, name) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Seconds since an arbitrary origin, replacing glfwGetTime()
+inline double getSeconds()
+{
+  return std::chrono::duration<double>(
+      std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <glad/glad.h>
+
+// GPU timer based on GL_TIME_ELAPSED queries. Two queries are used alternately
+// so that reading the result of the previous measure does not stall the
+// pipeline in interactive mode.
+class GLTimer
+{
+  GLuint m_queries[2] = {0, 0};
+  bool m_pending[2] = {false, false};
+  int m_current = 0;
+  double m_lastMilliseconds = 0.;
+
+  void fetch(int idx, bool wait)
+  {
+    if (!m_pending[idx]) {
+      return;
+    }
+    GLint available = 0;
+    glGetQueryObjectiv(m_queries[idx], GL_QUERY_RESULT_AVAILABLE, &available);
+    if (available || wait) {
+      GLuint64 elapsedNs = 0;
+      glGetQueryObjectui64v(m_queries[idx], GL_QUERY_RESULT, &elapsedNs);
+      m_lastMilliseconds = double(elapsedNs) * 1e-6;
+      m_pending[idx] = false;
+    }
+  }
+
+public:
+  GLTimer() { glGenQueries(2, m_queries); }
+
+  ~GLTimer() { glDeleteQueries(2, m_queries); }
+
+  GLTimer(const GLTimer &) = delete;
+
+  GLTimer &operator=(const GLTimer &) = delete;
+
+  void begin()
+  {
+    fetch(m_current, true); // Issued two measures ago, should be ready
+    glBeginQuery(GL_TIME_ELAPSED, m_queries[m_current]);
+  }
+
+  void end()
+  {
+    glEndQuery(GL_TIME_ELAPSED);
+    m_pending[m_current] = true;
+    m_current = 1 - m_current;
+    fetch(m_current, false);
+  }
+
+  // Last known result, does not block
+  double lastMilliseconds() const { return m_lastMilliseconds; }
+
+  // Result of the last measure, blocks until the GPU is done
+  double waitMilliseconds()
+  {
+    fetch(1 - m_current, true);
+    return m_lastMilliseconds;
+  }
+};
@@ -3,6 +3,7 @@
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/quaternion.hpp>
 
+#include <algorithm>
 #include <iostream>
 
 glm::mat4 getLocalToWorldMatrix(
@@ -150,4 +151,265 @@ void computeSceneBounds(
       updateBounds(nodeIdx, glm::mat4(1));
     }
   }
-}
\ No newline at end of file
+}
+
+void flattenScene(const tinygltf::Model &model, std::vector<int> &meshIndices,
+    std::vector<glm::mat4> &modelMatrices, std::vector<int> *nodeIndices)
+{
+  meshIndices.clear();
+  modelMatrices.clear();
+  if (nodeIndices) {
+    nodeIndices->clear();
+  }
+  if (model.defaultScene < 0) {
+    return;
+  }
+  const std::function<void(int, const glm::mat4 &)> visitNode =
+      [&](int nodeIdx, const glm::mat4 &parentMatrix) {
+        const auto &node = model.nodes[nodeIdx];
+        const auto modelMatrix = getLocalToWorldMatrix(node, parentMatrix);
+        if (node.mesh >= 0) {
+          meshIndices.emplace_back(node.mesh);
+          modelMatrices.emplace_back(modelMatrix);
+          if (nodeIndices) {
+            nodeIndices->emplace_back(nodeIdx);
+          }
+        }
+        for (const auto childNodeIdx : node.children) {
+          visitNode(childNodeIdx, modelMatrix);
+        }
+      };
+  for (const auto nodeIdx : model.scenes[model.defaultScene].nodes) {
+    visitNode(nodeIdx, glm::mat4(1));
+  }
+}
+
+bool readPrimitiveTriangles(const tinygltf::Model &model,
+    const tinygltf::Primitive &primitive, std::vector<glm::vec3> &positions,
+    std::vector<uint32_t> &indices)
+{
+  positions.clear();
+  indices.clear();
+  const auto positionAttrIdxIt = primitive.attributes.find("POSITION");
+  if (primitive.mode != TINYGLTF_MODE_TRIANGLES ||
+      positionAttrIdxIt == end(primitive.attributes)) {
+    return false;
+  }
+  const auto &positionAccessor = model.accessors[(*positionAttrIdxIt).second];
+  if (positionAccessor.type != TINYGLTF_TYPE_VEC3 ||
+      positionAccessor.componentType != TINYGLTF_COMPONENT_TYPE_FLOAT ||
+      positionAccessor.bufferView < 0) {
+    return false;
+  }
+  const auto &positionBufferView =
+      model.bufferViews[positionAccessor.bufferView];
+  const auto byteOffset =
+      positionAccessor.byteOffset + positionBufferView.byteOffset;
+  const auto &positionBuffer = model.buffers[positionBufferView.buffer];
+  const auto positionByteStride = positionBufferView.byteStride
+                                      ? positionBufferView.byteStride
+                                      : 3 * sizeof(float);
+  positions.resize(positionAccessor.count);
+  for (size_t i = 0; i < positionAccessor.count; ++i) {
+    positions[i] = *((const glm::vec3 *)&positionBuffer
+                         .data[byteOffset + positionByteStride * i]);
+  }
+
+  if (primitive.indices < 0) {
+    indices.resize(positions.size() - positions.size() % 3);
+    for (size_t i = 0; i < indices.size(); ++i) {
+      indices[i] = uint32_t(i);
+    }
+    return true;
+  }
+
+  const auto &indexAccessor = model.accessors[primitive.indices];
+  const auto &indexBufferView = model.bufferViews[indexAccessor.bufferView];
+  const auto indexByteOffset =
+      indexAccessor.byteOffset + indexBufferView.byteOffset;
+  const auto &indexBuffer = model.buffers[indexBufferView.buffer];
+  size_t indexByteStride = indexBufferView.byteStride;
+  switch (indexAccessor.componentType) {
+  default:
+    return false;
+  case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
+    indexByteStride = indexByteStride ? indexByteStride : sizeof(uint8_t);
+    break;
+  case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT:
+    indexByteStride = indexByteStride ? indexByteStride : sizeof(uint16_t);
+    break;
+  case TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT:
+    indexByteStride = indexByteStride ? indexByteStride : sizeof(uint32_t);
+    break;
+  }
+  indices.resize(indexAccessor.count - indexAccessor.count % 3);
+  for (size_t i = 0; i < indices.size(); ++i) {
+    const auto ptr = &indexBuffer.data[indexByteOffset + indexByteStride * i];
+    switch (indexAccessor.componentType) {
+    case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
+      indices[i] = *((const uint8_t *)ptr);
+      break;
+    case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT:
+      indices[i] = *((const uint16_t *)ptr);
+      break;
+    case TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT:
+      indices[i] = *((const uint32_t *)ptr);
+      break;
+    }
+    if (indices[i] >= positions.size()) {
+      std::cerr << "Primitive index out of range, skipping it." << std::endl;
+      indices.clear();
+      return false;
+    }
+  }
+  return true;
+}
+
+namespace {
+
+// Convert count elements of componentCount components starting at data,
+// byteStride bytes apart, false for unsupported component types
+bool convertFloats(int componentType, const unsigned char *data,
+    size_t byteStride, size_t count, size_t componentCount, float *values)
+{
+  const auto componentSize =
+      size_t(tinygltf::GetComponentSizeInBytes(uint32_t(componentType)));
+  for (size_t i = 0; i < count; ++i) {
+    const auto element = data + byteStride * i;
+    for (size_t c = 0; c < componentCount; ++c) {
+      const auto ptr = element + componentSize * c;
+      auto &value = values[componentCount * i + c];
+      switch (componentType) {
+      case TINYGLTF_COMPONENT_TYPE_FLOAT:
+        value = *((const float *)ptr);
+        break;
+      case TINYGLTF_COMPONENT_TYPE_BYTE:
+        value = std::max(*((const int8_t *)ptr) / 127.f, -1.f);
+        break;
+      case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
+        value = *((const uint8_t *)ptr) / 255.f;
+        break;
+      case TINYGLTF_COMPONENT_TYPE_SHORT:
+        value = std::max(*((const int16_t *)ptr) / 32767.f, -1.f);
+        break;
+      case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT:
+        value = *((const uint16_t *)ptr) / 65535.f;
+        break;
+      default:
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+} // namespace
+
+bool readAccessorFloats(const tinygltf::Model &model,
+    const tinygltf::Accessor &accessor, std::vector<float> &values)
+{
+  const auto componentCount =
+      size_t(tinygltf::GetNumComponentsInType(uint32_t(accessor.type)));
+  values.assign(componentCount * accessor.count, 0.f);
+  if (accessor.bufferView >= 0) {
+    const auto componentSize = size_t(
+        tinygltf::GetComponentSizeInBytes(uint32_t(accessor.componentType)));
+    const auto &bufferView = model.bufferViews[accessor.bufferView];
+    const auto &buffer = model.buffers[bufferView.buffer];
+    const auto byteOffset = accessor.byteOffset + bufferView.byteOffset;
+    const auto byteStride = bufferView.byteStride
+                                ? bufferView.byteStride
+                                : componentCount * componentSize;
+    if (byteOffset + byteStride * (accessor.count ? accessor.count - 1 : 0) +
+                componentCount * componentSize >
+            buffer.data.size() ||
+        !convertFloats(accessor.componentType, &buffer.data[byteOffset],
+            byteStride, accessor.count, componentCount, values.data())) {
+      values.clear();
+      return false;
+    }
+  }
+  if (accessor.sparse.isSparse) {
+    // Substitute the sparse values
+    std::vector<uint32_t> sparseIndices;
+    std::vector<float> sparseValues;
+    if (!readSparseAccessorFloats(
+            model, accessor, sparseIndices, sparseValues)) {
+      values.clear();
+      return false;
+    }
+    for (size_t i = 0; i < sparseIndices.size(); ++i) {
+      std::copy_n(&sparseValues[componentCount * i], componentCount,
+          &values[componentCount * sparseIndices[i]]);
+    }
+  }
+  return true;
+}
+
+bool readSparseAccessorFloats(const tinygltf::Model &model,
+    const tinygltf::Accessor &accessor, std::vector<uint32_t> &indices,
+    std::vector<float> &values)
+{
+  indices.clear();
+  values.clear();
+  if (!accessor.sparse.isSparse) {
+    return true;
+  }
+  const auto &sparse = accessor.sparse;
+  const auto count = size_t(sparse.count);
+  const auto componentCount =
+      size_t(tinygltf::GetNumComponentsInType(uint32_t(accessor.type)));
+  const auto componentSize = size_t(
+      tinygltf::GetComponentSizeInBytes(uint32_t(accessor.componentType)));
+  const auto indexSize = size_t(tinygltf::GetComponentSizeInBytes(
+      uint32_t(sparse.indices.componentType)));
+  if (sparse.indices.bufferView < 0 ||
+      size_t(sparse.indices.bufferView) >= model.bufferViews.size() ||
+      sparse.values.bufferView < 0 ||
+      size_t(sparse.values.bufferView) >= model.bufferViews.size()) {
+    return false;
+  }
+  const auto &indexView = model.bufferViews[sparse.indices.bufferView];
+  const auto &indexBuffer = model.buffers[indexView.buffer].data;
+  const auto indexOffset = indexView.byteOffset + sparse.indices.byteOffset;
+  const auto &valueView = model.bufferViews[sparse.values.bufferView];
+  const auto &valueBuffer = model.buffers[valueView.buffer].data;
+  const auto valueOffset = valueView.byteOffset + sparse.values.byteOffset;
+  // Sparse values are tightly packed
+  const auto valueSize = componentCount * componentSize;
+  if (indexOffset + indexSize * count > indexBuffer.size() ||
+      valueOffset + valueSize * count > valueBuffer.size()) {
+    return false;
+  }
+
+  indices.resize(count);
+  for (size_t i = 0; i < count; ++i) {
+    const auto ptr = &indexBuffer[indexOffset + indexSize * i];
+    switch (sparse.indices.componentType) {
+    case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
+      indices[i] = *((const uint8_t *)ptr);
+      break;
+    case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT:
+      indices[i] = *((const uint16_t *)ptr);
+      break;
+    case TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT:
+      indices[i] = *((const uint32_t *)ptr);
+      break;
+    default:
+      indices.clear();
+      return false;
+    }
+    if (indices[i] >= accessor.count) {
+      indices.clear();
+      return false;
+    }
+  }
+  values.resize(componentCount * count);
+  if (!convertFloats(accessor.componentType, &valueBuffer[valueOffset],
+          valueSize, count, componentCount, values.data())) {
+    indices.clear();
+    values.clear();
+    return false;
+  }
+  return true;
+}
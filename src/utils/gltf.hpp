@@ -3,8 +3,32 @@
 #include <glm/glm.hpp>
 #include <tiny_gltf.h>
 
+#include <vector>
+
 glm::mat4 getLocalToWorldMatrix(
     const tinygltf::Node &node, const glm::mat4 &parentMatrix);
 
 void computeSceneBounds(
-    const tinygltf::Model &model, glm::vec3 &bboxMin, glm::vec3 &bboxMax);
\ No newline at end of file
+    const tinygltf::Model &model, glm::vec3 &bboxMin, glm::vec3 &bboxMax);
+
+// Flatten the node hierarchy of the default scene into the list of its mesh
+// instances: meshIndices[i] is drawn with modelMatrices[i], and is the mesh of
+// node (*nodeIndices)[i] when nodeIndices is not null
+void flattenScene(const tinygltf::Model &model, std::vector<int> &meshIndices,
+    std::vector<glm::mat4> &modelMatrices,
+    std::vector<int> *nodeIndices = nullptr);
+// Read the local space positions and triangle indices of a primitive, false
+// if it is not made of triangles with float positions
+bool readPrimitiveTriangles(const tinygltf::Model &model,
+    const tinygltf::Primitive &primitive, std::vector<glm::vec3> &positions,
+    std::vector<uint32_t> &indices);
+// Read the components of a float or normalized integer accessor, integers
+// being converted to [0, 1] or [-1, 1], sparse values included. False for
+// other component types.
+bool readAccessorFloats(const tinygltf::Model &model,
+    const tinygltf::Accessor &accessor, std::vector<float> &values);
+// Read only the sparse values of an accessor and the indices of the elements
+// they replace, without densifying them. Empty if it is not sparse.
+bool readSparseAccessorFloats(const tinygltf::Model &model,
+    const tinygltf::Accessor &accessor, std::vector<uint32_t> &indices,
+    std::vector<float> &values);
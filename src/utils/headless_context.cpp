@@ -0,0 +1,176 @@
+#include "headless_context.hpp"
+
+#ifdef GLTF_VIEWER_USE_EGL
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+#include <cstring>
+#include <iostream>
+#include <utility>
+#include <vector>
+
+namespace {
+
+bool hasExtension(const char *extensions, const char *name)
+{
+  if (!extensions) {
+    return false;
+  }
+  const auto length = std::strlen(name);
+  for (auto p = std::strstr(extensions, name); p;
+       p = std::strstr(p + length, name)) {
+    const auto begins = p == extensions || p[-1] == ' ';
+    const auto ends = p[length] == ' ' || p[length] == '\0';
+    if (begins && ends) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Displays to try in order, with the name of their platform
+std::vector<std::pair<EGLDisplay, const char *>> candidateDisplays()
+{
+  std::vector<std::pair<EGLDisplay, const char *>> displays;
+  // Null without EGL_EXT_client_extensions
+  const auto clientExtensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+  const auto getPlatformDisplay =
+      (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress(
+          "eglGetPlatformDisplayEXT");
+  if (getPlatformDisplay) {
+    if (hasExtension(clientExtensions, "EGL_MESA_platform_surfaceless")) {
+      const auto display = getPlatformDisplay(
+          EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+      if (display != EGL_NO_DISPLAY) {
+        displays.emplace_back(display, "surfaceless");
+      }
+    }
+    const auto queryDevices =
+        (PFNEGLQUERYDEVICESEXTPROC)eglGetProcAddress("eglQueryDevicesEXT");
+    EGLDeviceEXT device = nullptr;
+    EGLint deviceCount = 0;
+    if (hasExtension(clientExtensions, "EGL_EXT_platform_device") &&
+        queryDevices && queryDevices(1, &device, &deviceCount) &&
+        deviceCount > 0) {
+      const auto display =
+          getPlatformDisplay(EGL_PLATFORM_DEVICE_EXT, device, nullptr);
+      if (display != EGL_NO_DISPLAY) {
+        displays.emplace_back(display, "device");
+      }
+    }
+  }
+  const auto display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+  if (display != EGL_NO_DISPLAY) {
+    displays.emplace_back(display, "default");
+  }
+  return displays;
+}
+
+} // namespace
+
+HeadlessContext::~HeadlessContext() { destroy(); }
+
+void HeadlessContext::destroy()
+{
+  if (!m_display) {
+    return;
+  }
+  eglMakeCurrent(m_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+  if (m_surface) {
+    eglDestroySurface(m_display, m_surface);
+  }
+  if (m_context) {
+    eglDestroyContext(m_display, m_context);
+  }
+  eglTerminate(m_display);
+  m_display = m_context = m_surface = nullptr;
+}
+
+bool HeadlessContext::create(int majorVersion, int minorVersion)
+{
+  destroy();
+  for (const auto &candidate : candidateDisplays()) {
+    const auto display = candidate.first;
+    EGLint eglMajor = 0;
+    EGLint eglMinor = 0;
+    if (!eglInitialize(display, &eglMajor, &eglMinor)) {
+      continue;
+    }
+    m_display = display;
+    if (!eglBindAPI(EGL_OPENGL_API)) {
+      destroy();
+      continue;
+    }
+
+    const EGLint configAttributes[] = {EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_RED_SIZE, 8, EGL_GREEN_SIZE,
+        8, EGL_BLUE_SIZE, 8, EGL_ALPHA_SIZE, 8, EGL_DEPTH_SIZE, 24, EGL_NONE};
+    EGLConfig config = nullptr;
+    EGLint configCount = 0;
+    eglChooseConfig(display, configAttributes, &config, 1, &configCount);
+    const auto extensions = eglQueryString(display, EGL_EXTENSIONS);
+    if (configCount == 0 &&
+        !hasExtension(extensions, "EGL_KHR_no_config_context")) {
+      destroy();
+      continue;
+    }
+    const auto surfaceless =
+        hasExtension(extensions, "EGL_KHR_surfaceless_context");
+    if (configCount == 0 && !surfaceless) {
+      destroy();
+      continue;
+    }
+
+    std::vector<EGLint> contextAttributes = {EGL_CONTEXT_MAJOR_VERSION,
+        majorVersion, EGL_CONTEXT_MINOR_VERSION, minorVersion,
+        EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT};
+    if (eglMajor > 1 || eglMinor >= 5) {
+      contextAttributes.insert(
+          end(contextAttributes), {EGL_CONTEXT_OPENGL_DEBUG, EGL_TRUE});
+    }
+    contextAttributes.push_back(EGL_NONE);
+    m_context = eglCreateContext(display,
+        configCount ? config : EGL_NO_CONFIG_KHR, EGL_NO_CONTEXT,
+        contextAttributes.data());
+    if (!m_context) {
+      destroy();
+      continue;
+    }
+
+    if (!surfaceless) {
+      const EGLint pbufferAttributes[] = {
+          EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE};
+      m_surface = eglCreatePbufferSurface(display, config, pbufferAttributes);
+      if (!m_surface) {
+        destroy();
+        continue;
+      }
+    }
+    if (!eglMakeCurrent(display, m_surface, m_surface, m_context)) {
+      destroy();
+      continue;
+    }
+    std::clog << "Headless OpenGL context on the EGL " << candidate.second
+              << " platform" << std::endl;
+    return true;
+  }
+  return false;
+}
+
+void *HeadlessContext::getProcAddress(const char *name)
+{
+  return (void *)eglGetProcAddress(name);
+}
+
+#else
+
+HeadlessContext::~HeadlessContext() { destroy(); }
+
+void HeadlessContext::destroy() {}
+
+bool HeadlessContext::create(int, int) { return false; }
+
+void *HeadlessContext::getProcAddress(const char *) { return nullptr; }
+
+#endif
@@ -0,0 +1,34 @@
+#pragma once
+
+// OpenGL context without window nor display, for offline renders on display
+// less machines (render nodes, Mesa llvmpipe in CI). It is created with EGL on
+// the surfaceless platform of Mesa, else on the first EGL device, else on the
+// default EGL display, and made current without surface when
+// EGL_KHR_surfaceless_context is exposed, with a 1x1 pbuffer otherwise: the
+// default framebuffer is not usable, images are rendered to framebuffer
+// objects. Only available when built with GLTF_VIEWER_USE_EGL.
+class HeadlessContext
+{
+public:
+  HeadlessContext() = default;
+  ~HeadlessContext();
+  HeadlessContext(const HeadlessContext &) = delete;
+  HeadlessContext &operator=(const HeadlessContext &) = delete;
+
+  // Create a core profile context of the version and make it current, false
+  // if no EGL display supports it
+  bool create(int majorVersion, int minorVersion);
+  bool created() const { return m_context != nullptr; }
+
+  // Loader of the OpenGL functions, for gladLoadGLLoader()
+  static void *getProcAddress(const char *name);
+
+private:
+  void destroy();
+
+  // EGLDisplay, EGLContext and EGLSurface, EGL headers being kept out of the
+  // includes of GLFWHandle.hpp
+  void *m_display = nullptr;
+  void *m_context = nullptr;
+  void *m_surface = nullptr;
+};
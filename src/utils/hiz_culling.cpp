@@ -0,0 +1,353 @@
+#include "hiz_culling.hpp"
+#include "gl_context.hpp"
+#include "gltf.hpp"
+
+#include <glm/gtc/type_ptr.hpp>
+
+#include <iostream>
+#include <map>
+#include <utility>
+
+namespace {
+
+// From GL_ARB_indirect_parameters
+const GLenum PARAMETER_BUFFER = 0x80EE;
+
+// Bytes before the commands in m_commandBuffer: compacted draw count of each
+// pass, padded to 16 bytes
+const GLintptr DRAW_COUNTS_SIZE = 4 * sizeof(GLuint);
+
+GLsizei previousPowerOfTwo(GLsizei value)
+{
+  GLsizei result = 1;
+  while (2 * result <= value) {
+    result *= 2;
+  }
+  return result;
+}
+
+GLuint createBuffer(GLenum target, GLsizeiptr size, const void *data)
+{
+  GLuint buffer = 0;
+  glGenBuffers(1, &buffer);
+  glBindBuffer(target, buffer);
+  // Never allocate an empty buffer
+  glBufferStorage(target, std::max(size, GLsizeiptr(16)),
+      size ? data : nullptr, 0);
+  glBindBuffer(target, 0);
+  return buffer;
+}
+
+} // namespace
+
+HiZCuller::~HiZCuller()
+{
+  if (!initialized()) {
+    return;
+  }
+  glDeleteVertexArrays(1, &m_vao);
+  const GLuint buffers[] = {m_positionBuffer, m_indexBuffer,
+      m_modelMatrixBuffer, m_drawInfoBuffer, m_commandBuffer,
+      m_visibilityBuffer, m_shadingCommandBuffer};
+  glDeleteBuffers(GLsizei(sizeof(buffers) / sizeof(buffers[0])), buffers);
+  glDeleteFramebuffers(1, &m_depthFBO);
+  glDeleteTextures(1, &m_depthTexture);
+  glDeleteTextures(1, &m_pyramidTexture);
+}
+
+void HiZCuller::init(const tinygltf::Model &model,
+    const std::vector<int> &meshIndices,
+    const std::vector<glm::mat4> &modelMatrices, GLsizei width, GLsizei height)
+{
+  m_width = width;
+  m_height = height;
+
+  const auto bounds = computeInstanceBounds(model, meshIndices, modelMatrices);
+
+  // Packed geometry of each primitive, shared by the instances of its mesh
+  std::map<std::pair<int, size_t>, DrawElementsIndirectCommand> packedCommands;
+  std::vector<glm::vec3> packedPositions;
+  std::vector<GLuint> packedIndices;
+  std::vector<glm::vec3> positions;
+  std::vector<uint32_t> indices;
+
+  std::vector<DrawInfo> drawInfos;
+  std::vector<glm::mat4> drawModelMatrices;
+  std::vector<DrawElementsIndirectCommand> shadingCommands;
+
+  for (size_t instanceIdx = 0; instanceIdx < meshIndices.size();
+       ++instanceIdx) {
+    const auto meshIdx = meshIndices[instanceIdx];
+    const auto &mesh = model.meshes[meshIdx];
+    for (size_t i = 0; i < mesh.primitives.size(); ++i) {
+      const auto &primitive = mesh.primitives[i];
+      const auto shadingCommandIndex = GLuint(shadingCommands.size());
+
+      DrawElementsIndirectCommand shadingCommand = {0, 1, 0, 0, 0};
+      if (primitive.indices >= 0) {
+        const auto &accessor = model.accessors[primitive.indices];
+        const auto &bufferView = model.bufferViews[accessor.bufferView];
+        const auto byteOffset = accessor.byteOffset + bufferView.byteOffset;
+        shadingCommand.count = GLuint(accessor.count);
+        shadingCommand.firstIndex =
+            GLuint(byteOffset / tinygltf::GetComponentSizeInBytes(
+                                    accessor.componentType));
+      } else if (!primitive.attributes.empty()) {
+        const auto accessorIdx = (*begin(primitive.attributes)).second;
+        shadingCommand.count = GLuint(model.accessors[accessorIdx].count);
+      }
+      shadingCommands.push_back(shadingCommand);
+
+      const auto &box = bounds[shadingCommandIndex];
+      if (box.min.x > box.max.x) {
+        continue;
+      }
+      auto it = packedCommands.find({meshIdx, i});
+      if (it == end(packedCommands)) {
+        DrawElementsIndirectCommand command = {0, 1, 0, 0, 0};
+        if (readPrimitiveTriangles(model, primitive, positions, indices)) {
+          command.count = GLuint(indices.size());
+          command.firstIndex = GLuint(packedIndices.size());
+          command.baseVertex = GLint(packedPositions.size());
+          packedPositions.insert(
+              end(packedPositions), begin(positions), end(positions));
+          packedIndices.insert(
+              end(packedIndices), begin(indices), end(indices));
+        }
+        it = packedCommands.emplace(std::make_pair(meshIdx, i), command).first;
+      }
+      if ((*it).second.count == 0) {
+        continue;
+      }
+
+      DrawInfo drawInfo = {};
+      drawInfo.bboxMin = box.min;
+      drawInfo.shadingCommandIndex = shadingCommandIndex;
+      drawInfo.bboxMax = box.max;
+      drawInfo.command = (*it).second;
+      drawInfo.command.baseInstance = GLuint(drawInfos.size());
+      drawInfos.push_back(drawInfo);
+      drawModelMatrices.push_back(modelMatrices[instanceIdx]);
+    }
+  }
+  m_packedDrawCount = drawInfos.size();
+
+  m_positionBuffer = createBuffer(GL_ARRAY_BUFFER,
+      GLsizeiptr(packedPositions.size() * sizeof(glm::vec3)),
+      packedPositions.data());
+  m_indexBuffer = createBuffer(GL_ELEMENT_ARRAY_BUFFER,
+      GLsizeiptr(packedIndices.size() * sizeof(GLuint)), packedIndices.data());
+  m_modelMatrixBuffer = createBuffer(GL_ARRAY_BUFFER,
+      GLsizeiptr(drawModelMatrices.size() * sizeof(glm::mat4)),
+      drawModelMatrices.data());
+  m_drawInfoBuffer = createBuffer(GL_SHADER_STORAGE_BUFFER,
+      GLsizeiptr(drawInfos.size() * sizeof(DrawInfo)), drawInfos.data());
+
+  // Written by the culling shader
+  const auto createDynamicBuffer = [](GLsizeiptr size, const void *data) {
+    GLuint buffer = 0;
+    glGenBuffers(1, &buffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, std::max(size, GLsizeiptr(16)),
+        data, GL_DYNAMIC_COPY);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    return buffer;
+  };
+  m_commandBuffer = createDynamicBuffer(
+      DRAW_COUNTS_SIZE + GLsizeiptr(4 * m_packedDrawCount *
+                                    sizeof(DrawElementsIndirectCommand)),
+      nullptr);
+  const std::vector<GLuint> visibility(m_packedDrawCount, 1);
+  m_visibilityBuffer = createDynamicBuffer(
+      GLsizeiptr(visibility.size() * sizeof(GLuint)), visibility.data());
+  m_shadingCommandBuffer = createDynamicBuffer(
+      GLsizeiptr(shadingCommands.size() * sizeof(DrawElementsIndirectCommand)),
+      shadingCommands.data());
+
+  glGenVertexArrays(1, &m_vao);
+  glBindVertexArray(m_vao);
+  glBindBuffer(GL_ARRAY_BUFFER, m_positionBuffer);
+  glEnableVertexAttribArray(0);
+  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, nullptr);
+  glBindBuffer(GL_ARRAY_BUFFER, m_modelMatrixBuffer);
+  for (GLuint column = 0; column < 4; ++column) {
+    glEnableVertexAttribArray(1 + column);
+    glVertexAttribPointer(1 + column, 4, GL_FLOAT, GL_FALSE,
+        sizeof(glm::mat4), (const GLvoid *)(column * sizeof(glm::vec4)));
+    glVertexAttribDivisor(1 + column, 1);
+  }
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_indexBuffer);
+  glBindVertexArray(0);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+  createDepthBuffers();
+
+  if (isGLExtensionSupported("GL_ARB_indirect_parameters")) {
+    m_multiDrawElementsIndirectCount =
+        (MultiDrawElementsIndirectCountProc)getGLProcAddress(
+            "glMultiDrawElementsIndirectCountARB");
+  }
+
+  std::clog << "Hi-Z culling: " << m_packedDrawCount << " packed draws, "
+            << packedIndices.size() / 3 << " triangles, "
+            << previousPowerOfTwo(m_width) << "x"
+            << previousPowerOfTwo(m_height) << " depth pyramid"
+            << (m_multiDrawElementsIndirectCount ? ", compacted draws" : "")
+            << std::endl;
+}
+
+void HiZCuller::resize(GLsizei width, GLsizei height)
+{
+  if (!initialized() || (width == m_width && height == m_height)) {
+    return;
+  }
+  glDeleteFramebuffers(1, &m_depthFBO);
+  glDeleteTextures(1, &m_depthTexture);
+  glDeleteTextures(1, &m_pyramidTexture);
+  m_width = width;
+  m_height = height;
+  createDepthBuffers();
+}
+
+void HiZCuller::createDepthBuffers()
+{
+  glGenTextures(1, &m_depthTexture);
+  glBindTexture(GL_TEXTURE_2D, m_depthTexture);
+  glTexStorage2D(GL_TEXTURE_2D, 1, GL_DEPTH_COMPONENT32F, m_width, m_height);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  const float farDepth = 1.f;
+  glClearTexImage(m_depthTexture, 0, GL_DEPTH_COMPONENT, GL_FLOAT, &farDepth);
+
+  glGenFramebuffers(1, &m_depthFBO);
+  glBindFramebuffer(GL_FRAMEBUFFER, m_depthFBO);
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D,
+      m_depthTexture, 0);
+  glDrawBuffer(GL_NONE);
+  glReadBuffer(GL_NONE);
+  const auto status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+  if (status != GL_FRAMEBUFFER_COMPLETE) {
+    std::cerr << "Hi-Z framebuffer is not complete: " << status << std::endl;
+  }
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+  const auto pyramidWidth = previousPowerOfTwo(m_width);
+  const auto pyramidHeight = previousPowerOfTwo(m_height);
+  m_pyramidLevelCount = 1;
+  while ((std::max(pyramidWidth, pyramidHeight) >> m_pyramidLevelCount) > 0) {
+    ++m_pyramidLevelCount;
+  }
+  glGenTextures(1, &m_pyramidTexture);
+  glBindTexture(GL_TEXTURE_2D, m_pyramidTexture);
+  glTexStorage2D(GL_TEXTURE_2D, m_pyramidLevelCount, GL_R32F, pyramidWidth,
+      pyramidHeight);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  // Everything is visible in the first frame
+  for (GLint level = 0; level < m_pyramidLevelCount; ++level) {
+    glClearTexImage(m_pyramidTexture, level, GL_RED, GL_FLOAT, &farDepth);
+  }
+  glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+void HiZCuller::cull(const glm::mat4 &viewProjMatrix,
+    const GLProgram &depthProgram, const GLProgram &pyramidProgram,
+    const GLProgram &cullProgram)
+{
+  if (m_packedDrawCount == 0) {
+    return;
+  }
+  GLint previousFramebuffer = 0;
+  glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &previousFramebuffer);
+  GLint previousViewport[4];
+  glGetIntegerv(GL_VIEWPORT, previousViewport);
+
+  const GLuint drawCounts[4] = {0, 0, 0, 0};
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_commandBuffer);
+  glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(drawCounts), drawCounts);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, m_drawInfoBuffer);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, m_commandBuffer);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, m_visibilityBuffer);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, m_shadingCommandBuffer);
+
+  // The depth buffer holds the draws of both passes of the previous frame
+  buildPyramid(pyramidProgram);
+  cullPass(0, viewProjMatrix, cullProgram);
+  drawPass(0, viewProjMatrix, depthProgram);
+  buildPyramid(pyramidProgram);
+  cullPass(1, viewProjMatrix, cullProgram);
+  drawPass(1, viewProjMatrix, depthProgram);
+
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, previousFramebuffer);
+  glViewport(previousViewport[0], previousViewport[1], previousViewport[2],
+      previousViewport[3]);
+}
+
+void HiZCuller::buildPyramid(const GLProgram &pyramidProgram)
+{
+  pyramidProgram.use();
+  glActiveTexture(GL_TEXTURE0);
+  glUniform1i(pyramidProgram.getUniformLocation("uInput"), 0);
+  const auto uInputLevel = pyramidProgram.getUniformLocation("uInputLevel");
+  for (GLint level = 0; level < m_pyramidLevelCount; ++level) {
+    glBindTexture(
+        GL_TEXTURE_2D, level == 0 ? m_depthTexture : m_pyramidTexture);
+    glUniform1i(uInputLevel, level == 0 ? 0 : level - 1);
+    glBindImageTexture(
+        0, m_pyramidTexture, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+    const auto width = std::max(previousPowerOfTwo(m_width) >> level, 1);
+    const auto height = std::max(previousPowerOfTwo(m_height) >> level, 1);
+    glDispatchCompute(GLuint(width + 7) / 8, GLuint(height + 7) / 8, 1);
+    glMemoryBarrier(
+        GL_TEXTURE_FETCH_BARRIER_BIT | GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+  }
+}
+
+void HiZCuller::cullPass(GLuint pass, const glm::mat4 &viewProjMatrix,
+    const GLProgram &cullProgram)
+{
+  cullProgram.use();
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, m_pyramidTexture);
+  glUniform1i(cullProgram.getUniformLocation("uDepthPyramid"), 0);
+  glUniformMatrix4fv(cullProgram.getUniformLocation("uViewProjMatrix"), 1,
+      GL_FALSE, glm::value_ptr(viewProjMatrix));
+  glUniform1ui(
+      cullProgram.getUniformLocation("uDrawCount"), GLuint(m_packedDrawCount));
+  glUniform1ui(cullProgram.getUniformLocation("uPass"), pass);
+  glDispatchCompute(GLuint(m_packedDrawCount + 63) / 64, 1, 1);
+  glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+void HiZCuller::drawPass(GLuint pass, const glm::mat4 &viewProjMatrix,
+    const GLProgram &depthProgram)
+{
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_depthFBO);
+  glViewport(0, 0, m_width, m_height);
+  if (pass == 0) {
+    glClear(GL_DEPTH_BUFFER_BIT);
+  }
+  depthProgram.use();
+  glUniformMatrix4fv(depthProgram.getUniformLocation("uViewProjMatrix"), 1,
+      GL_FALSE, glm::value_ptr(viewProjMatrix));
+  glBindVertexArray(m_vao);
+  glBindBuffer(GL_DRAW_INDIRECT_BUFFER, m_commandBuffer);
+  const auto commandSize = GLintptr(sizeof(DrawElementsIndirectCommand));
+  if (m_multiDrawElementsIndirectCount) {
+    glBindBuffer(PARAMETER_BUFFER, m_commandBuffer);
+    m_multiDrawElementsIndirectCount(GL_TRIANGLES, GL_UNSIGNED_INT,
+        (const void *)(DRAW_COUNTS_SIZE +
+                       (2 + pass) * m_packedDrawCount * commandSize),
+        GLintptr(pass * sizeof(GLuint)), GLsizei(m_packedDrawCount), 0);
+    glBindBuffer(PARAMETER_BUFFER, 0);
+  } else {
+    // Culled commands have an instance count of 0
+    const auto commands =
+        DRAW_COUNTS_SIZE + pass * m_packedDrawCount * commandSize;
+    glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT,
+        (const void *)commands, GLsizei(m_packedDrawCount), 0);
+  }
+  glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+  glBindVertexArray(0);
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+#include "occlusion_culling.hpp"
+#include "shaders.hpp"
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <tiny_gltf.h>
+
+#include <vector>
+
+// Command of glDrawElementsIndirect. glDrawArraysIndirect reads its first 4
+// members as count, instanceCount, first and baseInstance.
+struct DrawElementsIndirectCommand
+{
+  GLuint count;
+  GLuint instanceCount;
+  GLuint firstIndex;
+  GLint baseVertex;
+  GLuint baseInstance;
+};
+
+// GPU two-pass hierarchical-Z occlusion culling, see hiz_cull.cs.glsl.
+// The triangles of the scene are packed in shared buffers so that their depth
+// is rendered with one multi draw indirect call per pass, in an internal depth
+// buffer from which the depth pyramid is built. The result is the instance
+// count of one indirect command per primitive, that the shading passes draw
+// with their own VAOs and materials: culled primitives cost a draw call but
+// no vertex work, and the visibility is never read back on the CPU.
+// The packed draws bake the model matrices, this is for static scenes.
+class HiZCuller
+{
+public:
+  HiZCuller() = default;
+  ~HiZCuller();
+  HiZCuller(const HiZCuller &) = delete;
+  HiZCuller &operator=(const HiZCuller &) = delete;
+
+  // Compute shaders, glMultiDrawElementsIndirect and glClearTexImage
+  static bool isSupported() { return GLAD_GL_VERSION_4_4 != 0; }
+
+  // Pack the triangle primitives of the mesh instances returned by
+  // flattenScene(), the other primitives are never culled. width and height
+  // are the size of the rendered images.
+  void init(const tinygltf::Model &model, const std::vector<int> &meshIndices,
+      const std::vector<glm::mat4> &modelMatrices, GLsizei width,
+      GLsizei height);
+  bool initialized() const { return m_vao != 0; }
+
+  // Resize the depth buffer and pyramid for images of width by height pixels
+  void resize(GLsizei width, GLsizei height);
+
+  // Run both culling passes for the current view, the depth pyramid is then
+  // the one of the next frame. Depth test must be enabled with GL_LESS. The
+  // draw framebuffer and viewport are restored, texture unit 0 and the
+  // storage buffer bindings 3 to 6 are modified.
+  void cull(const glm::mat4 &viewProjMatrix, const GLProgram &depthProgram,
+      const GLProgram &pyramidProgram, const GLProgram &cullProgram);
+
+  // One command per primitive of the mesh instances, in drawing order
+  GLuint shadingCommandBuffer() const { return m_shadingCommandBuffer; }
+  size_t packedDrawCount() const { return m_packedDrawCount; }
+  // After cull(), built from the depth of the draws of the first pass
+  GLuint depthPyramid() const { return m_pyramidTexture; }
+
+private:
+  // std430 layout of DrawInfo in hiz_cull.cs.glsl
+  struct DrawInfo
+  {
+    glm::vec3 bboxMin;
+    GLuint shadingCommandIndex;
+    glm::vec3 bboxMax;
+    GLuint padding;
+    DrawElementsIndirectCommand command;
+    GLuint structPadding[3];
+  };
+
+  // Depth buffer, its framebuffer and depth pyramid of m_width by m_height
+  void createDepthBuffers();
+  void buildPyramid(const GLProgram &pyramidProgram);
+  void cullPass(GLuint pass, const glm::mat4 &viewProjMatrix,
+      const GLProgram &cullProgram);
+  void drawPass(GLuint pass, const glm::mat4 &viewProjMatrix,
+      const GLProgram &depthProgram);
+
+  size_t m_packedDrawCount = 0;
+  GLsizei m_width = 0;
+  GLsizei m_height = 0;
+  GLint m_pyramidLevelCount = 0;
+
+  GLuint m_vao = 0;
+  GLuint m_positionBuffer = 0;
+  GLuint m_indexBuffer = 0;
+  GLuint m_modelMatrixBuffer = 0;
+  GLuint m_drawInfoBuffer = 0;
+  GLuint m_commandBuffer = 0;
+  GLuint m_visibilityBuffer = 0;
+  GLuint m_shadingCommandBuffer = 0;
+  GLuint m_depthFBO = 0;
+  GLuint m_depthTexture = 0;
+  GLuint m_pyramidTexture = 0;
+
+  // GL_ARB_indirect_parameters, to only draw the compacted commands
+  typedef void(APIENTRYP MultiDrawElementsIndirectCountProc)(GLenum mode,
+      GLenum type, const void *indirect, GLintptr drawcount,
+      GLsizei maxdrawcount, GLsizei stride);
+  MultiDrawElementsIndirectCountProc m_multiDrawElementsIndirectCount =
+      nullptr;
+};
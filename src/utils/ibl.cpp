@@ -0,0 +1,409 @@
+#include "ibl.hpp"
+
+#include <glm/gtc/constants.hpp>
+#include <glm/gtc/packing.hpp>
+#include <stb_image.h>
+
+#include <algorithm>
+#include <array>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+namespace {
+
+const float PI = glm::pi<float>();
+
+// Bumped when the precomputation changes, to invalidate cached files
+const uint32_t IBL_CACHE_VERSION = 1;
+
+// Largest texture size read from a cache file, larger ones are corrupted
+const int IBL_CACHE_MAX_SIZE = 4096;
+
+// Direction of the texel (s, t) in [-1, 1]^2 of a cubemap face, see the
+// OpenGL specification "Cube Map Texture Selection"
+glm::vec3 cubeMapDirection(int face, float s, float t)
+{
+  switch (face) {
+  case 0:
+    return glm::vec3(1, -t, -s);
+  case 1:
+    return glm::vec3(-1, -t, s);
+  case 2:
+    return glm::vec3(s, 1, t);
+  case 3:
+    return glm::vec3(s, -1, -t);
+  case 4:
+    return glm::vec3(s, -t, 1);
+  default:
+    return glm::vec3(-s, -t, -1);
+  }
+}
+
+glm::vec2 equirectangularUV(const glm::vec3 &direction)
+{
+  return glm::vec2(std::atan2(direction.z, direction.x) * 0.5f / PI + 0.5f,
+      std::acos(glm::clamp(direction.y, -1.f, 1.f)) / PI);
+}
+
+glm::vec2 hammersley(uint32_t i, uint32_t count)
+{
+  auto bits = i;
+  bits = (bits << 16u) | (bits >> 16u);
+  bits = ((bits & 0x55555555u) << 1u) | ((bits & 0xAAAAAAAAu) >> 1u);
+  bits = ((bits & 0x33333333u) << 2u) | ((bits & 0xCCCCCCCCu) >> 2u);
+  bits = ((bits & 0x0F0F0F0Fu) << 4u) | ((bits & 0xF0F0F0F0u) >> 4u);
+  bits = ((bits & 0x00FF00FFu) << 8u) | ((bits & 0xFF00FF00u) >> 8u);
+  return glm::vec2(float(i) / float(count), float(bits) * 2.3283064365386963e-10f);
+}
+
+// Half vector distributed according to GGX around N
+glm::vec3 importanceSampleGGX(
+    const glm::vec2 &xi, const glm::vec3 &N, float alpha)
+{
+  const auto phi = 2.f * PI * xi.x;
+  const auto cosTheta =
+      std::sqrt((1.f - xi.y) / (1.f + (alpha * alpha - 1.f) * xi.y));
+  const auto sinTheta = std::sqrt(1.f - cosTheta * cosTheta);
+
+  const auto up =
+      std::abs(N.z) < 0.999f ? glm::vec3(0, 0, 1) : glm::vec3(1, 0, 0);
+  const auto T = glm::normalize(glm::cross(up, N));
+  const auto B = glm::cross(N, T);
+  return glm::normalize(T * (sinTheta * std::cos(phi)) +
+                        B * (sinTheta * std::sin(phi)) + N * cosTheta);
+}
+
+float distributionGGX(float NdotH, float alpha)
+{
+  const auto sqrAlpha = alpha * alpha;
+  const auto d = NdotH * NdotH * (sqrAlpha - 1.f) + 1.f;
+  return sqrAlpha / (PI * d * d);
+}
+
+// Mip levels of the environment, for filtered importance sampling
+// https://developer.nvidia.com/gpugems/gpugems3/part-iii-rendering/chapter-20-gpu-based-importance-sampling
+class EnvironmentPyramid
+{
+  std::vector<EnvironmentMap> m_levels;
+
+  glm::vec3 texel(const EnvironmentMap &level, int x, int y) const
+  {
+    x = (x % level.width + level.width) % level.width; // Repeat
+    y = glm::clamp(y, 0, level.height - 1);
+    const auto ptr = &level.pixels[3 * (x + y * size_t(level.width))];
+    return glm::vec3(ptr[0], ptr[1], ptr[2]);
+  }
+
+  glm::vec3 sampleLevel(const EnvironmentMap &level, const glm::vec2 &uv) const
+  {
+    const auto x = uv.x * level.width - 0.5f;
+    const auto y = uv.y * level.height - 0.5f;
+    const auto x0 = int(std::floor(x));
+    const auto y0 = int(std::floor(y));
+    const auto fx = x - x0;
+    const auto fy = y - y0;
+    return glm::mix(glm::mix(texel(level, x0, y0), texel(level, x0 + 1, y0), fx),
+        glm::mix(texel(level, x0, y0 + 1), texel(level, x0 + 1, y0 + 1), fx),
+        fy);
+  }
+
+public:
+  EnvironmentPyramid(const EnvironmentMap &environment)
+  {
+    m_levels.emplace_back(environment);
+    while (m_levels.back().width > 1 || m_levels.back().height > 1) {
+      const auto &previous = m_levels.back();
+      EnvironmentMap level;
+      level.width = glm::max(1, previous.width / 2);
+      level.height = glm::max(1, previous.height / 2);
+      level.pixels.resize(3 * size_t(level.width) * level.height);
+      for (int y = 0; y < level.height; ++y) {
+        for (int x = 0; x < level.width; ++x) {
+          const auto value =
+              0.25f * (texel(previous, 2 * x, 2 * y) +
+                          texel(previous, 2 * x + 1, 2 * y) +
+                          texel(previous, 2 * x, 2 * y + 1) +
+                          texel(previous, 2 * x + 1, 2 * y + 1));
+          const auto ptr = &level.pixels[3 * (x + y * size_t(level.width))];
+          ptr[0] = value.r;
+          ptr[1] = value.g;
+          ptr[2] = value.b;
+        }
+      }
+      m_levels.emplace_back(std::move(level));
+    }
+  }
+
+  int levelCount() const { return int(m_levels.size()); }
+
+  // Trilinear lookup, like textureLod on a mipmapped texture
+  glm::vec3 sample(const glm::vec3 &direction, float lod) const
+  {
+    const auto uv = equirectangularUV(direction);
+    lod = glm::clamp(lod, 0.f, float(levelCount() - 1));
+    const auto level = int(lod);
+    if (level == levelCount() - 1) {
+      return sampleLevel(m_levels[level], uv);
+    }
+    return glm::mix(sampleLevel(m_levels[level], uv),
+        sampleLevel(m_levels[level + 1], uv), lod - level);
+  }
+
+  float texelSolidAngle() const
+  {
+    return 4.f * PI / float(m_levels[0].width * m_levels[0].height);
+  }
+};
+
+uint64_t hash(const char *data, size_t size, uint64_t h)
+{
+  // FNV-1a
+  for (size_t i = 0; i < size; ++i) {
+    h ^= uint8_t(data[i]);
+    h *= 1099511628211ull;
+  }
+  return h;
+}
+
+} // namespace
+
+bool loadEnvironmentMap(const fs::path &path, EnvironmentMap &environment)
+{
+  int componentCount = 0;
+  const auto pixels = stbi_loadf(path.string().c_str(), &environment.width,
+      &environment.height, &componentCount, 3);
+  if (!pixels) {
+    std::cerr << "Unable to load environment map " << path << ": "
+              << stbi_failure_reason() << std::endl;
+    return false;
+  }
+  environment.pixels.assign(
+      pixels, pixels + 3 * size_t(environment.width) * environment.height);
+  stbi_image_free(pixels);
+  return true;
+}
+
+void computeIrradianceSH(
+    const EnvironmentMap &environment, IBLData &ibl, ThreadPool &threadPool)
+{
+  const auto width = environment.width;
+  const auto height = environment.height;
+
+  // One sum per row so that the result does not depend on thread scheduling
+  std::vector<std::array<glm::vec3, 9>> rowSums(height);
+  threadPool.parallelFor(height, [&](int y) {
+    auto &sum = rowSums[y];
+    sum.fill(glm::vec3(0));
+    const auto theta = PI * (y + 0.5f) / height;
+    const auto solidAngle =
+        (2.f * PI / width) * (PI / height) * std::sin(theta);
+    for (int x = 0; x < width; ++x) {
+      const auto phi = 2.f * PI * ((x + 0.5f) / width - 0.5f);
+      const glm::vec3 d(std::sin(theta) * std::cos(phi), std::cos(theta),
+          std::sin(theta) * std::sin(phi));
+      const auto ptr = &environment.pixels[3 * (x + y * size_t(width))];
+      const auto radiance = glm::vec3(ptr[0], ptr[1], ptr[2]) * solidAngle;
+
+      sum[0] += radiance * 0.282095f;
+      sum[1] += radiance * (0.488603f * d.y);
+      sum[2] += radiance * (0.488603f * d.z);
+      sum[3] += radiance * (0.488603f * d.x);
+      sum[4] += radiance * (1.092548f * d.x * d.y);
+      sum[5] += radiance * (1.092548f * d.y * d.z);
+      sum[6] += radiance * (0.315392f * (3.f * d.z * d.z - 1.f));
+      sum[7] += radiance * (1.092548f * d.x * d.z);
+      sum[8] += radiance * (0.546274f * (d.x * d.x - d.y * d.y));
+    }
+  });
+
+  // Convolution with the clamped cosine, divided by pi
+  // https://cseweb.ucsd.edu/~ravir/papers/envmap/envmap.pdf
+  const float bandFactors[3] = {1.f, 2.f / 3.f, 1.f / 4.f};
+  const int bands[9] = {0, 1, 1, 1, 2, 2, 2, 2, 2};
+  for (int i = 0; i < 9; ++i) {
+    glm::vec3 coefficient(0);
+    for (const auto &sum : rowSums) {
+      coefficient += sum[i];
+    }
+    ibl.shCoefficients[i] = coefficient * bandFactors[bands[i]];
+  }
+}
+
+void prefilterSpecular(
+    const EnvironmentMap &environment, IBLData &ibl, ThreadPool &threadPool)
+{
+  const EnvironmentPyramid pyramid(environment);
+  const auto sampleCount = IBL_SPECULAR_SAMPLE_COUNT;
+
+  ibl.specularMips.resize(ibl.specularMipCount);
+  for (int mip = 0; mip < ibl.specularMipCount; ++mip) {
+    const auto size = glm::max(1, ibl.specularSize >> mip);
+    const auto roughness =
+        ibl.specularMipCount > 1 ? float(mip) / (ibl.specularMipCount - 1) : 0.f;
+    const auto alpha = roughness * roughness;
+    auto &pixels = ibl.specularMips[mip];
+    pixels.resize(4 * size_t(size) * size * 6);
+
+    threadPool.parallelFor(6 * size, [&](int row) {
+      const auto face = row / size;
+      const auto y = row % size;
+      for (int x = 0; x < size; ++x) {
+        const auto N = glm::normalize(cubeMapDirection(face,
+            2.f * (x + 0.5f) / size - 1.f, 2.f * (y + 0.5f) / size - 1.f));
+
+        glm::vec3 color(0);
+        if (roughness == 0.f) {
+          color = pyramid.sample(N, 0.f);
+        } else {
+          // N = V = R assumption of the split sum
+          float weight = 0.f;
+          for (uint32_t i = 0; i < sampleCount; ++i) {
+            const auto H =
+                importanceSampleGGX(hammersley(i, sampleCount), N, alpha);
+            const auto NdotH = glm::max(glm::dot(N, H), 0.f);
+            const auto L = 2.f * glm::dot(N, H) * H - N;
+            const auto NdotL = glm::dot(N, L);
+            if (NdotL <= 0.f) {
+              continue;
+            }
+            // pdf = D * NdotH / (4 * VdotH) = D / 4 since V = N
+            const auto pdf = distributionGGX(NdotH, alpha) / 4.f;
+            const auto sampleSolidAngle = 1.f / (sampleCount * pdf + 1e-4f);
+            const auto lod =
+                0.5f * std::log2(sampleSolidAngle / pyramid.texelSolidAngle()) +
+                1.f;
+            color += pyramid.sample(L, lod) * NdotL;
+            weight += NdotL;
+          }
+          color /= glm::max(weight, 1e-4f);
+        }
+
+        const auto ptr =
+            &pixels[4 * (x + size * (y + size_t(size) * face))];
+        ptr[0] = glm::packHalf1x16(color.r);
+        ptr[1] = glm::packHalf1x16(color.g);
+        ptr[2] = glm::packHalf1x16(color.b);
+        ptr[3] = glm::packHalf1x16(1.f);
+      }
+    });
+  }
+}
+
+void computeBRDFLut(IBLData &ibl, ThreadPool &threadPool)
+{
+  const auto size = ibl.brdfLutSize;
+  const auto sampleCount = IBL_BRDF_LUT_SAMPLE_COUNT;
+  ibl.brdfLut.resize(2 * size_t(size) * size);
+
+  threadPool.parallelFor(size, [&](int y) {
+    const auto roughness = (y + 0.5f) / size;
+    const auto alpha = roughness * roughness;
+    // Geometry term of Schlick-GGX for IBL
+    const auto k = alpha / 2.f;
+    const glm::vec3 N(0, 0, 1);
+    for (int x = 0; x < size; ++x) {
+      const auto NdotV = (x + 0.5f) / size;
+      const glm::vec3 V(std::sqrt(1.f - NdotV * NdotV), 0, NdotV);
+
+      float scale = 0.f;
+      float bias = 0.f;
+      for (uint32_t i = 0; i < sampleCount; ++i) {
+        const auto H =
+            importanceSampleGGX(hammersley(i, sampleCount), N, alpha);
+        const auto L = 2.f * glm::dot(V, H) * H - V;
+        const auto NdotL = glm::max(L.z, 0.f);
+        if (NdotL <= 0.f) {
+          continue;
+        }
+        const auto NdotH = glm::max(H.z, 0.f);
+        const auto VdotH = glm::max(glm::dot(V, H), 0.f);
+        const auto G = (NdotV / (NdotV * (1.f - k) + k)) *
+                       (NdotL / (NdotL * (1.f - k) + k));
+        const auto GVis = G * VdotH / (NdotH * NdotV);
+        const auto Fc = std::pow(1.f - VdotH, 5.f);
+        scale += (1.f - Fc) * GVis;
+        bias += Fc * GVis;
+      }
+
+      const auto ptr = &ibl.brdfLut[2 * (x + size_t(size) * y)];
+      ptr[0] = glm::packHalf1x16(scale / sampleCount);
+      ptr[1] = glm::packHalf1x16(bias / sampleCount);
+    }
+  });
+}
+
+fs::path iblCachePath(
+    const fs::path &cacheDirectory, const fs::path &environmentPath)
+{
+  auto h = 14695981039346656037ull;
+  const uint32_t parameters[] = {IBL_CACHE_VERSION, IBL_SPECULAR_SAMPLE_COUNT,
+      IBL_BRDF_LUT_SAMPLE_COUNT};
+  h = hash((const char *)parameters, sizeof(parameters), h);
+
+  std::ifstream input(environmentPath.string(), std::ios::binary);
+  std::vector<char> buffer(1 << 20);
+  while (input.read(buffer.data(), buffer.size()) || input.gcount() > 0) {
+    h = hash(buffer.data(), size_t(input.gcount()), h);
+  }
+
+  std::stringstream name;
+  name << std::hex << h << ".ibl";
+  return cacheDirectory / name.str();
+}
+
+bool loadIBLCache(const fs::path &path, IBLData &ibl)
+{
+  std::ifstream input(path.string(), std::ios::binary);
+  char magic[4];
+  if (!input.read(magic, 4) || !std::equal(magic, magic + 4, "IBL1")) {
+    return false;
+  }
+  input.read((char *)ibl.shCoefficients, sizeof(ibl.shCoefficients));
+  input.read((char *)&ibl.specularSize, sizeof(ibl.specularSize));
+  input.read((char *)&ibl.specularMipCount, sizeof(ibl.specularMipCount));
+  input.read((char *)&ibl.brdfLutSize, sizeof(ibl.brdfLutSize));
+  if (!input || ibl.specularMipCount <= 0 || ibl.specularMipCount > 16 ||
+      ibl.specularSize <= 0 || ibl.specularSize > IBL_CACHE_MAX_SIZE ||
+      ibl.brdfLutSize <= 0 || ibl.brdfLutSize > IBL_CACHE_MAX_SIZE) {
+    return false;
+  }
+  ibl.specularMips.resize(ibl.specularMipCount);
+  for (int mip = 0; mip < ibl.specularMipCount; ++mip) {
+    const auto size = size_t(glm::max(1, ibl.specularSize >> mip));
+    ibl.specularMips[mip].resize(4 * size * size * 6);
+    input.read((char *)ibl.specularMips[mip].data(),
+        ibl.specularMips[mip].size() * sizeof(uint16_t));
+  }
+  ibl.brdfLut.resize(2 * size_t(ibl.brdfLutSize) * ibl.brdfLutSize);
+  input.read((char *)ibl.brdfLut.data(), ibl.brdfLut.size() * sizeof(uint16_t));
+  return bool(input);
+}
+
+bool saveIBLCache(const fs::path &path, const IBLData &ibl)
+{
+  try {
+    fs::create_directories(path.parent_path());
+  } catch (const std::exception &e) {
+    std::cerr << "Unable to create IBL cache directory: " << e.what()
+              << std::endl;
+    return false;
+  }
+  std::ofstream output(path.string(), std::ios::binary);
+  output.write("IBL1", 4);
+  output.write((const char *)ibl.shCoefficients, sizeof(ibl.shCoefficients));
+  output.write((const char *)&ibl.specularSize, sizeof(ibl.specularSize));
+  output.write(
+      (const char *)&ibl.specularMipCount, sizeof(ibl.specularMipCount));
+  output.write((const char *)&ibl.brdfLutSize, sizeof(ibl.brdfLutSize));
+  for (const auto &mip : ibl.specularMips) {
+    output.write((const char *)mip.data(), mip.size() * sizeof(uint16_t));
+  }
+  output.write(
+      (const char *)ibl.brdfLut.data(), ibl.brdfLut.size() * sizeof(uint16_t));
+  if (!output) {
+    std::cerr << "Unable to write IBL cache " << path << std::endl;
+    return false;
+  }
+  return true;
+}
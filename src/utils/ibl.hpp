@@ -0,0 +1,67 @@
+#pragma once
+
+#include "filesystem.hpp"
+#include "thread_pool.hpp"
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <vector>
+
+// Image based lighting from an equirectangular HDR environment map, using the
+// split sum approximation:
+// https://cdn2.unrealengine.com/Resources/files/2013SiggraphPresentationsNotes-26915738.pdf
+// Diffuse irradiance is stored as 9 spherical harmonics coefficients,
+// specular radiance as a cubemap prefiltered with GGX for increasing
+// roughness along its mip levels, and the environment BRDF as a 2D LUT
+// indexed by (NdotV, roughness).
+// The GPU version of the prefiltering and of the LUT are the compute shaders
+// ibl_prefilter.cs.glsl and ibl_brdf_lut.cs.glsl, which must match the CPU
+// version below.
+
+// Equirectangular image, first row is the top (+Y)
+struct EnvironmentMap
+{
+  int width = 0;
+  int height = 0;
+  std::vector<float> pixels; // RGB
+};
+
+struct IBLData
+{
+  // Irradiance divided by pi, in world space, so that the diffuse term is
+  // c_diff * sum(shCoefficients[i] * Y_i(N))
+  glm::vec3 shCoefficients[9];
+
+  int32_t specularSize = 128;
+  int32_t specularMipCount = 5; // Roughness of mip i is i / (mipCount - 1)
+  // RGBA half floats, for each mip level the 6 faces in GL order
+  std::vector<std::vector<uint16_t>> specularMips;
+
+  int32_t brdfLutSize = 128;
+  std::vector<uint16_t> brdfLut; // RG half floats, scale and bias of F_0
+};
+
+// Number of GGX samples per texel, the same for CPU and GPU prefiltering
+const uint32_t IBL_SPECULAR_SAMPLE_COUNT = 256;
+const uint32_t IBL_BRDF_LUT_SAMPLE_COUNT = 512;
+
+bool loadEnvironmentMap(const fs::path &path, EnvironmentMap &environment);
+
+// Rows are computed in parallel on the threads of threadPool
+void computeIrradianceSH(const EnvironmentMap &environment, IBLData &ibl,
+    ThreadPool &threadPool);
+
+void prefilterSpecular(const EnvironmentMap &environment, IBLData &ibl,
+    ThreadPool &threadPool);
+
+void computeBRDFLut(IBLData &ibl, ThreadPool &threadPool);
+
+// Precomputed data are cached on disk, keyed by the content of the source
+// image and the parameters of the precomputation
+fs::path iblCachePath(
+    const fs::path &cacheDirectory, const fs::path &environmentPath);
+
+bool loadIBLCache(const fs::path &path, IBLData &ibl);
+
+bool saveIBLCache(const fs::path &path, const IBLData &ibl);
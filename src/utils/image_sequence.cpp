@@ -0,0 +1,397 @@
+#include "image_sequence.hpp"
+#include "exr_writer.hpp"
+#include "thread_pool.hpp"
+
+#include <stb_image_write.h>
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <string>
+
+namespace {
+
+// Timeout of a blocking fence wait, after which it is retried
+const GLuint64 FENCE_TIMEOUT_NS = 1000000000;
+const int JPEG_QUALITY = 95;
+
+// Bytes per pixel of the readbacks, packed in this order in a pixel buffer:
+// RGBA8 color, then with AOVs float depth, float RGB normal and uint ids
+const size_t COLOR_PIXEL_SIZE = 4;
+const size_t DEPTH_PIXEL_SIZE = sizeof(float);
+const size_t NORMAL_PIXEL_SIZE = 3 * sizeof(float);
+const size_t IDS_PIXEL_SIZE = 2 * sizeof(GLuint);
+const size_t AOV_PIXEL_SIZE =
+    DEPTH_PIXEL_SIZE + NORMAL_PIXEL_SIZE + IDS_PIXEL_SIZE;
+
+bool isJpeg(const fs::path &path)
+{
+  auto extension = path.extension().string();
+  std::transform(begin(extension), end(extension), begin(extension),
+      [](unsigned char c) { return char(std::tolower(c)); });
+  return extension == ".jpg" || extension == ".jpeg";
+}
+
+fs::path aovPath(const fs::path &path, const char *suffix)
+{
+  return path.parent_path() / (path.stem().string() + suffix);
+}
+
+// Id of a 16 bits gray PNG, big endian
+void storeId(GLuint id, unsigned char *out)
+{
+  const auto value = std::min(id, GLuint(0xffff));
+  out[0] = (unsigned char)(value >> 8);
+  out[1] = (unsigned char)value;
+}
+
+} // namespace
+
+void clearAovAttachments()
+{
+  const GLfloat zeros[4] = {0, 0, 0, 0};
+  const GLuint emptyIds[4] = {0, 0, 0, 0};
+  glClearBufferfv(GL_COLOR, AOV_LINEAR_DEPTH, zeros);
+  glClearBufferfv(GL_COLOR, AOV_NORMAL, zeros);
+  glClearBufferuiv(GL_COLOR, AOV_IDS, emptyIds);
+}
+
+OffscreenFramebuffer::~OffscreenFramebuffer() { release(); }
+
+void OffscreenFramebuffer::release()
+{
+  glDeleteFramebuffers(1, &m_framebuffer);
+  glDeleteTextures(1, &m_colorTexture);
+  glDeleteTextures(1, &m_depthTexture);
+  glDeleteTextures(AOV_ATTACHMENT_COUNT, m_aovTextures);
+  m_framebuffer = m_colorTexture = m_depthTexture = 0;
+  std::fill_n(m_aovTextures, AOV_ATTACHMENT_COUNT, 0);
+}
+
+void OffscreenFramebuffer::resize(GLsizei width, GLsizei height)
+{
+  if (m_framebuffer && width == m_width && height == m_height) {
+    return;
+  }
+  release();
+  m_width = width;
+  m_height = height;
+
+  GLint previousTexture = 0;
+  GLint previousFramebuffer = 0;
+  glGetIntegerv(GL_TEXTURE_BINDING_2D, &previousTexture);
+  glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &previousFramebuffer);
+
+  // 8 bits per component, as written in the image files
+  glGenTextures(1, &m_colorTexture);
+  glBindTexture(GL_TEXTURE_2D, m_colorTexture);
+  glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, width, height);
+  glGenTextures(1, &m_depthTexture);
+  glBindTexture(GL_TEXTURE_2D, m_depthTexture);
+  glTexStorage2D(GL_TEXTURE_2D, 1, GL_DEPTH_COMPONENT32F, width, height);
+  if (m_aovs) {
+    // Indexed by attachment - 1
+    const GLenum formats[AOV_ATTACHMENT_COUNT] = {
+        GL_R32F, GL_RGBA16F, GL_RG32UI};
+    glGenTextures(AOV_ATTACHMENT_COUNT, m_aovTextures);
+    for (auto i = 0; i < AOV_ATTACHMENT_COUNT; ++i) {
+      glBindTexture(GL_TEXTURE_2D, m_aovTextures[i]);
+      glTexStorage2D(GL_TEXTURE_2D, 1, formats[i], width, height);
+    }
+  }
+  glBindTexture(GL_TEXTURE_2D, GLuint(previousTexture));
+
+  glGenFramebuffers(1, &m_framebuffer);
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_framebuffer);
+  glFramebufferTexture(
+      GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, m_colorTexture, 0);
+  glFramebufferTexture(
+      GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, m_depthTexture, 0);
+  GLenum drawBuffers[1 + AOV_ATTACHMENT_COUNT] = {GL_COLOR_ATTACHMENT0};
+  if (m_aovs) {
+    for (auto i = 0; i < AOV_ATTACHMENT_COUNT; ++i) {
+      drawBuffers[i + 1] = GLenum(GL_COLOR_ATTACHMENT1 + i);
+      glFramebufferTexture(
+          GL_DRAW_FRAMEBUFFER, drawBuffers[i + 1], m_aovTextures[i], 0);
+    }
+  }
+  glDrawBuffers(m_aovs ? 1 + AOV_ATTACHMENT_COUNT : 1, drawBuffers);
+  const auto status = glCheckFramebufferStatus(GL_DRAW_FRAMEBUFFER);
+  if (status != GL_FRAMEBUFFER_COMPLETE) {
+    std::cerr << "Offscreen framebuffer is not complete: " << status
+              << std::endl;
+  }
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, GLuint(previousFramebuffer));
+}
+
+ImageSequenceWriter::ImageSequenceWriter(const PngCompression &compression,
+    size_t ringSize, unsigned encoderCount) :
+    m_compression(compression),
+    m_slots(std::max(ringSize, size_t(1)))
+{
+  if (encoderCount == 0) {
+    encoderCount = std::max(2u, std::thread::hardware_concurrency()) - 1;
+  }
+  for (unsigned i = 0; i < encoderCount; ++i) {
+    m_encoders.emplace_back([this]() { encoderLoop(); });
+  }
+}
+
+ImageSequenceWriter::~ImageSequenceWriter()
+{
+  finish();
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stop = true;
+  }
+  m_jobCondition.notify_all();
+  for (auto &encoder : m_encoders) {
+    encoder.join();
+  }
+  for (auto &slot : m_slots) {
+    if (slot.buffer) {
+      glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+      glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+      glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+      glDeleteBuffers(1, &slot.buffer);
+    }
+  }
+}
+
+void ImageSequenceWriter::write(
+    const OffscreenFramebuffer &framebuffer, const fs::path &path)
+{
+  const auto width = framebuffer.width();
+  const auto height = framebuffer.height();
+  const auto slotIdx = m_nextSlot;
+  m_nextSlot = (m_nextSlot + 1) % m_slots.size();
+  auto &slot = m_slots[slotIdx];
+
+  // The slot is the oldest one in use, if any
+  const auto start = std::chrono::steady_clock::now();
+  for (;;) {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      if (slot.state != SLOT_READING) {
+        break;
+      }
+    }
+    submitReadbacks(true);
+  }
+  {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_slotCondition.wait(lock, [&]() { return slot.state == SLOT_FREE; });
+  }
+  m_stallMilliseconds += std::chrono::duration<double, std::milli>(
+      std::chrono::steady_clock::now() - start)
+                             .count();
+
+  const auto pixelCount = size_t(width) * size_t(height);
+  const auto pixelSize =
+      COLOR_PIXEL_SIZE + (framebuffer.aovs() ? AOV_PIXEL_SIZE : 0);
+  const auto size = pixelCount * pixelSize;
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+  if (slot.capacity < size) {
+    if (slot.buffer) {
+      glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+      glDeleteBuffers(1, &slot.buffer);
+    }
+    const GLbitfield flags =
+        GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    glGenBuffers(1, &slot.buffer);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+    glBufferStorage(GL_PIXEL_PACK_BUFFER, GLsizeiptr(size), nullptr,
+        flags | GL_CLIENT_STORAGE_BIT);
+    slot.pixels = (const unsigned char *)glMapBufferRange(
+        GL_PIXEL_PACK_BUFFER, 0, GLsizeiptr(size), flags);
+    slot.capacity = size;
+    if (!slot.pixels) {
+      // Out of memory, or an image too large for a buffer
+      std::cerr << "Unable to map a pixel buffer of " << size
+                << " bytes, " << path << " not written" << std::endl;
+      glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+      glDeleteBuffers(1, &slot.buffer);
+      slot.buffer = 0;
+      slot.capacity = 0;
+      std::lock_guard<std::mutex> lock(m_mutex);
+      ++m_failureCount;
+      return;
+    }
+  }
+
+  GLint previousFramebuffer = 0;
+  glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &previousFramebuffer);
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer.framebuffer());
+  glReadBuffer(GL_COLOR_ATTACHMENT0);
+  glPixelStorei(GL_PACK_ALIGNMENT, 4);
+  glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+  if (framebuffer.aovs()) {
+    auto offset = pixelCount * COLOR_PIXEL_SIZE;
+    glReadBuffer(GL_COLOR_ATTACHMENT0 + AOV_LINEAR_DEPTH);
+    glReadPixels(0, 0, width, height, GL_RED, GL_FLOAT, (GLvoid *)offset);
+    offset += pixelCount * DEPTH_PIXEL_SIZE;
+    glReadBuffer(GL_COLOR_ATTACHMENT0 + AOV_NORMAL);
+    glReadPixels(0, 0, width, height, GL_RGB, GL_FLOAT, (GLvoid *)offset);
+    offset += pixelCount * NORMAL_PIXEL_SIZE;
+    glReadBuffer(GL_COLOR_ATTACHMENT0 + AOV_IDS);
+    glReadPixels(0, 0, width, height, GL_RG_INTEGER, GL_UNSIGNED_INT,
+        (GLvoid *)offset);
+  }
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, GLuint(previousFramebuffer));
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+  slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  // Submit the fence, so that polling it without flushing terminates
+  glFlush();
+  slot.width = width;
+  slot.height = height;
+  slot.aovs = framebuffer.aovs();
+  slot.path = path;
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    slot.state = SLOT_READING;
+  }
+  m_readingSlots.push_back(slotIdx);
+
+  submitReadbacks(false);
+}
+
+bool ImageSequenceWriter::finish()
+{
+  while (!m_readingSlots.empty()) {
+    submitReadbacks(true);
+  }
+  std::unique_lock<std::mutex> lock(m_mutex);
+  m_slotCondition.wait(lock, [&]() { return m_pendingJobCount == 0; });
+  const auto success = m_failureCount == 0;
+  m_failureCount = 0;
+  return success;
+}
+
+void ImageSequenceWriter::submitReadbacks(bool wait)
+{
+  while (!m_readingSlots.empty()) {
+    auto &slot = m_slots[m_readingSlots.front()];
+    const auto status = glClientWaitSync(slot.fence,
+        wait ? GL_SYNC_FLUSH_COMMANDS_BIT : 0, wait ? FENCE_TIMEOUT_NS : 0);
+    if (status == GL_TIMEOUT_EXPIRED) {
+      if (wait) {
+        continue;
+      }
+      return;
+    }
+    // A failed wait is not retried, the image is written as it is
+    glDeleteSync(slot.fence);
+    slot.fence = nullptr;
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      slot.state = SLOT_ENCODING;
+      m_jobs.push_back(m_readingSlots.front());
+      ++m_pendingJobCount;
+    }
+    m_jobCondition.notify_one();
+    m_readingSlots.pop_front();
+    wait = false;
+  }
+}
+
+void ImageSequenceWriter::encoderLoop()
+{
+  std::vector<unsigned char> rgb;
+  std::vector<float> depths;
+  std::vector<float> normals;
+  std::vector<unsigned char> nodeIds;
+  std::vector<unsigned char> materialIds;
+  // The encoders already run in parallel
+  ThreadPool threadPool(1);
+  for (;;) {
+    size_t slotIdx = 0;
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_jobCondition.wait(lock, [&]() { return m_stop || !m_jobs.empty(); });
+      if (m_jobs.empty()) {
+        return;
+      }
+      slotIdx = m_jobs.front();
+      m_jobs.pop_front();
+    }
+    // The render thread does not touch the slot until it is freed
+    auto &slot = m_slots[slotIdx];
+    const auto width = size_t(slot.width);
+    const auto height = size_t(slot.height);
+    const auto aovs = slot.aovs;
+    const auto path = slot.path;
+
+    // OpenGL rows go upward: flip them while dropping the alpha
+    rgb.resize(width * height * 3);
+    for (size_t y = 0; y < height; ++y) {
+      const auto src = slot.pixels + (height - 1 - y) * width * 4;
+      const auto dst = rgb.data() + y * width * 3;
+      for (size_t x = 0; x < width; ++x) {
+        dst[3 * x] = src[4 * x];
+        dst[3 * x + 1] = src[4 * x + 1];
+        dst[3 * x + 2] = src[4 * x + 2];
+      }
+    }
+    if (aovs) {
+      const auto pixelCount = width * height;
+      const auto aovPixels = slot.pixels + pixelCount * COLOR_PIXEL_SIZE;
+      const auto srcDepths = (const float *)aovPixels;
+      const auto srcNormals = srcDepths + pixelCount;
+      const auto srcIds = (const GLuint *)(srcNormals + 3 * pixelCount);
+      depths.resize(pixelCount);
+      normals.resize(3 * pixelCount);
+      nodeIds.resize(2 * pixelCount);
+      materialIds.resize(2 * pixelCount);
+      for (size_t y = 0; y < height; ++y) {
+        const auto srcRow = (height - 1 - y) * width;
+        const auto dstRow = y * width;
+        std::copy_n(srcDepths + srcRow, width, depths.data() + dstRow);
+        std::copy_n(
+            srcNormals + 3 * srcRow, 3 * width, normals.data() + 3 * dstRow);
+        for (size_t x = 0; x < width; ++x) {
+          storeId(srcIds[2 * (srcRow + x)], &nodeIds[2 * (dstRow + x)]);
+          storeId(
+              srcIds[2 * (srcRow + x) + 1], &materialIds[2 * (dstRow + x)]);
+        }
+      }
+    }
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      slot.state = SLOT_FREE;
+    }
+    m_slotCondition.notify_all();
+
+    const auto strPath = path.string();
+    auto success =
+        isJpeg(path) ? stbi_write_jpg(strPath.c_str(), int(width),
+                           int(height), 3, rgb.data(), JPEG_QUALITY) != 0
+                     : writePng(path, int(width), int(height), 3, rgb.data(),
+                           m_compression, threadPool);
+    if (!success) {
+      std::cerr << "Unable to write " << strPath << std::endl;
+    }
+    if (aovs && success) {
+      success =
+          writeExr(aovPath(path, "_depth.exr"), int(width), int(height),
+              {"Z"}, depths.data()) &&
+          writeExr(aovPath(path, "_normal.exr"), int(width), int(height),
+              {"R", "G", "B"}, normals.data()) &&
+          writePng(aovPath(path, "_node.png"), int(width), int(height), 1,
+              nodeIds.data(), m_compression, threadPool, 16) &&
+          writePng(aovPath(path, "_material.png"), int(width), int(height),
+              1, materialIds.data(), m_compression, threadPool, 16);
+      if (!success) {
+        std::cerr << "Unable to write the AOVs of " << strPath << std::endl;
+      }
+    }
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_failureCount += success ? 0 : 1;
+      --m_pendingJobCount;
+    }
+    m_slotCondition.notify_all();
+  }
+}
@@ -0,0 +1,133 @@
+#pragma once
+
+#include "filesystem.hpp"
+#include "png_writer.hpp"
+
+#include <glad/glad.h>
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Arbitrary output variables written by the shaders compiled with HAS_AOV
+// next to the color, in the color attachments 1 to AOV_ATTACHMENT_COUNT
+enum AovAttachment
+{
+  AOV_LINEAR_DEPTH = 1, // R32F, view space distance along -z, 0 if empty
+  AOV_NORMAL, // RGBA16F, view space normal in rgb
+  AOV_IDS, // RG32UI, node and material indices + 1, 0 if empty
+  AOV_ATTACHMENT_COUNT = AOV_IDS
+};
+
+// Clear the AOV attachments of the bound draw framebuffer, after a glClear()
+// that sets them to the clear color
+void clearAovAttachments();
+
+// Offscreen framebuffer of an RGBA8 color texture and a depth texture, plus
+// the AOV attachments if requested, kept from an image of a sequence to the
+// next
+class OffscreenFramebuffer
+{
+public:
+  explicit OffscreenFramebuffer(bool aovs = false) : m_aovs(aovs) {}
+  ~OffscreenFramebuffer();
+  OffscreenFramebuffer(const OffscreenFramebuffer &) = delete;
+  OffscreenFramebuffer &operator=(const OffscreenFramebuffer &) = delete;
+
+  // Reallocate the textures if the size changed
+  void resize(GLsizei width, GLsizei height);
+
+  GLuint framebuffer() const { return m_framebuffer; }
+  GLsizei width() const { return m_width; }
+  GLsizei height() const { return m_height; }
+  bool aovs() const { return m_aovs; }
+
+private:
+  void release();
+
+  bool m_aovs = false;
+  GLsizei m_width = 0;
+  GLsizei m_height = 0;
+  GLuint m_framebuffer = 0;
+  GLuint m_colorTexture = 0;
+  GLuint m_depthTexture = 0;
+  GLuint m_aovTextures[AOV_ATTACHMENT_COUNT] = {};
+};
+
+// Pipelined readback and encoding of the images of a sequence. Images are read
+// in a ring of persistently mapped pixel buffers, each followed by a fence, so
+// that the render thread does not wait for the GPU: an image is handed to the
+// encoder threads once its fence is signaled, usually while the next images
+// are rendered. Encoders flip the rows while converting them to RGB, release
+// the pixel buffer and write a JPEG file for .jpg and .jpeg paths, a PNG file
+// with the given compression otherwise. The AOVs of a framebuffer that has
+// them are written next to the image, <stem>_depth.exr (Z),
+// <stem>_normal.exr (RGB), <stem>_node.png and <stem>_material.png (16 bits
+// gray). Requires OpenGL 4.4 for persistent mapping.
+class ImageSequenceWriter
+{
+public:
+  // ringSize images in flight between the GPU and the encoders. encoderCount
+  // = 0 uses std::thread::hardware_concurrency() - 1 threads, at least 1.
+  explicit ImageSequenceWriter(const PngCompression &compression = {},
+      size_t ringSize = 3, unsigned encoderCount = 0);
+  ~ImageSequenceWriter();
+  ImageSequenceWriter(const ImageSequenceWriter &) = delete;
+  ImageSequenceWriter &operator=(const ImageSequenceWriter &) = delete;
+
+  // Queue the readback of the color attachment 0 of framebuffer, and of its
+  // AOVs, to be written to path. Only waits if every pixel buffer is in use.
+  void write(const OffscreenFramebuffer &framebuffer, const fs::path &path);
+
+  // Wait for all queued images to be written, false if one of them could not
+  // be written since the last call
+  bool finish();
+
+  // Time the render thread waited for a free pixel buffer
+  double stallMilliseconds() const { return m_stallMilliseconds; }
+
+private:
+  enum SlotState
+  {
+    SLOT_FREE,
+    SLOT_READING, // Readback issued, fence not signaled yet
+    SLOT_ENCODING // Pixels owned by an encoder
+  };
+
+  struct Slot
+  {
+    GLuint buffer = 0;
+    const unsigned char *pixels = nullptr; // Persistent mapping of buffer
+    size_t capacity = 0;
+    GLsync fence = nullptr;
+    GLsizei width = 0;
+    GLsizei height = 0;
+    bool aovs = false;
+    fs::path path;
+    SlotState state = SLOT_FREE;
+  };
+
+  // Hand the slots whose readback is done to the encoders, in readback order.
+  // If wait, block until the oldest one is done.
+  void submitReadbacks(bool wait);
+  void encoderLoop();
+
+  PngCompression m_compression;
+  std::vector<Slot> m_slots;
+  size_t m_nextSlot = 0;
+  std::deque<size_t> m_readingSlots;
+  double m_stallMilliseconds = 0.;
+
+  std::mutex m_mutex;
+  // Signaled for encoders when a job is queued
+  std::condition_variable m_jobCondition;
+  // Signaled for the render thread when a slot is freed or a job is done
+  std::condition_variable m_slotCondition;
+  std::deque<size_t> m_jobs;
+  size_t m_pendingJobCount = 0;
+  size_t m_failureCount = 0;
+  bool m_stop = false;
+  std::vector<std::thread> m_encoders;
+};
@@ -1,6 +1,7 @@
 #pragma once
 
-#include <functional>
+#include <cstddef>
+#include <utility>
 
 template <typename ComponentType>
 void flipImageYAxis(
@@ -16,15 +17,3 @@ void flipImageYAxis(
     pLastLine -= width * numComponent;
   }
 }
-
-void renderToImage(std::size_t width, std::size_t height, std::size_t numComponents,
-    unsigned char *outPixels, std::function<void()> render, std::function<void()> computeShadows);
-// Setup GL state in order to render in texture, call drawScene() then get the
-// texture from the GPU and store it on outPixels[0 : width * height *
-// numComponent]. Then restore the previous GL state.
-//
-// For this to work, drawScene must render on the currently bound
-// GL_DRAW_FRAMEBUFFER.
-// It means that if drawScene change GL_DRAW_FRAMEBUFFER, in must restore it
-// before doing final rendering (for example for deferred rendering,
-// GL_DRAW_FRAMEBUFFER must be restored before the shading pass).
\ No newline at end of file
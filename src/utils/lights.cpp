@@ -0,0 +1,245 @@
+#include "lights.hpp"
+#include "gltf.hpp"
+
+#include <glm/gtc/constants.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <iostream>
+#include <random>
+
+// Intensity under which a light is considered to have no influence, used to
+// bound lights with an undefined (infinite) range
+static const float LIGHT_INFLUENCE_CUTOFF = 0.005f;
+
+std::vector<PunctualLight> loadPunctualLights(const tinygltf::Model &model)
+{
+  std::vector<PunctualLight> lights;
+  if (model.lights.empty() || model.defaultScene < 0) {
+    return lights;
+  }
+
+  const std::function<void(int, const glm::mat4 &)> visitNode =
+      [&](int nodeIdx, const glm::mat4 &parentMatrix) {
+        const auto &node = model.nodes[nodeIdx];
+        const auto modelMatrix = getLocalToWorldMatrix(node, parentMatrix);
+        const auto extIt = node.extensions.find("KHR_lights_punctual");
+        if (extIt != end(node.extensions) && (*extIt).second.Has("light")) {
+          const auto lightIdx =
+              int((*extIt).second.Get("light").GetNumberAsInt());
+          if (lightIdx >= 0 && size_t(lightIdx) < model.lights.size()) {
+            const auto &light = model.lights[lightIdx];
+            PunctualLight l = {};
+            l.position = glm::vec3(modelMatrix * glm::vec4(0, 0, 0, 1));
+            l.direction = glm::normalize(
+                glm::vec3(modelMatrix * glm::vec4(0, 0, -1, 0)));
+            l.color = glm::vec3(1);
+            if (light.color.size() == 3) {
+              l.color = glm::vec3(light.color[0], light.color[1],
+                  light.color[2]);
+            }
+            l.color *= float(light.intensity);
+            l.range = light.range > 0.
+                          ? float(light.range)
+                          : glm::sqrt(glm::max(l.color.r,
+                                          glm::max(l.color.g, l.color.b)) /
+                                      LIGHT_INFLUENCE_CUTOFF);
+            l.innerConeCos = glm::cos(float(light.spot.innerConeAngle));
+            l.outerConeCos = glm::cos(float(light.spot.outerConeAngle));
+            if (light.type == "directional") {
+              l.type = PUNCTUAL_LIGHT_DIRECTIONAL;
+            } else if (light.type == "spot") {
+              l.type = PUNCTUAL_LIGHT_SPOT;
+            } else {
+              l.type = PUNCTUAL_LIGHT_POINT;
+            }
+            lights.push_back(l);
+          }
+        }
+        for (const auto childNodeIdx : node.children) {
+          visitNode(childNodeIdx, modelMatrix);
+        }
+      };
+  for (const auto nodeIdx : model.scenes[model.defaultScene].nodes) {
+    visitNode(nodeIdx, glm::mat4(1));
+  }
+
+  std::stable_partition(begin(lights), end(lights),
+      [](const PunctualLight &l) {
+        return l.type == PUNCTUAL_LIGHT_DIRECTIONAL;
+      });
+
+  std::clog << "Number of punctual lights: " << lights.size() << std::endl;
+
+  return lights;
+}
+
+void transformPunctualLights(const std::vector<PunctualLight> &lights,
+    const glm::mat4 &viewMatrix, std::vector<PunctualLight> &outLights)
+{
+  outLights.resize(lights.size());
+  for (size_t i = 0; i < lights.size(); ++i) {
+    outLights[i] = lights[i];
+    outLights[i].position =
+        glm::vec3(viewMatrix * glm::vec4(lights[i].position, 1));
+    outLights[i].direction =
+        glm::vec3(viewMatrix * glm::vec4(lights[i].direction, 0));
+  }
+}
+
+void addRandomPointLights(tinygltf::Model &model, size_t count,
+    const glm::vec3 &bboxMin, const glm::vec3 &bboxMax, unsigned seed)
+{
+  if (model.scenes.empty()) {
+    return;
+  }
+  if (model.defaultScene < 0) {
+    model.defaultScene = 0;
+  }
+
+  std::mt19937 generator{seed};
+  std::uniform_real_distribution<float> distribution{0.f, 1.f};
+
+  const auto diag = bboxMax - bboxMin;
+  const auto range = 0.1f * glm::length(diag);
+
+  for (size_t i = 0; i < count; ++i) {
+    // Saturated color with a random hue
+    const auto hue = 6.f * distribution(generator);
+    const auto color = glm::clamp(
+        glm::vec3(glm::abs(hue - 3.f) - 1.f, 2.f - glm::abs(hue - 2.f),
+            2.f - glm::abs(hue - 4.f)),
+        0.f, 1.f);
+    const auto position =
+        bboxMin + diag * glm::vec3(distribution(generator),
+                             distribution(generator), distribution(generator));
+
+    tinygltf::Light light;
+    light.name = "RandomLight" + std::to_string(i);
+    light.type = "point";
+    light.color = {color.r, color.g, color.b};
+    // Intensity 1 at half range
+    light.intensity = 0.25 * range * range;
+    light.range = range;
+    model.lights.push_back(light);
+
+    tinygltf::Node node;
+    node.name = light.name;
+    node.translation = {position.x, position.y, position.z};
+    tinygltf::Value::Object lightExtension;
+    lightExtension["light"] = tinygltf::Value(int(model.lights.size() - 1));
+    node.extensions["KHR_lights_punctual"] =
+        tinygltf::Value(std::move(lightExtension));
+    model.nodes.push_back(node);
+    model.scenes[model.defaultScene].nodes.push_back(
+        int(model.nodes.size() - 1));
+  }
+
+  if (std::find(begin(model.extensionsUsed), end(model.extensionsUsed),
+          "KHR_lights_punctual") == end(model.extensionsUsed)) {
+    model.extensionsUsed.push_back("KHR_lights_punctual");
+  }
+}
+
+glm::vec2 LightClusterGrid::sliceScaleBias() const
+{
+  const auto logFarOverNear = glm::log(zFar / zNear);
+  return glm::vec2(float(size.z) / logFarOverNear,
+      float(size.z) * glm::log(zNear) / logFarOverNear);
+}
+
+void buildLightClusters(const std::vector<PunctualLight> &viewSpaceLights,
+    const glm::mat4 &projMatrix, LightClusterGrid &grid,
+    ThreadPool &threadPool)
+{
+  const auto &size = grid.size;
+  const auto clustersPerSlice = size_t(size.x * size.y);
+
+  // View space direction, scaled such that z = -1, of each tile corner
+  const auto invProjMatrix = glm::inverse(projMatrix);
+  std::vector<glm::vec3> cornerDirections((size.x + 1) * (size.y + 1));
+  for (int y = 0; y <= size.y; ++y) {
+    for (int x = 0; x <= size.x; ++x) {
+      const auto ndc =
+          glm::vec2(float(x) / size.x, float(y) / size.y) * 2.f - 1.f;
+      const auto p = invProjMatrix * glm::vec4(ndc, -1, 1);
+      cornerDirections[x + y * (size.x + 1)] = glm::vec3(p) / -p.z;
+    }
+  }
+
+  struct SliceResult
+  {
+    std::vector<glm::uvec2> clusters;
+    std::vector<uint32_t> lightIndices;
+  };
+  std::vector<SliceResult> slices(size.z);
+
+  const auto buildSlice = [&](int z) {
+    auto &slice = slices[z];
+    slice.clusters.resize(clustersPerSlice);
+    slice.lightIndices.clear();
+
+    const auto d0 = grid.zNear * glm::pow(grid.zFar / grid.zNear,
+                                     float(z) / size.z);
+    const auto d1 = grid.zNear * glm::pow(grid.zFar / grid.zNear,
+                                     float(z + 1) / size.z);
+
+    std::vector<uint32_t> candidates;
+    for (size_t i = 0; i < viewSpaceLights.size(); ++i) {
+      const auto &light = viewSpaceLights[i];
+      const auto depth = -light.position.z;
+      if (light.type != PUNCTUAL_LIGHT_DIRECTIONAL &&
+          depth + light.range >= d0 && depth - light.range <= d1) {
+        candidates.push_back(uint32_t(i));
+      }
+    }
+
+    for (int y = 0; y < size.y; ++y) {
+      for (int x = 0; x < size.x; ++x) {
+        const glm::vec3 corners[4] = {
+            cornerDirections[x + y * (size.x + 1)],
+            cornerDirections[x + 1 + y * (size.x + 1)],
+            cornerDirections[x + (y + 1) * (size.x + 1)],
+            cornerDirections[x + 1 + (y + 1) * (size.x + 1)]};
+        auto aabbMin = glm::vec3(std::numeric_limits<float>::max());
+        auto aabbMax = glm::vec3(std::numeric_limits<float>::lowest());
+        for (const auto &corner : corners) {
+          aabbMin = glm::min(aabbMin, glm::min(corner * d0, corner * d1));
+          aabbMax = glm::max(aabbMax, glm::max(corner * d0, corner * d1));
+        }
+
+        auto &cluster = slice.clusters[x + y * size.x];
+        cluster.x = uint32_t(slice.lightIndices.size());
+        for (const auto lightIdx : candidates) {
+          const auto &light = viewSpaceLights[lightIdx];
+          const auto closest =
+              glm::clamp(light.position, aabbMin, aabbMax) - light.position;
+          if (glm::dot(closest, closest) <= light.range * light.range) {
+            slice.lightIndices.push_back(lightIdx);
+          }
+        }
+        cluster.y = uint32_t(slice.lightIndices.size()) - cluster.x;
+      }
+    }
+  };
+
+  threadPool.parallelFor(size.z, buildSlice);
+
+  // Concatenate slices
+  grid.clusters.resize(clustersPerSlice * size.z);
+  grid.lightIndices.clear();
+  grid.maxLightsPerCluster = 0;
+  for (int z = 0; z < size.z; ++z) {
+    const auto &slice = slices[z];
+    const auto offset = uint32_t(grid.lightIndices.size());
+    for (size_t i = 0; i < clustersPerSlice; ++i) {
+      const auto &cluster = slice.clusters[i];
+      grid.clusters[i + z * clustersPerSlice] =
+          glm::uvec2(cluster.x + offset, cluster.y);
+      grid.maxLightsPerCluster = glm::max(grid.maxLightsPerCluster, cluster.y);
+    }
+    grid.lightIndices.insert(end(grid.lightIndices),
+        begin(slice.lightIndices), end(slice.lightIndices));
+  }
+}
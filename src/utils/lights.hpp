@@ -0,0 +1,70 @@
+#pragma once
+
+#include "thread_pool.hpp"
+
+#include <glm/glm.hpp>
+#include <tiny_gltf.h>
+
+#include <cstdint>
+#include <vector>
+
+// KHR_lights_punctual support and clustered light culling
+// https://github.com/KhronosGroup/glTF/tree/master/extensions/2.0/Khronos/KHR_lights_punctual
+
+enum PunctualLightType
+{
+  PUNCTUAL_LIGHT_DIRECTIONAL = 0,
+  PUNCTUAL_LIGHT_POINT = 1,
+  PUNCTUAL_LIGHT_SPOT = 2
+};
+
+// Same layout as the PunctualLight struct of the std430 light buffer in
+// pbr_directional_light_shadows_clustered.fs.glsl
+struct PunctualLight
+{
+  glm::vec3 position;
+  float range; // Distance after which the light has no influence
+  glm::vec3 color; // Color multiplied by intensity
+  int32_t type;
+  glm::vec3 direction; // Direction the light is pointing to
+  float innerConeCos;
+  float outerConeCos;
+  float padding[3];
+};
+static_assert(sizeof(PunctualLight) == 64, "PunctualLight must match std430");
+
+// World space lights of the default scene. Directional lights come first.
+std::vector<PunctualLight> loadPunctualLights(const tinygltf::Model &model);
+
+// Transform world space lights to view space
+void transformPunctualLights(const std::vector<PunctualLight> &lights,
+    const glm::mat4 &viewMatrix, std::vector<PunctualLight> &outLights);
+
+// Synthetic many-light benchmark: add count random colored point lights in
+// the scene bounds as KHR_lights_punctual nodes of the default scene
+void addRandomPointLights(tinygltf::Model &model, size_t count,
+    const glm::vec3 &bboxMin, const glm::vec3 &bboxMax, unsigned seed = 0);
+
+// View frustum divided in a 3D grid of clusters (froxels): screen tiles in x
+// and y, exponential slices in z. Each cluster references the point and spot
+// lights whose sphere of influence intersects it.
+struct LightClusterGrid
+{
+  glm::ivec3 size{16, 9, 24};
+  float zNear = 0.1f;
+  float zFar = 100.f;
+  // Offset and count in lightIndices, for each cluster x + y * size.x + z *
+  // size.x * size.y
+  std::vector<glm::uvec2> clusters;
+  std::vector<uint32_t> lightIndices;
+  uint32_t maxLightsPerCluster = 0;
+
+  // Parameters such that slice = log(-viewSpaceZ) * scale - bias
+  glm::vec2 sliceScaleBias() const;
+};
+
+// Fill the clusters of grid from view space lights, splitting slices across
+// the threads of threadPool
+void buildLightClusters(const std::vector<PunctualLight> &viewSpaceLights,
+    const glm::mat4 &projMatrix, LightClusterGrid &grid,
+    ThreadPool &threadPool);
@@ -0,0 +1,197 @@
+#include "meshlet_culling.hpp"
+#include "gltf.hpp"
+
+#include <glm/gtc/type_ptr.hpp>
+
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <utility>
+
+namespace {
+
+// Maximum work group count of a dispatch dimension guaranteed by OpenGL
+const GLuint MAX_WORK_GROUP_COUNT = 65535;
+
+GLuint createBuffer(
+    GLenum target, GLsizeiptr size, const void *data, GLbitfield flags)
+{
+  GLuint buffer = 0;
+  glGenBuffers(1, &buffer);
+  glBindBuffer(target, buffer);
+  // Never allocate an empty buffer
+  glBufferStorage(target, std::max(size, GLsizeiptr(16)),
+      size ? data : nullptr, flags);
+  glBindBuffer(target, 0);
+  return buffer;
+}
+
+// World space planes of the frustum, pointing inside
+void extractFrustumPlanes(const glm::mat4 &viewProjMatrix, glm::vec4 planes[6])
+{
+  const auto rows = glm::transpose(viewProjMatrix);
+  for (int axis = 0; axis < 3; ++axis) {
+    planes[2 * axis] = rows[3] + rows[axis];
+    planes[2 * axis + 1] = rows[3] - rows[axis];
+  }
+  for (int i = 0; i < 6; ++i) {
+    planes[i] /= glm::length(glm::vec3(planes[i]));
+  }
+}
+
+} // namespace
+
+MeshletCuller::~MeshletCuller()
+{
+  if (!initialized()) {
+    return;
+  }
+  const GLuint buffers[] = {m_meshletBuffer, m_meshletIndexBuffer,
+      m_clearedCommandBuffer, m_commandBuffer, m_visibleIndexBuffer};
+  glDeleteBuffers(GLsizei(sizeof(buffers) / sizeof(buffers[0])), buffers);
+}
+
+void MeshletCuller::init(const tinygltf::Model &model,
+    const std::vector<int> &meshIndices,
+    const std::vector<glm::mat4> &modelMatrices, size_t minTriangleCount)
+{
+  // Meshlets of each split primitive, shared by the instances of its mesh.
+  // Their first triangle is offset to index the shared index buffer.
+  std::map<std::pair<int, size_t>, std::vector<Meshlet>> primitiveMeshlets;
+  std::vector<GLuint> meshletIndices;
+  std::vector<glm::vec3> positions;
+  std::vector<uint32_t> indices;
+  std::vector<Meshlet> meshlets;
+  std::vector<uint32_t> reorderedIndices;
+
+  std::vector<GPUMeshlet> gpuMeshlets;
+  std::vector<DrawElementsIndirectCommand> commands;
+  GLuint visibleIndexCount = 0;
+
+  size_t drawIdx = 0;
+  for (size_t instanceIdx = 0; instanceIdx < meshIndices.size();
+       ++instanceIdx) {
+    const auto meshIdx = meshIndices[instanceIdx];
+    const auto &mesh = model.meshes[meshIdx];
+    for (size_t i = 0; i < mesh.primitives.size(); ++i, ++drawIdx) {
+      const auto &primitive = mesh.primitives[i];
+      m_commandOffsets.push_back(-1);
+
+      auto it = primitiveMeshlets.find({meshIdx, i});
+      if (it == end(primitiveMeshlets)) {
+        meshlets.clear();
+        if (readPrimitiveTriangles(model, primitive, positions, indices) &&
+            indices.size() / 3 >= minTriangleCount) {
+          buildMeshlets(positions, indices, meshlets, reorderedIndices);
+          const auto firstTriangle = GLuint(meshletIndices.size() / 3);
+          for (auto &meshlet : meshlets) {
+            meshlet.firstTriangle += firstTriangle;
+          }
+          meshletIndices.insert(end(meshletIndices), begin(reorderedIndices),
+              end(reorderedIndices));
+        }
+        it = primitiveMeshlets.emplace(std::make_pair(meshIdx, i), meshlets)
+                 .first;
+      }
+      if ((*it).second.empty()) {
+        continue;
+      }
+
+      // Both sides of double sided materials are visible
+      const auto doubleSided = primitive.material >= 0 &&
+                               model.materials[primitive.material].doubleSided;
+      GLuint indexCount = 0;
+      for (const auto &meshlet : (*it).second) {
+        const auto worldMeshlet =
+            transformMeshlet(meshlet, modelMatrices[instanceIdx]);
+        GPUMeshlet gpuMeshlet;
+        gpuMeshlet.center = worldMeshlet.center;
+        gpuMeshlet.radius = worldMeshlet.radius;
+        gpuMeshlet.coneAxis = worldMeshlet.coneAxis;
+        gpuMeshlet.coneCutoff = doubleSided ? 1.f : worldMeshlet.coneCutoff;
+        gpuMeshlet.firstIndex = 3 * meshlet.firstTriangle;
+        gpuMeshlet.triangleCount = meshlet.triangleCount;
+        gpuMeshlet.drawIdx = GLuint(commands.size());
+        gpuMeshlet.shadingCommandIndex = GLuint(drawIdx);
+        gpuMeshlets.push_back(gpuMeshlet);
+        indexCount += 3 * meshlet.triangleCount;
+      }
+      m_commandOffsets.back() =
+          GLintptr(commands.size() * sizeof(DrawElementsIndirectCommand));
+      commands.push_back({0, 1, visibleIndexCount, 0, 0});
+      visibleIndexCount += indexCount;
+    }
+  }
+  m_meshletCount = gpuMeshlets.size();
+  m_drawCount = commands.size();
+
+  m_meshletBuffer = createBuffer(GL_SHADER_STORAGE_BUFFER,
+      GLsizeiptr(gpuMeshlets.size() * sizeof(GPUMeshlet)), gpuMeshlets.data(),
+      0);
+  m_meshletIndexBuffer = createBuffer(GL_SHADER_STORAGE_BUFFER,
+      GLsizeiptr(meshletIndices.size() * sizeof(GLuint)),
+      meshletIndices.data(), 0);
+  const auto commandsSize =
+      GLsizeiptr(commands.size() * sizeof(DrawElementsIndirectCommand));
+  m_clearedCommandBuffer = createBuffer(
+      GL_SHADER_STORAGE_BUFFER, commandsSize, commands.data(), 0);
+  m_commandBuffer = createBuffer(
+      GL_SHADER_STORAGE_BUFFER, commandsSize, commands.data(), 0);
+  m_visibleIndexBuffer = createBuffer(GL_SHADER_STORAGE_BUFFER,
+      GLsizeiptr(visibleIndexCount * sizeof(GLuint)), nullptr, 0);
+  m_initialized = true;
+
+  std::clog << "Meshlet culling: " << m_drawCount << " split draws, "
+            << m_meshletCount << " meshlets, " << meshletIndices.size() / 3
+            << " triangles" << std::endl;
+}
+
+void MeshletCuller::cull(const glm::mat4 &viewProjMatrix,
+    const glm::vec3 &cameraPosition, const GLProgram &cullProgram,
+    const HiZCuller *hiZCuller)
+{
+  if (m_meshletCount == 0) {
+    return;
+  }
+  const auto hiZ = hiZCuller && hiZCuller->initialized();
+
+  glBindBuffer(GL_COPY_READ_BUFFER, m_clearedCommandBuffer);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, m_commandBuffer);
+  glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0,
+      GLsizeiptr(m_drawCount * sizeof(DrawElementsIndirectCommand)));
+  glBindBuffer(GL_COPY_READ_BUFFER, 0);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, m_meshletBuffer);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, m_meshletIndexBuffer);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, m_commandBuffer);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, m_visibleIndexBuffer);
+  // Never leave a binding empty
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7,
+      hiZ ? hiZCuller->shadingCommandBuffer() : m_commandBuffer);
+
+  glm::vec4 frustumPlanes[6];
+  extractFrustumPlanes(viewProjMatrix, frustumPlanes);
+
+  cullProgram.use();
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, hiZ ? hiZCuller->depthPyramid() : 0);
+  glUniform1i(cullProgram.getUniformLocation("uDepthPyramid"), 0);
+  glUniform1i(cullProgram.getUniformLocation("uHiZCulling"), hiZ);
+  glUniform4fv(cullProgram.getUniformLocation("uFrustumPlanes"), 6,
+      glm::value_ptr(frustumPlanes[0]));
+  glUniform3fv(cullProgram.getUniformLocation("uCameraPosition"), 1,
+      glm::value_ptr(cameraPosition));
+  glUniformMatrix4fv(cullProgram.getUniformLocation("uViewProjMatrix"), 1,
+      GL_FALSE, glm::value_ptr(viewProjMatrix));
+  glUniform1ui(
+      cullProgram.getUniformLocation("uMeshletCount"), GLuint(m_meshletCount));
+
+  const auto groupCountX =
+      std::min(GLuint(m_meshletCount), MAX_WORK_GROUP_COUNT);
+  const auto groupCountY =
+      (GLuint(m_meshletCount) + groupCountX - 1) / groupCountX;
+  glDispatchCompute(groupCountX, groupCountY, 1);
+  glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_ELEMENT_ARRAY_BARRIER_BIT);
+  glBindTexture(GL_TEXTURE_2D, 0);
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include "hiz_culling.hpp"
+#include "meshlets.hpp"
+#include "shaders.hpp"
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <tiny_gltf.h>
+
+#include <vector>
+
+// GPU meshlet culling, see meshlet_cull.cs.glsl.
+// Large triangle primitives are split in meshlets when the culler is
+// initialized. Each frame, the indices of their visible meshlets are compacted
+// in an index buffer drawn with one indirect command per primitive instance,
+// with the VAOs of the primitive. The meshlets are stored in world space, this
+// is for static scenes.
+class MeshletCuller
+{
+public:
+  MeshletCuller() = default;
+  ~MeshletCuller();
+  MeshletCuller(const MeshletCuller &) = delete;
+  MeshletCuller &operator=(const MeshletCuller &) = delete;
+
+  // Compute shaders and shader storage buffers
+  static bool isSupported() { return GLAD_GL_VERSION_4_3 != 0; }
+
+  // Split the triangle primitives of at least minTriangleCount triangles of
+  // the mesh instances returned by flattenScene()
+  void init(const tinygltf::Model &model, const std::vector<int> &meshIndices,
+      const std::vector<glm::mat4> &modelMatrices,
+      size_t minTriangleCount = 1 << 12);
+  bool initialized() const { return m_initialized; }
+
+  // Cull the meshlets for the current view. If hiZCuller is not null, the
+  // meshlets of primitives it culled are skipped and the others are tested
+  // against its depth pyramid, so cull() must be called after
+  // hiZCuller->cull(). Texture unit 0 and the storage buffer bindings 3 to 7
+  // are modified.
+  void cull(const glm::mat4 &viewProjMatrix, const glm::vec3 &cameraPosition,
+      const GLProgram &cullProgram, const HiZCuller *hiZCuller = nullptr);
+
+  // Offset in commandBuffer() of the command of a primitive in drawing order,
+  // -1 if it is not split in meshlets. The command draws GL_UNSIGNED_INT
+  // indices from indexBuffer(), that must be bound as the element buffer of
+  // the VAO of the primitive.
+  GLintptr commandOffset(size_t drawIdx) const
+  {
+    return drawIdx < m_commandOffsets.size() ? m_commandOffsets[drawIdx] : -1;
+  }
+  GLuint commandBuffer() const { return m_commandBuffer; }
+  GLuint indexBuffer() const { return m_visibleIndexBuffer; }
+
+  size_t meshletCount() const { return m_meshletCount; }
+
+private:
+  // std430 layout of Meshlet in meshlet_cull.cs.glsl
+  struct GPUMeshlet
+  {
+    glm::vec3 center;
+    float radius;
+    glm::vec3 coneAxis;
+    float coneCutoff;
+    GLuint firstIndex;
+    GLuint triangleCount;
+    GLuint drawIdx;
+    GLuint shadingCommandIndex;
+  };
+
+  bool m_initialized = false;
+  size_t m_meshletCount = 0;
+  size_t m_drawCount = 0;
+  std::vector<GLintptr> m_commandOffsets;
+
+  GLuint m_meshletBuffer = 0;
+  GLuint m_meshletIndexBuffer = 0;
+  // Commands with a count of 0, copied to m_commandBuffer before culling
+  GLuint m_clearedCommandBuffer = 0;
+  GLuint m_commandBuffer = 0;
+  GLuint m_visibleIndexBuffer = 0;
+};
@@ -0,0 +1,196 @@
+#include "meshlets.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace {
+
+void computeMeshletBounds(const std::vector<glm::vec3> &positions,
+    const uint32_t *triangles, const std::vector<uint32_t> &vertices,
+    Meshlet &meshlet)
+{
+  auto bboxMin = glm::vec3(std::numeric_limits<float>::max());
+  auto bboxMax = glm::vec3(std::numeric_limits<float>::lowest());
+  for (const auto vertex : vertices) {
+    bboxMin = glm::min(bboxMin, positions[vertex]);
+    bboxMax = glm::max(bboxMax, positions[vertex]);
+  }
+  meshlet.center = 0.5f * (bboxMin + bboxMax);
+  meshlet.radius = 0.f;
+  for (const auto vertex : vertices) {
+    meshlet.radius = std::max(
+        meshlet.radius, glm::distance(meshlet.center, positions[vertex]));
+  }
+
+  // Geometric normals, front faces are counter clockwise
+  std::vector<glm::vec3> normals;
+  auto normalSum = glm::vec3(0);
+  for (uint32_t t = 0; t < meshlet.triangleCount; ++t) {
+    const auto &a = positions[triangles[3 * t]];
+    const auto &b = positions[triangles[3 * t + 1]];
+    const auto &c = positions[triangles[3 * t + 2]];
+    const auto normal = glm::cross(b - a, c - a);
+    const auto length = glm::length(normal);
+    if (length > 0.f) {
+      normals.emplace_back(normal / length);
+      normalSum += normals.back();
+    }
+  }
+  meshlet.coneAxis = glm::vec3(0, 0, 1);
+  meshlet.coneCutoff = 1.f;
+  const auto sumLength = glm::length(normalSum);
+  if (normals.empty() || sumLength < 1e-6f) {
+    return;
+  }
+  meshlet.coneAxis = normalSum / sumLength;
+  auto minDot = 1.f;
+  for (const auto &normal : normals) {
+    minDot = std::min(minDot, glm::dot(normal, meshlet.coneAxis));
+  }
+  // A cone wider than a hemisphere always has front facing triangles
+  if (minDot > 0.f) {
+    meshlet.coneCutoff = std::sqrt(1.f - minDot * minDot);
+  }
+}
+
+} // namespace
+
+void buildMeshlets(const std::vector<glm::vec3> &positions,
+    const std::vector<uint32_t> &indices, std::vector<Meshlet> &meshlets,
+    std::vector<uint32_t> &meshletIndices, size_t maxVertexCount,
+    size_t maxTriangleCount)
+{
+  meshlets.clear();
+  meshletIndices.clear();
+  const auto triangleCount = indices.size() / 3;
+  meshletIndices.reserve(3 * triangleCount);
+
+  // Triangles of each vertex
+  std::vector<uint32_t> adjacencyOffsets(positions.size() + 1, 0);
+  for (size_t i = 0; i < 3 * triangleCount; ++i) {
+    ++adjacencyOffsets[indices[i] + 1];
+  }
+  for (size_t v = 0; v < positions.size(); ++v) {
+    adjacencyOffsets[v + 1] += adjacencyOffsets[v];
+  }
+  std::vector<uint32_t> adjacency(3 * triangleCount);
+  {
+    auto cursors = adjacencyOffsets;
+    for (size_t i = 0; i < 3 * triangleCount; ++i) {
+      adjacency[cursors[indices[i]]++] = uint32_t(i / 3);
+    }
+  }
+
+  std::vector<uint8_t> emitted(triangleCount, 0);
+  // Index of the meshlet that last used each vertex
+  std::vector<uint32_t> vertexMeshlet(
+      positions.size(), std::numeric_limits<uint32_t>::max());
+  std::vector<uint32_t> vertices;
+  std::vector<uint32_t> candidates;
+  size_t nextSeed = 0;
+
+  for (;;) {
+    while (nextSeed < triangleCount && emitted[nextSeed]) {
+      ++nextSeed;
+    }
+    if (nextSeed == triangleCount) {
+      break;
+    }
+
+    const auto meshletIdx = uint32_t(meshlets.size());
+    Meshlet meshlet;
+    meshlet.firstTriangle = uint32_t(meshletIndices.size() / 3);
+    meshlet.triangleCount = 0;
+    vertices.clear();
+    candidates.clear();
+
+    const auto newVertexCount = [&](size_t triangle) {
+      size_t count = 0;
+      for (int k = 0; k < 3; ++k) {
+        count += vertexMeshlet[indices[3 * triangle + k]] != meshletIdx;
+      }
+      return count;
+    };
+    const auto addTriangle = [&](size_t triangle) {
+      emitted[triangle] = 1;
+      ++meshlet.triangleCount;
+      for (int k = 0; k < 3; ++k) {
+        const auto vertex = indices[3 * triangle + k];
+        meshletIndices.push_back(vertex);
+        if (vertexMeshlet[vertex] == meshletIdx) {
+          continue;
+        }
+        vertexMeshlet[vertex] = meshletIdx;
+        vertices.push_back(vertex);
+        for (auto a = adjacencyOffsets[vertex];
+             a < adjacencyOffsets[vertex + 1]; ++a) {
+          if (!emitted[adjacency[a]]) {
+            candidates.push_back(adjacency[a]);
+          }
+        }
+      }
+    };
+
+    addTriangle(nextSeed);
+    while (meshlet.triangleCount < maxTriangleCount) {
+      // Remove the emitted candidates while looking for the best one
+      size_t best = triangleCount;
+      size_t bestNewVertexCount = 4;
+      size_t kept = 0;
+      for (const auto candidate : candidates) {
+        if (emitted[candidate]) {
+          continue;
+        }
+        candidates[kept++] = candidate;
+        const auto count = newVertexCount(candidate);
+        if (count < bestNewVertexCount) {
+          best = candidate;
+          bestNewVertexCount = count;
+        }
+      }
+      candidates.resize(kept);
+      // Disconnected from the meshlet, continue with the next triangle
+      if (best == triangleCount) {
+        while (nextSeed < triangleCount && emitted[nextSeed]) {
+          ++nextSeed;
+        }
+        if (nextSeed == triangleCount) {
+          break;
+        }
+        best = nextSeed;
+        bestNewVertexCount = newVertexCount(best);
+      }
+      if (vertices.size() + bestNewVertexCount > maxVertexCount) {
+        break;
+      }
+      addTriangle(best);
+    }
+
+    meshlet.vertexCount = uint32_t(vertices.size());
+    computeMeshletBounds(positions,
+        meshletIndices.data() + 3 * meshlet.firstTriangle, vertices, meshlet);
+    meshlets.push_back(meshlet);
+  }
+}
+
+Meshlet transformMeshlet(const Meshlet &meshlet, const glm::mat4 &matrix)
+{
+  const glm::mat3 linear(matrix);
+  const glm::vec3 scales(glm::length(linear[0]), glm::length(linear[1]),
+      glm::length(linear[2]));
+  const auto maxScale = std::max(scales.x, std::max(scales.y, scales.z));
+  const auto minScale = std::min(scales.x, std::min(scales.y, scales.z));
+
+  auto result = meshlet;
+  result.center = glm::vec3(matrix * glm::vec4(meshlet.center, 1));
+  result.radius = meshlet.radius * maxScale;
+  // Normals transform with the inverse transpose, which keeps them pointing
+  // to the front side when the transform is mirrored
+  result.coneAxis =
+      glm::normalize(glm::transpose(glm::inverse(linear)) * meshlet.coneAxis);
+  if (maxScale - minScale > 1e-3f * maxScale) {
+    result.coneCutoff = 1.f;
+  }
+  return result;
+}
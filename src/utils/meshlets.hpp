@@ -0,0 +1,46 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <vector>
+
+// Clusters of neighbour triangles of a mesh, small enough to be culled
+// individually: large meshes then only rasterize their visible parts.
+struct Meshlet
+{
+  // Bounding sphere
+  glm::vec3 center;
+  float radius;
+  // Normal cone: the meshlet is back facing when seen from eye if
+  // dot(center - eye, coneAxis) >= coneCutoff * length(center - eye) + radius.
+  // coneCutoff is the sine of the half angle of the cone, 1 if the meshlet is
+  // never back facing from every point of view.
+  glm::vec3 coneAxis;
+  float coneCutoff;
+  // Range of triangles in the meshlet index buffer
+  uint32_t firstTriangle;
+  uint32_t triangleCount;
+  uint32_t vertexCount;
+};
+
+// Split the triangles of an indexed mesh in meshlets of at most
+// maxVertexCount vertices and maxTriangleCount triangles. Triangles are grown
+// greedily from a seed, preferring the ones that add the fewest vertices.
+// meshletIndices receives the triangles reordered by meshlet, with the
+// original vertex indices.
+void buildMeshlets(const std::vector<glm::vec3> &positions,
+    const std::vector<uint32_t> &indices, std::vector<Meshlet> &meshlets,
+    std::vector<uint32_t> &meshletIndices, size_t maxVertexCount = 64,
+    size_t maxTriangleCount = 124);
+
+// Transform a meshlet to the space of matrix. The normal cone is disabled if
+// the transform has a non uniform scale.
+Meshlet transformMeshlet(const Meshlet &meshlet, const glm::mat4 &matrix);
+
+inline bool isMeshletBackFacing(const Meshlet &meshlet, const glm::vec3 &eye)
+{
+  const auto view = meshlet.center - eye;
+  return glm::dot(view, meshlet.coneAxis) >=
+         meshlet.coneCutoff * glm::length(view) + meshlet.radius;
+}
@@ -0,0 +1,128 @@
+#include "model_cache.hpp"
+
+#include <iostream>
+
+namespace {
+
+double megabytes(size_t bytes) { return double(bytes) / (1024. * 1024.); }
+
+size_t bufferBytes(GLuint buffer)
+{
+  if (!buffer) {
+    return 0;
+  }
+  GLint64 size = 0;
+  glBindBuffer(GL_ARRAY_BUFFER, buffer);
+  glGetBufferParameteri64v(GL_ARRAY_BUFFER, GL_BUFFER_SIZE, &size);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  return size_t(size);
+}
+
+// Textures of createTextureObjects(): RGBA, 8 bits per component for the
+// usual images, with a full mipmap chain for the mipmap filters
+size_t textureBytes(GLuint texture)
+{
+  GLint width = 0;
+  GLint height = 0;
+  GLint minFilter = 0;
+  glBindTexture(GL_TEXTURE_2D, texture);
+  glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &width);
+  glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &height);
+  glGetTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, &minFilter);
+  glBindTexture(GL_TEXTURE_2D, 0);
+  const auto bytes = size_t(width) * size_t(height) * 4;
+  const auto mipmaps = minFilter != GL_NEAREST && minFilter != GL_LINEAR;
+  return mipmaps ? bytes * 4 / 3 : bytes;
+}
+
+} // namespace
+
+ResidentModel::~ResidentModel()
+{
+  glDeleteVertexArrays(
+      GLsizei(vertexArrayObjects.size()), vertexArrayObjects.data());
+  glDeleteVertexArrays(
+      GLsizei(depthVertexArrayObjects.size()), depthVertexArrayObjects.data());
+  glDeleteBuffers(1, &positionBufferObject);
+  glDeleteBuffers(GLsizei(bufferObjects.size()), bufferObjects.data());
+  glDeleteTextures(GLsizei(textureObjects.size()), textureObjects.data());
+}
+
+void ResidentModel::computeFootprint()
+{
+  cpuBytes = sizeof(*this);
+  for (const auto &buffer : model.buffers) {
+    cpuBytes += buffer.data.size();
+  }
+  for (const auto &image : model.images) {
+    cpuBytes += image.image.size();
+  }
+
+  // Vertex array objects are not counted, their state is tiny
+  gpuBytes = bufferBytes(positionBufferObject);
+  for (const auto buffer : bufferObjects) {
+    gpuBytes += bufferBytes(buffer);
+  }
+  for (const auto texture : textureObjects) {
+    gpuBytes += textureBytes(texture);
+  }
+}
+
+void ModelCache::setBudgets(size_t cpuBytes, size_t gpuBytes)
+{
+  m_cpuBudget = cpuBytes;
+  m_gpuBudget = gpuBytes;
+  evict();
+}
+
+std::shared_ptr<ResidentModel> ModelCache::find(const fs::path &path)
+{
+  for (auto it = begin(m_models); it != end(m_models); ++it) {
+    if (it->first == path) {
+      m_models.splice(begin(m_models), m_models, it);
+      return it->second;
+    }
+  }
+  return nullptr;
+}
+
+void ModelCache::insert(
+    const fs::path &path, std::shared_ptr<ResidentModel> model)
+{
+  for (auto it = begin(m_models); it != end(m_models); ++it) {
+    if (it->first == path) {
+      m_cpuBytes -= it->second->cpuBytes;
+      m_gpuBytes -= it->second->gpuBytes;
+      m_models.erase(it);
+      break;
+    }
+  }
+  m_cpuBytes += model->cpuBytes;
+  m_gpuBytes += model->gpuBytes;
+  m_models.emplace_front(path, std::move(model));
+  evict();
+}
+
+void ModelCache::clear()
+{
+  m_models.clear();
+  m_cpuBytes = m_gpuBytes = 0;
+}
+
+void ModelCache::evict()
+{
+  const auto overBudget = [&]() {
+    return (m_cpuBudget && m_cpuBytes > m_cpuBudget) ||
+           (m_gpuBudget && m_gpuBytes > m_gpuBudget);
+  };
+  while (!m_models.empty() && overBudget()) {
+    const auto &evicted = m_models.back();
+    m_cpuBytes -= evicted.second->cpuBytes;
+    m_gpuBytes -= evicted.second->gpuBytes;
+    std::clog << "Model cache: evicted " << evicted.first << ", "
+              << megabytes(evicted.second->cpuBytes) << " MB CPU, "
+              << megabytes(evicted.second->gpuBytes) << " MB GPU"
+              << std::endl;
+    m_models.pop_back();
+  }
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include "filesystem.hpp"
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <tiny_gltf.h>
+
+#include <cstddef>
+#include <list>
+#include <memory>
+#include <utility>
+#include <vector>
+
+// A range of indices in a vector containing Vertex Array Objects
+struct VaoRange
+{
+  GLsizei begin; // Index of first element in vertexArrayObjects
+  GLsizei count; // Number of elements in range
+};
+
+// A loaded model and the OpenGL objects created from it, deleted with it
+struct ResidentModel
+{
+  // After the changes of the command line options (static batching, copies,
+  // random lights)
+  tinygltf::Model model;
+  glm::vec3 bboxMin{0};
+  glm::vec3 bboxMax{0};
+
+  std::vector<GLuint> textureObjects;
+  std::vector<GLuint> bufferObjects;
+  std::vector<GLuint> vertexArrayObjects;
+  std::vector<VaoRange> meshToVertexArrays;
+  std::vector<GLuint> depthVertexArrayObjects;
+  GLuint positionBufferObject = 0;
+
+  // Memory used by the model and by its OpenGL objects, set by
+  // computeFootprint() once they are created
+  size_t cpuBytes = 0;
+  size_t gpuBytes = 0;
+
+  ResidentModel() = default;
+  ~ResidentModel();
+  ResidentModel(const ResidentModel &) = delete;
+  ResidentModel &operator=(const ResidentModel &) = delete;
+
+  void computeFootprint();
+};
+
+// Models kept loaded between the runs of a long running process, such as the
+// serve command, within budgets of CPU and GPU memory. The least recently
+// used models are evicted first. An evicted model that is still in use is
+// only deleted when its last shared pointer is released, so the budgets can
+// be exceeded while a model larger than the remaining space is rendered.
+class ModelCache
+{
+public:
+  // 0 for no limit
+  void setBudgets(size_t cpuBytes, size_t gpuBytes);
+
+  // Model loaded from path, made the most recently used one, null if it is
+  // not in the cache
+  std::shared_ptr<ResidentModel> find(const fs::path &path);
+
+  // Add the model loaded from path as the most recently used one, then evict
+  // the least recently used ones until the budgets are respected
+  void insert(const fs::path &path, std::shared_ptr<ResidentModel> model);
+
+  void clear();
+
+  size_t cpuBytes() const { return m_cpuBytes; }
+  size_t gpuBytes() const { return m_gpuBytes; }
+
+private:
+  void evict();
+
+  // Most recently used first
+  std::list<std::pair<fs::path, std::shared_ptr<ResidentModel>>> m_models;
+  size_t m_cpuBudget = 0;
+  size_t m_gpuBudget = 0;
+  size_t m_cpuBytes = 0;
+  size_t m_gpuBytes = 0;
+};
@@ -0,0 +1,320 @@
+#include "morph_targets.hpp"
+#include "gltf.hpp"
+
+#include <glm/gtc/type_ptr.hpp>
+
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <utility>
+
+namespace {
+
+// Maximum work group count of a dispatch dimension guaranteed by OpenGL
+const GLuint MAX_WORK_GROUP_COUNT = 65535;
+// local_size_x of morph_targets.cs.glsl
+const GLuint WORK_GROUP_SIZE = 64;
+
+GLuint createBuffer(
+    GLenum target, GLsizeiptr size, const void *data, GLbitfield flags)
+{
+  GLuint buffer = 0;
+  glGenBuffers(1, &buffer);
+  glBindBuffer(target, buffer);
+  // Never allocate an empty buffer
+  glBufferStorage(target, std::max(size, GLsizeiptr(16)),
+      size ? data : nullptr, flags);
+  glBindBuffer(target, 0);
+  return buffer;
+}
+
+// Read the values of the elements of an accessor of componentCount
+// components that are not all zeros. The sparse values of accessors without
+// buffer view are read as they are.
+bool readNonZeroElements(const tinygltf::Model &model,
+    const tinygltf::Accessor &accessor, size_t componentCount,
+    std::vector<uint32_t> &indices, std::vector<float> &values)
+{
+  if (size_t(tinygltf::GetNumComponentsInType(uint32_t(accessor.type))) !=
+      componentCount) {
+    return false;
+  }
+  if (accessor.sparse.isSparse && accessor.bufferView < 0) {
+    return readSparseAccessorFloats(model, accessor, indices, values);
+  }
+  std::vector<float> denseValues;
+  if (!readAccessorFloats(model, accessor, denseValues)) {
+    return false;
+  }
+  indices.clear();
+  values.clear();
+  for (size_t i = 0; i < accessor.count; ++i) {
+    const auto element = &denseValues[componentCount * i];
+    if (std::any_of(element, element + componentCount,
+            [](float value) { return value != 0.f; })) {
+      indices.push_back(uint32_t(i));
+      values.insert(end(values), element, element + componentCount);
+    }
+  }
+  return true;
+}
+
+} // namespace
+
+MorphTargetEvaluator::~MorphTargetEvaluator()
+{
+  if (!initialized()) {
+    return;
+  }
+  const GLuint buffers[] = {
+      m_baseBuffer, m_deltaBuffer, m_outputBuffer, m_jobBuffer};
+  glDeleteBuffers(GLsizei(sizeof(buffers) / sizeof(buffers[0])), buffers);
+}
+
+void MorphTargetEvaluator::init(const tinygltf::Model &model,
+    const std::vector<int> &meshIndices, const std::vector<int> &nodeIndices)
+{
+  // Base vertices and targets of each primitive with targets, shared by the
+  // instances of its mesh
+  struct MorphedPrimitive
+  {
+    GLintptr baseOffset;
+    GLuint vertexCount;
+    std::vector<Target> targets;
+  };
+  std::map<std::pair<int, size_t>, MorphedPrimitive> morphedPrimitives;
+  std::vector<Vertex> baseVertices;
+  std::vector<Delta> deltas;
+  size_t targetCount = 0;
+  size_t sparseTargetCount = 0;
+
+  std::vector<float> values;
+  std::vector<uint32_t> indices;
+  const char *attributes[] = {"POSITION", "NORMAL", "TANGENT"};
+
+  GLuint outputVertexCount = 0;
+  for (size_t instanceIdx = 0; instanceIdx < meshIndices.size();
+       ++instanceIdx) {
+    const auto meshIdx = meshIndices[instanceIdx];
+    const auto &mesh = model.meshes[meshIdx];
+    for (size_t i = 0; i < mesh.primitives.size(); ++i) {
+      const auto &primitive = mesh.primitives[i];
+      m_vertexOffsets.push_back(-1);
+      const auto positions = primitive.attributes.find("POSITION");
+      if (primitive.targets.empty() ||
+          positions == end(primitive.attributes)) {
+        continue;
+      }
+
+      auto it = morphedPrimitives.find({meshIdx, i});
+      if (it == end(morphedPrimitives)) {
+        MorphedPrimitive morphed;
+        morphed.baseOffset = GLintptr(baseVertices.size() * sizeof(Vertex));
+        const auto vertexCount = model.accessors[(*positions).second].count;
+        morphed.vertexCount = GLuint(vertexCount);
+        baseVertices.resize(baseVertices.size() + vertexCount,
+            {glm::vec4(0), glm::vec4(0), glm::vec4(0)});
+        const auto vertices =
+            baseVertices.data() + (baseVertices.size() - vertexCount);
+        for (int a = 0; a < 3; ++a) {
+          const auto attribute = primitive.attributes.find(attributes[a]);
+          if (attribute == end(primitive.attributes) ||
+              !readAccessorFloats(
+                  model, model.accessors[(*attribute).second], values)) {
+            continue;
+          }
+          const auto componentCount = a == 2 ? 4 : 3;
+          const auto count =
+              std::min(values.size() / componentCount, vertexCount);
+          for (size_t v = 0; v < count; ++v) {
+            auto &vertex = vertices[v];
+            auto &value = a == 0 ? vertex.position
+                                 : (a == 1 ? vertex.normal : vertex.tangent);
+            std::copy_n(&values[componentCount * v], componentCount,
+                glm::value_ptr(value));
+          }
+        }
+
+        for (const auto &target : primitive.targets) {
+          // Deltas of the vertices moved by one of the attributes
+          std::map<uint32_t, Delta> vertexDeltas;
+          auto sparse = false;
+          for (int a = 0; a < 3; ++a) {
+            const auto attribute = target.find(attributes[a]);
+            if (attribute == end(target)) {
+              continue;
+            }
+            const auto &accessor = model.accessors[(*attribute).second];
+            sparse |= accessor.sparse.isSparse;
+            // Tangent deltas have no handedness
+            if (!readNonZeroElements(model, accessor, 3, indices, values)) {
+              std::cerr << "Invalid morph target " << attributes[a]
+                        << " in mesh " << meshIdx << ", skipping it."
+                        << std::endl;
+              continue;
+            }
+            for (size_t k = 0; k < indices.size(); ++k) {
+              if (indices[k] >= vertexCount) {
+                continue;
+              }
+              auto delta = vertexDeltas.find(indices[k]);
+              if (delta == end(vertexDeltas)) {
+                delta = vertexDeltas
+                            .emplace(indices[k],
+                                Delta{glm::vec3(0), indices[k], glm::vec4(0),
+                                    glm::vec4(0)})
+                            .first;
+              }
+              const auto value = glm::make_vec3(&values[3 * k]);
+              if (a == 0) {
+                (*delta).second.position = value;
+              } else if (a == 1) {
+                (*delta).second.normal = glm::vec4(value, 0.f);
+              } else {
+                (*delta).second.tangent = glm::vec4(value, 0.f);
+              }
+            }
+          }
+          morphed.targets.push_back(
+              {GLuint(deltas.size()), GLuint(vertexDeltas.size())});
+          for (const auto &delta : vertexDeltas) {
+            deltas.push_back(delta.second);
+          }
+          ++targetCount;
+          sparseTargetCount += sparse;
+        }
+        it = morphedPrimitives.emplace(std::make_pair(meshIdx, i), morphed)
+                 .first;
+      }
+
+      const auto &morphed = (*it).second;
+      Draw draw;
+      draw.node = nodeIndices[instanceIdx];
+      draw.baseOffset = morphed.baseOffset;
+      draw.firstVertex = outputVertexCount;
+      draw.vertexCount = morphed.vertexCount;
+      draw.targets = morphed.targets;
+      m_vertexOffsets.back() = GLintptr(outputVertexCount * sizeof(Vertex));
+      outputVertexCount += morphed.vertexCount;
+      m_draws.push_back(std::move(draw));
+    }
+  }
+
+  m_baseBuffer = createBuffer(GL_COPY_READ_BUFFER,
+      GLsizeiptr(baseVertices.size() * sizeof(Vertex)), baseVertices.data(),
+      0);
+  m_deltaBuffer = createBuffer(GL_SHADER_STORAGE_BUFFER,
+      GLsizeiptr(deltas.size() * sizeof(Delta)), deltas.data(), 0);
+  m_outputBuffer = createBuffer(GL_SHADER_STORAGE_BUFFER,
+      GLsizeiptr(outputVertexCount * sizeof(Vertex)), nullptr, 0);
+  glGenBuffers(1, &m_jobBuffer);
+  m_initialized = true;
+
+  std::clog << "Morph targets: " << m_draws.size() << " morphed draws, "
+            << targetCount << " targets (" << sparseTargetCount
+            << " sparse), " << deltas.size() << " deltas" << std::endl;
+}
+
+void MorphTargetEvaluator::evaluate(
+    const std::vector<std::vector<float>> &nodeWeights,
+    const GLProgram &program)
+{
+  m_blendedTargetCount = 0;
+  m_blendedDeltaCount = 0;
+  if (m_draws.empty()) {
+    return;
+  }
+  for (auto &layer : m_layers) {
+    layer.clear();
+  }
+
+  // Reset the vertices of the draws whose weights changed, and gather the
+  // jobs blending their targets
+  glBindBuffer(GL_COPY_READ_BUFFER, m_baseBuffer);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, m_outputBuffer);
+  for (auto &draw : m_draws) {
+    static const std::vector<float> noWeights;
+    const auto &weights = size_t(draw.node) < nodeWeights.size()
+                              ? nodeWeights[draw.node]
+                              : noWeights;
+    if (draw.evaluated && weights == draw.weights) {
+      continue;
+    }
+    draw.evaluated = true;
+    draw.weights = weights;
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER,
+        draw.baseOffset, GLintptr(draw.firstVertex * sizeof(Vertex)),
+        GLsizeiptr(draw.vertexCount * sizeof(Vertex)));
+
+    size_t layerIdx = 0;
+    const auto targetCount = std::min(draw.targets.size(), weights.size());
+    for (size_t t = 0; t < targetCount; ++t) {
+      const auto &target = draw.targets[t];
+      if (weights[t] == 0.f || target.deltaCount == 0) {
+        continue;
+      }
+      if (layerIdx == m_layers.size()) {
+        m_layers.emplace_back();
+      }
+      m_layers[layerIdx++].push_back({target.firstDelta, target.deltaCount,
+          draw.firstVertex, 0, weights[t]});
+      ++m_blendedTargetCount;
+      m_blendedDeltaCount += target.deltaCount;
+    }
+  }
+  glBindBuffer(GL_COPY_READ_BUFFER, 0);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+  if (m_blendedTargetCount == 0) {
+    return;
+  }
+
+  m_jobs.clear();
+  for (auto &layer : m_layers) {
+    GLuint threadCount = 0;
+    for (auto &job : layer) {
+      job.firstThread = threadCount;
+      threadCount += job.deltaCount;
+    }
+    m_jobs.insert(end(m_jobs), begin(layer), end(layer));
+  }
+  const auto jobsSize = GLsizeiptr(m_jobs.size() * sizeof(Job));
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_jobBuffer);
+  m_jobBufferCapacity = std::max(m_jobBufferCapacity, size_t(jobsSize));
+  // Orphan the jobs that might still be read by the previous evaluation
+  glBufferData(GL_SHADER_STORAGE_BUFFER, GLsizeiptr(m_jobBufferCapacity),
+      nullptr, GL_STREAM_DRAW);
+  glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, jobsSize, m_jobs.data());
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, m_deltaBuffer);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, m_jobBuffer);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, m_outputBuffer);
+  program.use();
+  const auto uFirstJob = program.getUniformLocation("uFirstJob");
+  const auto uJobCount = program.getUniformLocation("uJobCount");
+  const auto uThreadCount = program.getUniformLocation("uThreadCount");
+
+  GLuint firstJob = 0;
+  for (const auto &layer : m_layers) {
+    if (layer.empty()) {
+      break;
+    }
+    const auto threadCount =
+        layer.back().firstThread + layer.back().deltaCount;
+    glUniform1ui(uFirstJob, firstJob);
+    glUniform1ui(uJobCount, GLuint(layer.size()));
+    glUniform1ui(uThreadCount, threadCount);
+    const auto groupCount =
+        (threadCount + WORK_GROUP_SIZE - 1) / WORK_GROUP_SIZE;
+    const auto groupCountX = std::min(groupCount, MAX_WORK_GROUP_COUNT);
+    const auto groupCountY = (groupCount + groupCountX - 1) / groupCountX;
+    if (firstJob > 0) {
+      // Blend on top of the previous layer
+      glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    }
+    glDispatchCompute(groupCountX, groupCountY, 1);
+    firstJob += GLuint(layer.size());
+  }
+  glMemoryBarrier(
+      GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+}
@@ -0,0 +1,118 @@
+#pragma once
+
+#include "shaders.hpp"
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <tiny_gltf.h>
+
+#include <vector>
+
+// GPU morph target evaluation, see morph_targets.cs.glsl.
+// The targets of each primitive are stored as sparse lists of the vertices
+// they move, read from the sparse values of their accessors without
+// densifying them, dense accessors being compacted to their non-zero deltas.
+// Each primitive instance with targets gets its own range of an output vertex
+// buffer, reset to the base vertices and then blended with its targets of
+// non-zero weight only. Instances whose weights did not change are skipped.
+class MorphTargetEvaluator
+{
+public:
+  // Morphed vertices of the output buffer, std430 layout of MorphedVertex in
+  // morph_targets.cs.glsl
+  struct Vertex
+  {
+    glm::vec4 position; // w unused
+    glm::vec4 normal; // w unused
+    glm::vec4 tangent;
+  };
+
+  MorphTargetEvaluator() = default;
+  ~MorphTargetEvaluator();
+  MorphTargetEvaluator(const MorphTargetEvaluator &) = delete;
+  MorphTargetEvaluator &operator=(const MorphTargetEvaluator &) = delete;
+
+  // Compute shaders and shader storage buffers
+  static bool isSupported() { return GLAD_GL_VERSION_4_3 != 0; }
+
+  // Read the targets of the primitives of the mesh instances returned by
+  // flattenScene(), with their node indices
+  void init(const tinygltf::Model &model, const std::vector<int> &meshIndices,
+      const std::vector<int> &nodeIndices);
+  bool initialized() const { return m_initialized; }
+
+  // Blend the targets of each instance with the weights of its node, as
+  // returned by Animator::morphWeights(). The storage buffer bindings 3 to 5
+  // are modified.
+  void evaluate(const std::vector<std::vector<float>> &nodeWeights,
+      const GLProgram &program);
+
+  // Offset in vertexBuffer() of the first morphed vertex of a primitive in
+  // drawing order, -1 if it has no target
+  GLintptr vertexOffset(size_t drawIdx) const
+  {
+    return drawIdx < m_vertexOffsets.size() ? m_vertexOffsets[drawIdx] : -1;
+  }
+  GLuint vertexBuffer() const { return m_outputBuffer; }
+
+  size_t morphedDrawCount() const { return m_draws.size(); }
+  // Targets blended and vertices moved by the last evaluate() call
+  size_t blendedTargetCount() const { return m_blendedTargetCount; }
+  size_t blendedDeltaCount() const { return m_blendedDeltaCount; }
+
+private:
+  // std430 layout of MorphDelta in morph_targets.cs.glsl
+  struct Delta
+  {
+    glm::vec3 position;
+    GLuint vertex; // In the primitive
+    glm::vec4 normal; // w unused
+    glm::vec4 tangent; // w unused
+  };
+
+  // std430 layout of MorphJob in morph_targets.cs.glsl
+  struct Job
+  {
+    GLuint firstDelta;
+    GLuint deltaCount;
+    GLuint firstVertex; // In the output buffer
+    GLuint firstThread; // In the dispatch of its layer
+    GLfloat weight;
+  };
+
+  struct Target
+  {
+    GLuint firstDelta;
+    GLuint deltaCount;
+  };
+
+  // Primitive instance with targets
+  struct Draw
+  {
+    int node;
+    GLintptr baseOffset; // In m_baseBuffer
+    GLuint firstVertex; // In m_outputBuffer
+    GLuint vertexCount;
+    std::vector<Target> targets;
+    bool evaluated = false;
+    std::vector<float> weights; // Of the last evaluation
+  };
+
+  bool m_initialized = false;
+  std::vector<GLintptr> m_vertexOffsets;
+  std::vector<Draw> m_draws;
+  size_t m_blendedTargetCount = 0;
+  size_t m_blendedDeltaCount = 0;
+
+  // Jobs of each layer of the current evaluation: the k-th target of
+  // non-zero weight of each draw, so that the jobs of a layer never move the
+  // same vertex
+  std::vector<std::vector<Job>> m_layers;
+  std::vector<Job> m_jobs;
+
+  GLuint m_baseBuffer = 0;
+  GLuint m_deltaBuffer = 0;
+  GLuint m_outputBuffer = 0;
+  GLuint m_jobBuffer = 0;
+  size_t m_jobBufferCapacity = 0;
+};
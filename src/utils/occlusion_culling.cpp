@@ -0,0 +1,467 @@
+#include "occlusion_culling.hpp"
+#include "gltf.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <limits>
+
+#if defined(__SSE2__) || defined(_M_X64) ||                                    \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define GLTF_VIEWER_USE_SSE 1
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+const size_t TRIANGLE_BATCH_SIZE = 1024;
+const size_t VERTEX_BATCH_SIZE = 4096;
+const size_t BOX_BATCH_SIZE = 256;
+
+// Boxes with min > max have unknown bounds and are never culled
+const BoundingBox UNKNOWN_BOUNDS = {
+    glm::vec3(std::numeric_limits<float>::max()),
+    glm::vec3(std::numeric_limits<float>::lowest())};
+
+BoundingBox computePrimitiveBounds(
+    const tinygltf::Model &model, const tinygltf::Primitive &primitive)
+{
+  const auto positionAttrIdxIt = primitive.attributes.find("POSITION");
+  if (positionAttrIdxIt == end(primitive.attributes)) {
+    return UNKNOWN_BOUNDS;
+  }
+  // Mandatory for positions in glTF 2.0
+  const auto &accessor = model.accessors[(*positionAttrIdxIt).second];
+  if (accessor.minValues.size() == 3 && accessor.maxValues.size() == 3) {
+    return {glm::vec3(accessor.minValues[0], accessor.minValues[1],
+                accessor.minValues[2]),
+        glm::vec3(accessor.maxValues[0], accessor.maxValues[1],
+            accessor.maxValues[2])};
+  }
+  std::vector<glm::vec3> positions;
+  std::vector<uint32_t> indices;
+  if (!readPrimitiveTriangles(model, primitive, positions, indices) ||
+      positions.empty()) {
+    return UNKNOWN_BOUNDS;
+  }
+  BoundingBox bounds = {positions[0], positions[0]};
+  for (const auto &position : positions) {
+    bounds.min = glm::min(bounds.min, position);
+    bounds.max = glm::max(bounds.max, position);
+  }
+  return bounds;
+}
+
+BoundingBox transformBounds(const glm::mat4 &matrix, const BoundingBox &box)
+{
+  if (box.min.x > box.max.x) {
+    return box;
+  }
+  const auto center =
+      glm::vec3(matrix * glm::vec4(0.5f * (box.min + box.max), 1));
+  const auto halfExtent = 0.5f * (box.max - box.min);
+  glm::vec3 worldHalfExtent(0);
+  for (int i = 0; i < 3; ++i) {
+    worldHalfExtent += glm::abs(glm::vec3(matrix[i])) * halfExtent[i];
+  }
+  return {center - worldHalfExtent, center + worldHalfExtent};
+}
+
+} // namespace
+
+std::vector<BoundingBox> computeInstanceBounds(const tinygltf::Model &model,
+    const std::vector<int> &meshIndices,
+    const std::vector<glm::mat4> &modelMatrices)
+{
+  // Local bounds are shared by the instances of a mesh
+  std::vector<std::vector<BoundingBox>> meshBounds(model.meshes.size());
+  std::vector<BoundingBox> bounds;
+  for (size_t instanceIdx = 0; instanceIdx < meshIndices.size();
+       ++instanceIdx) {
+    const auto &mesh = model.meshes[meshIndices[instanceIdx]];
+    auto &localBounds = meshBounds[meshIndices[instanceIdx]];
+    if (localBounds.empty()) {
+      for (const auto &primitive : mesh.primitives) {
+        localBounds.emplace_back(computePrimitiveBounds(model, primitive));
+      }
+    }
+    for (const auto &box : localBounds) {
+      bounds.emplace_back(transformBounds(modelMatrices[instanceIdx], box));
+    }
+  }
+  return bounds;
+}
+
+OccluderMesh selectOccluders(const tinygltf::Model &model,
+    const std::vector<int> &meshIndices,
+    const std::vector<glm::mat4> &modelMatrices, size_t maxTriangleCount)
+{
+  struct Candidate
+  {
+    size_t instanceIdx;
+    size_t primitiveIdx;
+    float score;
+  };
+  std::vector<Candidate> candidates;
+  const auto bounds = computeInstanceBounds(model, meshIndices, modelMatrices);
+  size_t drawIdx = 0;
+  for (size_t instanceIdx = 0; instanceIdx < meshIndices.size();
+       ++instanceIdx) {
+    const auto &mesh = model.meshes[meshIndices[instanceIdx]];
+    for (size_t i = 0; i < mesh.primitives.size(); ++i, ++drawIdx) {
+      const auto &primitive = mesh.primitives[i];
+      const auto &box = bounds[drawIdx];
+      // Blended or alpha tested surfaces have holes
+      if (primitive.mode != TINYGLTF_MODE_TRIANGLES ||
+          box.min.x > box.max.x ||
+          (primitive.material >= 0 &&
+              model.materials[primitive.material].alphaMode != "OPAQUE")) {
+        continue;
+      }
+      // Area of the largest face of the box, large for walls and floors
+      auto extent = box.max - box.min;
+      std::sort(&extent[0], &extent[0] + 3);
+      candidates.push_back({instanceIdx, i, extent[2] * extent[1]});
+    }
+  }
+  std::sort(begin(candidates), end(candidates),
+      [](const Candidate &a, const Candidate &b) { return a.score > b.score; });
+
+  OccluderMesh occluders;
+  std::vector<glm::vec3> positions;
+  std::vector<uint32_t> indices;
+  for (const auto &candidate : candidates) {
+    const auto &mesh = model.meshes[meshIndices[candidate.instanceIdx]];
+    if (!readPrimitiveTriangles(model, mesh.primitives[candidate.primitiveIdx],
+            positions, indices)) {
+      continue;
+    }
+    const auto triangleCount = indices.size() / 3;
+    const auto occluderTriangleCount = occluders.indices.size() / 3;
+    if (triangleCount > maxTriangleCount / 4 ||
+        occluderTriangleCount + triangleCount > maxTriangleCount) {
+      continue;
+    }
+    const auto &modelMatrix = modelMatrices[candidate.instanceIdx];
+    const auto firstVertex = uint32_t(occluders.positions.size());
+    for (const auto &position : positions) {
+      occluders.positions.emplace_back(
+          glm::vec3(modelMatrix * glm::vec4(position, 1)));
+    }
+    for (const auto index : indices) {
+      occluders.indices.emplace_back(firstVertex + index);
+    }
+  }
+  return occluders;
+}
+
+OcclusionCuller::OcclusionCuller(int width, int height, unsigned threadCount) :
+    m_width((width + TILE_SIZE - 1) / TILE_SIZE * TILE_SIZE),
+    m_height((height + TILE_SIZE - 1) / TILE_SIZE * TILE_SIZE),
+    m_tileCountX(m_width / TILE_SIZE),
+    m_tileCountY(m_height / TILE_SIZE),
+    m_depth(size_t(m_width) * m_height, 1.f),
+    m_tileMaxDepth(size_t(m_tileCountX) * m_tileCountY, 1.f),
+    m_threadPool(threadCount)
+{
+}
+
+void OcclusionCuller::setOccluders(OccluderMesh occluders)
+{
+  m_occluders = std::move(occluders);
+  m_clipPositions.resize(m_occluders.positions.size());
+  m_triangleBatches.resize(
+      (m_occluders.indices.size() / 3 + TRIANGLE_BATCH_SIZE - 1) /
+      TRIANGLE_BATCH_SIZE);
+}
+
+void OcclusionCuller::renderOccluders(const glm::mat4 &viewProjMatrix)
+{
+  m_viewProjMatrix = viewProjMatrix;
+
+  const auto vertexCount = m_occluders.positions.size();
+  m_threadPool.parallelFor(
+      int((vertexCount + VERTEX_BATCH_SIZE - 1) / VERTEX_BATCH_SIZE),
+      [&](int batch) {
+        const auto last =
+            std::min(vertexCount, (batch + 1) * VERTEX_BATCH_SIZE);
+        for (auto i = batch * VERTEX_BATCH_SIZE; i < last; ++i) {
+          m_clipPositions[i] =
+              viewProjMatrix * glm::vec4(m_occluders.positions[i], 1);
+        }
+      });
+
+  const auto triangleCount = m_occluders.indices.size() / 3;
+  m_threadPool.parallelFor(int(m_triangleBatches.size()), [&](int batch) {
+    setupTriangles(batch * TRIANGLE_BATCH_SIZE,
+        std::min(triangleCount, (batch + 1) * TRIANGLE_BATCH_SIZE),
+        m_triangleBatches[batch]);
+  });
+  m_rasterizedTriangleCount = 0;
+  for (const auto &triangles : m_triangleBatches) {
+    m_rasterizedTriangleCount += triangles.size();
+  }
+
+  // Each task owns a row of tiles
+  m_threadPool.parallelFor(m_tileCountY, [&](int tileY) {
+    const auto minY = tileY * TILE_SIZE;
+    const auto maxY = minY + TILE_SIZE - 1;
+    std::fill(m_depth.begin() + size_t(minY) * m_width,
+        m_depth.begin() + size_t(maxY + 1) * m_width, 1.f);
+    rasterizeRows(minY, maxY);
+
+    for (int tileX = 0; tileX < m_tileCountX; ++tileX) {
+      float maxDepth = 0.f;
+      for (int y = minY; y <= maxY; ++y) {
+        const auto row = &m_depth[size_t(y) * m_width + tileX * TILE_SIZE];
+        maxDepth = std::max(maxDepth, *std::max_element(row, row + TILE_SIZE));
+      }
+      m_tileMaxDepth[size_t(tileY) * m_tileCountX + tileX] = maxDepth;
+    }
+  });
+}
+
+void OcclusionCuller::setupTriangles(
+    size_t first, size_t last, std::vector<ScreenTriangle> &triangles) const
+{
+  triangles.clear();
+
+  const auto addTriangle = [&](glm::dvec3 v0, glm::dvec3 v1, glm::dvec3 v2) {
+    auto area = (v1.x - v0.x) * (v2.y - v0.y) - (v1.y - v0.y) * (v2.x - v0.x);
+    if (area == 0. || std::min({v0.z, v1.z, v2.z}) > 1.) {
+      return;
+    }
+    // Occluders are rasterized without back face culling
+    if (area < 0.) {
+      std::swap(v1, v2);
+      area = -area;
+    }
+    ScreenTriangle triangle;
+    triangle.minX = int(std::max(0., std::floor(std::min({v0.x, v1.x, v2.x}))));
+    triangle.maxX = int(std::min(
+        m_width - 1., std::floor(std::max({v0.x, v1.x, v2.x}))));
+    triangle.minY = int(std::max(0., std::floor(std::min({v0.y, v1.y, v2.y}))));
+    triangle.maxY = int(std::min(
+        m_height - 1., std::floor(std::max({v0.y, v1.y, v2.y}))));
+    if (triangle.minX > triangle.maxX || triangle.minY > triangle.maxY) {
+      return;
+    }
+    // edges[i] is zero on the edge opposite to vertex i and area on vertex i
+    const glm::dvec3 *vertices[3] = {&v0, &v1, &v2};
+    for (int i = 0; i < 3; ++i) {
+      const auto &a = *vertices[(i + 1) % 3];
+      const auto &b = *vertices[(i + 2) % 3];
+      triangle.edges[i][0] = a.y - b.y;
+      triangle.edges[i][1] = b.x - a.x;
+      triangle.edges[i][2] = a.x * b.y - a.y * b.x;
+    }
+    for (int j = 0; j < 3; ++j) {
+      triangle.depth[j] =
+          (triangle.edges[0][j] * v0.z + triangle.edges[1][j] * v1.z +
+              triangle.edges[2][j] * v2.z) /
+          area;
+    }
+    triangles.push_back(triangle);
+  };
+
+  for (auto t = first; t < last; ++t) {
+    glm::vec4 clip[3];
+    for (int k = 0; k < 3; ++k) {
+      clip[k] = m_clipPositions[m_occluders.indices[3 * t + k]];
+    }
+    // Clip against the near plane z = -w, the other planes are handled by
+    // the bounds of the rasterization
+    glm::vec4 polygon[4];
+    int vertexCount = 0;
+    for (int k = 0; k < 3; ++k) {
+      const auto &a = clip[k];
+      const auto &b = clip[(k + 1) % 3];
+      const auto da = a.z + a.w;
+      const auto db = b.z + b.w;
+      if (da >= 0.f) {
+        polygon[vertexCount++] = a;
+      }
+      if ((da >= 0.f) != (db >= 0.f)) {
+        polygon[vertexCount++] = a + (b - a) * (da / (da - db));
+      }
+    }
+    if (vertexCount < 3) {
+      continue;
+    }
+    glm::dvec3 screen[4];
+    bool valid = true;
+    for (int k = 0; k < vertexCount; ++k) {
+      const auto &p = polygon[k];
+      if (p.w <= 0.f) {
+        valid = false;
+        break;
+      }
+      screen[k] = glm::dvec3((p.x / double(p.w) * 0.5 + 0.5) * m_width,
+          (p.y / double(p.w) * 0.5 + 0.5) * m_height,
+          p.z / double(p.w) * 0.5 + 0.5);
+    }
+    if (!valid) {
+      continue;
+    }
+    for (int k = 1; k + 1 < vertexCount; ++k) {
+      addTriangle(screen[0], screen[k], screen[k + 1]);
+    }
+  }
+}
+
+void OcclusionCuller::rasterizeRows(int minY, int maxY)
+{
+  for (const auto &triangles : m_triangleBatches) {
+    for (const auto &triangle : triangles) {
+      const auto y0 = std::max(triangle.minY, minY);
+      const auto y1 = std::min(triangle.maxY, maxY);
+      // Rows are processed by blocks of 4 pixels, m_width is a multiple of 4
+      const auto x0 = triangle.minX & ~3;
+      for (int y = y0; y <= y1; ++y) {
+        // Row start in double precision: clipped vertices can be far outside
+        // of the viewport
+        const auto px = x0 + 0.5;
+        const auto py = y + 0.5;
+        float e[3], de[3];
+        for (int i = 0; i < 3; ++i) {
+          const auto &edge = triangle.edges[i];
+          e[i] = float(edge[0] * px + edge[1] * py + edge[2]);
+          de[i] = float(edge[0]);
+        }
+        const auto &plane = triangle.depth;
+        const auto z = float(plane[0] * px + plane[1] * py + plane[2]);
+        const auto dz = float(triangle.depth[0]);
+        const auto row = &m_depth[size_t(y) * m_width];
+#ifdef GLTF_VIEWER_USE_SSE
+        const auto lanes = _mm_set_ps(3.f, 2.f, 1.f, 0.f);
+        const auto zero = _mm_setzero_ps();
+        __m128 edges[3], edgeSteps[3];
+        for (int i = 0; i < 3; ++i) {
+          edges[i] = _mm_add_ps(
+              _mm_set1_ps(e[i]), _mm_mul_ps(_mm_set1_ps(de[i]), lanes));
+          edgeSteps[i] = _mm_set1_ps(4.f * de[i]);
+        }
+        auto depth =
+            _mm_add_ps(_mm_set1_ps(z), _mm_mul_ps(_mm_set1_ps(dz), lanes));
+        const auto depthStep = _mm_set1_ps(4.f * dz);
+        for (int x = x0; x <= triangle.maxX; x += 4) {
+          const auto inside =
+              _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(edges[0], zero),
+                             _mm_cmpge_ps(edges[1], zero)),
+                  _mm_cmpge_ps(edges[2], zero));
+          if (_mm_movemask_ps(inside)) {
+            const auto current = _mm_loadu_ps(row + x);
+            const auto nearest = _mm_min_ps(current, depth);
+            _mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, nearest),
+                                       _mm_andnot_ps(inside, current)));
+          }
+          for (int i = 0; i < 3; ++i) {
+            edges[i] = _mm_add_ps(edges[i], edgeSteps[i]);
+          }
+          depth = _mm_add_ps(depth, depthStep);
+        }
+#else
+        for (int x = x0; x <= triangle.maxX; ++x) {
+          const auto offset = float(x - x0);
+          if (e[0] + offset * de[0] >= 0.f && e[1] + offset * de[1] >= 0.f &&
+              e[2] + offset * de[2] >= 0.f) {
+            row[x] = std::min(row[x], z + offset * dz);
+          }
+        }
+#endif
+      }
+    }
+  }
+}
+
+bool OcclusionCuller::isVisible(const BoundingBox &box) const
+{
+  if (box.min.x > box.max.x) {
+    return true;
+  }
+  glm::vec3 ndcMin(std::numeric_limits<float>::max());
+  glm::vec3 ndcMax(std::numeric_limits<float>::lowest());
+  int cornersBehindNearPlane = 0;
+  for (int i = 0; i < 8; ++i) {
+    const glm::vec3 corner(i & 1 ? box.max.x : box.min.x,
+        i & 2 ? box.max.y : box.min.y, i & 4 ? box.max.z : box.min.z);
+    const auto clip = m_viewProjMatrix * glm::vec4(corner, 1);
+    if (clip.w <= 0.f || clip.z < -clip.w) {
+      ++cornersBehindNearPlane;
+      continue;
+    }
+    const auto ndc = glm::vec3(clip) / clip.w;
+    ndcMin = glm::min(ndcMin, ndc);
+    ndcMax = glm::max(ndcMax, ndc);
+  }
+  // Crossing the near plane: the screen space bounds are unbounded
+  if (cornersBehindNearPlane > 0) {
+    return cornersBehindNearPlane < 8;
+  }
+  if (ndcMax.x < -1.f || ndcMin.x > 1.f || ndcMax.y < -1.f ||
+      ndcMin.y > 1.f || ndcMin.z > 1.f) {
+    return false;
+  }
+
+  const auto toPixel = [](float ndc, int size) {
+    return int(glm::clamp((ndc * 0.5f + 0.5f) * size, 0.f, size - 1.f));
+  };
+  const auto minX = toPixel(ndcMin.x, m_width);
+  const auto maxX = toPixel(ndcMax.x, m_width);
+  const auto minY = toPixel(ndcMin.y, m_height);
+  const auto maxY = toPixel(ndcMax.y, m_height);
+  const auto nearestDepth = ndcMin.z * 0.5f + 0.5f;
+
+  for (int tileY = minY / TILE_SIZE; tileY <= maxY / TILE_SIZE; ++tileY) {
+    for (int tileX = minX / TILE_SIZE; tileX <= maxX / TILE_SIZE; ++tileX) {
+      if (m_tileMaxDepth[size_t(tileY) * m_tileCountX + tileX] <
+          nearestDepth) {
+        continue; // Fully occluded in this tile
+      }
+      const auto x0 = std::max(minX, tileX * TILE_SIZE);
+      const auto x1 = std::min(maxX, tileX * TILE_SIZE + TILE_SIZE - 1);
+      const auto y0 = std::max(minY, tileY * TILE_SIZE);
+      const auto y1 = std::min(maxY, tileY * TILE_SIZE + TILE_SIZE - 1);
+      for (int y = y0; y <= y1; ++y) {
+        const auto row = &m_depth[size_t(y) * m_width];
+#ifdef GLTF_VIEWER_USE_SSE
+        const auto reference = _mm_set1_ps(nearestDepth);
+        for (int blockX = x0 & ~3; blockX <= x1; blockX += 4) {
+          const auto first = std::max(x0 - blockX, 0);
+          const auto last = std::min(x1 - blockX, 3);
+          const auto laneMask = ((1 << (last + 1)) - 1) & ~((1 << first) - 1);
+          if (_mm_movemask_ps(_mm_cmpge_ps(
+                  _mm_loadu_ps(row + blockX), reference)) &
+              laneMask) {
+            return true;
+          }
+        }
+#else
+        for (int x = x0; x <= x1; ++x) {
+          if (row[x] >= nearestDepth) {
+            return true;
+          }
+        }
+#endif
+      }
+    }
+  }
+  return false;
+}
+
+size_t OcclusionCuller::testVisibility(
+    const BoundingBox *boxes, size_t count, uint8_t *visible)
+{
+  std::atomic<size_t> visibleCount{0};
+  m_threadPool.parallelFor(
+      int((count + BOX_BATCH_SIZE - 1) / BOX_BATCH_SIZE), [&](int batch) {
+        const auto last = std::min(count, (batch + 1) * BOX_BATCH_SIZE);
+        size_t batchVisibleCount = 0;
+        for (auto i = batch * BOX_BATCH_SIZE; i < last; ++i) {
+          visible[i] = visible[i] && isVisible(boxes[i]) ? 1 : 0;
+          batchVisibleCount += visible[i];
+        }
+        visibleCount += batchVisibleCount;
+      });
+  return visibleCount;
+}
@@ -0,0 +1,105 @@
+#pragma once
+
+#include "thread_pool.hpp"
+
+#include <glm/glm.hpp>
+#include <tiny_gltf.h>
+
+#include <cstdint>
+#include <vector>
+
+// Software occlusion culling: a few large occluders are rasterized on the CPU
+// into a low resolution depth buffer, then the screen space bounds of each
+// draw are tested against it before submission. Rasterization and tests are
+// spread over worker threads and use SSE when available.
+// The depth buffer is sampled at pixel centers, so a draw that is only
+// visible through a gap thinner than a depth buffer pixel can be culled.
+
+struct BoundingBox
+{
+  glm::vec3 min;
+  glm::vec3 max;
+};
+
+// World space triangles
+struct OccluderMesh
+{
+  std::vector<glm::vec3> positions;
+  std::vector<uint32_t> indices;
+};
+
+// World space bounds of the primitives of the mesh instances returned by
+// flattenScene(), in drawing order: primitives of instance 0, then of
+// instance 1...
+std::vector<BoundingBox> computeInstanceBounds(const tinygltf::Model &model,
+    const std::vector<int> &meshIndices,
+    const std::vector<glm::mat4> &modelMatrices);
+
+// Select the opaque primitive instances with the largest bounds as occluders,
+// up to maxTriangleCount triangles. Primitives with more than a quarter of the
+// budget are skipped: they are too detailed to be cheap occluders.
+OccluderMesh selectOccluders(const tinygltf::Model &model,
+    const std::vector<int> &meshIndices,
+    const std::vector<glm::mat4> &modelMatrices,
+    size_t maxTriangleCount = 1 << 15);
+
+class OcclusionCuller
+{
+public:
+  // Tiles store the farthest depth of their pixels to reject most tests early
+  static const int TILE_SIZE = 8;
+
+  // width and height are rounded up to a multiple of TILE_SIZE, threadCount
+  // = 0 uses std::thread::hardware_concurrency()
+  OcclusionCuller(int width = 256, int height = 128, unsigned threadCount = 0);
+
+  void setOccluders(OccluderMesh occluders);
+
+  // Clear the depth buffer and rasterize the occluders
+  void renderOccluders(const glm::mat4 &viewProjMatrix);
+
+  // Test a world space box against the frustum and the depth buffer of the
+  // last renderOccluders() call
+  bool isVisible(const BoundingBox &box) const;
+
+  // visible[i] = isVisible(boxes[i]) for the boxes that are not already
+  // culled by visible[i] = 0, return the number of visible boxes
+  size_t testVisibility(
+      const BoundingBox *boxes, size_t count, uint8_t *visible);
+
+  int width() const { return m_width; }
+  int height() const { return m_height; }
+  // Window space depth in [0, 1], 1 where no occluder was rasterized. Row 0 is
+  // the bottom of the viewport.
+  const std::vector<float> &depthBuffer() const { return m_depth; }
+  size_t rasterizedTriangleCount() const { return m_rasterizedTriangleCount; }
+
+private:
+  // Triangle in pixel coordinates, counter clockwise, as edge functions that
+  // are positive inside and a depth plane
+  struct ScreenTriangle
+  {
+    double edges[3][3]; // a * x + b * y + c
+    double depth[3];
+    int minX, maxX, minY, maxY;
+  };
+
+  void setupTriangles(size_t first, size_t last,
+      std::vector<ScreenTriangle> &triangles) const;
+  void rasterizeRows(int minY, int maxY);
+
+  int m_width;
+  int m_height;
+  int m_tileCountX;
+  int m_tileCountY;
+  std::vector<float> m_depth;
+  std::vector<float> m_tileMaxDepth;
+
+  OccluderMesh m_occluders;
+  glm::mat4 m_viewProjMatrix{1};
+  std::vector<glm::vec4> m_clipPositions;
+  std::vector<std::vector<ScreenTriangle>> m_triangleBatches;
+  size_t m_rasterizedTriangleCount = 0;
+
+  ThreadPool m_threadPool;
+};
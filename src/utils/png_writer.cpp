@@ -0,0 +1,821 @@
+#include "png_writer.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <queue>
+#include <utility>
+#include <vector>
+
+namespace {
+
+// Filtered bytes per strip: large enough for matches to find references,
+// small enough to balance the strips between threads
+const size_t STRIP_SIZE = 256 * 1024;
+// LZ77 symbols per deflate block, each block having its own Huffman codes
+const size_t BLOCK_SYMBOL_COUNT = 32 * 1024;
+const size_t MAX_STORED_BLOCK_SIZE = 65535;
+
+const size_t WINDOW_SIZE = 32768;
+const int MIN_MATCH = 3;
+const int MAX_MATCH = 258;
+// Matches of MIN_MATCH bytes farther than this cost more than literals
+const size_t TOO_FAR = 4096;
+const int HASH_BITS = 15;
+
+// Hash chain length and length of a match good enough to stop searching, by
+// deflate level
+const int MAX_CHAINS[9] = {4, 8, 16, 32, 64, 128, 256, 1024, 4096};
+const int NICE_LENGTHS[9] = {8, 16, 32, 32, 64, 128, 128, 258, 258};
+// Longest match whose positions are all hashed, as zlib's fast levels
+const int MAX_INSERT_LENGTHS[9] = {4, 5, 6, 258, 258, 258, 258, 258, 258};
+
+const int LENGTH_BASES[29] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19,
+    23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+const int LENGTH_EXTRA_BITS[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2,
+    2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+const int DISTANCE_BASES[30] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65,
+    97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+    8193, 12289, 16385, 24577};
+const int DISTANCE_EXTRA_BITS[30] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5,
+    5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+// Order of the code length code lengths in a dynamic block header
+const int CODE_LENGTH_ORDER[19] = {
+    16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+const int LITERAL_LENGTH_CODE_COUNT = 286;
+const int DISTANCE_CODE_COUNT = 30;
+const int CODE_LENGTH_CODE_COUNT = 19;
+const int END_OF_BLOCK = 256;
+
+// Deflate bit stream, bits being packed from the least significant bit of
+// each byte
+class BitWriter
+{
+public:
+  explicit BitWriter(std::vector<uint8_t> &bytes) : m_bytes(bytes) {}
+
+  void write(uint32_t value, int count)
+  {
+    m_bits |= uint64_t(value) << m_count;
+    m_count += count;
+    while (m_count >= 8) {
+      m_bytes.push_back(uint8_t(m_bits));
+      m_bits >>= 8;
+      m_count -= 8;
+    }
+  }
+
+  // Pad the last byte with zeros
+  void align()
+  {
+    if (m_count > 0) {
+      write(0, 8 - m_count);
+    }
+  }
+  bool aligned() const { return m_count == 0; }
+
+  // Only when aligned
+  void writeBytes(const uint8_t *bytes, size_t count)
+  {
+    m_bytes.insert(end(m_bytes), bytes, bytes + count);
+  }
+
+private:
+  std::vector<uint8_t> &m_bytes;
+  uint64_t m_bits = 0;
+  int m_count = 0;
+};
+
+// LZ77 output: a literal byte if distance is 0, a match otherwise
+struct Symbol
+{
+  uint16_t length;
+  uint16_t distance;
+};
+
+int lengthCode(int length)
+{
+  static const auto codes = []() {
+    std::vector<uint8_t> codes(MAX_MATCH + 1, 0);
+    for (auto length = MIN_MATCH; length <= MAX_MATCH; ++length) {
+      codes[length] = uint8_t(
+          std::upper_bound(LENGTH_BASES, LENGTH_BASES + 29, length) -
+          LENGTH_BASES - 1);
+    }
+    return codes;
+  }();
+  return codes[length];
+}
+
+int distanceCode(int distance)
+{
+  // Distances up to 256 are looked up directly, farther ones by steps of 128
+  // that do not cross code boundaries, as zlib does
+  static const auto codes = []() {
+    std::vector<uint8_t> codes(512, 0);
+    for (auto i = 0; i < 512; ++i) {
+      const auto distance = i < 256 ? i + 1 : ((i - 256) << 7) + 1;
+      codes[i] = uint8_t(
+          std::upper_bound(DISTANCE_BASES, DISTANCE_BASES + 30, distance) -
+          DISTANCE_BASES - 1);
+    }
+    return codes;
+  }();
+  return codes[distance <= 256 ? distance - 1 : 256 + ((distance - 1) >> 7)];
+}
+
+// Give a frequency to unused symbols until two symbols are used, for
+// decoders rejecting codes of a single symbol
+void ensureTwoSymbols(std::vector<uint32_t> &frequencies)
+{
+  auto usedCount =
+      std::count_if(begin(frequencies), end(frequencies), [](uint32_t f) {
+        return f > 0;
+      });
+  for (size_t i = 0; i < frequencies.size() && usedCount < 2; ++i) {
+    if (frequencies[i] == 0) {
+      frequencies[i] = 1;
+      ++usedCount;
+    }
+  }
+}
+
+// Huffman code lengths of the symbols, limited to maxLength bits by moving
+// the deepest leaves up, as miniz does
+std::vector<uint8_t> huffmanLengths(
+    const std::vector<uint32_t> &frequencies, int maxLength)
+{
+  std::vector<int> symbols;
+  for (size_t i = 0; i < frequencies.size(); ++i) {
+    if (frequencies[i] > 0) {
+      symbols.push_back(int(i));
+    }
+  }
+  std::vector<uint8_t> lengths(frequencies.size(), 0);
+  if (symbols.size() < 2) {
+    for (const auto symbol : symbols) {
+      lengths[symbol] = 1;
+    }
+    return lengths;
+  }
+
+  // Leaves first, then the nodes merging the two least frequent ones
+  struct Node
+  {
+    uint64_t frequency;
+    int left;
+    int right;
+  };
+  std::vector<Node> nodes;
+  using Entry = std::pair<uint64_t, int>;
+  std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> queue;
+  for (const auto symbol : symbols) {
+    queue.emplace(frequencies[symbol], int(nodes.size()));
+    nodes.push_back({frequencies[symbol], -1, -1});
+  }
+  while (queue.size() > 1) {
+    const auto a = queue.top();
+    queue.pop();
+    const auto b = queue.top();
+    queue.pop();
+    queue.emplace(a.first + b.first, int(nodes.size()));
+    nodes.push_back({a.first + b.first, a.second, b.second});
+  }
+
+  // Children come before their parent
+  std::vector<int> depths(nodes.size(), 0);
+  auto maxDepth = 0;
+  for (auto i = int(nodes.size()) - 1; i >= int(symbols.size()); --i) {
+    depths[nodes[i].left] = depths[nodes[i].right] = depths[i] + 1;
+    maxDepth = std::max(maxDepth, depths[i] + 1);
+  }
+  std::vector<int> counts(std::max(maxDepth, maxLength) + 1, 0);
+  for (size_t i = 0; i < symbols.size(); ++i) {
+    ++counts[depths[i]];
+  }
+  for (size_t depth = maxLength + 1; depth < counts.size(); ++depth) {
+    counts[maxLength] += counts[depth];
+    counts[depth] = 0;
+  }
+  // Restore the Kraft equality
+  uint32_t total = 0;
+  for (auto depth = 1; depth <= maxLength; ++depth) {
+    total += uint32_t(counts[depth]) << (maxLength - depth);
+  }
+  while (total > (1u << maxLength)) {
+    --counts[maxLength];
+    for (auto depth = maxLength - 1; depth > 0; --depth) {
+      if (counts[depth]) {
+        --counts[depth];
+        counts[depth + 1] += 2;
+        break;
+      }
+    }
+    --total;
+  }
+
+  // Shortest lengths to the most frequent symbols
+  std::stable_sort(begin(symbols), end(symbols),
+      [&](int a, int b) { return frequencies[a] < frequencies[b]; });
+  size_t symbolIdx = 0;
+  for (auto depth = maxLength; depth > 0; --depth) {
+    for (auto i = 0; i < counts[depth]; ++i) {
+      lengths[symbols[symbolIdx++]] = uint8_t(depth);
+    }
+  }
+  return lengths;
+}
+
+// Canonical codes of the lengths, bit reversed to be written from their
+// least significant bit
+std::vector<uint16_t> canonicalCodes(const std::vector<uint8_t> &lengths)
+{
+  int lengthCounts[16] = {0};
+  for (const auto length : lengths) {
+    ++lengthCounts[length];
+  }
+  lengthCounts[0] = 0;
+  uint32_t nextCodes[16] = {0};
+  uint32_t code = 0;
+  for (auto length = 1; length < 16; ++length) {
+    code = (code + lengthCounts[length - 1]) << 1;
+    nextCodes[length] = code;
+  }
+  std::vector<uint16_t> codes(lengths.size(), 0);
+  for (size_t i = 0; i < lengths.size(); ++i) {
+    const auto length = lengths[i];
+    if (length == 0) {
+      continue;
+    }
+    const auto canonical = nextCodes[length]++;
+    uint32_t reversed = 0;
+    for (auto bit = 0; bit < length; ++bit) {
+      reversed |= ((canonical >> bit) & 1) << (length - 1 - bit);
+    }
+    codes[i] = uint16_t(reversed);
+  }
+  return codes;
+}
+
+void writeStoredBlocks(BitWriter &writer, const uint8_t *data, size_t size)
+{
+  for (size_t offset = 0; offset < size; offset += MAX_STORED_BLOCK_SIZE) {
+    const auto blockSize = std::min(size - offset, MAX_STORED_BLOCK_SIZE);
+    writer.write(0, 3); // Not final, stored
+    writer.align();
+    writer.write(uint32_t(blockSize), 16);
+    writer.write(uint32_t(~blockSize & 0xffff), 16);
+    writer.writeBytes(data + offset, blockSize);
+  }
+}
+
+// Write the symbols of data[0:size] in a dynamic Huffman block, or data in
+// stored blocks if smaller
+void writeBlock(BitWriter &writer, const std::vector<Symbol> &symbols,
+    const uint8_t *data, size_t size)
+{
+  std::vector<uint32_t> literalFrequencies(LITERAL_LENGTH_CODE_COUNT, 0);
+  std::vector<uint32_t> distanceFrequencies(DISTANCE_CODE_COUNT, 0);
+  for (const auto &symbol : symbols) {
+    if (symbol.distance == 0) {
+      ++literalFrequencies[symbol.length];
+    } else {
+      ++literalFrequencies[END_OF_BLOCK + 1 + lengthCode(symbol.length)];
+      ++distanceFrequencies[distanceCode(symbol.distance)];
+    }
+  }
+  literalFrequencies[END_OF_BLOCK] = 1;
+  ensureTwoSymbols(literalFrequencies);
+  ensureTwoSymbols(distanceFrequencies);
+  const auto literalLengths = huffmanLengths(literalFrequencies, 15);
+  const auto distanceLengths = huffmanLengths(distanceFrequencies, 15);
+
+  auto literalCount = LITERAL_LENGTH_CODE_COUNT;
+  while (literalCount > END_OF_BLOCK + 1 &&
+         literalLengths[literalCount - 1] == 0) {
+    --literalCount;
+  }
+  auto distanceCount = DISTANCE_CODE_COUNT;
+  while (distanceCount > 1 && distanceLengths[distanceCount - 1] == 0) {
+    --distanceCount;
+  }
+
+  // Run length encoding of the code lengths of both codes: 16 repeats the
+  // previous length 3 to 6 times, 17 and 18 are runs of 3 to 10 and 11 to
+  // 138 zeros. Pairs of a code length symbol and its extra bits value.
+  std::vector<uint8_t> allLengths(
+      begin(literalLengths), begin(literalLengths) + literalCount);
+  allLengths.insert(end(allLengths), begin(distanceLengths),
+      begin(distanceLengths) + distanceCount);
+  std::vector<std::pair<uint8_t, uint8_t>> runs;
+  for (size_t i = 0; i < allLengths.size();) {
+    const auto length = allLengths[i];
+    size_t run = 1;
+    while (i + run < allLengths.size() && allLengths[i + run] == length) {
+      ++run;
+    }
+    i += run;
+    if (length == 0) {
+      while (run >= 11) {
+        const auto count = std::min(run, size_t(138));
+        runs.emplace_back(18, uint8_t(count - 11));
+        run -= count;
+      }
+      if (run >= 3) {
+        runs.emplace_back(17, uint8_t(run - 3));
+        run = 0;
+      }
+    } else {
+      runs.emplace_back(length, 0);
+      --run;
+      while (run >= 3) {
+        const auto count = std::min(run, size_t(6));
+        runs.emplace_back(16, uint8_t(count - 3));
+        run -= count;
+      }
+    }
+    for (; run > 0; --run) {
+      runs.emplace_back(length, 0);
+    }
+  }
+  std::vector<uint32_t> codeLengthFrequencies(CODE_LENGTH_CODE_COUNT, 0);
+  for (const auto &run : runs) {
+    ++codeLengthFrequencies[run.first];
+  }
+  ensureTwoSymbols(codeLengthFrequencies);
+  const auto codeLengthLengths = huffmanLengths(codeLengthFrequencies, 7);
+  auto codeLengthCount = CODE_LENGTH_CODE_COUNT;
+  while (codeLengthCount > 4 &&
+         codeLengthLengths[CODE_LENGTH_ORDER[codeLengthCount - 1]] == 0) {
+    --codeLengthCount;
+  }
+  const auto runExtraBits = [](uint8_t symbol) {
+    return symbol == 16 ? 2 : symbol == 17 ? 3 : symbol == 18 ? 7 : 0;
+  };
+
+  // Compare the sizes in bits of both encodings
+  size_t dynamicSize = 3 + 5 + 5 + 4 + 3 * codeLengthCount;
+  for (const auto &run : runs) {
+    dynamicSize += codeLengthLengths[run.first] + runExtraBits(run.first);
+  }
+  for (auto i = 0; i < LITERAL_LENGTH_CODE_COUNT; ++i) {
+    dynamicSize += size_t(literalFrequencies[i]) * literalLengths[i];
+    if (i > END_OF_BLOCK) {
+      dynamicSize += size_t(literalFrequencies[i]) *
+                     LENGTH_EXTRA_BITS[i - END_OF_BLOCK - 1];
+    }
+  }
+  for (auto i = 0; i < DISTANCE_CODE_COUNT; ++i) {
+    dynamicSize += size_t(distanceFrequencies[i]) *
+                   (distanceLengths[i] + DISTANCE_EXTRA_BITS[i]);
+  }
+  const auto storedBlockCount =
+      (size + MAX_STORED_BLOCK_SIZE - 1) / MAX_STORED_BLOCK_SIZE;
+  const auto storedSize = storedBlockCount * (3 + 7 + 32) + 8 * size;
+  if (storedSize <= dynamicSize) {
+    writeStoredBlocks(writer, data, size);
+    return;
+  }
+
+  writer.write(0, 1); // Not final
+  writer.write(2, 2); // Dynamic Huffman codes
+  writer.write(uint32_t(literalCount - 257), 5);
+  writer.write(uint32_t(distanceCount - 1), 5);
+  writer.write(uint32_t(codeLengthCount - 4), 4);
+  for (auto i = 0; i < codeLengthCount; ++i) {
+    writer.write(codeLengthLengths[CODE_LENGTH_ORDER[i]], 3);
+  }
+  const auto codeLengthCodes = canonicalCodes(codeLengthLengths);
+  for (const auto &run : runs) {
+    writer.write(codeLengthCodes[run.first], codeLengthLengths[run.first]);
+    writer.write(run.second, runExtraBits(run.first));
+  }
+
+  const auto literalCodes = canonicalCodes(literalLengths);
+  const auto distanceCodes = canonicalCodes(distanceLengths);
+  for (const auto &symbol : symbols) {
+    if (symbol.distance == 0) {
+      writer.write(
+          literalCodes[symbol.length], literalLengths[symbol.length]);
+      continue;
+    }
+    const auto length = lengthCode(symbol.length);
+    const auto literal = END_OF_BLOCK + 1 + length;
+    writer.write(literalCodes[literal], literalLengths[literal]);
+    writer.write(uint32_t(symbol.length - LENGTH_BASES[length]),
+        LENGTH_EXTRA_BITS[length]);
+    const auto distance = distanceCode(symbol.distance);
+    writer.write(distanceCodes[distance], distanceLengths[distance]);
+    writer.write(uint32_t(symbol.distance - DISTANCE_BASES[distance]),
+        DISTANCE_EXTRA_BITS[distance]);
+  }
+  writer.write(
+      literalCodes[END_OF_BLOCK], literalLengths[END_OF_BLOCK]);
+}
+
+// Append non-final deflate blocks of data to out, ending on a byte boundary
+// so that the blocks of the next strip can follow
+void deflateStrip(const uint8_t *data, size_t size,
+    const PngCompression &compression, std::vector<uint8_t> &out)
+{
+  BitWriter writer(out);
+  if (compression.mode == PngCompression::STORE) {
+    writeStoredBlocks(writer, data, size);
+    return;
+  }
+
+  std::vector<Symbol> symbols;
+  symbols.reserve(BLOCK_SYMBOL_COUNT);
+  size_t blockStart = 0;
+  const auto addSymbol = [&](int length, size_t distance, size_t end) {
+    symbols.push_back({uint16_t(length), uint16_t(distance)});
+    if (symbols.size() == BLOCK_SYMBOL_COUNT) {
+      writeBlock(writer, symbols, data + blockStart, end - blockStart);
+      symbols.clear();
+      blockStart = end;
+    }
+  };
+
+  if (compression.mode == PngCompression::RLE) {
+    // Matches of distance 1 only
+    for (size_t pos = 0; pos < size;) {
+      size_t run = 0;
+      if (pos > 0) {
+        while (run < MAX_MATCH && pos + run < size &&
+               data[pos + run] == data[pos - 1]) {
+          ++run;
+        }
+      }
+      if (run >= MIN_MATCH) {
+        addSymbol(int(run), 1, pos + run);
+        pos += run;
+      } else {
+        addSymbol(data[pos], 0, pos + 1);
+        ++pos;
+      }
+    }
+  } else {
+    // Greedy matching on hash chains of the 3 byte sequences
+    const auto level = std::min(std::max(compression.level, 1), 9);
+    const auto maxChain = MAX_CHAINS[level - 1];
+    const auto niceLength = size_t(NICE_LENGTHS[level - 1]);
+    const auto maxInsertLength = size_t(MAX_INSERT_LENGTHS[level - 1]);
+    std::vector<int32_t> heads(size_t(1) << HASH_BITS, -1);
+    std::vector<int32_t> previous(size);
+    const auto insert = [&](size_t pos) {
+      if (pos + MIN_MATCH > size) {
+        return;
+      }
+      const uint32_t key =
+          (uint32_t(data[pos]) << 16) | (data[pos + 1] << 8) | data[pos + 2];
+      auto &head = heads[(key * 2654435761u) >> (32 - HASH_BITS)];
+      previous[pos] = head;
+      head = int32_t(pos);
+    };
+    for (size_t pos = 0; pos < size;) {
+      size_t bestLength = 0;
+      size_t bestDistance = 0;
+      if (pos + MIN_MATCH <= size) {
+        const uint32_t key = (uint32_t(data[pos]) << 16) |
+                             (data[pos + 1] << 8) | data[pos + 2];
+        auto candidate = heads[(key * 2654435761u) >> (32 - HASH_BITS)];
+        const auto maxLength = std::min(size_t(MAX_MATCH), size - pos);
+        for (auto chain = maxChain;
+             candidate >= 0 && pos - candidate <= WINDOW_SIZE && chain > 0;
+             --chain, candidate = previous[candidate]) {
+          const auto reference = data + candidate;
+          if (reference[bestLength] != data[pos + bestLength]) {
+            continue;
+          }
+          size_t length = 0;
+          while (length < maxLength &&
+                 reference[length] == data[pos + length]) {
+            ++length;
+          }
+          if (length > bestLength) {
+            bestLength = length;
+            bestDistance = pos - candidate;
+            if (length >= niceLength || length == maxLength) {
+              break;
+            }
+          }
+        }
+      }
+      if (bestLength > MIN_MATCH ||
+          (bestLength == MIN_MATCH && bestDistance <= TOO_FAR)) {
+        addSymbol(int(bestLength), bestDistance, pos + bestLength);
+        const auto insertCount = bestLength <= maxInsertLength ? bestLength : 1;
+        for (size_t i = 0; i < insertCount; ++i) {
+          insert(pos + i);
+        }
+        pos += bestLength;
+      } else {
+        addSymbol(data[pos], 0, pos + 1);
+        insert(pos);
+        ++pos;
+      }
+    }
+  }
+  if (!symbols.empty()) {
+    writeBlock(writer, symbols, data + blockStart, size - blockStart);
+  }
+  if (!writer.aligned()) {
+    // Empty stored block, as a zlib full flush
+    writer.write(0, 3);
+    writer.align();
+    writer.write(0, 16);
+    writer.write(0xffff, 16);
+  }
+}
+
+uint8_t paethPredictor(int left, int up, int upLeft)
+{
+  const auto p = left + up - upLeft;
+  const auto pLeft = std::abs(p - left);
+  const auto pUp = std::abs(p - up);
+  const auto pUpLeft = std::abs(p - upLeft);
+  if (pLeft <= pUp && pLeft <= pUpLeft) {
+    return uint8_t(left);
+  }
+  return uint8_t(pUp <= pUpLeft ? up : upLeft);
+}
+
+// Append the filter type and the filtered bytes of a row, with the filter
+// minimizing the sum of the filtered bytes as signed values, the heuristic
+// of the PNG specification. scratch holds the candidate rows.
+void filterRow(const uint8_t *row, const uint8_t *previousRow,
+    size_t rowSize, size_t bytesPerPixel, bool adaptive, uint8_t *out,
+    std::vector<uint8_t> &scratch)
+{
+  if (!adaptive) {
+    out[0] = 0;
+    std::copy(row, row + rowSize, out + 1);
+    return;
+  }
+  scratch.resize(5 * rowSize);
+  uint64_t sums[5] = {0};
+  for (size_t x = 0; x < rowSize; ++x) {
+    const int left = x >= bytesPerPixel ? row[x - bytesPerPixel] : 0;
+    const int up = previousRow[x];
+    const int upLeft =
+        x >= bytesPerPixel ? previousRow[x - bytesPerPixel] : 0;
+    const uint8_t filtered[5] = {row[x], uint8_t(row[x] - left),
+        uint8_t(row[x] - up), uint8_t(row[x] - ((left + up) >> 1)),
+        uint8_t(row[x] - paethPredictor(left, up, upLeft))};
+    for (auto filter = 0; filter < 5; ++filter) {
+      scratch[filter * rowSize + x] = filtered[filter];
+      sums[filter] += uint64_t(std::abs(int(int8_t(filtered[filter]))));
+    }
+  }
+  const auto bestFilter = int(std::min_element(sums, sums + 5) - sums);
+  out[0] = uint8_t(bestFilter);
+  std::copy(scratch.data() + bestFilter * rowSize,
+      scratch.data() + (bestFilter + 1) * rowSize, out + 1);
+}
+
+uint32_t adler32(const uint8_t *data, size_t size)
+{
+  const uint32_t base = 65521;
+  // Largest count of bytes summed before sums overflow
+  const size_t maxRun = 5552;
+  uint32_t a = 1;
+  uint32_t b = 0;
+  while (size > 0) {
+    const auto run = std::min(size, maxRun);
+    for (size_t i = 0; i < run; ++i) {
+      a += data[i];
+      b += a;
+    }
+    a %= base;
+    b %= base;
+    data += run;
+    size -= run;
+  }
+  return (b << 16) | a;
+}
+
+// Checksum of the concatenation of data whose checksum is adler and size
+// bytes whose checksum is nextAdler, as zlib's adler32_combine()
+uint32_t combineAdler32(uint32_t adler, uint32_t nextAdler, size_t size)
+{
+  const uint32_t base = 65521;
+  const auto remainder = uint32_t(size % base);
+  auto a = adler & 0xffff;
+  auto b = uint32_t((uint64_t(remainder) * a) % base);
+  a += (nextAdler & 0xffff) + base - 1;
+  b += ((adler >> 16) & 0xffff) + ((nextAdler >> 16) & 0xffff) + base -
+       remainder;
+  if (a >= base) {
+    a -= base;
+  }
+  if (a >= base) {
+    a -= base;
+  }
+  if (b >= 2 * base) {
+    b -= 2 * base;
+  }
+  if (b >= base) {
+    b -= base;
+  }
+  return (b << 16) | a;
+}
+
+uint32_t updateCrc32(uint32_t crc, const uint8_t *data, size_t size)
+{
+  static const auto table = []() {
+    std::vector<uint32_t> table(256);
+    for (uint32_t i = 0; i < 256; ++i) {
+      auto c = i;
+      for (auto bit = 0; bit < 8; ++bit) {
+        c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+      }
+      table[i] = c;
+    }
+    return table;
+  }();
+  for (size_t i = 0; i < size; ++i) {
+    crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+  }
+  return crc;
+}
+
+void appendBigEndian(std::vector<uint8_t> &bytes, uint32_t value)
+{
+  for (auto shift = 24; shift >= 0; shift -= 8) {
+    bytes.push_back(uint8_t(value >> shift));
+  }
+}
+
+// PNG chunk: size, type, data and CRC of the type and data
+void appendChunk(std::vector<uint8_t> &bytes, const char *type,
+    const std::vector<uint8_t> &data)
+{
+  appendBigEndian(bytes, uint32_t(data.size()));
+  const auto typeBegin = bytes.size();
+  bytes.insert(end(bytes), type, type + 4);
+  bytes.insert(end(bytes), begin(data), end(data));
+  appendBigEndian(bytes,
+      ~updateCrc32(
+          ~0u, bytes.data() + typeBegin, bytes.size() - typeBegin));
+}
+
+} // namespace
+
+bool parsePngCompression(const std::string &str, PngCompression &compression)
+{
+  if (str == "store") {
+    compression.mode = PngCompression::STORE;
+  } else if (str == "rle") {
+    compression.mode = PngCompression::RLE;
+  } else if (str.size() == 1 && str[0] >= '1' && str[0] <= '9') {
+    compression.mode = PngCompression::DEFLATE;
+    compression.level = str[0] - '0';
+  } else {
+    return false;
+  }
+  return true;
+}
+
+PngWriter::PngWriter(ThreadPool &threadPool) : m_threadPool(threadPool) {}
+
+bool PngWriter::open(const fs::path &path, int width, int height,
+    int components, const PngCompression &compression, int bitDepth)
+{
+  m_file.close();
+  m_file.clear();
+  m_file.open(path.string(), std::ios::binary);
+  return open(m_file, width, height, components, compression, bitDepth);
+}
+
+bool PngWriter::open(std::ostream &output, int width, int height,
+    int components, const PngCompression &compression, int bitDepth)
+{
+  m_output = nullptr;
+  if (width <= 0 || height <= 0 || components < 1 || components > 4 ||
+      (bitDepth != 8 && bitDepth != 16)) {
+    return false;
+  }
+  m_width = width;
+  m_height = height;
+  m_components = components;
+  m_bitDepth = bitDepth;
+  m_compression = compression;
+  m_writtenRowCount = 0;
+  m_previousRow.assign(size_t(width) * components * bitDepth / 8, 0);
+  m_adler = 1;
+
+  std::vector<uint8_t> header = {137, 'P', 'N', 'G', '\r', '\n', 26, '\n'};
+  std::vector<uint8_t> ihdr;
+  appendBigEndian(ihdr, uint32_t(width));
+  appendBigEndian(ihdr, uint32_t(height));
+  static const uint8_t colorTypes[] = {0, 4, 2, 6};
+  // Bit depth, color type, compression, filter and interlace methods
+  ihdr.insert(end(ihdr),
+      {uint8_t(bitDepth), colorTypes[components - 1], 0, 0, 0});
+  appendChunk(header, "IHDR", ihdr);
+
+  m_output = &output;
+  output.write((const char *)header.data(), std::streamsize(header.size()));
+  return bool(output);
+}
+
+bool PngWriter::writeRows(const unsigned char *rows, int rowCount)
+{
+  if (!m_output || !*m_output || rowCount <= 0 ||
+      m_writtenRowCount + rowCount > m_height) {
+    return false;
+  }
+  const auto rowSize = m_previousRow.size();
+  const auto filteredRowSize = rowSize + 1;
+  const auto stripRowCount =
+      std::max(size_t(1), STRIP_SIZE / filteredRowSize);
+  const auto stripCount =
+      (size_t(rowCount) + stripRowCount - 1) / stripRowCount;
+
+  // Complete IDAT chunks of each strip, the first one of the image starting
+  // with the zlib header
+  std::vector<std::vector<uint8_t>> chunks(stripCount);
+  std::vector<uint32_t> adlers(stripCount);
+  std::vector<size_t> filteredSizes(stripCount);
+  m_threadPool.parallelFor(int(stripCount), [&](int stripIdx) {
+    const auto firstRow = size_t(stripIdx) * stripRowCount;
+    const auto stripRows = std::min(stripRowCount, size_t(rowCount) - firstRow);
+    std::vector<uint8_t> filtered(stripRows * filteredRowSize);
+    std::vector<uint8_t> scratch;
+    for (size_t i = 0; i < stripRows; ++i) {
+      const auto y = firstRow + i;
+      const auto row = rows + y * rowSize;
+      filterRow(row, y > 0 ? row - rowSize : m_previousRow.data(), rowSize,
+          size_t(m_components * m_bitDepth / 8),
+          m_compression.mode != PngCompression::STORE,
+          filtered.data() + i * filteredRowSize, scratch);
+    }
+    adlers[stripIdx] = adler32(filtered.data(), filtered.size());
+    filteredSizes[stripIdx] = filtered.size();
+
+    auto &chunk = chunks[stripIdx];
+    chunk.reserve(filtered.size() / 2 + 64);
+    chunk.resize(8); // Size and type, set once compressed
+    if (stripIdx == 0 && m_writtenRowCount == 0) {
+      // Deflate with a 32K window, then the compression level hint
+      chunk.push_back(0x78);
+      chunk.push_back(m_compression.mode != PngCompression::DEFLATE
+                          ? 0x01
+                          : m_compression.level >= 7
+                                ? 0xda
+                                : m_compression.level >= 2 ? 0x9c : 0x5e);
+    }
+    deflateStrip(filtered.data(), filtered.size(), m_compression, chunk);
+    const auto dataSize = uint32_t(chunk.size() - 8);
+    for (auto i = 0; i < 4; ++i) {
+      chunk[i] = uint8_t(dataSize >> (24 - 8 * i));
+    }
+    std::copy_n("IDAT", 4, chunk.begin() + 4);
+    const auto crc = ~updateCrc32(~0u, chunk.data() + 4, chunk.size() - 4);
+    appendBigEndian(chunk, crc);
+  });
+
+  for (size_t i = 0; i < stripCount; ++i) {
+    m_adler = combineAdler32(m_adler, adlers[i], filteredSizes[i]);
+    m_output->write(
+        (const char *)chunks[i].data(), std::streamsize(chunks[i].size()));
+  }
+  const auto lastRow = rows + size_t(rowCount - 1) * rowSize;
+  std::copy(lastRow, lastRow + rowSize, begin(m_previousRow));
+  m_writtenRowCount += rowCount;
+  return bool(*m_output);
+}
+
+bool PngWriter::finish()
+{
+  if (!m_output || !*m_output || m_writtenRowCount != m_height) {
+    return false;
+  }
+  // Final empty block with fixed codes, then the checksum of the stream
+  std::vector<uint8_t> streamEnd = {0x03, 0x00};
+  appendBigEndian(streamEnd, m_adler);
+  std::vector<uint8_t> trailer;
+  appendChunk(trailer, "IDAT", streamEnd);
+  appendChunk(trailer, "IEND", {});
+  m_output->write(
+      (const char *)trailer.data(), std::streamsize(trailer.size()));
+  if (m_file.is_open()) {
+    m_file.close();
+  }
+  const auto success = bool(*m_output);
+  m_output = nullptr;
+  return success;
+}
+
+bool writePng(const fs::path &path, int width, int height, int components,
+    const unsigned char *pixels, const PngCompression &compression,
+    ThreadPool &threadPool, int bitDepth)
+{
+  PngWriter writer(threadPool);
+  return writer.open(
+             path, width, height, components, compression, bitDepth) &&
+         writer.writeRows(pixels, height) && writer.finish();
+}
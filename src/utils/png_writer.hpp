@@ -0,0 +1,74 @@
+#pragma once
+
+#include "filesystem.hpp"
+#include "thread_pool.hpp"
+
+#include <cstdint>
+#include <fstream>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Compression of the files written by writePng()
+struct PngCompression
+{
+  enum Mode
+  {
+    STORE, // Uncompressed deflate blocks, rows are not filtered
+    RLE, // Only runs of repeated bytes, after filtering
+    DEFLATE // Matches searched with an effort growing with level
+  };
+
+  Mode mode = DEFLATE;
+  int level = 6; // 1 (fastest) to 9 (smallest), for DEFLATE
+};
+
+// Parse "store", "rle" or a deflate level from 1 to 9
+bool parsePngCompression(const std::string &str, PngCompression &compression);
+
+// Write a PNG file of 1 (gray), 2 (gray and alpha), 3 (RGB) or 4 (RGBA)
+// components of 8 or 16 bits, 16 bits samples being big endian, rows going
+// downward. The image is split in horizontal strips that are filtered and
+// deflated in parallel, each strip being a sequence of independent deflate
+// blocks ending on a byte boundary, so that the strips are concatenated in a
+// single zlib stream, as pigz does. Matches do not cross strip boundaries,
+// which costs a little compression.
+bool writePng(const fs::path &path, int width, int height, int components,
+    const unsigned char *pixels, const PngCompression &compression,
+    ThreadPool &threadPool, int bitDepth = 8);
+
+// Streaming writePng(), for images produced in bands of rows: only the rows of
+// a band and their compressed strips are in memory at once
+class PngWriter
+{
+public:
+  explicit PngWriter(ThreadPool &threadPool);
+  PngWriter(const PngWriter &) = delete;
+  PngWriter &operator=(const PngWriter &) = delete;
+
+  // Create the file and write its header
+  bool open(const fs::path &path, int width, int height, int components,
+      const PngCompression &compression, int bitDepth = 8);
+  // Write to output instead of a file, which must outlive the writing
+  bool open(std::ostream &output, int width, int height, int components,
+      const PngCompression &compression, int bitDepth = 8);
+  // Append the next rowCount rows, going downward
+  bool writeRows(const unsigned char *rows, int rowCount);
+  // Terminate the file, false if a write failed or rows are missing
+  bool finish();
+
+private:
+  ThreadPool &m_threadPool;
+  std::ofstream m_file;
+  std::ostream *m_output = nullptr; // m_file or the stream given to open()
+  PngCompression m_compression;
+  int m_width = 0;
+  int m_height = 0;
+  int m_components = 0;
+  int m_bitDepth = 8;
+  int m_writtenRowCount = 0;
+  // Last row of the previous band, the reference of the filters of the first
+  // row of the next one
+  std::vector<uint8_t> m_previousRow;
+  uint32_t m_adler = 1; // Of the filtered rows written
+};
@@ -0,0 +1,403 @@
+#include "pvs.hpp"
+#include "gltf.hpp"
+#include "occlusion_culling.hpp"
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <random>
+
+namespace {
+
+// Corners of each cell, that see the most around occluders, then jittered
+// on a 2x2x2 grid
+const int SAMPLES_PER_CELL = 16;
+// From each sample toward random points of the bounds of each primitive
+const int RAYS_PER_PRIMITIVE = 16;
+
+struct Triangle
+{
+  glm::vec3 v0;
+  glm::vec3 e1; // v1 - v0
+  glm::vec3 e2; // v2 - v0
+  uint32_t drawIdx;
+};
+
+// Bounding volume hierarchy of the scene triangles, split at the median
+// centroid along the largest axis
+class TriangleBVH
+{
+public:
+  explicit TriangleBVH(std::vector<Triangle> triangles) :
+      m_triangles(std::move(triangles))
+  {
+    m_nodes.reserve(2 * m_triangles.size() / LEAF_SIZE + 1);
+    m_nodes.emplace_back();
+    build(0, 0, uint32_t(m_triangles.size()));
+  }
+
+  // drawIdx of the closest triangle intersected by origin + t * direction
+  // for t in (0, tMax), -1 if none
+  int64_t intersect(
+      const glm::vec3 &origin, const glm::vec3 &direction, float tMax) const
+  {
+    // The root of an empty BVH is a leaf of count 0, read as an inner node
+    if (m_triangles.empty()) {
+      return -1;
+    }
+    const auto inverseDirection = 1.f / direction;
+    auto closest = tMax;
+    int64_t hit = -1;
+    uint32_t stack[64];
+    int stackSize = 0;
+    stack[stackSize++] = 0;
+    while (stackSize > 0) {
+      const auto &node = m_nodes[stack[--stackSize]];
+      const auto t0 = (node.min - origin) * inverseDirection;
+      const auto t1 = (node.max - origin) * inverseDirection;
+      const auto tNear = glm::min(t0, t1);
+      const auto tFar = glm::max(t0, t1);
+      const auto entry = std::max(std::max(tNear.x, tNear.y), tNear.z);
+      const auto exit = std::min(std::min(tFar.x, tFar.y), tFar.z);
+      if (exit < std::max(entry, 0.f) || entry >= closest) {
+        continue;
+      }
+      if (node.count == 0) {
+        stack[stackSize++] = node.first;
+        stack[stackSize++] = node.first + 1;
+        continue;
+      }
+      for (auto i = node.first; i < node.first + node.count; ++i) {
+        const auto &triangle = m_triangles[i];
+        const auto p = glm::cross(direction, triangle.e2);
+        const auto determinant = glm::dot(triangle.e1, p);
+        if (std::abs(determinant) < 1e-12f) {
+          continue;
+        }
+        const auto inverseDeterminant = 1.f / determinant;
+        const auto s = origin - triangle.v0;
+        const auto u = glm::dot(s, p) * inverseDeterminant;
+        if (u < 0.f || u > 1.f) {
+          continue;
+        }
+        const auto q = glm::cross(s, triangle.e1);
+        const auto v = glm::dot(direction, q) * inverseDeterminant;
+        if (v < 0.f || u + v > 1.f) {
+          continue;
+        }
+        const auto t = glm::dot(triangle.e2, q) * inverseDeterminant;
+        if (t > 1e-5f && t < closest) {
+          closest = t;
+          hit = triangle.drawIdx;
+        }
+      }
+    }
+    return hit;
+  }
+
+private:
+  static const uint32_t LEAF_SIZE = 4;
+
+  // Inner nodes have a count of 0 and their children at first and first + 1
+  struct Node
+  {
+    glm::vec3 min;
+    uint32_t first;
+    glm::vec3 max;
+    uint32_t count;
+  };
+
+  static glm::vec3 centroid(const Triangle &triangle)
+  {
+    return triangle.v0 + (triangle.e1 + triangle.e2) / 3.f;
+  }
+
+  void build(uint32_t nodeIdx, uint32_t first, uint32_t count)
+  {
+    auto bboxMin = glm::vec3(std::numeric_limits<float>::max());
+    auto bboxMax = glm::vec3(std::numeric_limits<float>::lowest());
+    auto centroidMin = bboxMin;
+    auto centroidMax = bboxMax;
+    for (auto i = first; i < first + count; ++i) {
+      const auto &triangle = m_triangles[i];
+      for (const auto &vertex : {triangle.v0, triangle.v0 + triangle.e1,
+               triangle.v0 + triangle.e2}) {
+        bboxMin = glm::min(bboxMin, vertex);
+        bboxMax = glm::max(bboxMax, vertex);
+      }
+      centroidMin = glm::min(centroidMin, centroid(triangle));
+      centroidMax = glm::max(centroidMax, centroid(triangle));
+    }
+    m_nodes[nodeIdx].min = bboxMin;
+    m_nodes[nodeIdx].max = bboxMax;
+    if (count <= LEAF_SIZE) {
+      m_nodes[nodeIdx].first = first;
+      m_nodes[nodeIdx].count = count;
+      return;
+    }
+
+    const auto extent = centroidMax - centroidMin;
+    const auto axis =
+        extent.x > extent.y ? (extent.x > extent.z ? 0 : 2)
+                            : (extent.y > extent.z ? 1 : 2);
+    const auto begin = m_triangles.begin() + first;
+    std::nth_element(begin, begin + count / 2, begin + count,
+        [axis](const Triangle &a, const Triangle &b) {
+          return centroid(a)[axis] < centroid(b)[axis];
+        });
+
+    const auto leftIdx = uint32_t(m_nodes.size());
+    m_nodes[nodeIdx].first = leftIdx;
+    m_nodes[nodeIdx].count = 0;
+    m_nodes.emplace_back();
+    m_nodes.emplace_back();
+    build(leftIdx, first, count / 2);
+    build(leftIdx + 1, first + count / 2, count - count / 2);
+  }
+
+  std::vector<Triangle> m_triangles;
+  std::vector<Node> m_nodes;
+};
+
+// PackBits run-length encoding: a header byte h followed by h + 1 literal
+// bytes if h < 128, or by one byte repeated 257 - h times if h > 128
+std::vector<uint8_t> compress(const std::vector<uint8_t> &bytes)
+{
+  std::vector<uint8_t> result;
+  size_t i = 0;
+  while (i < bytes.size()) {
+    size_t run = 1;
+    while (i + run < bytes.size() && run < 128 &&
+           bytes[i + run] == bytes[i]) {
+      ++run;
+    }
+    // Shorter runs are cheaper in literals
+    if (run >= 3) {
+      result.push_back(uint8_t(257 - run));
+      result.push_back(bytes[i]);
+      i += run;
+      continue;
+    }
+    const auto start = i;
+    while (i < bytes.size() && i - start < 128 &&
+           !(i + 2 < bytes.size() && bytes[i + 1] == bytes[i] &&
+               bytes[i + 2] == bytes[i])) {
+      ++i;
+    }
+    result.push_back(uint8_t(i - start - 1));
+    result.insert(end(result), begin(bytes) + start, begin(bytes) + i);
+  }
+  return result;
+}
+
+bool decompress(const std::vector<uint8_t> &compressed, size_t size,
+    std::vector<uint8_t> &bytes)
+{
+  bytes.clear();
+  size_t i = 0;
+  while (i < compressed.size()) {
+    const auto header = compressed[i++];
+    if (header < 128) {
+      const auto count = size_t(header) + 1;
+      if (i + count > compressed.size()) {
+        return false;
+      }
+      bytes.insert(end(bytes), begin(compressed) + i,
+          begin(compressed) + i + count);
+      i += count;
+    } else if (header > 128) {
+      if (i == compressed.size()) {
+        return false;
+      }
+      bytes.insert(end(bytes), size_t(257 - header), compressed[i++]);
+    }
+  }
+  return bytes.size() == size;
+}
+
+} // namespace
+
+int PotentiallyVisibleSets::cellIndex(const glm::vec3 &position) const
+{
+  if (cells.empty()) {
+    return -1;
+  }
+  const auto cell = glm::ivec3(glm::floor((position - bboxMin) /
+                                          (bboxMax - bboxMin) *
+                                          glm::vec3(cellCounts)));
+  if (glm::any(glm::lessThan(cell, glm::ivec3(0))) ||
+      glm::any(glm::greaterThanEqual(cell, cellCounts))) {
+    return -1;
+  }
+  return cell.x + cellCounts.x * (cell.y + cellCounts.y * cell.z);
+}
+
+int PotentiallyVisibleSets::cellVisibility(
+    const glm::vec3 &position, uint8_t *visible) const
+{
+  const auto cell = cellIndex(position);
+  std::vector<uint8_t> bits;
+  if (cell < 0 || !decompress(cells[cell], (drawCount + 7) / 8, bits)) {
+    std::fill(visible, visible + drawCount, 1);
+    return -1;
+  }
+  for (size_t i = 0; i < drawCount; ++i) {
+    visible[i] = (bits[i / 8] >> (i % 8)) & 1;
+  }
+  return cell;
+}
+
+PotentiallyVisibleSets bakePVS(const tinygltf::Model &model,
+    const std::vector<int> &meshIndices,
+    const std::vector<glm::mat4> &modelMatrices, const glm::vec3 &bboxMin,
+    const glm::vec3 &bboxMax, int maxCellCount, unsigned threadCount)
+{
+  const auto bounds = computeInstanceBounds(model, meshIndices, modelMatrices);
+
+  std::vector<Triangle> triangles;
+  std::vector<glm::vec3> positions;
+  std::vector<uint32_t> indices;
+  uint32_t drawIdx = 0;
+  for (size_t instanceIdx = 0; instanceIdx < meshIndices.size();
+       ++instanceIdx) {
+    const auto &mesh = model.meshes[meshIndices[instanceIdx]];
+    const auto &modelMatrix = modelMatrices[instanceIdx];
+    for (const auto &primitive : mesh.primitives) {
+      if (readPrimitiveTriangles(model, primitive, positions, indices)) {
+        for (auto &position : positions) {
+          position = glm::vec3(modelMatrix * glm::vec4(position, 1));
+        }
+        for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+          const auto &v0 = positions[indices[i]];
+          triangles.push_back({v0, positions[indices[i + 1]] - v0,
+              positions[indices[i + 2]] - v0, drawIdx});
+        }
+      }
+      ++drawIdx;
+    }
+  }
+  const TriangleBVH bvh(std::move(triangles));
+
+  PotentiallyVisibleSets pvs;
+  pvs.drawCount = bounds.size();
+  const auto extent = bboxMax - bboxMin;
+  const auto cellSize =
+      std::max(std::max(extent.x, std::max(extent.y, extent.z)) /
+                   float(std::max(maxCellCount, 1)),
+          1e-6f);
+  pvs.cellCounts =
+      glm::max(glm::ivec3(glm::ceil(extent / cellSize)), glm::ivec3(1));
+  pvs.bboxMin = bboxMin;
+  pvs.bboxMax = bboxMin + cellSize * glm::vec3(pvs.cellCounts);
+  pvs.cells.resize(
+      size_t(pvs.cellCounts.x) * pvs.cellCounts.y * pvs.cellCounts.z);
+
+  ThreadPool threadPool(threadCount);
+  threadPool.parallelFor(int(pvs.cells.size()), [&](int cell) {
+    std::mt19937 random(cell);
+    std::uniform_real_distribution<float> distribution(0.f, 1.f);
+    const auto random3 = [&]() {
+      const auto x = distribution(random);
+      const auto y = distribution(random);
+      return glm::vec3(x, y, distribution(random));
+    };
+    const auto cellMin =
+        pvs.bboxMin +
+        cellSize * glm::vec3(cell % pvs.cellCounts.x,
+                       (cell / pvs.cellCounts.x) % pvs.cellCounts.y,
+                       cell / (pvs.cellCounts.x * pvs.cellCounts.y));
+    const auto cellMax = cellMin + cellSize;
+
+    // Primitives with unknown bounds or overlapping the cell are visible
+    std::vector<uint8_t> visible(bounds.size(), 0);
+    for (size_t i = 0; i < bounds.size(); ++i) {
+      const auto &box = bounds[i];
+      visible[i] = box.min.x > box.max.x ||
+                   (glm::all(glm::lessThanEqual(box.min, cellMax)) &&
+                       glm::all(glm::lessThanEqual(cellMin, box.max)));
+    }
+
+    for (int s = 0; s < SAMPLES_PER_CELL; ++s) {
+      const auto octant = glm::vec3(s & 1, (s >> 1) & 1, (s >> 2) & 1);
+      const auto sample =
+          cellMin + cellSize * (s < 8 ? octant
+                                      : 0.5f * (octant + random3()));
+      for (size_t i = 0; i < bounds.size(); ++i) {
+        for (int r = 0; r < RAYS_PER_PRIMITIVE && !visible[i]; ++r) {
+          const auto target =
+              glm::mix(bounds[i].min, bounds[i].max, random3());
+          // Reaching the target unoccluded is enough, it may not be on a
+          // triangle of the primitive
+          const auto hit = bvh.intersect(sample, target - sample, 1.f);
+          visible[hit < 0 ? i : size_t(hit)] = 1;
+        }
+      }
+    }
+
+    std::vector<uint8_t> bits((visible.size() + 7) / 8, 0);
+    for (size_t i = 0; i < visible.size(); ++i) {
+      bits[i / 8] |= uint8_t(visible[i] << (i % 8));
+    }
+    pvs.cells[cell] = compress(bits);
+  });
+  return pvs;
+}
+
+fs::path pvsPath(const fs::path &gltfFile)
+{
+  auto path = gltfFile;
+  path += ".pvs";
+  return path;
+}
+
+bool loadPVS(const fs::path &path, PotentiallyVisibleSets &pvs)
+{
+  std::ifstream input(path.string(), std::ios::binary);
+  char magic[4];
+  if (!input.read(magic, 4) || !std::equal(magic, magic + 4, "PVS1")) {
+    return false;
+  }
+  input.read((char *)&pvs.bboxMin, sizeof(pvs.bboxMin));
+  input.read((char *)&pvs.bboxMax, sizeof(pvs.bboxMax));
+  input.read((char *)&pvs.cellCounts, sizeof(pvs.cellCounts));
+  input.read((char *)&pvs.drawCount, sizeof(pvs.drawCount));
+  if (!input || glm::any(glm::lessThan(pvs.cellCounts, glm::ivec3(1))) ||
+      pvs.cellCounts.x * pvs.cellCounts.y * pvs.cellCounts.z > (1 << 24)) {
+    return false;
+  }
+  pvs.cells.resize(
+      size_t(pvs.cellCounts.x) * pvs.cellCounts.y * pvs.cellCounts.z);
+  for (auto &cell : pvs.cells) {
+    uint32_t size = 0;
+    if (!input.read((char *)&size, sizeof(size)) ||
+        size > 2 * (pvs.drawCount / 8 + 1)) {
+      return false;
+    }
+    cell.resize(size);
+    input.read((char *)cell.data(), size);
+  }
+  return bool(input);
+}
+
+bool savePVS(const fs::path &path, const PotentiallyVisibleSets &pvs)
+{
+  std::ofstream output(path.string(), std::ios::binary);
+  output.write("PVS1", 4);
+  output.write((const char *)&pvs.bboxMin, sizeof(pvs.bboxMin));
+  output.write((const char *)&pvs.bboxMax, sizeof(pvs.bboxMax));
+  output.write((const char *)&pvs.cellCounts, sizeof(pvs.cellCounts));
+  output.write((const char *)&pvs.drawCount, sizeof(pvs.drawCount));
+  for (const auto &cell : pvs.cells) {
+    const auto size = uint32_t(cell.size());
+    output.write((const char *)&size, sizeof(size));
+    output.write((const char *)cell.data(), size);
+  }
+  if (!output) {
+    std::cerr << "Unable to write PVS file " << path << std::endl;
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include "filesystem.hpp"
+
+#include <glm/glm.hpp>
+#include <tiny_gltf.h>
+
+#include <cstdint>
+#include <vector>
+
+// Potentially visible sets for static scenes: the scene bounds are divided in
+// a grid of view cells, each storing which primitives can be seen from inside
+// it. Sets are baked offline by casting rays from sample points of each cell
+// toward the bounds of each primitive, so a primitive only visible through a
+// gap that no ray goes through can be missed.
+// Primitives are identified by their index in drawing order: primitives of
+// instance 0 returned by flattenScene(), then of instance 1...
+
+struct PotentiallyVisibleSets
+{
+  glm::vec3 bboxMin{0};
+  glm::vec3 bboxMax{0};
+  glm::ivec3 cellCounts{0};
+  uint64_t drawCount = 0;
+  // Bitset of the visible primitives of each cell, compressed with PackBits
+  std::vector<std::vector<uint8_t>> cells;
+
+  // Cell containing position, -1 if it is outside of the grid
+  int cellIndex(const glm::vec3 &position) const;
+
+  // visible[i] = 1 if primitive i can be seen from the cell containing
+  // position, 1 everywhere outside of the grid. Return the cell index.
+  int cellVisibility(const glm::vec3 &position, uint8_t *visible) const;
+};
+
+// Bake the sets of a grid over the scene bounds, whose largest dimension is
+// divided in maxCellCount cubic cells. threadCount = 0 uses
+// std::thread::hardware_concurrency().
+PotentiallyVisibleSets bakePVS(const tinygltf::Model &model,
+    const std::vector<int> &meshIndices,
+    const std::vector<glm::mat4> &modelMatrices, const glm::vec3 &bboxMin,
+    const glm::vec3 &bboxMax, int maxCellCount = 16, unsigned threadCount = 0);
+
+// Sidecar file of a glTF file
+fs::path pvsPath(const fs::path &gltfFile);
+
+bool loadPVS(const fs::path &path, PotentiallyVisibleSets &pvs);
+
+bool savePVS(const fs::path &path, const PotentiallyVisibleSets &pvs);
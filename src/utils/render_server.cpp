@@ -0,0 +1,369 @@
+#include "render_server.hpp"
+
+#include <json.hpp>
+#include <stb_image_write.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdio>
+#include <iostream>
+#include <sstream>
+
+#ifndef _WIN32
+#include <csignal>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+const int JPEG_QUALITY = 95;
+
+// Longest request line, the rest of a longer line is discarded
+const size_t MAX_REQUEST_LENGTH = 1 << 16;
+
+bool readNumbers(const nlohmann::json &object, const char *key, size_t count,
+    float *numbers, std::string &error)
+{
+  const auto it = object.find(key);
+  if (it == object.end()) {
+    return true;
+  }
+  if (!it->is_array() || it->size() != count ||
+      !std::all_of(it->begin(), it->end(),
+          [](const nlohmann::json &value) { return value.is_number(); })) {
+    error = std::string(key) + " must be an array of " +
+            std::to_string(count) + " numbers";
+    return false;
+  }
+  for (size_t i = 0; i < count; ++i) {
+    numbers[i] = (*it)[i].get<float>();
+  }
+  return true;
+}
+
+} // namespace
+
+bool parseRenderRequest(const std::string &line, const BatchView &defaults,
+    RenderRequest &request, std::string &error)
+{
+  const auto object = nlohmann::json::parse(line, nullptr, false);
+  if (object.is_discarded() || !object.is_object()) {
+    error = "Request is not a JSON object";
+    return false;
+  }
+  // Every request sets the light, so that it does not depend on the previous
+  // ones
+  request = RenderRequest();
+  request.view = defaults;
+  request.view.output.clear();
+  request.view.hasLightDirection = true;
+  request.view.hasLightIntensity = true;
+
+  const auto model = object.find("model");
+  if (model == object.end() || !model->is_string()) {
+    error = "model must be the path of a glTF file";
+    return false;
+  }
+  request.model = model->get<std::string>();
+
+  float lookat[9];
+  if (!readNumbers(object, "lookat", 9, lookat, error)) {
+    return false;
+  }
+  if (object.count("lookat")) {
+    const auto eye = glm::vec3(lookat[0], lookat[1], lookat[2]);
+    const auto center = glm::vec3(lookat[3], lookat[4], lookat[5]);
+    const auto up = glm::vec3(lookat[6], lookat[7], lookat[8]);
+    if (glm::cross(up, center - eye) == glm::vec3(0)) {
+      error = "the up vector of lookat is colinear to the view direction";
+      return false;
+    }
+    request.hasCamera = true;
+    request.view.camera = Camera(eye, center, up);
+  }
+
+  float size[2];
+  if (!readNumbers(object, "size", 2, size, error)) {
+    return false;
+  }
+  if (object.count("size")) {
+    if (size[0] < 1 || size[1] < 1) {
+      error = "size must be positive";
+      return false;
+    }
+    request.view.width = int(size[0]);
+    request.view.height = int(size[1]);
+  }
+
+  float light[2];
+  if (!readNumbers(object, "light", 2, light, error)) {
+    return false;
+  }
+  if (object.count("light")) {
+    request.view.lightTheta = light[0];
+    request.view.lightPhi = light[1];
+  }
+
+  if (!readNumbers(object, "light-intensity", 3,
+          &request.view.lightIntensity[0], error)) {
+    return false;
+  }
+
+  const auto format = object.find("format");
+  if (format != object.end()) {
+    auto str = format->is_string() ? format->get<std::string>() : "";
+    std::transform(begin(str), end(str), begin(str),
+        [](unsigned char c) { return char(std::tolower(c)); });
+    if (str == "jpeg") {
+      str = "jpg";
+    }
+    if (str != "png" && str != "jpg") {
+      error = "format must be png or jpg";
+      return false;
+    }
+    request.format = str;
+  }
+  return true;
+}
+
+bool encodeImage(const std::string &format, int width, int height,
+    const unsigned char *pixels, const PngCompression &compression,
+    ThreadPool &threadPool, std::string &bytes)
+{
+  bytes.clear();
+  if (format == "jpg") {
+    return stbi_write_jpg_to_func(
+               [](void *context, void *data, int size) {
+                 ((std::string *)context)->append((const char *)data, size);
+               },
+               &bytes, width, height, 3, pixels, JPEG_QUALITY) != 0;
+  }
+  std::ostringstream output;
+  PngWriter writer(threadPool);
+  if (!writer.open(output, width, height, 3, compression) ||
+      !writer.writeRows(pixels, height) || !writer.finish()) {
+    return false;
+  }
+  bytes = output.str();
+  return true;
+}
+
+#ifndef _WIN32
+
+RenderServer::~RenderServer()
+{
+  closeClient();
+  if (m_listenSocket >= 0) {
+    close(m_listenSocket);
+    unlink(m_socketPath.c_str());
+  }
+}
+
+bool RenderServer::listen(
+    const std::string &socketPath, const BatchView &defaults)
+{
+  m_defaults = defaults;
+  m_socketPath = socketPath;
+  // A client leaving while a response is sent must not kill the server
+  std::signal(SIGPIPE, SIG_IGN);
+
+  if (socketPath.empty()) {
+    // The protocol owns the standard output: keep it on another descriptor
+    // and send whatever else is printed to the standard error
+    std::fflush(stdout);
+    m_input = STDIN_FILENO;
+    m_output = dup(STDOUT_FILENO);
+    if (m_output < 0 || dup2(STDERR_FILENO, STDOUT_FILENO) < 0) {
+      std::cerr << "Unable to redirect the standard output" << std::endl;
+      return false;
+    }
+    return true;
+  }
+
+  sockaddr_un address{};
+  address.sun_family = AF_UNIX;
+  if (socketPath.size() >= sizeof(address.sun_path)) {
+    std::cerr << "Socket path is too long: " << socketPath << std::endl;
+    return false;
+  }
+  std::copy(begin(socketPath), end(socketPath), address.sun_path);
+  m_listenSocket = socket(AF_UNIX, SOCK_STREAM, 0);
+  // Replace the socket left by a previous server
+  unlink(socketPath.c_str());
+  if (m_listenSocket < 0 ||
+      bind(m_listenSocket, (const sockaddr *)&address, sizeof(address)) < 0 ||
+      ::listen(m_listenSocket, 8) < 0) {
+    std::cerr << "Unable to listen on " << socketPath << std::endl;
+    return false;
+  }
+  std::clog << "Listening on " << socketPath << std::endl;
+  return true;
+}
+
+bool RenderServer::acceptClient()
+{
+  closeClient();
+  for (;;) {
+    const auto client = accept(m_listenSocket, nullptr, nullptr);
+    if (client >= 0) {
+      m_input = m_output = client;
+      return true;
+    }
+    if (errno != EINTR && errno != ECONNABORTED) {
+      std::cerr << "Unable to accept a client on " << m_socketPath
+                << std::endl;
+      return false;
+    }
+  }
+}
+
+void RenderServer::closeClient()
+{
+  m_buffer.clear();
+  m_skippingLine = false;
+  if (m_listenSocket >= 0 && m_input >= 0) {
+    close(m_input);
+  } else if (m_output >= 0) {
+    close(m_output);
+  }
+  m_input = m_output = -1;
+}
+
+bool RenderServer::readLine(std::string &line, bool &tooLong)
+{
+  tooLong = false;
+  for (;;) {
+    const auto newline = m_buffer.find('\n');
+    if (m_skippingLine) {
+      // Rest of a line already answered as too long
+      if (newline == std::string::npos) {
+        m_buffer.clear();
+      } else {
+        m_buffer.erase(0, newline + 1);
+        m_skippingLine = false;
+        continue;
+      }
+    } else if (newline != std::string::npos &&
+               newline <= MAX_REQUEST_LENGTH) {
+      line = m_buffer.substr(0, newline);
+      m_buffer.erase(0, newline + 1);
+      return true;
+    } else if (m_buffer.size() > MAX_REQUEST_LENGTH) {
+      if (newline == std::string::npos) {
+        m_buffer.clear();
+        m_skippingLine = true;
+      } else {
+        m_buffer.erase(0, newline + 1);
+      }
+      line.clear();
+      tooLong = true;
+      return true;
+    }
+    if (m_input < 0) {
+      return false;
+    }
+    char data[4096];
+    const auto size = read(m_input, data, sizeof(data));
+    if (size > 0) {
+      m_buffer.append(data, size_t(size));
+    } else if (size == 0 || errno != EINTR) {
+      // An unterminated last request is still served
+      line.swap(m_buffer);
+      m_buffer.clear();
+      return !line.empty() && !m_skippingLine;
+    }
+  }
+}
+
+bool RenderServer::readRequest(RenderRequest &request)
+{
+  for (;;) {
+    if (m_listenSocket >= 0 && m_input < 0 && !acceptClient()) {
+      return false;
+    }
+    std::string line;
+    bool tooLong = false;
+    if (!readLine(line, tooLong)) {
+      if (m_listenSocket < 0) {
+        return false;
+      }
+      closeClient();
+      continue;
+    }
+    if (tooLong) {
+      sendError("Request longer than " + std::to_string(MAX_REQUEST_LENGTH) +
+                " bytes");
+      continue;
+    }
+    if (std::all_of(begin(line), end(line),
+            [](unsigned char c) { return std::isspace(c); })) {
+      continue;
+    }
+    std::string error;
+    if (parseRenderRequest(line, m_defaults, request, error)) {
+      return true;
+    }
+    sendError(error);
+  }
+}
+
+void RenderServer::send(const std::string &bytes)
+{
+  size_t sent = 0;
+  while (m_output >= 0 && sent < bytes.size()) {
+    const auto size = write(m_output, bytes.data() + sent, bytes.size() - sent);
+    if (size < 0 && errno == EINTR) {
+      continue;
+    }
+    if (size <= 0) {
+      // The client is gone, the next request will come from another one
+      std::cerr << "Unable to send a response" << std::endl;
+      if (m_listenSocket >= 0) {
+        closeClient();
+      }
+      return;
+    }
+    sent += size_t(size);
+  }
+}
+
+#else
+
+RenderServer::~RenderServer() {}
+
+bool RenderServer::listen(const std::string &, const BatchView &)
+{
+  std::cerr << "The serve command is not supported on this platform"
+            << std::endl;
+  return false;
+}
+
+bool RenderServer::acceptClient() { return false; }
+
+void RenderServer::closeClient() {}
+
+bool RenderServer::readLine(std::string &, bool &) { return false; }
+
+bool RenderServer::readRequest(RenderRequest &) { return false; }
+
+void RenderServer::send(const std::string &) {}
+
+#endif
+
+void RenderServer::sendError(const std::string &message)
+{
+  const nlohmann::json response = {{"status", "error"}, {"message", message}};
+  send(response.dump() + "\n");
+}
+
+void RenderServer::sendImage(const std::string &format, int width, int height,
+    double milliseconds, const std::string &bytes)
+{
+  const nlohmann::json response = {{"status", "ok"}, {"format", format},
+      {"width", width}, {"height", height}, {"milliseconds", milliseconds},
+      {"size", bytes.size()}};
+  send(response.dump() + "\n" + bytes);
+}
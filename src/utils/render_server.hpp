@@ -0,0 +1,78 @@
+#pragma once
+
+#include "batch_views.hpp"
+#include "filesystem.hpp"
+#include "png_writer.hpp"
+#include "thread_pool.hpp"
+
+#include <string>
+
+// Render request of the serve command, one JSON object per line:
+//   {"model": "scene.gltf", "lookat": [eye, center and up, 9 numbers],
+//    "size": [width, height], "light": [theta, phi],
+//    "light-intensity": [r, g, b], "format": "png" or "jpg"}
+// Only model is required. The camera defaults to the one of the viewer for
+// the model, the other settings to the ones of the command line.
+// Requests for the same model are rendered from one load of it, a request for
+// another model releases it.
+struct RenderRequest
+{
+  fs::path model;
+  bool hasCamera = false;
+  BatchView view; // Output unused
+  std::string format = "png";
+};
+
+// Connection of the serve command: the standard input and output, or the
+// clients of a Unix domain socket served one after the other. Each request
+// is answered with a JSON line, {"status": "ok", "format": ..., "width": ...,
+// "height": ..., "milliseconds": ..., "size": <byte count>} followed by the
+// bytes of the encoded image, or {"status": "error", "message": ...}, also
+// sent for request lines longer than 64 KB.
+// With the standard output, anything else printed goes to the standard error.
+class RenderServer
+{
+public:
+  RenderServer() = default;
+  ~RenderServer();
+  RenderServer(const RenderServer &) = delete;
+  RenderServer &operator=(const RenderServer &) = delete;
+
+  // Serve the standard input and output if socketPath is empty. defaults
+  // gives the size and light of the requests that do not set them.
+  bool listen(const std::string &socketPath, const BatchView &defaults);
+
+  // Read the next valid request, answering invalid ones with an error and
+  // waiting for the next client when one disconnects. False at the end of
+  // the standard input or on a socket error.
+  bool readRequest(RenderRequest &request);
+
+  void sendError(const std::string &message);
+  void sendImage(const std::string &format, int width, int height,
+      double milliseconds, const std::string &bytes);
+
+private:
+  // tooLong is set, with an empty line, for a line longer than the limit,
+  // whose rest is then skipped
+  bool readLine(std::string &line, bool &tooLong);
+  bool acceptClient();
+  void closeClient();
+  void send(const std::string &bytes);
+
+  BatchView m_defaults;
+  std::string m_socketPath;
+  int m_listenSocket = -1;
+  int m_input = -1;
+  int m_output = -1;
+  std::string m_buffer; // Read past the last line
+  bool m_skippingLine = false;
+};
+
+// Parse a request line, the fields it does not set being taken from defaults
+bool parseRenderRequest(const std::string &line, const BatchView &defaults,
+    RenderRequest &request, std::string &error);
+
+// Encode RGB pixels, rows going downward, as a PNG or JPEG file in bytes
+bool encodeImage(const std::string &format, int width, int height,
+    const unsigned char *pixels, const PngCompression &compression,
+    ThreadPool &threadPool, std::string &bytes);
@@ -1,14 +1,22 @@
 #pragma once
 
 #include "filesystem.hpp"
+#include <algorithm>
+#include <bitset>
+#include <chrono>
+#include <cstdint>
+#include <ctime>
 #include <fstream>
 #include <glad/glad.h>
 #include <iostream>
+#include <map>
 #include <memory>
+#include <set>
 #include <sstream>
 #include <stdexcept>
 #include <string>
 #include <unordered_map>
+#include <vector>
 
 class GLShader
 {
@@ -46,6 +54,9 @@ public:
     return getCompileStatus();
   }
 
+  // Issue the compilation without waiting for its status
+  void compileAsync() { glCompileShader(m_GLId); }
+
   bool getCompileStatus() const
   {
     GLint status;
@@ -80,6 +91,29 @@ inline std::string loadShaderSource(const fs::path &filepath)
   return buffer.str();
 }
 
+// Insert defines (lines of "#define NAME") right after the #version directive
+// of src, which must come first in GLSL
+inline std::string injectShaderDefines(
+    const std::string &src, const std::string &defines)
+{
+  if (defines.empty()) {
+    return src;
+  }
+  const auto versionPos = src.find("#version");
+  if (versionPos == std::string::npos) {
+    return defines + src;
+  }
+  const auto lineEnd = src.find('\n', versionPos);
+  if (lineEnd == std::string::npos) {
+    return src + "\n" + defines;
+  }
+  // #line keeps line numbers of compilation errors in sync with the file
+  const auto versionLine =
+      std::count(begin(src), begin(src) + lineEnd, '\n') + 1;
+  return src.substr(0, lineEnd + 1) + defines + "#line " +
+         std::to_string(versionLine + 1) + "\n" + src.substr(lineEnd + 1);
+}
+
 template <typename StringType>
 GLShader compileShader(GLenum type, StringType &&src)
 {
@@ -92,12 +126,14 @@ GLShader compileShader(GLenum type, StringType &&src)
   return shader;
 }
 
-// Load and compile a shader according to the following naming convention:
+// Load a shader and issue its compilation without checking the result, the
+// type is deduced from the file name:
 // *.vs.glsl -> vertex shader
 // *.fs.glsl -> fragment shader
 // *.gs.glsl -> geometry shader
 // *.cs.glsl -> compute shader
-inline GLShader loadShader(const fs::path &shaderPath)
+inline GLShader loadShaderAsync(
+    const fs::path &shaderPath, const std::string &defines = "")
 {
   static auto extToShaderType =
       std::unordered_map<std::string, std::pair<GLenum, std::string>>(
@@ -117,13 +153,27 @@ inline GLShader loadShader(const fs::path &shaderPath)
             << "\n";
 
   GLShader shader{(*it).second.first};
-  shader.setSource(loadShaderSource(shaderPath));
-  shader.compile();
+  shader.setSource(
+      injectShaderDefines(loadShaderSource(shaderPath), defines));
+  shader.compileAsync();
+  return shader;
+}
+
+inline void checkShaderCompileStatus(const GLShader &shader)
+{
   if (!shader.getCompileStatus()) {
     std::cerr << "Shader compilation error:" << shader.getInfoLog()
               << std::endl;
     throw std::runtime_error("Shader compilation error:" + shader.getInfoLog());
   }
+}
+
+// Load and compile a shader, see loadShaderAsync for the naming convention
+inline GLShader loadShader(
+    const fs::path &shaderPath, const std::string &defines = "")
+{
+  auto shader = loadShaderAsync(shaderPath, defines);
+  checkShaderCompileStatus(shader);
   return shader;
 }
 
@@ -135,6 +185,9 @@ public:
   GLint m_uViewMatrixLocation;
   GLint m_uProjectionMatrixLocation;
   GLint m_uModelMatrixLocation;
+  GLint m_uModelViewMatrixLocation;
+  GLint m_uModelViewProjMatrixLocation;
+  GLint m_uNormalMatrixLocation;
   GLint m_ulightDirection;
   GLint m_ulightIntensity;
   GLint m_uBaseColorTexture;
@@ -146,13 +199,31 @@ public:
   GLint m_uEmissiveFactor;
   GLint m_uOcclusionTexture;
   GLint m_uOcclusionStrength;
-  GLint m_uApplyOcclusion;
   GLint m_uLightSpaceMatrix;
   GLint m_uDirLightShadowMap;
   GLint m_uNormalTexture;
   GLint m_uNormalScale;
-  GLint m_uHasNormalMap;
-  GLint m_applyNormalMapping;
+  GLint m_uInvProjectionMatrix;
+  GLint m_uViewToLightSpaceMatrix;
+  GLint m_uGBufferNormal;
+  GLint m_uGBufferBaseColor;
+  GLint m_uGBufferMaterial;
+  GLint m_uGBufferEmissive;
+  GLint m_uGBufferDepth;
+  GLint m_uDirectionalLightCount;
+  GLint m_uClusterGridSize;
+  GLint m_uClusterTileSize;
+  GLint m_uClusterSliceScaleBias;
+  GLint m_uInvViewMatrix;
+  GLint m_uSHCoefficients;
+  GLint m_uSpecularMap;
+  GLint m_uBRDFLut;
+  GLint m_uSpecularMaxLod;
+  GLint m_uIBLIntensity;
+  GLint m_uJointMatrices;
+  GLint m_uJointOffset;
+  GLint m_uNodeId;
+  GLint m_uMaterialId;
 
   GLProgram() : m_GLId(glCreateProgram()) { }
 
@@ -217,6 +288,9 @@ public:
     m_uProjectionMatrixLocation =
         getUniformLocation("uProjectionMatrix");
     m_uModelMatrixLocation = getUniformLocation("uModelMatrix");
+    m_uModelViewMatrixLocation = getUniformLocation("uModelViewMatrix");
+    m_uModelViewProjMatrixLocation = getUniformLocation("uModelViewProjMatrix");
+    m_uNormalMatrixLocation = getUniformLocation("uNormalMatrix");
     m_ulightDirection = getUniformLocation("uLightDirection");
     m_ulightIntensity = getUniformLocation("uLightIntensity");
     m_uBaseColorTexture = getUniformLocation("uBaseColorTexture");
@@ -229,13 +303,31 @@ public:
     m_uEmissiveFactor = getUniformLocation("uEmissiveFactor");
     m_uOcclusionTexture = getUniformLocation("uOcclusionTexture");
     m_uOcclusionStrength = getUniformLocation("uOcclusionStrength");
-    m_uApplyOcclusion = getUniformLocation("uApplyOcclusion");
     m_uLightSpaceMatrix = getUniformLocation("uLightSpaceMatrix");
     m_uDirLightShadowMap = getUniformLocation("uDirLightShadowMap");
     m_uNormalTexture = getUniformLocation("uNormalTexture");
     m_uNormalScale = getUniformLocation("uNormalScale");
-    m_uHasNormalMap = getUniformLocation("uHasNormalMap");
-    m_applyNormalMapping = getUniformLocation("uApplyNormalMapping");
+    m_uInvProjectionMatrix = getUniformLocation("uInvProjectionMatrix");
+    m_uViewToLightSpaceMatrix = getUniformLocation("uViewToLightSpaceMatrix");
+    m_uGBufferNormal = getUniformLocation("uGBufferNormal");
+    m_uGBufferBaseColor = getUniformLocation("uGBufferBaseColor");
+    m_uGBufferMaterial = getUniformLocation("uGBufferMaterial");
+    m_uGBufferEmissive = getUniformLocation("uGBufferEmissive");
+    m_uGBufferDepth = getUniformLocation("uGBufferDepth");
+    m_uDirectionalLightCount = getUniformLocation("uDirectionalLightCount");
+    m_uClusterGridSize = getUniformLocation("uClusterGridSize");
+    m_uClusterTileSize = getUniformLocation("uClusterTileSize");
+    m_uClusterSliceScaleBias = getUniformLocation("uClusterSliceScaleBias");
+    m_uInvViewMatrix = getUniformLocation("uInvViewMatrix");
+    m_uSHCoefficients = getUniformLocation("uSHCoefficients");
+    m_uSpecularMap = getUniformLocation("uSpecularMap");
+    m_uBRDFLut = getUniformLocation("uBRDFLut");
+    m_uSpecularMaxLod = getUniformLocation("uSpecularMaxLod");
+    m_uIBLIntensity = getUniformLocation("uIBLIntensity");
+    m_uJointMatrices = getUniformLocation("uJointMatrices");
+    m_uJointOffset = getUniformLocation("uJointOffset");
+    m_uNodeId = getUniformLocation("uNodeId");
+    m_uMaterialId = getUniformLocation("uMaterialId");
   }
 
   GLint getAttribLocation(const GLchar *name) const
@@ -292,18 +384,480 @@ template <typename CSrc> GLProgram buildComputeProgram(CSrc &&src)
   ;
 }
 
-inline GLProgram compileProgram(std::vector<fs::path> shaderPaths)
+// A program whose compilation and link were issued but not checked yet. With
+// parallel shader compilation (see enableParallelShaderCompile) the driver
+// works on it in the background until finishCompileProgram is called.
+struct GLPendingProgram
 {
   GLProgram program;
+  std::vector<GLShader> shaders;
+  // GLProgramCache entry to fill once linked, empty if none
+  fs::path cacheEntry;
+  std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+};
+
+// retrievableBinary must be set for programs whose binary will be read back
+// with glGetProgramBinary
+inline GLPendingProgram startCompileProgram(std::vector<fs::path> shaderPaths,
+    const std::string &defines = "", bool retrievableBinary = false)
+{
+  GLPendingProgram pending;
   for (const auto &path : shaderPaths) {
-    auto shader = loadShader(path);
-    program.attachShader(shader);
+    pending.shaders.emplace_back(loadShaderAsync(path, defines));
+    pending.program.attachShader(pending.shaders.back());
   }
-  program.link();
-  if (!program.getLinkStatus()) {
-    std::cerr << "Program link error:" << program.getInfoLog() << std::endl;
-    throw std::runtime_error("Program link error:" + program.getInfoLog());
+  if (retrievableBinary) {
+    glProgramParameteri(
+        pending.program.glId(), GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
   }
+  glLinkProgram(pending.program.glId());
+  return pending;
+}
 
-  return program;
+// Wait for a program started with startCompileProgram and check for errors
+inline GLProgram finishCompileProgram(GLPendingProgram &&pending)
+{
+  for (const auto &shader : pending.shaders) {
+    checkShaderCompileStatus(shader);
+  }
+  if (!pending.program.getLinkStatus()) {
+    std::cerr << "Program link error:" << pending.program.getInfoLog()
+              << std::endl;
+    throw std::runtime_error(
+        "Program link error:" + pending.program.getInfoLog());
+  }
+
+  return std::move(pending.program);
+}
+
+inline GLProgram compileProgram(std::vector<fs::path> shaderPaths,
+    const std::string &defines = "", bool retrievableBinary = false)
+{
+  return finishCompileProgram(
+      startCompileProgram(std::move(shaderPaths), defines, retrievableBinary));
+}
+
+// On-disk cache of linked program binaries (glGetProgramBinary). Entries are
+// keyed by a hash of the shader sources, defines and driver, so editing a
+// shader or updating the driver invalidates them. A binary rejected by
+// glProgramBinary falls back to compileProgram and is replaced. Entries are
+// touched when hit, and the least recently used ones are removed when the
+// cache is opened, so that entries of old sources or drivers do not pile up.
+class GLProgramCache
+{
+  // Size of the directory kept when the cache is opened
+  static const uintmax_t MAX_DIRECTORY_BYTES = 64 * 1024 * 1024;
+
+  fs::path m_directory;
+  std::string m_driver;
+  bool m_enabled = false;
+
+  size_t m_hitCount = 0;
+  size_t m_missCount = 0;
+  double m_savedMilliseconds = 0.;
+
+  // Header of a cache file, followed by the binary
+  struct FileHeader
+  {
+    char magic[4];
+    GLenum format;
+    uint32_t size;
+    // Time spent compiling from sources, to report time saved on hits
+    float compileMilliseconds;
+  };
+
+  static uint64_t hash(const std::string &data, uint64_t h)
+  {
+    // FNV-1a
+    for (const auto c : data) {
+      h ^= uint8_t(c);
+      h *= 1099511628211ull;
+    }
+    return h;
+  }
+
+  fs::path entryPath(
+      const std::vector<fs::path> &shaderPaths, const std::string &defines) const
+  {
+    auto h = hash(m_driver, 14695981039346656037ull);
+    h = hash(defines, h);
+    for (const auto &path : shaderPaths) {
+      h = hash(path.filename().string(), h);
+      h = hash(loadShaderSource(path), h);
+    }
+    std::stringstream name;
+    name << std::hex << h << ".bin";
+    return m_directory / name.str();
+  }
+
+  // Mark an entry as recently used
+  static void touch(const fs::path &path)
+  {
+    try {
+#ifdef GLMLV_USE_BOOST_FILESYSTEM
+      fs::last_write_time(path, std::time(nullptr));
+#else
+      fs::last_write_time(path, fs::file_time_type::clock::now());
+#endif
+    } catch (const std::exception &) {
+      // Only makes the entry evicted sooner
+    }
+  }
+
+  // Remove the least recently used entries beyond MAX_DIRECTORY_BYTES
+  void evict() const
+  {
+    try {
+      struct Entry
+      {
+        decltype(fs::last_write_time(m_directory)) time;
+        uintmax_t size;
+        fs::path path;
+      };
+      std::vector<Entry> entries;
+      for (const auto &file : fs::directory_iterator(m_directory)) {
+        const auto &path = file.path();
+        if (fs::is_regular_file(path) && path.extension() == ".bin") {
+          entries.push_back(
+              {fs::last_write_time(path), fs::file_size(path), path});
+        }
+      }
+      std::sort(begin(entries), end(entries),
+          [](const Entry &a, const Entry &b) { return a.time > b.time; });
+      uintmax_t size = 0;
+      size_t removedCount = 0;
+      for (const auto &entry : entries) {
+        size += entry.size;
+        if (size > MAX_DIRECTORY_BYTES) {
+          fs::remove(entry.path);
+          ++removedCount;
+        }
+      }
+      if (removedCount) {
+        std::clog << "Program binary cache: " << removedCount
+                  << " least recently used entries removed" << std::endl;
+      }
+    } catch (const std::exception &e) {
+      std::cerr << "Unable to clean the program binary cache: " << e.what()
+                << std::endl;
+    }
+  }
+
+  static double millisecondsSince(
+      std::chrono::steady_clock::time_point start)
+  {
+    return std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - start)
+        .count();
+  }
+
+public:
+  GLProgramCache() = default;
+
+  // Requires a current GL context
+  GLProgramCache(fs::path directory) : m_directory(std::move(directory))
+  {
+    GLint formatCount = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formatCount);
+    if (formatCount <= 0) {
+      std::clog << "Program binary cache disabled: no binary format supported"
+                << std::endl;
+      return;
+    }
+    try {
+      fs::create_directories(m_directory);
+    } catch (const std::exception &e) {
+      std::clog << "Program binary cache disabled: " << e.what() << std::endl;
+      return;
+    }
+    for (const auto name : {GL_VENDOR, GL_RENDERER, GL_VERSION}) {
+      const auto str = glGetString(name);
+      m_driver += str ? (const char *)str : "";
+      m_driver += '\n';
+    }
+    m_enabled = true;
+    evict();
+  }
+
+  // Load the program from the cache, or issue its compilation from sources
+  GLPendingProgram startCompileProgram(
+      std::vector<fs::path> shaderPaths, const std::string &defines = "")
+  {
+    if (!m_enabled) {
+      return ::startCompileProgram(std::move(shaderPaths), defines);
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    const auto path = entryPath(shaderPaths, defines);
+
+    std::ifstream input(path.string(), std::ios::binary);
+    FileHeader header;
+    if (input && input.read((char *)&header, sizeof(header)) &&
+        std::equal(header.magic, header.magic + 4, "GLPB")) {
+      std::vector<char> binary(header.size);
+      if (input.read(binary.data(), binary.size())) {
+        GLPendingProgram pending;
+        glProgramBinary(pending.program.glId(), header.format, binary.data(),
+            GLsizei(header.size));
+        if (pending.program.getLinkStatus()) {
+          const auto loadMilliseconds = millisecondsSince(start);
+          ++m_hitCount;
+          m_savedMilliseconds += header.compileMilliseconds - loadMilliseconds;
+          std::clog << "Loaded program binary " << path << " in "
+                    << loadMilliseconds << " ms" << std::endl;
+          input.close();
+          touch(path);
+          return pending;
+        }
+      }
+      std::clog << "Program binary " << path << " rejected, recompiling"
+                << std::endl;
+    }
+    input.close();
+
+    ++m_missCount;
+    auto pending = ::startCompileProgram(shaderPaths, defines, true);
+    pending.cacheEntry = path;
+    pending.start = start;
+    return pending;
+  }
+
+  // Wait for a program returned by startCompileProgram and store its binary
+  // if it was compiled from sources. The recorded compile time is measured
+  // from startCompileProgram, so it includes work overlapping a parallel
+  // compilation.
+  GLProgram finishCompileProgram(GLPendingProgram &&pending)
+  {
+    const auto path = pending.cacheEntry;
+    const auto start = pending.start;
+    auto program = ::finishCompileProgram(std::move(pending));
+    if (path.empty()) {
+      return program;
+    }
+    const auto compileMilliseconds = millisecondsSince(start);
+
+    GLint size = 0;
+    glGetProgramiv(program.glId(), GL_PROGRAM_BINARY_LENGTH, &size);
+    if (size > 0) {
+      std::vector<char> binary(size);
+      FileHeader header = {{'G', 'L', 'P', 'B'}, 0, 0, float(compileMilliseconds)};
+      GLsizei length = 0;
+      glGetProgramBinary(
+          program.glId(), size, &length, &header.format, binary.data());
+      header.size = uint32_t(length);
+      std::ofstream output(path.string(), std::ios::binary);
+      if (!output.write((const char *)&header, sizeof(header)) ||
+          !output.write(binary.data(), length)) {
+        std::cerr << "Unable to write program binary " << path << std::endl;
+      }
+    }
+    return program;
+  }
+
+  GLProgram compileProgram(
+      std::vector<fs::path> shaderPaths, const std::string &defines = "")
+  {
+    return finishCompileProgram(
+        startCompileProgram(std::move(shaderPaths), defines));
+  }
+
+  void logStatistics() const
+  {
+    if (!m_enabled) {
+      return;
+    }
+    std::clog << "Program binary cache: " << m_hitCount << " hits, "
+              << m_missCount << " misses, " << m_savedMilliseconds
+              << " ms saved" << std::endl;
+  }
+};
+
+// Compile time features of the shaders. Each bit enables a #define in the
+// program variants compiled by GLProgramPermutations.
+enum ShaderFeature : uint32_t
+{
+  SHADER_FEATURE_NORMAL_MAP = 1 << 0, // HAS_NORMAL_MAP
+  SHADER_FEATURE_TANGENTS = 1 << 1,   // HAS_TANGENTS
+  SHADER_FEATURE_OCCLUSION = 1 << 2,  // HAS_OCCLUSION
+  SHADER_FEATURE_IBL = 1 << 3,        // HAS_IBL
+  SHADER_FEATURE_SKINNING = 1 << 4,   // HAS_SKINNING
+  SHADER_FEATURE_AOV = 1 << 5,        // HAS_AOV, see utils/image_sequence.hpp
+  SHADER_FEATURE_ALL = (1 << 6) - 1
+};
+
+inline std::string shaderFeatureDefines(uint32_t features)
+{
+  static const char *names[] = {"HAS_NORMAL_MAP", "HAS_TANGENTS",
+      "HAS_OCCLUSION", "HAS_IBL", "HAS_SKINNING", "HAS_AOV"};
+  std::string defines;
+  for (uint32_t i = 0; i < sizeof(names) / sizeof(names[0]); ++i) {
+    if (features & (1u << i)) {
+      defines += std::string("#define ") + names[i] + "\n";
+    }
+  }
+  return defines;
 }
+
+// A program compiled in several variants, one for each combination of the
+// shader features it supports. Variants are compiled on first use, or in the
+// background after a call to request.
+class GLProgramPermutations
+{
+  std::vector<fs::path> m_shaderPaths;
+  uint32_t m_supportedFeatures = 0;
+  GLProgramCache *m_cache = nullptr;
+  std::map<uint32_t, GLProgram> m_variants;
+  std::map<uint32_t, GLPendingProgram> m_pendingVariants;
+  // Variants that failed to compile from the current sources, replaced by
+  // fallbackVariant until the next successful reload
+  std::set<uint32_t> m_failedVariants;
+
+  // Compiled variant with the most of the given features and none of the
+  // others, any compiled one otherwise
+  const GLProgram *fallbackVariant(uint32_t features) const
+  {
+    const GLProgram *fallback = nullptr;
+    int fallbackFeatureCount = -1;
+    for (const auto &variant : m_variants) {
+      const auto subset = (variant.first & ~features) == 0;
+      const auto featureCount =
+          subset ? int(std::bitset<32>(variant.first).count()) : -1;
+      if (!fallback || featureCount > fallbackFeatureCount) {
+        fallback = &variant.second;
+        fallbackFeatureCount = featureCount;
+      }
+    }
+    return fallback;
+  }
+
+public:
+  GLProgramPermutations() = default;
+
+  // Variants are compiled through cache when not null
+  GLProgramPermutations(std::vector<fs::path> shaderPaths,
+      uint32_t supportedFeatures, GLProgramCache *cache = nullptr) :
+      m_shaderPaths(std::move(shaderPaths)),
+      m_supportedFeatures(supportedFeatures),
+      m_cache(cache)
+  {
+  }
+
+  GLProgramPermutations(const GLProgramPermutations &) = delete;
+
+  GLProgramPermutations &operator=(const GLProgramPermutations &) = delete;
+
+  GLProgramPermutations(GLProgramPermutations &&) = default;
+
+  GLProgramPermutations &operator=(GLProgramPermutations &&) = default;
+
+  uint32_t supportedFeatures() const { return m_supportedFeatures; }
+
+  bool usesShader(const fs::path &shaderPath) const
+  {
+    return std::any_of(begin(m_shaderPaths), end(m_shaderPaths),
+        [&](const fs::path &path) {
+          return path.filename() == shaderPath.filename();
+        });
+  }
+
+  // Issue the compilation of a variant without waiting for it
+  void request(uint32_t features)
+  {
+    features &= m_supportedFeatures;
+    if (m_variants.count(features) || m_pendingVariants.count(features) ||
+        m_failedVariants.count(features)) {
+      return;
+    }
+    const auto defines = shaderFeatureDefines(features);
+    try {
+      m_pendingVariants.emplace(features,
+          m_cache ? m_cache->startCompileProgram(m_shaderPaths, defines)
+                  : startCompileProgram(m_shaderPaths, defines));
+    } catch (const std::exception &e) {
+      std::cerr << "Unable to compile program variant: " << e.what()
+                << std::endl;
+      m_failedVariants.insert(features);
+    }
+  }
+
+  // Variant for a draw with the given features, unsupported ones are ignored.
+  // Blocks until the variant is compiled. If it does not compile, another
+  // variant is returned so that a broken shader edit does not end the session;
+  // throws only if no variant was ever compiled.
+  const GLProgram &variant(uint32_t features)
+  {
+    features &= m_supportedFeatures;
+    auto it = m_variants.find(features);
+    if (it != end(m_variants)) {
+      return (*it).second;
+    }
+    request(features);
+    const auto pendingIt = m_pendingVariants.find(features);
+    if (pendingIt != end(m_pendingVariants)) {
+      auto pending = std::move((*pendingIt).second);
+      m_pendingVariants.erase(pendingIt);
+      try {
+        it = m_variants
+                 .emplace(features,
+                     m_cache
+                         ? m_cache->finishCompileProgram(std::move(pending))
+                         : finishCompileProgram(std::move(pending)))
+                 .first;
+        (*it).second.setUniform();
+        return (*it).second;
+      } catch (const std::exception &e) {
+        std::cerr << "Unable to compile program variant: " << e.what()
+                  << std::endl;
+        m_failedVariants.insert(features);
+      }
+    }
+    const auto fallback = fallbackVariant(features);
+    if (!fallback) {
+      throw std::runtime_error("No program variant compiled");
+    }
+    return *fallback;
+  }
+
+  // Recompile the variants from the current sources. They are swapped only if
+  // all of them compile, otherwise the previous ones are kept.
+  bool reload()
+  {
+    std::map<uint32_t, GLProgram> variants;
+    try {
+      std::map<uint32_t, GLPendingProgram> pendingVariants;
+      for (const auto &variant : m_variants) {
+        const auto defines = shaderFeatureDefines(variant.first);
+        pendingVariants.emplace(variant.first,
+            m_cache ? m_cache->startCompileProgram(m_shaderPaths, defines)
+                    : startCompileProgram(m_shaderPaths, defines));
+      }
+      for (auto &pending : pendingVariants) {
+        auto it = variants
+                      .emplace(pending.first,
+                          m_cache ? m_cache->finishCompileProgram(
+                                        std::move(pending.second))
+                                  : finishCompileProgram(
+                                        std::move(pending.second)))
+                      .first;
+        (*it).second.setUniform();
+      }
+    } catch (const std::exception &e) {
+      std::cerr << "Reload failed, keeping previous program: " << e.what()
+                << std::endl;
+      return false;
+    }
+    m_variants = std::move(variants);
+    // Requested from the previous sources
+    m_pendingVariants.clear();
+    m_failedVariants.clear();
+    return true;
+  }
+
+  template <typename Function> void forEachVariant(Function &&f) const
+  {
+    for (const auto &variant : m_variants) {
+      f(variant.second);
+    }
+  }
+};
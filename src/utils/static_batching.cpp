@@ -0,0 +1,426 @@
+#include "static_batching.hpp"
+#include "gltf.hpp"
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <tuple>
+
+namespace {
+
+struct AttributeLayout
+{
+  std::string name;
+  int type;
+  int componentType;
+  bool normalized;
+
+  bool operator<(const AttributeLayout &other) const
+  {
+    return std::tie(name, type, componentType, normalized) <
+           std::tie(other.name, other.type, other.componentType,
+               other.normalized);
+  }
+};
+
+// Primitives can only be merged if they have the same key
+struct BatchKey
+{
+  int material;
+  std::vector<AttributeLayout> attributes; // Sorted by name
+
+  bool operator<(const BatchKey &other) const
+  {
+    return std::tie(material, attributes) <
+           std::tie(other.material, other.attributes);
+  }
+};
+
+struct Candidate
+{
+  int node;
+  int primitive;
+  glm::mat4 worldMatrix;
+  size_t vertexCount;
+  glm::vec3 center; // World space
+  uint32_t mortonCode;
+};
+
+bool isDenseAccessor(const tinygltf::Accessor &accessor)
+{
+  return accessor.bufferView >= 0 && !accessor.sparse.isSparse;
+}
+
+bool isFloatAccessor(const tinygltf::Accessor &accessor, int type)
+{
+  return accessor.type == type &&
+         accessor.componentType == TINYGLTF_COMPONENT_TYPE_FLOAT;
+}
+
+size_t elementSize(const tinygltf::Accessor &accessor)
+{
+  return size_t(tinygltf::GetComponentSizeInBytes(accessor.componentType) *
+                tinygltf::GetNumComponentsInType(accessor.type));
+}
+
+const unsigned char *elementPointer(const tinygltf::Model &model,
+    const tinygltf::Accessor &accessor, size_t i)
+{
+  const auto &bufferView = model.bufferViews[accessor.bufferView];
+  const auto byteStride =
+      bufferView.byteStride ? bufferView.byteStride : elementSize(accessor);
+  return model.buffers[bufferView.buffer].data.data() +
+         bufferView.byteOffset + accessor.byteOffset + byteStride * i;
+}
+
+bool isBatchable(const tinygltf::Model &model,
+    const tinygltf::Primitive &primitive, size_t maxVertexCount, BatchKey &key,
+    size_t &vertexCount)
+{
+  const auto positionIt = primitive.attributes.find("POSITION");
+  if (primitive.mode != TINYGLTF_MODE_TRIANGLES ||
+      !primitive.targets.empty() ||
+      positionIt == end(primitive.attributes) ||
+      !isFloatAccessor(
+          model.accessors[(*positionIt).second], TINYGLTF_TYPE_VEC3)) {
+    return false;
+  }
+  vertexCount = model.accessors[(*positionIt).second].count;
+  if (vertexCount == 0 || vertexCount > maxVertexCount) {
+    return false;
+  }
+  if (primitive.indices >= 0) {
+    const auto &accessor = model.accessors[primitive.indices];
+    if (!isDenseAccessor(accessor) || accessor.type != TINYGLTF_TYPE_SCALAR) {
+      return false;
+    }
+  }
+
+  key.material = primitive.material;
+  key.attributes.clear();
+  for (const auto &attribute : primitive.attributes) {
+    const auto &accessor = model.accessors[attribute.second];
+    if (!isDenseAccessor(accessor) || accessor.count != vertexCount) {
+      return false;
+    }
+    // Transformed attributes
+    if ((attribute.first == "NORMAL" &&
+            !isFloatAccessor(accessor, TINYGLTF_TYPE_VEC3)) ||
+        (attribute.first == "TANGENT" &&
+            !isFloatAccessor(accessor, TINYGLTF_TYPE_VEC4))) {
+      return false;
+    }
+    key.attributes.push_back({attribute.first, accessor.type,
+        accessor.componentType, accessor.normalized});
+  }
+  return true;
+}
+
+uint32_t readIndex(const tinygltf::Model &model,
+    const tinygltf::Accessor &accessor, size_t i)
+{
+  const auto pointer = elementPointer(model, accessor, i);
+  switch (accessor.componentType) {
+  case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
+    return *pointer;
+  case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT:
+    return *(const uint16_t *)pointer;
+  default:
+    return *(const uint32_t *)pointer;
+  }
+}
+
+// Interleave the 10 low bits of v with two zero bits
+uint32_t expandBits(uint32_t v)
+{
+  v = (v * 0x00010001u) & 0xFF0000FFu;
+  v = (v * 0x00000101u) & 0x0F00F00Fu;
+  v = (v * 0x00000011u) & 0xC30C30C3u;
+  v = (v * 0x00000005u) & 0x49249249u;
+  return v;
+}
+
+// p in [0, 1]^3
+uint32_t mortonCode(const glm::vec3 &p)
+{
+  const auto cell =
+      glm::uvec3(glm::clamp(p * 1024.f, glm::vec3(0), glm::vec3(1023)));
+  return (expandBits(cell.x) << 2) | (expandBits(cell.y) << 1) |
+         expandBits(cell.z);
+}
+
+// Append data to buffer in a new buffer view
+int addBufferView(tinygltf::Model &model, int bufferIdx,
+    const std::vector<unsigned char> &data, size_t byteStride, int target)
+{
+  auto &buffer = model.buffers[bufferIdx].data;
+  buffer.resize((buffer.size() + 3) & ~size_t(3));
+  tinygltf::BufferView bufferView;
+  bufferView.buffer = bufferIdx;
+  bufferView.byteOffset = buffer.size();
+  bufferView.byteLength = data.size();
+  bufferView.byteStride = byteStride;
+  bufferView.target = target;
+  buffer.insert(end(buffer), begin(data), end(data));
+  model.bufferViews.push_back(bufferView);
+  return int(model.bufferViews.size() - 1);
+}
+
+} // namespace
+
+void batchStaticNodes(tinygltf::Model &model, size_t maxPrimitiveVertexCount,
+    size_t maxBatchVertexCount)
+{
+  if (model.defaultScene < 0) {
+    return;
+  }
+  size_t batchCount = 0;
+
+  std::vector<uint8_t> animated(model.nodes.size(), 0);
+  for (const auto &animation : model.animations) {
+    for (const auto &channel : animation.channels) {
+      if (channel.target_node >= 0) {
+        animated[channel.target_node] = 1;
+      }
+    }
+  }
+
+  // Group the static primitive instances by key
+  std::map<BatchKey, std::vector<Candidate>> groups;
+  auto sceneMin = glm::vec3(std::numeric_limits<float>::max());
+  auto sceneMax = glm::vec3(std::numeric_limits<float>::lowest());
+  BatchKey key;
+  const std::function<void(int, const glm::mat4 &, bool)> visitNode =
+      [&](int nodeIdx, const glm::mat4 &parentMatrix, bool parentStatic) {
+        const auto &node = model.nodes[nodeIdx];
+        const auto worldMatrix = getLocalToWorldMatrix(node, parentMatrix);
+        const auto isStatic =
+            parentStatic && !animated[nodeIdx] && node.skin < 0;
+        if (isStatic && node.mesh >= 0) {
+          const auto &mesh = model.meshes[node.mesh];
+          for (size_t i = 0; i < mesh.primitives.size(); ++i) {
+            size_t vertexCount = 0;
+            if (!isBatchable(model, mesh.primitives[i],
+                    maxPrimitiveVertexCount, key, vertexCount)) {
+              continue;
+            }
+            const auto &positions =
+                model.accessors[mesh.primitives[i].attributes.at("POSITION")];
+            auto center = glm::vec3(0);
+            if (positions.minValues.size() == 3 &&
+                positions.maxValues.size() == 3) {
+              for (int k = 0; k < 3; ++k) {
+                center[k] = float(
+                    0.5 * (positions.minValues[k] + positions.maxValues[k]));
+              }
+            }
+            center = glm::vec3(worldMatrix * glm::vec4(center, 1));
+            sceneMin = glm::min(sceneMin, center);
+            sceneMax = glm::max(sceneMax, center);
+            groups[key].push_back(
+                {nodeIdx, int(i), worldMatrix, vertexCount, center, 0});
+          }
+        }
+        for (const auto child : node.children) {
+          visitNode(child, worldMatrix, isStatic);
+        }
+      };
+  for (const auto nodeIdx : model.scenes[model.defaultScene].nodes) {
+    visitNode(nodeIdx, glm::mat4(1), true);
+  }
+
+  const auto sceneExtent = glm::max(sceneMax - sceneMin, glm::vec3(1e-6f));
+  for (auto &group : groups) {
+    for (auto &candidate : group.second) {
+      candidate.mortonCode =
+          mortonCode((candidate.center - sceneMin) / sceneExtent);
+    }
+  }
+
+  model.buffers.emplace_back();
+  const auto bufferIdx = int(model.buffers.size() - 1);
+  // Primitives merged in a batch, for each node
+  std::map<int, std::vector<uint8_t>> mergedPrimitives;
+  size_t mergedPrimitiveCount = 0;
+
+  for (auto &group : groups) {
+    auto &candidates = group.second;
+    std::sort(begin(candidates), end(candidates),
+        [](const Candidate &a, const Candidate &b) {
+          return a.mortonCode < b.mortonCode;
+        });
+
+    size_t first = 0;
+    while (first < candidates.size()) {
+      auto last = first;
+      size_t batchVertexCount = 0;
+      while (last < candidates.size() &&
+             batchVertexCount + candidates[last].vertexCount <=
+                 maxBatchVertexCount) {
+        batchVertexCount += candidates[last++].vertexCount;
+      }
+      // Merging a single primitive does not save any draw
+      if (last - first < 2) {
+        first = std::max(last, first + 1);
+        continue;
+      }
+
+      const auto &attributes = group.first.attributes;
+      std::vector<std::vector<unsigned char>> vertexData(attributes.size());
+      std::vector<size_t> strides(attributes.size());
+      std::vector<uint32_t> indices;
+      auto bboxMin = glm::vec3(std::numeric_limits<float>::max());
+      auto bboxMax = glm::vec3(std::numeric_limits<float>::lowest());
+      uint32_t baseVertex = 0;
+
+      for (auto c = first; c < last; ++c) {
+        const auto &candidate = candidates[c];
+        const auto &primitive =
+            model.meshes[model.nodes[candidate.node].mesh]
+                .primitives[candidate.primitive];
+        const glm::mat3 linear(candidate.worldMatrix);
+        const auto normalMatrix = glm::transpose(glm::inverse(linear));
+        // Mirroring transforms flip the winding and the bitangents
+        const auto mirrored = glm::determinant(linear) < 0.f;
+
+        if (primitive.indices >= 0) {
+          const auto &accessor = model.accessors[primitive.indices];
+          for (size_t i = 0; i + 2 < accessor.count; i += 3) {
+            for (const auto k : {0, mirrored ? 2 : 1, mirrored ? 1 : 2}) {
+              indices.push_back(
+                  baseVertex + readIndex(model, accessor, i + k));
+            }
+          }
+        } else {
+          for (uint32_t i = 0; i + 2 < candidate.vertexCount; i += 3) {
+            for (const auto k : {0u, mirrored ? 2u : 1u, mirrored ? 1u : 2u}) {
+              indices.push_back(baseVertex + i + k);
+            }
+          }
+        }
+        for (size_t a = 0; a < attributes.size(); ++a) {
+          const auto &name = attributes[a].name;
+          const auto &accessor =
+              model.accessors[primitive.attributes.at(name)];
+          const auto size = elementSize(accessor);
+          // Vertex attributes are aligned on 4 bytes
+          strides[a] = (size + 3) & ~size_t(3);
+          auto &data = vertexData[a];
+          for (size_t i = 0; i < candidate.vertexCount; ++i) {
+            const auto offset = data.size();
+            data.resize(offset + strides[a], 0);
+            std::memcpy(
+                &data[offset], elementPointer(model, accessor, i), size);
+            auto vector = (float *)&data[offset];
+            if (name == "POSITION") {
+              const auto position = glm::vec3(candidate.worldMatrix *
+                                              glm::vec4(vector[0], vector[1],
+                                                  vector[2], 1));
+              std::memcpy(vector, &position, sizeof(position));
+              bboxMin = glm::min(bboxMin, position);
+              bboxMax = glm::max(bboxMax, position);
+            } else if (name == "NORMAL" || name == "TANGENT") {
+              const glm::vec3 direction(vector[0], vector[1], vector[2]);
+              auto transformed = name == "NORMAL" ? normalMatrix * direction
+                                                  : linear * direction;
+              const auto length = glm::length(transformed);
+              transformed = length > 0.f ? transformed / length : transformed;
+              std::memcpy(vector, &transformed, sizeof(transformed));
+              if (name == "TANGENT" && mirrored) {
+                vector[3] = -vector[3];
+              }
+            }
+          }
+        }
+        baseVertex += uint32_t(candidate.vertexCount);
+        mergedPrimitives[candidate.node].resize(
+            model.meshes[model.nodes[candidate.node].mesh].primitives.size());
+        mergedPrimitives[candidate.node][candidate.primitive] = 1;
+        ++mergedPrimitiveCount;
+      }
+
+      tinygltf::Primitive primitive;
+      primitive.mode = TINYGLTF_MODE_TRIANGLES;
+      primitive.material = group.first.material;
+      for (size_t a = 0; a < attributes.size(); ++a) {
+        const auto size = size_t(
+            tinygltf::GetComponentSizeInBytes(attributes[a].componentType) *
+            tinygltf::GetNumComponentsInType(attributes[a].type));
+        tinygltf::Accessor accessor;
+        accessor.bufferView = addBufferView(model, bufferIdx, vertexData[a],
+            strides[a] != size ? strides[a] : 0, TINYGLTF_TARGET_ARRAY_BUFFER);
+        accessor.type = attributes[a].type;
+        accessor.componentType = attributes[a].componentType;
+        accessor.normalized = attributes[a].normalized;
+        accessor.count = baseVertex;
+        if (attributes[a].name == "POSITION") {
+          accessor.minValues = {bboxMin.x, bboxMin.y, bboxMin.z};
+          accessor.maxValues = {bboxMax.x, bboxMax.y, bboxMax.z};
+        }
+        model.accessors.push_back(accessor);
+        primitive.attributes[attributes[a].name] =
+            int(model.accessors.size() - 1);
+      }
+      tinygltf::Accessor indexAccessor;
+      indexAccessor.bufferView = addBufferView(model, bufferIdx,
+          std::vector<unsigned char>((const unsigned char *)indices.data(),
+              (const unsigned char *)(indices.data() + indices.size())),
+          0, TINYGLTF_TARGET_ELEMENT_ARRAY_BUFFER);
+      indexAccessor.type = TINYGLTF_TYPE_SCALAR;
+      indexAccessor.componentType = TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT;
+      indexAccessor.count = indices.size();
+      model.accessors.push_back(indexAccessor);
+      primitive.indices = int(model.accessors.size() - 1);
+
+      tinygltf::Mesh mesh;
+      mesh.name = "static batch " + std::to_string(batchCount++);
+      mesh.primitives.push_back(primitive);
+      model.meshes.push_back(mesh);
+
+      tinygltf::Node node;
+      node.name = mesh.name;
+      node.mesh = int(model.meshes.size() - 1);
+      model.nodes.push_back(node);
+      model.scenes[model.defaultScene].nodes.push_back(
+          int(model.nodes.size() - 1));
+      first = last;
+    }
+  }
+
+  // Remove the merged primitives from their nodes, nodes with the same mesh
+  // and merged primitives share the same copy
+  std::map<std::pair<int, std::vector<uint8_t>>, int> remainingMeshes;
+  for (const auto &merged : mergedPrimitives) {
+    auto &node = model.nodes[merged.first];
+    if (std::count(begin(merged.second), end(merged.second), 1) ==
+        std::ptrdiff_t(merged.second.size())) {
+      node.mesh = -1;
+      continue;
+    }
+    auto it = remainingMeshes.find({node.mesh, merged.second});
+    if (it == end(remainingMeshes)) {
+      auto mesh = model.meshes[node.mesh];
+      mesh.primitives.clear();
+      for (size_t i = 0; i < merged.second.size(); ++i) {
+        if (!merged.second[i]) {
+          mesh.primitives.push_back(model.meshes[node.mesh].primitives[i]);
+        }
+      }
+      model.meshes.push_back(mesh);
+      it = remainingMeshes
+               .emplace(std::make_pair(node.mesh, merged.second),
+                   int(model.meshes.size() - 1))
+               .first;
+    }
+    node.mesh = (*it).second;
+  }
+
+  std::clog << "Static batching: " << mergedPrimitiveCount
+            << " primitives merged in " << batchCount << " batches"
+            << std::endl;
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <tiny_gltf.h>
+
+#include <cstddef>
+
+// Static batching: the small triangle primitives of the static nodes of the
+// default scene are transformed to world space and merged in a few large
+// meshes, one draw each, so that scenes made of many small nodes are not
+// limited by the draw call count. A node is static if neither it nor one of
+// its ancestors is animated or skinned.
+
+// Merge the static primitives of at most maxPrimitiveVertexCount vertices that
+// share a material and a vertex layout, in batches of at most
+// maxBatchVertexCount vertices. Primitives are sorted along a Morton curve so
+// that each batch covers a compact region, with bounds that are still useful
+// for culling. Batches are added to the model as new meshes of new root nodes
+// of the default scene. Nodes whose primitives are all merged lose their mesh,
+// the others get a copy of their mesh without the merged primitives.
+void batchStaticNodes(tinygltf::Model &model,
+    size_t maxPrimitiveVertexCount = 1 << 12,
+    size_t maxBatchVertexCount = 1 << 16);
+
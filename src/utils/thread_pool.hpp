@@ -0,0 +1,117 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Persistent worker threads for work that is parallelized every frame, where
+// spawning threads would cost more than the work itself
+class ThreadPool
+{
+public:
+  // threadCount includes the calling thread, 0 uses
+  // std::thread::hardware_concurrency()
+  explicit ThreadPool(unsigned threadCount = 0)
+  {
+    if (threadCount == 0) {
+      threadCount = std::max(1u, std::thread::hardware_concurrency());
+    }
+    for (unsigned i = 1; i < threadCount; ++i) {
+      m_workers.emplace_back([this]() { workerLoop(); });
+    }
+  }
+
+  ~ThreadPool()
+  {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_stop = true;
+    }
+    m_wakeCondition.notify_all();
+    for (auto &worker : m_workers) {
+      worker.join();
+    }
+  }
+
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  unsigned size() const { return unsigned(m_workers.size()) + 1; }
+
+  // Call f(i) for each i in [0, count) from the workers and the calling
+  // thread, return when all calls are done. Not reentrant.
+  void parallelFor(int count, const std::function<void(int)> &f)
+  {
+    if (m_workers.empty() || count <= 1) {
+      for (int i = 0; i < count; ++i) {
+        f(i);
+      }
+      return;
+    }
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_task = &f;
+      m_count = count;
+      m_next = 0;
+      m_activeWorkers = m_workers.size();
+      ++m_generation;
+    }
+    m_wakeCondition.notify_all();
+    runTask(f, count);
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_doneCondition.wait(lock, [&]() { return m_activeWorkers == 0; });
+    m_task = nullptr;
+  }
+
+private:
+  void runTask(const std::function<void(int)> &f, int count)
+  {
+    for (int i = m_next++; i < count; i = m_next++) {
+      f(i);
+    }
+  }
+
+  void workerLoop()
+  {
+    uint64_t generation = 0;
+    for (;;) {
+      const std::function<void(int)> *task = nullptr;
+      int count = 0;
+      {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_wakeCondition.wait(
+            lock, [&]() { return m_stop || m_generation != generation; });
+        if (m_stop) {
+          return;
+        }
+        generation = m_generation;
+        task = m_task;
+        count = m_count;
+      }
+      runTask(*task, count);
+      {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (--m_activeWorkers == 0) {
+          m_doneCondition.notify_one();
+        }
+      }
+    }
+  }
+
+  std::vector<std::thread> m_workers;
+  std::mutex m_mutex;
+  std::condition_variable m_wakeCondition;
+  std::condition_variable m_doneCondition;
+  const std::function<void(int)> *m_task = nullptr;
+  int m_count = 0;
+  std::atomic<int> m_next{0};
+  size_t m_activeWorkers = 0;
+  uint64_t m_generation = 0;
+  bool m_stop = false;
+};
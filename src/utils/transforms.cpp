@@ -0,0 +1,128 @@
+#include "transforms.hpp"
+
+#include <glm/gtc/type_ptr.hpp>
+
+#if defined(__SSE2__) || defined(_M_X64) ||                                    \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define GLTF_VIEWER_USE_SSE 1
+#include <emmintrin.h>
+#endif
+
+#ifdef GLTF_VIEWER_USE_SSE
+
+namespace {
+
+struct Mat4SSE
+{
+  __m128 cols[4];
+};
+
+Mat4SSE load(const glm::mat4 &m)
+{
+  const auto ptr = glm::value_ptr(m);
+  return {{_mm_loadu_ps(ptr), _mm_loadu_ps(ptr + 4), _mm_loadu_ps(ptr + 8),
+      _mm_loadu_ps(ptr + 12)}};
+}
+
+void store(const Mat4SSE &m, glm::mat4 &out)
+{
+  const auto ptr = glm::value_ptr(out);
+  for (int i = 0; i < 4; ++i) {
+    _mm_storeu_ps(ptr + 4 * i, m.cols[i]);
+  }
+}
+
+// Column of a * b, bColumn being the corresponding column of b
+__m128 multiplyColumn(const Mat4SSE &a, const float *bColumn)
+{
+  auto col = _mm_mul_ps(a.cols[0], _mm_set1_ps(bColumn[0]));
+  col = _mm_add_ps(col, _mm_mul_ps(a.cols[1], _mm_set1_ps(bColumn[1])));
+  col = _mm_add_ps(col, _mm_mul_ps(a.cols[2], _mm_set1_ps(bColumn[2])));
+  return _mm_add_ps(col, _mm_mul_ps(a.cols[3], _mm_set1_ps(bColumn[3])));
+}
+
+Mat4SSE multiply(const Mat4SSE &a, const glm::mat4 &b)
+{
+  const auto ptr = glm::value_ptr(b);
+  return {{multiplyColumn(a, ptr), multiplyColumn(a, ptr + 4),
+      multiplyColumn(a, ptr + 8), multiplyColumn(a, ptr + 12)}};
+}
+
+// xyz cross product, w is 0 if it is 0 in a or b
+__m128 cross(__m128 a, __m128 b)
+{
+  const auto aYZX = _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 0, 2, 1));
+  const auto bYZX = _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 0, 2, 1));
+  const auto c = _mm_sub_ps(_mm_mul_ps(a, bYZX), _mm_mul_ps(aYZX, b));
+  return _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 0, 2, 1));
+}
+
+} // namespace
+
+void computeDrawTransforms(const glm::mat4 &viewMatrix,
+    const glm::mat4 &projMatrix, const glm::mat4 *modelMatrices, size_t count,
+    DrawTransforms *transforms)
+{
+  const auto view = load(viewMatrix);
+  const auto viewProj = load(projMatrix * viewMatrix);
+  // Keep the w component of the upper 3x3 columns out of the cross products
+  const auto xyzMask = _mm_castsi128_ps(_mm_set_epi32(0, -1, -1, -1));
+  for (size_t i = 0; i < count; ++i) {
+    const auto modelView = multiply(view, modelMatrices[i]);
+    store(modelView, transforms[i].modelViewMatrix);
+    store(multiply(viewProj, modelMatrices[i]),
+        transforms[i].modelViewProjMatrix);
+
+    // The inverse transpose of a 3x3 matrix is its cofactor matrix divided by
+    // its determinant, and the cofactor columns are cross products of the
+    // columns
+    const auto c0 = _mm_and_ps(modelView.cols[0], xyzMask);
+    const auto c1 = _mm_and_ps(modelView.cols[1], xyzMask);
+    const auto c2 = _mm_and_ps(modelView.cols[2], xyzMask);
+    const auto cof0 = cross(c1, c2);
+    const auto cof1 = cross(c2, c0);
+    const auto cof2 = cross(c0, c1);
+    alignas(16) float dot[4];
+    _mm_store_ps(dot, _mm_mul_ps(c0, cof0));
+    const auto invDet = _mm_set1_ps(1.f / (dot[0] + dot[1] + dot[2]));
+    alignas(16) float cols[3][4];
+    _mm_store_ps(cols[0], _mm_mul_ps(cof0, invDet));
+    _mm_store_ps(cols[1], _mm_mul_ps(cof1, invDet));
+    _mm_store_ps(cols[2], _mm_mul_ps(cof2, invDet));
+    auto &normalMatrix = transforms[i].normalMatrix;
+    for (int c = 0; c < 3; ++c) {
+      normalMatrix[c] = glm::vec3(cols[c][0], cols[c][1], cols[c][2]);
+    }
+  }
+}
+
+#else
+
+void computeDrawTransforms(const glm::mat4 &viewMatrix,
+    const glm::mat4 &projMatrix, const glm::mat4 *modelMatrices, size_t count,
+    DrawTransforms *transforms)
+{
+  const auto viewProjMatrix = projMatrix * viewMatrix;
+  for (size_t i = 0; i < count; ++i) {
+    const auto modelViewMatrix = viewMatrix * modelMatrices[i];
+    transforms[i].modelViewMatrix = modelViewMatrix;
+    transforms[i].modelViewProjMatrix = viewProjMatrix * modelMatrices[i];
+    transforms[i].normalMatrix =
+        glm::transpose(glm::inverse(glm::mat3(modelViewMatrix)));
+  }
+}
+
+#endif
+
+glm::mat4 tileProjection(const glm::mat4 &projMatrix, int x, int y, int width,
+    int height, int imageWidth, int imageHeight)
+{
+  // Normalized device coordinates of the image scaled and translated so that
+  // the tile covers [-1, 1]
+  glm::mat4 tileMatrix(1);
+  tileMatrix[0][0] = float(imageWidth) / float(width);
+  tileMatrix[1][1] = float(imageHeight) / float(height);
+  tileMatrix[3][0] = float(imageWidth - 2 * x - width) / float(width);
+  tileMatrix[3][1] = float(imageHeight - 2 * y - height) / float(height);
+  return tileMatrix * projMatrix;
+}
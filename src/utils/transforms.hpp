@@ -0,0 +1,27 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cstddef>
+
+// Matrices of a draw that are constant over its vertices, computed on the CPU
+// instead of in the vertex shaders
+struct DrawTransforms
+{
+  glm::mat4 modelViewMatrix;
+  glm::mat4 modelViewProjMatrix;
+  glm::mat3 normalMatrix; // Inverse transpose of the model view matrix
+};
+
+// Compute the transforms of count draws from their model matrices, using SSE
+// when available
+void computeDrawTransforms(const glm::mat4 &viewMatrix,
+    const glm::mat4 &projMatrix, const glm::mat4 *modelMatrices, size_t count,
+    DrawTransforms *transforms);
+
+// Projection of the tile of width x height pixels whose bottom left corner is
+// (x, y) in an image of imageWidth x imageHeight pixels rendered with
+// projMatrix, y going upward: the sub-frustum of the tile, mapped to the whole
+// viewport of the tile. Tiles may extend past the image.
+glm::mat4 tileProjection(const glm::mat4 &projMatrix, int x, int y, int width,
+    int height, int imageWidth, int imageHeight);